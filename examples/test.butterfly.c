@@ -91,6 +91,7 @@ int main(int argc, char *argv[])
     sp.bnc      = atoi(argv[10]);
     sp.sys      = atoi(argv[11]);
     sp.seed     = -1;
+    sp.sce      = 0;
     int bufsize = atoi(argv[12]);
     double Esa, Esb, Eac, Ebc, Ear, Ecd, Edr;
     if (argc == 14)
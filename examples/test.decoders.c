@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -60,6 +61,29 @@ int main(int argc, char *argv[])
     sp.bnc      = atoi(argv[9]);
     sp.sys      = atoi(argv[10]);
     sp.seed     = -1;  // Initialize seed as -1
+    char *sce = getenv("SNC_SEEDED_COES");
+    sp.sce      = (sce != NULL && atoi(sce) == 1);   // Derive coefficients from packet seq
+
+    char *wire = getenv("SNC_WIRE_FORMAT");
+    int wire_format = (wire != NULL && atoi(wire) == 1);    // Pass packets through the wire format
+
+    char *usepool = getenv("SNC_PACKET_POOL");
+    int packet_pool = (usepool != NULL && atoi(usepool) == 1);  // Take packets from a pool
+
+    char *async = getenv("SNC_ASYNC_DECODER");
+    int async_decoder = (async != NULL && atoi(async) == 1);    // Decode in a solver thread
+    if (async_decoder && wire_format) {
+        printf("Packet views of the wire format cannot be decoded asynchronously.\n");
+        exit(1);
+    }
+
+    char *outbuf = getenv("SNC_OUTPUT_BUFFER");
+    int output_buffer = (outbuf != NULL && atoi(outbuf) == 1);  // Decode in place into a buffer of ours
+
+    char *step = getenv("SNC_DECODER_STEP");
+    long long step_budget = (step != NULL) ? atoll(step) : 0;   // Complete decoding in slices of step_budget ops
+    char *interleave = getenv("SNC_DECODER_INTERLEAVE");
+    int interleave_steps = (interleave != NULL && atoi(interleave) == 1);  // One slice per received packet
 
     char *ur = getenv("SNC_NONUNIFORM_RAND");
     if ( ur != NULL && atoi(ur) == 1) {
@@ -83,11 +107,45 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    struct snc_packet_pool *pool = NULL;
+    if (packet_pool) {
+        if ((pool = snc_create_packet_pool(&sp)) == NULL || snc_set_enc_packet_pool(sc, pool) != 0)
+            exit(1);
+    }
+
     sp.seed = (snc_get_parameters(sc))->seed;
-    struct snc_decoder *decoder = snc_create_decoder(&sp, decoder_type);
-    if (decoder == NULL)
+    struct snc_decoder *decoder = NULL;
+    struct snc_async_decoder *adec = NULL;
+    if (async_decoder)
+        adec = snc_create_async_decoder(&sp, decoder_type, 256, NULL, NULL);
+    else
+        decoder = snc_create_decoder(&sp, decoder_type);
+    if (decoder == NULL && adec == NULL)
         exit(1);
+    if (decoder != NULL && step_budget > 0)
+        snc_set_decoder_stepped(decoder, 1);
+    unsigned char *out = NULL;
+    if (output_buffer) {
+        // The solver of an asynchronous decoder is idle until packets are submitted
+        long outsize = (sp.datasize + sp.size_p - 1) / sp.size_p * sp.size_p;
+        if ((out = malloc(outsize)) == NULL
+            || snc_bind_decoder_output(async_decoder ? snc_async_get_decoder(adec) : decoder, out) != 0)
+            exit(1);
+    }
     clock_t start, stop, dtime = 0;
+    if (async_decoder) {
+        // Submit packets as a receive loop would do, dropping those
+        // arriving when the ring is full
+        start = clock();
+        while (!snc_async_decoder_finished(adec)) {
+            struct snc_packet *pkt = snc_generate_packet(sc);
+            if (snc_async_process_packet(adec, pkt) != 0)
+                snc_free_packet(pkt);
+        }
+        stop = clock();
+        dtime += stop - start;
+        decoder = snc_async_get_decoder(adec);
+    }
     // Make decoder stop in the middle of decoding.
     // Test saving/restoring decoder context to/from file.
     /*
@@ -110,27 +168,58 @@ int main(int argc, char *argv[])
 
     decoder = snc_restore_decoder("CBDdecoder.part");
     */
+    unsigned char hdr[SNC_WIRE_HEADER];
+    struct iovec iov[3];
+    unsigned char *datagram = malloc(SNC_WIRE_HEADER + sp.size_g + sp.size_p);
     while (snc_decoder_finished(decoder) != 1) {
         struct snc_packet *pkt = snc_generate_packet(sc);
+        struct snc_packet view;
+        if (wire_format) {
+            // Gather the packet into a datagram as sendmsg() would do, and
+            // decode from a view of the received datagram
+            int len = 0;
+            int niov = snc_serialize_packet(&sp, pkt, hdr, iov);
+            for (int i=0; i<niov; i++) {
+                memcpy(datagram + len, iov[i].iov_base, iov[i].iov_len);
+                len += iov[i].iov_len;
+            }
+            snc_free_packet(pkt);
+            if (snc_deserialize_packet(&sp, datagram, len, &view) != 0)
+                exit(1);
+            pkt = &view;
+        }
         /* Measure decoding time */
         start = clock();
         snc_process_packet(decoder, pkt);
-        snc_free_packet(pkt);
+        if (!wire_format)
+            snc_free_packet(pkt);
+        // Slices would be interleaved with receiving packets in an event loop
+        if (step_budget > 0 && interleave_steps)
+            snc_decoder_step(decoder, step_budget);
+        else
+            while (step_budget > 0 && snc_decoder_step(decoder, step_budget))
+                ;
         stop = clock();
         dtime += (stop - start);
     }
+    free(datagram);
     //printf("clocks: %d CLOCKS_PER_SEC: %d \n", dtime, CLOCKS_PER_SEC);
 
     printf("dec-time: %.6f ", (double) dtime/CLOCKS_PER_SEC);
 
     struct snc_context *dsc = snc_get_enc_context(decoder);
-    unsigned char *rec_buf = snc_recover_data(dsc);
+    unsigned char *rec_buf = output_buffer ? out : snc_recover_data(dsc);
     if (memcmp(buf, rec_buf, sp.datasize) != 0)
         fprintf(stderr, "recovered is NOT identical to original.\n");
 
     print_code_summary(dsc, snc_decode_overhead(decoder), snc_decode_cost(decoder));
 
     snc_free_enc_context(sc);
-    snc_free_decoder(decoder);
+    if (async_decoder)
+        snc_free_async_decoder(adec);
+    else
+        snc_free_decoder(decoder);
+    snc_free_packet_pool(pool);
+    free(out);
     return 0;
 }
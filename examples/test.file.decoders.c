@@ -1,6 +1,5 @@
-#include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
+#define _POSIX_C_SOURCE 199309L   // clock_gettime()
+#include <sched.h>
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -10,6 +9,29 @@
 char usage[] = "usage: ./programName code_t dec_t chunksize size_p size_c size_b size_g filename\n\
                        code_t - RAND, BAND, WINDWRAP\n\
                        dec_t  - GG, OA, BD, CBD\n";
+
+// Whether two files have the same contents
+static int same_file(const char *path1, const char *path2)
+{
+    FILE *f1 = fopen(path1, "rb");
+    FILE *f2 = fopen(path2, "rb");
+    int same = (f1 != NULL && f2 != NULL);
+    char b1[65536], b2[65536];
+    while (same) {
+        size_t n1 = fread(b1, 1, sizeof(b1), f1);
+        size_t n2 = fread(b2, 1, sizeof(b2), f2);
+        if (n1 != n2 || memcmp(b1, b2, n1) != 0)
+            same = 0;
+        else if (n1 == 0)
+            break;
+    }
+    if (f1 != NULL)
+        fclose(f1);
+    if (f2 != NULL)
+        fclose(f2);
+    return same;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 9) {
@@ -51,64 +73,78 @@ int main(int argc, char *argv[])
     sp.bnc      = 0;
     sp.sys      = 0;
     sp.seed     = -1;  // Initialize seed as -1
+    sp.sce      = 0;
     char *copyname = calloc(strlen(argv[8])+strlen(".dec.copy")+1, sizeof(char));
     strcat(copyname, filename);
     strcat(copyname, ".dec.copy");
 
+    // Blocks in flight and decoding threads (one per CPU by default)
+    int window   = getenv("SNC_FILE_WINDOW") != NULL ? atoi(getenv("SNC_FILE_WINDOW")) : 4;
+    int nthreads = getenv("SNC_FILE_THREADS") != NULL ? atoi(getenv("SNC_FILE_THREADS")) : 0;
+
     srand( (int) time(0) );
-    // Get filesize in bytes
-    struct stat sb;
-    if (stat(filename, &sb) < -1) {
-        printf("main: cannot obtain %s's stat\n", filename);
-        exit(1);
+    struct snc_file_encoder *fenc = snc_create_file_encoder(filename, &sp, window);
+    if (fenc == NULL) {
+        fprintf(stderr, "Cannot create file encoder.\n");
+        return 1;
+    }
+    int blocks = snc_file_encoder_blocks(fenc);
+    long filesize = snc_file_encoder_size(fenc);
+    printf("File size: %ld splitted to %d chunks\n", filesize, blocks);
+    struct snc_file_decoder *fdec = snc_create_file_decoder(copyname, &sp, decoder_type, filesize, window, nthreads);
+    if (fdec == NULL) {
+        fprintf(stderr, "Cannot create file decoder.\n");
+        return 1;
     }
-    long filesize = sb.st_size;
 
-    int chunks = filesize % sp.datasize == 0 ? filesize/sp.datasize : filesize/sp.datasize+1;
-    printf("File size: %d splitted to %d chunks\n", filesize, chunks);
-    struct snc_context *sc;
-    long remaining = filesize;
-    long start = 0;
-    while (chunks > 0) {
-        /*
-         * As a rough example, we create and free enc/dec context
-         * for each chunk. It's a waste of (alloc/init/free) time
-         * to not reuse existing context. But we don't care because
-         * this is just a test of APIs.
-         */
-        long toEncode = remaining > sp.datasize ? sp.datasize : remaining;
-        sp.datasize = toEncode;
-        if ((sc = snc_create_enc_context(NULL, &sp)) == NULL) {
-            fprintf(stderr, "Cannot create File Context.\n");
-            return 1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    /*
+     * Send packets of the blocks in flight in turn, and release each
+     * block at the encoder once the decoder has written it. A packet
+     * refused by the decoder (its queue being full) is held and sent
+     * again in the next turn.
+     */
+    struct snc_packet **held = calloc(window, sizeof(struct snc_packet *));
+    int first = 0;      // first block not written yet
+    while (first < blocks && !snc_file_decoder_finished(fdec)) {
+        int sent = 0;
+        for (int blk=first; blk<first+window && blk<blocks; blk++) {
+            struct snc_packet **pkt = &held[blk % window];
+            if (snc_file_block_finished(fdec, blk))
+                continue;
+            if (*pkt == NULL)
+                *pkt = snc_generate_packet(snc_file_encoder_get_block(fenc, blk));
+            if (snc_file_process_packet(fdec, blk, *pkt) == 0) {
+                *pkt = NULL;
+                sent++;
+            }
         }
-        snc_load_file_to_context(filename, start, sc);
-        remaining -= toEncode;
-        start += toEncode;
-        chunks--;
-
-        sp.seed = (snc_get_parameters(sc))->seed;
-        struct snc_decoder *decoder = snc_create_decoder(&sp, decoder_type);
-        clock_t start, stop, dtime = 0;
-        while (snc_decoder_finished(decoder) != 1) {
-            struct snc_packet *pkt = snc_generate_packet(sc);
-            /* Measure decoding time */
-            start = clock();
-            snc_process_packet(decoder, pkt);
-            stop = clock();
-            dtime += stop - start;
+        if (sent == 0)
+            sched_yield();      // let the decoder catch up
+        while (first < blocks && snc_file_block_finished(fdec, first)) {
+            if (held[first % window] != NULL) {
+                snc_free_packet(held[first % window]);
+                held[first % window] = NULL;
+            }
+            snc_file_encoder_release_block(fenc, first++);
         }
-        printf("chunk %d || dec-time: %.2f ", chunks, ((double) dtime)/CLOCKS_PER_SEC);
-
-        struct snc_context *dsc = snc_get_enc_context(decoder);
-        snc_recover_to_file(copyname, dsc);
-
-        print_code_summary(dsc, snc_decode_overhead(decoder), snc_decode_cost(decoder));
-
-        snc_free_enc_context(sc);
-        snc_free_decoder(decoder);
     }
+    free(held);
+    int rc = snc_file_decoder_wait(fdec);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("chunks %d || time: %.2f s, %.2f MB/s || overhead: %.4f cost: %.4f\n", blocks, elapsed,
+           filesize / elapsed / 1e6, snc_file_decode_overhead(fdec), snc_file_decode_cost(fdec));
 
-
-    return 0;
+    snc_free_file_decoder(fdec);
+    snc_free_file_encoder(fenc);
+    if (rc != 0) {
+        fprintf(stderr, "decoding %s failed.\n", filename);
+    } else if (!same_file(filename, copyname)) {
+        fprintf(stderr, "recovered is NOT identical to original.\n");
+        rc = -1;
+    }
+    free(copyname);
+    return rc == 0 ? 0 : 1;
 }
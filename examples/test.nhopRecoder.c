@@ -92,6 +92,12 @@ int main(int argc, char *argv[])
     sp.bnc      = atoi(argv[10]);
     sp.sys      = atoi(argv[11]);
     sp.seed     = -1;
+    char *sce = getenv("SNC_SEEDED_COES");
+    sp.sce      = (sce != NULL && atoi(sce) == 1);   // Derive coefficients from packet seq
+    char *usepool = getenv("SNC_PACKET_POOL");
+    int packet_pool = (usepool != NULL && atoi(usepool) == 1);  // Take packets from a pool
+    char *basis = getenv("SNC_BASIS_BUFFER");
+    int basis_buffer = (basis != NULL && atoi(basis) == 1);    // Buffer bases instead of FIFOs
     int bufsize = atoi(argv[12]);
     int numhop  = atoi(argv[13]);    // Number of hops of the line network
     int *rate   = malloc(sizeof(int) * numhop);
@@ -143,14 +149,26 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    struct snc_packet_pool *pool = NULL;
+    if (packet_pool) {
+        if ((pool = snc_create_packet_pool(&sp)) == NULL || snc_set_enc_packet_pool(sc, pool) != 0)
+            exit(1);
+    }
+
     /* Create recoder buffers */
     // n-hop network has (n-1) intermediate nodes, and therefore has (n-1) recoders
     struct snc_buffer **buffer = malloc(sizeof(struct snc_buffer*) * (numhop-1));
     for (i=0; i<numhop-1; i++) {
-        if ((buffer[i] = snc_create_buffer(snc_get_parameters(sc), bufsize)) == NULL) {
+        if (basis_buffer)
+            buffer[i] = snc_create_basis_buffer(snc_get_parameters(sc));
+        else
+            buffer[i] = snc_create_buffer(snc_get_parameters(sc), bufsize);
+        if (buffer[i] == NULL) {
             fprintf(stderr, "Cannot create snc buffer.\n");
             exit(1);
         }
+        if (pool != NULL)
+            snc_set_buffer_packet_pool(buffer[i], pool);
     }
 
     /* Create decoder */
@@ -164,8 +182,8 @@ int main(int argc, char *argv[])
                 if (i == 0) {
                     pkt = snc_generate_packet(sc);  // coded packet generated at the source node
                 } else {
-                    pkt = snc_alloc_empty_packet(&sp);
-                    if (snc_recode_packet_im(buffer[i-1], pkt, sched_t) == -1)
+                    pkt = snc_recode_packet(buffer[i-1], sched_t);   // systematic packets are forwarded by reference
+                    if (pkt == NULL)
                         continue;
                 }
                 if (rand() % 100 >= pe[i] * 100) {
@@ -202,5 +220,6 @@ int main(int argc, char *argv[])
     for (i=0; i<numhop-1; i++) 
         snc_free_buffer(buffer[i]);
     snc_free_decoder(decoder);
+    snc_free_packet_pool(pool);
     return 0;
 }
@@ -6,7 +6,7 @@
 #include <string.h>
 #include "sparsenc.h"
 
-char usage[] = "usage: ./restoreDecoders code_t dec_t datasize size_p size_c size_b size_g size_p bpc bnc sys\n\
+char usage[] = "usage: ./sncRestore code_t dec_t datasize size_p size_c size_b size_g bpc bnc sys [save_at]\n\
                        code_t   - RAND, BAND, WINDWRAP\n\
                        dec_t    - GG, OA, BD, CBD, PP\n\
                        datasize - Number of bytes\n\
@@ -16,10 +16,14 @@ char usage[] = "usage: ./restoreDecoders code_t dec_t datasize size_p size_c siz
                        size_g   - Subgeneration size\n\
                        bpc      - Use binary precode (0 or 1)\n\
                        bnc      - Use binary network code (0 or 1)\n\
-                       sys      - Systematic code (0 or 1)\n";
+                       sys      - Systematic code (0 or 1)\n\
+                       save_at  - Number of received packets after which the decoder\n\
+                                  is saved and restored (default: half of the source packets)\n\
+Set SNC_JOURNAL=1 to journal the decoder from the start instead, and restore\n\
+it from the journal after save_at packets.\n";
 int main(int argc, char *argv[])
 {
-    if (argc != 11) {
+    if (argc != 11 && argc != 12) {
         printf("%s\n", usage);
         exit(1);
     }
@@ -59,6 +63,8 @@ int main(int argc, char *argv[])
     sp.bnc      = atoi(argv[9]);
     sp.sys      = atoi(argv[10]);
     sp.seed     = -1;  // Initialize seed as -1
+    sp.sce      = 0;
+    int save_at = argc == 12 ? atoi(argv[11]) : sp.datasize / sp.size_p / 2;
 
     srand( (int) time(0) );
     unsigned char *buf = malloc(sp.datasize);
@@ -76,27 +82,41 @@ int main(int argc, char *argv[])
     struct snc_decoder *decoder = snc_create_decoder(&sp, decoder_type);
     if (decoder == NULL)
         exit(1);
+    int journal = getenv("SNC_JOURNAL") != NULL && atoi(getenv("SNC_JOURNAL")) == 1;
+    if (journal && snc_journal_decoder(decoder, "decoder.part") != 0)
+        exit(1);
     clock_t start, stop, dtime = 0;
     // Make decoder stop in the middle of decoding.
     // Test saving/restoring decoder context to/from file.
     int count = 0;
-    while (snc_decoder_finished(decoder) != 1) {
+    while (snc_decoder_finished(decoder) != 1 && count < save_at) {
         struct snc_packet *pkt = snc_generate_packet(sc);
         //Measure decoding time
         start = clock();
         snc_process_packet(decoder, pkt);
+        snc_free_packet(pkt);
         stop = clock();
         dtime += stop - start;
         count++;
-        if (count > 2200) {
-            printf("Save decoder context into file\n");
-            snc_save_decoder_context(decoder, "CBDdecoder.part");
-            break;
-        }
     }
-    snc_free_decoder(decoder);
+    if (journal) {
+        // Drop the decoder as if the process stopped; its snapshot and
+        // journal are up to date
+        printf("Restore decoder from journal after %d packets\n", count);
+        snc_free_decoder(decoder);
+        if ((decoder = snc_restore_journaled_decoder("decoder.part")) == NULL)
+            exit(1);
+    } else {
+        printf("Save decoder context into file after %d packets\n", count);
+        long filesize = snc_save_decoder_context(decoder, "decoder.part");
+        snc_free_decoder(decoder);
+        if (filesize == -1)
+            exit(1);
+        printf("Saved %ld bytes\n", filesize);
 
-    decoder = snc_restore_decoder("decoder.part");
+        if ((decoder = snc_restore_decoder("decoder.part")) == NULL)
+            exit(1);
+    }
 
     while (snc_decoder_finished(decoder) != 1) {
         struct snc_packet *pkt = snc_generate_packet(sc);
@@ -112,12 +132,13 @@ int main(int argc, char *argv[])
 
     struct snc_context *dsc = snc_get_enc_context(decoder);
     unsigned char *rec_buf = snc_recover_data(dsc);
-    if (memcmp(buf, rec_buf, sp.datasize) != 0)
+    int identical = memcmp(buf, rec_buf, sp.datasize) == 0;
+    if (!identical)
         fprintf(stderr, "recovered is NOT identical to original.\n");
 
     print_code_summary(dsc, snc_decode_overhead(decoder), snc_decode_cost(decoder));
 
     snc_free_enc_context(sc);
     snc_free_decoder(decoder);
-    return 0;
+    return identical ? 0 : 1;
 }
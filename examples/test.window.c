@@ -0,0 +1,100 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sparsenc.h"
+
+char usage[] = "usage: ./sncWindow npkts size_p size_g bnc sys pe delay\n\
+                       npkts    - Number of source packets of the stream\n\
+                       size_p   - Packet size in bytes\n\
+                       size_g   - Window size\n\
+                       bnc      - Use binary network code (0 or 1)\n\
+                       sys      - Systematic code (0 or 1)\n\
+                       pe       - Packet erasure probability of the channel\n\
+                       delay    - Acknowledgement delay (in packets)\n";
+/*
+ * Stream source packets through a lossy channel in sliding-window mode.
+ * One packet is sent per time slot; the source enqueues a new packet
+ * whenever the window has room, and the receiver's acknowledgement
+ * reaches the source after the given delay.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 8) {
+        printf("%s\n", usage);
+        exit(1);
+    }
+    int npkts = atoi(argv[1]);
+    struct snc_parameters sp;
+    memset(&sp, 0, sizeof(struct snc_parameters));
+    sp.size_p = atoi(argv[2]);
+    sp.size_g = atoi(argv[3]);
+    sp.bnc    = atoi(argv[4]);
+    sp.sys    = atoi(argv[5]);
+    sp.seed   = -1;
+    double pe = atof(argv[6]);
+    int delay = atoi(argv[7]);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    srand(tv.tv_sec * 1000 + tv.tv_usec / 1000); // seed use microsec
+    unsigned char *buf = malloc((long) npkts * sp.size_p);
+    int rnd=open("/dev/urandom", O_RDONLY);
+    read(rnd, buf, (long) npkts * sp.size_p);
+    close(rnd);
+
+    struct snc_window_encoder *enc = snc_create_window_encoder(&sp);
+    struct snc_window_decoder *dec = snc_create_window_decoder(&sp);
+    if (enc == NULL || dec == NULL)
+        exit(1);
+    struct snc_packet *pkt = snc_alloc_empty_packet(&sp);
+    unsigned char *out = malloc(sp.size_p);
+    int *acks = calloc(delay+1, sizeof(int));      // acknowledgements in flight
+
+    int enqueued = 0;
+    int delivered = 0;
+    int mismatch = 0;
+    long sent = 0;
+    long long latency = 0;                          // slots between enqueue and delivery
+    long *enq_time = malloc(sizeof(long) * npkts);
+    clock_t start, stop, dtime = 0;
+    while (delivered < npkts) {
+        while (enqueued < npkts && snc_window_enqueue(enc, buf + (long) enqueued * sp.size_p) != -1)
+            enq_time[enqueued++] = sent;
+        if (snc_window_generate_packet_im(enc, pkt) == 0 && (double) rand() / RAND_MAX >= pe) {
+            start = clock();
+            snc_window_process_packet(dec, pkt);
+            stop = clock();
+            dtime += stop - start;
+        }
+        int seq;
+        while ((seq = snc_window_deliver(dec, out)) != -1) {
+            if (seq != delivered || memcmp(out, buf + (long) seq * sp.size_p, sp.size_p) != 0)
+                mismatch += 1;
+            latency += sent - enq_time[seq];
+            delivered += 1;
+        }
+        sent += 1;
+        acks[sent % (delay+1)] = snc_window_delivered(dec);
+        snc_window_acknowledge(enc, acks[(sent+1) % (delay+1)]);
+    }
+    if (mismatch == 0)
+        printf("All %d packets were delivered in order and are identical to the source.\n", npkts);
+    else
+        printf("%d of %d delivered packets are NOT identical to the source.\n", mismatch, npkts);
+    printf("dec-time: %.6f npkts: %d size_p: %d size_g: %d bnc: %d sys: %d pe: %.3f delay: %d overhead: %.6f latency: %.2f\n",
+            (double) dtime/CLOCKS_PER_SEC, npkts, sp.size_p, sp.size_g, sp.bnc, sp.sys, pe, delay,
+            (double) sent/npkts, (double) latency/npkts);
+
+    snc_free_packet(pkt);
+    snc_free_window_encoder(enc);
+    snc_free_window_decoder(dec);
+    free(enq_time);
+    free(acks);
+    free(out);
+    free(buf);
+    return mismatch == 0 ? 0 : 1;
+}
@@ -42,12 +42,18 @@ typedef unsigned char GF_ELEMENT;
 
 struct snc_context;     // Sparse network code encode context
 
+struct snc_packet_pool; // Pool of snc packets of a parameter set
+
 struct snc_packet {
     int         gid;    // subgeneration id;
     int         ucid;   // it's an uncoded packet of THE GENERATION 
                         // (note: not the packet index; -1 if it's coded)
     GF_ELEMENT  *coes;  // SIZE_G coding coefficients of coded packet
     GF_ELEMENT  *syms;  // SIZE_P symbols of coded packet
+    struct snc_packet_pool *pool;   // pool the packet is returned to (NULL if none)
+    int         refcnt; // number of holders of the packet (0 for packet views)
+    int         seq;    // sequence number from which coes are derived for
+                        // code with seeded coefficients (-1 if coes are explicit)
 };
 
 // SNC parameters for the data to be snc-coded
@@ -62,12 +68,21 @@ struct snc_parameters {
     int     bnc;        // binary network coding
     int     sys;        // systematic code
     int     seed;       // seed of local RNG
+    int     sce;        // seeded coefficients: coded packets from the encoder
+                        // carry seq instead of coes, decoders regenerate coes
 };
 
 struct snc_decoder;     // Sparse network code decoder
 
 struct snc_buffer;      // Buffer for storing snc packets
 
+struct snc_window_encoder;  // Sliding-window encoder
+
+struct snc_window_decoder;  // Sliding-window decoder
+struct snc_async_decoder;   // Decoder working in a background thread
+struct snc_file_encoder;    // Encoder of a file split to blocks
+struct snc_file_decoder;    // Decoder of a file split to blocks
+
 /*------------------------------- sncEncoder -------------------------------*/
 /**
  * Create encode context from a message buffer pointed by buf. Code parameters
@@ -97,8 +112,14 @@ void snc_free_recovered(unsigned char *data);
 // Restore data in the encode context to a file (append if file exists)
 long snc_recover_to_file(const char *filepath, struct snc_context *sc);
 
-// Allocate an snc packet with coes and syms being zero
-struct snc_packet *snc_alloc_empty_packet(struct snc_parameters *sp);
+/**
+ * Write data in the encode context to the file open as fd at the given
+ * offset, with positional writes batching many packets each, without
+ * using or moving the file offset of fd. Blocks of a file can thus be
+ * written out of order, or concurrently to their own offsets. Return
+ * the number of bytes written, or -1.
+ */
+long snc_recover_to_fd(int fd, long offset, struct snc_context *sc);
 
 // Generate an snc packet from the encode context
 struct snc_packet *snc_generate_packet(struct snc_context *sc);
@@ -106,12 +127,83 @@ struct snc_packet *snc_generate_packet(struct snc_context *sc);
 // Generate an snc packet to the memory of an existing snc_packet struct
 int snc_generate_packet_im(struct snc_context *sc, struct snc_packet *pkt);
 
-// Free up an snc packet
-void snc_free_packet(struct snc_packet *pkt);
+// Take packets generated by snc_generate_packet() from a pool (NULL: allocate them)
+int snc_set_enc_packet_pool(struct snc_context *sc, struct snc_packet_pool *pool);
 
 // Print encode/decode summary of an snc (for benchmarking)
 void print_code_summary(struct snc_context *sc, double overhead, double operations);
 
+/*------------------------------- sncPacket --------------------------------*/
+/*
+ * Wire format of snc packets: a header of gid, ucid and seq as 32-bit
+ * integers in network byte order, followed by coes (ALIGN(size_g, 8) bytes
+ * for binary codes, size_g bytes otherwise) and size_p bytes of syms. coes
+ * are omitted for systematic packets and for packets with seeded coefficients.
+ */
+#define SNC_WIRE_HEADER 12
+
+struct iovec;
+
+// Allocate an snc packet with coes and syms being zero (in a single allocation)
+struct snc_packet *snc_alloc_empty_packet(struct snc_parameters *sp);
+
+/*
+ * Packets are reference counted so that one packet can be held by several
+ * recoder buffers and send queues at a time. A packet is allocated with one
+ * reference; snc_ref_packet() adds a reference, and snc_free_packet() drops
+ * one and frees the packet when the last one is dropped. A packet with more
+ * than one reference is shared and must not be modified: snc_buffer_packet()
+ * and the decoders copy what they would modify.
+ */
+// Add a reference to pkt and return it
+struct snc_packet *snc_ref_packet(struct snc_packet *pkt);
+
+// Drop a reference to an snc packet, and free it up with the last reference
+void snc_free_packet(struct snc_packet *pkt);
+
+/**
+ * Create a pool of packets for the code parameters in sp. Packets of the
+ * pool are carved from slabs, and are recycled through per-thread caches
+ * and a lock-free free list shared by the threads.
+ *
+ * Return Values:
+ *   On success, a pointer to the pool is returned;
+ *   On error, NULL is returned.
+ **/
+struct snc_packet_pool *snc_create_packet_pool(struct snc_parameters *sp);
+
+// Take an snc packet with coes and syms being zero from the pool
+// (snc_free_packet() returns it to the pool)
+struct snc_packet *snc_pool_alloc_packet(struct snc_packet_pool *pool);
+
+// Free up the pool and all its packets, which must no longer be in use
+void snc_free_packet_pool(struct snc_packet_pool *pool);
+
+// Number of bytes of the packet on the wire
+int snc_packet_wire_size(struct snc_parameters *sp, struct snc_packet *pkt);
+
+/**
+ * Describe the wire representation of pkt with iovecs (at most 3), e.g. for
+ * writev()/sendmsg(), without copying coes and syms. The header is written to
+ * hdr of SNC_WIRE_HEADER bytes.
+ *
+ * Return Values:
+ *   The number of iovecs filled.
+ **/
+int snc_serialize_packet(struct snc_parameters *sp, struct snc_packet *pkt, unsigned char *hdr, struct iovec *iov);
+
+/**
+ * Wrap a received packet of len bytes in buf as a view in pkt, without
+ * copying. coes and syms of the view point into buf, and the view has no
+ * reference count (snc_free_packet() leaves it alone). Decoders may use syms
+ * of a view as scratch space, and snc_buffer_packet() buffers a copy of it.
+ *
+ * Return Values:
+ *   0 on success, -1 if buf is not a valid packet of the code of sp
+ *   (including gid/ucid out of the range of the code).
+ **/
+int snc_deserialize_packet(struct snc_parameters *sp, unsigned char *buf, int len, struct snc_packet *pkt);
+
 /*------------------------------- sncDecoder -------------------------------*/
 /**
  * Create an snc decoder given code parameter and decoder type
@@ -126,12 +218,45 @@ struct snc_decoder *snc_create_decoder(struct snc_parameters *sp, int d_type);
 // Get the encode context that the decoder is working on/finished.
 struct snc_context *snc_get_enc_context(struct snc_decoder *decoder);
 
+/**
+ * Decode into an output region instead of packets allocated by the
+ * decoder. Source packet i is written in place at buf + i*size_p, so
+ * that the data is in buf once the decoder is finished, without calling
+ * snc_recover_data(). buf must hold snum*size_p bytes, i.e., datasize
+ * rounded up to a multiple of size_p, and outlive the decoder. The region
+ * is to be bound before packets are processed (or right after restoring
+ * the decoder, in which case packets decoded so far are moved to it).
+ *
+ * snc_bind_decoder_output_file() binds a shared mapping of the file
+ * filepath, which is created (or truncated) and cut to datasize bytes
+ * when the decoder is freed.
+ */
+int snc_bind_decoder_output(struct snc_decoder *decoder, unsigned char *buf);
+int snc_bind_decoder_output_file(struct snc_decoder *decoder, const char *filepath);
+
 // Feed decoder with an snc packet
 void snc_process_packet(struct snc_decoder *decoder, struct snc_packet *pkt);
 
 // Check whether the decoder is finished
 int snc_decoder_finished(struct snc_decoder *decoder);
 
+/**
+ * Stepped decoding. By default, snc_process_packet() also carries out the
+ * heavy work triggered when the decoder gets full rank (e.g., back
+ * substitution of the whole decoding matrix), so that a single call may
+ * take much longer than the others. A stepped decoder leaves that work
+ * pending instead, to be done in slices of about budget_ops finite field
+ * operations by snc_decoder_step(), e.g., between packets of an event
+ * loop. snc_decoder_step() returns 1 if work remains pending, 0 otherwise;
+ * the decoder is not finished until no work is pending. Packets processed
+ * meanwhile don't force the work to complete: a GG decoder queues them
+ * until snc_decoder_step() has done the work, and other decoders, which
+ * leave work pending once they (nearly) have full rank, drop them. Saving
+ * the decoder completes the work and the queued packets.
+ */
+void snc_set_decoder_stepped(struct snc_decoder *decoder, int stepped);
+int snc_decoder_step(struct snc_decoder *decoder, long long budget_ops);
+
 // Return decode overhead, which is defined as oh = N / M, where
 //   N - Number of received packets to successfully decode
 //   M - Number of source packets
@@ -152,6 +277,23 @@ long snc_save_decoder_context(struct snc_decoder *decoder, const char *filepath)
 // Restore decoder from the context stored in a file
 struct snc_decoder *snc_restore_decoder(const char *filepath);
 
+/**
+ * Journal the decoder for frequent checkpoints: a snapshot of the decoder
+ * is saved to filepath, and every packet fed to the decoder afterwards is
+ * appended to the journal filepath.jnl with one write. The journal is
+ * compacted into a new snapshot when it grows larger than the snapshot.
+ *
+ * Return Values:
+ *   0 on success, -1 on error.
+ **/
+int snc_journal_decoder(struct snc_decoder *decoder, const char *filepath);
+
+// Save a new snapshot of a journaled decoder and clear its journal (returns bytes of the snapshot or -1)
+long snc_compact_decoder_journal(struct snc_decoder *decoder);
+
+// Restore a journaled decoder from its snapshot and journal; the decoder keeps journaling
+struct snc_decoder *snc_restore_journaled_decoder(const char *filepath);
+
 /*----------------------------- sncRecoder ------------------------------*/
 /**
  * Create a buffer for storing snc packets.
@@ -163,16 +305,153 @@ struct snc_decoder *snc_restore_decoder(const char *filepath);
  **/
 struct snc_buffer *snc_create_buffer(struct snc_parameters *sp, int bufsize);
 
-// Save an snc packet to an snc buffer
+/**
+ * Create a buffer that keeps a basis of the packets received from each
+ * subgeneration (at most size_g packets) instead of the latest bufsize
+ * packets. Non-innovative packets are dropped when buffered, and recoding
+ * combines only the basis packets.
+ **/
+struct snc_buffer *snc_create_basis_buffer(struct snc_parameters *sp);
+
+// Save an snc packet to an snc buffer (the buffer takes over the caller's reference)
 void snc_buffer_packet(struct snc_buffer *buffer, struct snc_packet *pkt);
 
-// Recode an snc packet from an snc buffer
+// Recode an snc packet from an snc buffer (systematic packets are forwarded by reference)
 struct snc_packet *snc_recode_packet(struct snc_buffer *buffer, int sched_t);
 
 // Recode a packet from an snc buffer to an allocated snc_packet struct
 int snc_recode_packet_im(struct snc_buffer *buffer, struct snc_packet *pkt, int sched_t);
 
+// Take packets recoded by snc_recode_packet() from a pool (NULL: allocate them)
+int snc_set_buffer_packet_pool(struct snc_buffer *buffer, struct snc_packet_pool *pool);
+
 // Free snc buffer
 void snc_free_buffer(struct snc_buffer *buffer);
 
+/*------------------------------- sncAsync -------------------------------*/
+/**
+ * Asynchronous decoder. Packets are submitted to a bounded lock-free ring
+ * of at least qsize packets and decoded by a dedicated solver thread, so
+ * that submitting a packet costs the same regardless of the decoding phase.
+ * When the decoder is finished, the fd of snc_async_decoder_fd() becomes
+ * readable, and done(decoder, arg) is called on the solver thread if done
+ * is not NULL.
+ */
+struct snc_async_decoder *snc_create_async_decoder(struct snc_parameters *sp, int d_type, int qsize,
+                                                   void (*done)(struct snc_decoder *, void *), void *arg);
+
+// Submit an allocated packet (the decoder takes over the caller's reference); return -1 if the ring is full
+int snc_async_process_packet(struct snc_async_decoder *adec, struct snc_packet *pkt);
+
+// Check whether the decoder is finished
+int snc_async_decoder_finished(struct snc_async_decoder *adec);
+
+// File descriptor (eventfd or pipe) that becomes readable when the decoder is finished
+int snc_async_decoder_fd(struct snc_async_decoder *adec);
+
+// Wait until the packets submitted so far by the calling thread are processed
+void snc_async_flush(struct snc_async_decoder *adec);
+
+// Get the decoder, to be used only when it is finished or flushed
+struct snc_decoder *snc_async_get_decoder(struct snc_async_decoder *adec);
+
+// Stop the solver thread and free the decoder
+void snc_free_async_decoder(struct snc_async_decoder *adec);
+
+/*------------------------------- sncFile -------------------------------*/
+/**
+ * File sessions. A file is split to blocks of sp->datasize bytes (the
+ * last one padded with zeros), each coded as the data of an encode
+ * context with the parameters in sp, and up to window blocks are in
+ * flight at a time.
+ *
+ * The file encoder loads the blocks of the window ahead of time in a
+ * background thread. The context of a block released by the application
+ * is reused for the block a window later. All blocks share the seed of
+ * sp, which is set when the encoder is created.
+ *
+ * The file decoder decodes the blocks of its window in parallel on a
+ * pool of threads, and writes each decoded block at its offset of the
+ * output file as soon as it is finished.
+ **/
+struct snc_file_encoder *snc_create_file_encoder(const char *filepath, struct snc_parameters *sp, int window);
+
+// Number of blocks of the file
+int snc_file_encoder_blocks(struct snc_file_encoder *fenc);
+
+// Size of the file in bytes, which the decoder needs
+long snc_file_encoder_size(struct snc_file_encoder *fenc);
+
+// Encode context of block blk, once loaded (NULL if already released)
+struct snc_context *snc_file_encoder_get_block(struct snc_file_encoder *fenc, int blk);
+
+// Release block blk so that the block a window later can be loaded
+void snc_file_encoder_release_block(struct snc_file_encoder *fenc, int blk);
+
+void snc_free_file_encoder(struct snc_file_encoder *fenc);
+
+// Decode a file of filesize bytes to filepath with nthreads threads (one per CPU if <= 0)
+struct snc_file_decoder *snc_create_file_decoder(const char *filepath, struct snc_parameters *sp, int d_type,
+                                                 long filesize, int window, int nthreads);
+
+// Submit an allocated packet of block blk (the decoder takes over the caller's reference);
+// return -1 if blk is beyond the window or the queue of blk is full
+int snc_file_process_packet(struct snc_file_decoder *fdec, int blk, struct snc_packet *pkt);
+
+// Check whether block blk is decoded and written
+int snc_file_block_finished(struct snc_file_decoder *fdec, int blk);
+
+// Check whether all blocks are decoded and written, or decoding failed
+int snc_file_decoder_finished(struct snc_file_decoder *fdec);
+
+// Wait until all blocks are decoded and written; return -1 once a block could not be decoded or written
+int snc_file_decoder_wait(struct snc_file_decoder *fdec);
+
+// Average decoding overhead and cost of the blocks written so far
+double snc_file_decode_overhead(struct snc_file_decoder *fdec);
+double snc_file_decode_cost(struct snc_file_decoder *fdec);
+
+// Stop the worker threads and free the decoder
+void snc_free_file_decoder(struct snc_file_decoder *fdec);
+
+/*------------------------------- sncWindow -------------------------------*/
+/**
+ * Sliding-window (streaming) mode. Source packets are appended to the
+ * encoder as they are produced; coded packets combine the packets not yet
+ * acknowledged, whose number is limited by size_g (the window size). Only
+ * size_p, size_g, bnc and sys of snc_parameters are used.
+ *
+ * Window packets are allocated by snc_alloc_empty_packet() and freed by
+ * snc_free_packet(). gid of a window packet is the seq of the first packet
+ * of the window, and the i-th coefficient applies to packet gid+i.
+ **/
+struct snc_window_encoder *snc_create_window_encoder(struct snc_parameters *sp);
+
+// Append a source packet of size_p bytes; return its seq, or -1 if the window is full
+int snc_window_enqueue(struct snc_window_encoder *enc, unsigned char *buf);
+
+// Generate a packet from the current window (NULL if the window is empty)
+struct snc_packet *snc_window_generate_packet(struct snc_window_encoder *enc);
+
+// Generate a packet from the current window to an allocated snc_packet struct
+int snc_window_generate_packet_im(struct snc_window_encoder *enc, struct snc_packet *pkt);
+
+// Slide the window after the receiver has delivered all packets before seq
+void snc_window_acknowledge(struct snc_window_encoder *enc, int seq);
+
+void snc_free_window_encoder(struct snc_window_encoder *enc);
+
+struct snc_window_decoder *snc_create_window_decoder(struct snc_parameters *sp);
+
+// Feed the window decoder with a packet
+void snc_window_process_packet(struct snc_window_decoder *dec, struct snc_packet *pkt);
+
+// Copy the next in-order decoded packet to buf; return its seq, or -1 if none is ready
+int snc_window_deliver(struct snc_window_decoder *dec, unsigned char *buf);
+
+// Number of packets delivered so far, to be acknowledged to the encoder
+int snc_window_delivered(struct snc_window_decoder *dec);
+
+void snc_free_window_decoder(struct snc_window_decoder *dec);
+
 #endif /* SNC_H */
@@ -2,7 +2,7 @@
 from __future__ import division
 from math import floor, ceil, sqrt
 # from ctypes import *
-from ctypes import cdll, c_int, c_ubyte, c_double, c_long, c_longlong, c_char_p, POINTER, sizeof, byref, cast, memmove, Structure
+from ctypes import cdll, c_int, c_ubyte, c_double, c_long, c_longlong, c_char_p, c_void_p, POINTER, sizeof, byref, cast, memmove, Structure
 # code types
 RAND_SNC = 0
 BAND_SNC = 1
@@ -31,7 +31,10 @@ class snc_packet(Structure):
     _fields_ = [("gid",  c_int),
                 ("ucid",  c_int),
                 ("coes", POINTER(c_ubyte)),
-                ("syms", POINTER(c_ubyte))]
+                ("syms", POINTER(c_ubyte)),
+                ("pool", c_void_p),
+                ("refcnt", c_int),
+                ("seq",  c_int)]
 
     def serialize(self, size_g, size_p, bnc):
         """ Serialize an SNC packet to a binary byte string
@@ -39,11 +42,14 @@ class snc_packet(Structure):
         pktstr = bytearray()
         pktstr += c_int(self.gid)
         pktstr += c_int(self.ucid)
+        pktstr += c_int(self.seq)
         if bnc == 1:
             ce_len = int(ceil(size_g/8))  # Python 2/3 compatibility
         else:
             ce_len = size_g
-        pktstr += cast(self.coes, POINTER(c_ubyte * ce_len))[0]
+        # Seeded coefficients are regenerated from seq by the receiver
+        if self.seq < 0:
+            pktstr += cast(self.coes, POINTER(c_ubyte * ce_len))[0]
         pktstr += cast(self.syms, POINTER(c_ubyte * size_p))[0]
         return pktstr
 
@@ -53,13 +59,17 @@ class snc_packet(Structure):
         """
         self.gid = c_int.from_buffer_copy(pktstr)
         self.ucid = c_int.from_buffer_copy(pktstr, sizeof(c_int))
+        self.seq = c_int.from_buffer_copy(pktstr, 2*sizeof(c_int))
         if bnc == 1:
             ce_len = int(ceil(size_g/8))  # Python 2/3 compatibility
         else:
             ce_len = size_g
-        coes = (c_ubyte * ce_len).from_buffer_copy(pktstr, 2*sizeof(c_int))
-        memmove(self.coes, coes, ce_len)
-        syms = (c_ubyte * size_p).from_buffer_copy(pktstr, 2*sizeof(c_int)+ce_len)
+        if self.seq < 0:
+            coes = (c_ubyte * ce_len).from_buffer_copy(pktstr, 3*sizeof(c_int))
+            memmove(self.coes, coes, ce_len)
+        else:
+            ce_len = 0
+        syms = (c_ubyte * size_p).from_buffer_copy(pktstr, 3*sizeof(c_int)+ce_len)
         memmove(self.syms, syms, size_p)
 
 
@@ -73,7 +83,8 @@ class snc_parameters(Structure):
                 ("bpc",    c_int),
                 ("bnc",    c_int),
                 ("sys",    c_int),
-                ("seed",   c_int)]
+                ("seed",   c_int),
+                ("sce",    c_int)]
 
 
 class snc_decoder(Structure):
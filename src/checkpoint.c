@@ -0,0 +1,522 @@
+/**************************************************************
+ * checkpoint.c
+ *
+ * Checkpoint files of decoding contexts.
+ *
+ * A checkpoint consists of three sections:
+ *
+ *   header   - magic, version, decoder type, snc_parameters and
+ *              the sizes of the other two sections
+ *   state    - decoder specific state (counters, index mappings,
+ *              coefficient rows in sparse form), in the order it
+ *              is put by the decoder's saver
+ *   payload  - message rows of size_p bytes each, stored one after
+ *              another from a page-aligned offset
+ *
+ * A checkpoint is written with a single writev() pass: the state is
+ * gathered in memory and payload rows are referenced in place. The
+ * file is written under a temporary name, synced and then renamed, so
+ * that a complete checkpoint is in place at any time. On restore the
+ * file is mmap'd, so the state is parsed and payload rows are copied
+ * straight out of the mapping.
+ *
+ * Coefficient rows are stored as
+ *   len | n | ...
+ * If n >= 0, the row has n nonzero elements, stored as n 32-bit
+ * column indices followed by their n values. Otherwise the nonzero
+ * span [-n-1, end) of the row is stored as end followed by the
+ * elements of the span. Elements out of the stored ones are zero.
+ *
+ * The header is stored field by field in network byte order
+ * (CKPT_HEADER_SIZE bytes). Integers of the state section are in host
+ * byte order, i.e., checkpoints are meant to be restored on the host
+ * where they were saved.
+ **************************************************************/
+#define _DEFAULT_SOURCE     // madvise()
+#include <stdint.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "common.h"
+
+#define CKPT_MAGIC      0x534e434b      // "SNCK"
+#define CKPT_VERSION    2
+#define CKPT_HEADER_SIZE 88             // bytes of the header on file
+#define CKPT_PAGE       4096            // alignment of the payload section
+#ifndef IOV_MAX
+#define IOV_MAX         1024            // limit on iovcnt of writev() on Linux
+#endif
+
+struct ckpt_header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t  d_type;
+    int32_t  rowsize;                   // bytes of each payload row
+    uint64_t state_size;                // bytes of the state section
+    uint64_t payload_offset;            // file offset of the payload section
+    uint64_t nrows;                     // number of payload rows
+    struct snc_parameters params;
+};
+
+struct ckpt_writer {
+    struct ckpt_header hdr;
+    unsigned char  hbuf[CKPT_HEADER_SIZE];  // the header as written
+    unsigned char *state;               // state section
+    size_t         len;
+    size_t         cap;
+    GF_ELEMENT   **rows;                // payload rows (not copied)
+    long           maxrows;
+    int            failed;              // an allocation failed
+};
+
+struct ckpt_reader {
+    struct ckpt_header hdr;
+    unsigned char *map;                 // the mapped file
+    size_t         size;
+    size_t         pos;                 // next byte to read in the state section
+    long           next;                // next payload row
+    int            failed;              // read past the end of a section
+};
+
+static const unsigned char zeros[CKPT_PAGE];
+
+static unsigned char *put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+static unsigned char *put_u64(unsigned char *p, uint64_t v)
+{
+    p = put_u32(p, v >> 32);
+    return put_u32(p, (uint32_t) v);
+}
+
+static const unsigned char *get_u32(const unsigned char *p, uint32_t *v)
+{
+    *v = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+    return p + 4;
+}
+
+static const unsigned char *get_u64(const unsigned char *p, uint64_t *v)
+{
+    uint32_t hi, lo;
+    p = get_u32(p, &hi);
+    p = get_u32(p, &lo);
+    *v = (uint64_t) hi << 32 | lo;
+    return p;
+}
+
+static const unsigned char *get_i32(const unsigned char *p, int *v)
+{
+    uint32_t u;
+    p = get_u32(p, &u);
+    *v = (int32_t) u;
+    return p;
+}
+
+// Store the header in buf (CKPT_HEADER_SIZE bytes)
+static void encode_header(const struct ckpt_header *hdr, unsigned char *buf)
+{
+    const struct snc_parameters *sp = &hdr->params;
+    unsigned char *p = buf;
+    p = put_u32(p, hdr->magic);
+    p = put_u32(p, hdr->version);
+    p = put_u32(p, (uint32_t) hdr->d_type);
+    p = put_u32(p, (uint32_t) hdr->rowsize);
+    p = put_u64(p, hdr->state_size);
+    p = put_u64(p, hdr->payload_offset);
+    p = put_u64(p, hdr->nrows);
+    p = put_u64(p, (uint64_t) (int64_t) sp->datasize);
+    p = put_u32(p, (uint32_t) sp->size_p);
+    p = put_u32(p, (uint32_t) sp->size_c);
+    p = put_u32(p, (uint32_t) sp->size_b);
+    p = put_u32(p, (uint32_t) sp->size_g);
+    p = put_u32(p, (uint32_t) sp->type);
+    p = put_u32(p, (uint32_t) sp->bpc);
+    p = put_u32(p, (uint32_t) sp->bnc);
+    p = put_u32(p, (uint32_t) sp->sys);
+    p = put_u32(p, (uint32_t) sp->seed);
+    put_u32(p, (uint32_t) sp->sce);
+}
+
+static void decode_header(const unsigned char *buf, struct ckpt_header *hdr)
+{
+    struct snc_parameters *sp = &hdr->params;
+    const unsigned char *p = buf;
+    uint64_t datasize;
+    memset(hdr, 0, sizeof(struct ckpt_header));
+    p = get_u32(p, &hdr->magic);
+    p = get_u32(p, &hdr->version);
+    p = get_i32(p, &hdr->d_type);
+    p = get_i32(p, &hdr->rowsize);
+    p = get_u64(p, &hdr->state_size);
+    p = get_u64(p, &hdr->payload_offset);
+    p = get_u64(p, &hdr->nrows);
+    p = get_u64(p, &datasize);
+    sp->datasize = (long) (int64_t) datasize;
+    p = get_i32(p, &sp->size_p);
+    p = get_i32(p, &sp->size_c);
+    p = get_i32(p, &sp->size_b);
+    p = get_i32(p, &sp->size_g);
+    p = get_i32(p, &sp->type);
+    p = get_i32(p, &sp->bpc);
+    p = get_i32(p, &sp->bnc);
+    p = get_i32(p, &sp->sys);
+    p = get_i32(p, &sp->seed);
+    get_i32(p, &sp->sce);
+}
+
+struct ckpt_writer *ckpt_create_writer(struct snc_parameters *sp, int d_type)
+{
+    static char fname[] = "ckpt_create_writer";
+    struct ckpt_writer *w;
+    if ((w = calloc(1, sizeof(struct ckpt_writer))) == NULL) {
+        fprintf(stderr, "%s: calloc ckpt_writer\n", fname);
+        return NULL;
+    }
+    w->hdr.magic   = CKPT_MAGIC;
+    w->hdr.version = CKPT_VERSION;
+    w->hdr.d_type  = d_type;
+    w->hdr.rowsize = sp->size_p;
+    w->hdr.params  = *sp;
+    return w;
+}
+
+void ckpt_put(struct ckpt_writer *w, const void *data, size_t size)
+{
+    if (w->failed)
+        return;
+    if (w->len + size > w->cap) {
+        size_t cap = w->cap == 0 ? CKPT_PAGE : w->cap;
+        while (cap < w->len + size)
+            cap *= 2;
+        unsigned char *state = realloc(w->state, cap);
+        if (state == NULL) {
+            w->failed = 1;
+            return;
+        }
+        w->state = state;
+        w->cap   = cap;
+    }
+    memcpy(w->state + w->len, data, size);
+    w->len += size;
+}
+
+void ckpt_put_int(struct ckpt_writer *w, int value)
+{
+    int32_t v = value;
+    ckpt_put(w, &v, sizeof(int32_t));
+}
+
+// Put a coefficient row of len elements, in sparse form if it's smaller
+void ckpt_put_row(struct ckpt_writer *w, GF_ELEMENT *row, int len)
+{
+    int first = 0, end = len;
+    while (first < end && row[first] == 0)
+        first++;
+    while (end > first && row[end-1] == 0)
+        end--;
+    int nnz = 0;
+    for (int j=first; j<end; j++)
+        nnz += (row[j] != 0);
+    ckpt_put_int(w, len);
+    if ((long) nnz * (sizeof(int32_t) + 1) < end - first) {
+        ckpt_put_int(w, nnz);
+        for (int j=first; j<end; j++) {
+            if (row[j] != 0)
+                ckpt_put_int(w, j);
+        }
+        for (int j=first; j<end; j++) {
+            if (row[j] != 0)
+                ckpt_put(w, &row[j], 1);
+        }
+    } else {
+        ckpt_put_int(w, -first-1);
+        ckpt_put_int(w, end);
+        ckpt_put(w, row+first, end-first);
+    }
+}
+
+// Append a payload row of size_p bytes. It's referenced until ckpt_write().
+void ckpt_put_payload(struct ckpt_writer *w, GF_ELEMENT *syms)
+{
+    if (w->failed)
+        return;
+    if (w->hdr.nrows == w->maxrows) {
+        long maxrows = w->maxrows == 0 ? 64 : w->maxrows * 2;
+        GF_ELEMENT **rows = realloc(w->rows, sizeof(GF_ELEMENT*) * maxrows);
+        if (rows == NULL) {
+            w->failed = 1;
+            return;
+        }
+        w->rows    = rows;
+        w->maxrows = maxrows;
+    }
+    w->rows[w->hdr.nrows++] = syms;
+}
+
+static void free_writer(struct ckpt_writer *w)
+{
+    free(w->state);
+    free(w->rows);
+    free(w);
+}
+
+// Write all of iov[0..cnt-1], IOV_MAX vectors at a time
+static int writev_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+        if (n < 0)
+            return -1;
+        while (cnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (unsigned char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write the checkpoint to filepath and free the writer.
+ * Return values:
+ *   On success: bytes written
+ *   On error: -1
+ */
+long ckpt_write(struct ckpt_writer *w, const char *filepath)
+{
+    static char fname[] = "ckpt_write";
+    if (w->failed) {
+        fprintf(stderr, "%s: out of memory while saving decoding context\n", fname);
+        free_writer(w);
+        return (-1);
+    }
+    size_t head = CKPT_HEADER_SIZE + w->len;
+    w->hdr.state_size     = w->len;
+    w->hdr.payload_offset = (uint64_t) ALIGN(head, CKPT_PAGE) * CKPT_PAGE;
+    long nrows = w->hdr.nrows;
+    struct iovec *iov = malloc(sizeof(struct iovec) * (nrows + 3));
+    if (iov == NULL) {
+        fprintf(stderr, "%s: malloc iovec\n", fname);
+        free_writer(w);
+        return (-1);
+    }
+    encode_header(&w->hdr, w->hbuf);
+    int cnt = 0;
+    iov[cnt].iov_base = w->hbuf;
+    iov[cnt++].iov_len = CKPT_HEADER_SIZE;
+    if (w->len != 0) {
+        iov[cnt].iov_base = w->state;
+        iov[cnt++].iov_len = w->len;
+    }
+    if (w->hdr.payload_offset != head) {
+        iov[cnt].iov_base = (void *) zeros;
+        iov[cnt++].iov_len = w->hdr.payload_offset - head;
+    }
+    for (long i=0; i<nrows; i++) {
+        // Rows that are adjacent in memory are written by one vector
+        struct iovec *last = &iov[cnt-1];
+        if (i != 0 && (unsigned char *) last->iov_base + last->iov_len == w->rows[i]) {
+            last->iov_len += w->hdr.rowsize;
+        } else {
+            iov[cnt].iov_base = w->rows[i];
+            iov[cnt++].iov_len = w->hdr.rowsize;
+        }
+    }
+    long filesize = w->hdr.payload_offset + (long) nrows * w->hdr.rowsize;
+    // Write to filepath.tmp and rename it over filepath once it is on disk
+    char *tmp = malloc(strlen(filepath) + 5);
+    if (tmp == NULL) {
+        fprintf(stderr, "%s: malloc path\n", fname);
+        free(iov);
+        free_writer(w);
+        return (-1);
+    }
+    sprintf(tmp, "%s.tmp", filepath);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || writev_all(fd, iov, cnt) != 0 || fsync(fd) != 0) {
+        fprintf(stderr, "%s: cannot write decoding context to %s\n", fname, tmp);
+        filesize = -1;
+    }
+    if (fd != -1 && close(fd) != 0)
+        filesize = -1;
+    if (filesize != -1 && rename(tmp, filepath) != 0) {
+        fprintf(stderr, "%s: cannot rename %s to %s\n", fname, tmp, filepath);
+        filesize = -1;
+    }
+    if (filesize == -1 && fd != -1)
+        remove(tmp);
+    free(tmp);
+    free(iov);
+    free_writer(w);
+    return filesize;
+}
+
+/*
+ * Map a checkpoint file and check its header. The code parameters and
+ * the decoder type are stored in sp and d_type.
+ */
+struct ckpt_reader *ckpt_open(const char *filepath, struct snc_parameters *sp, int *d_type)
+{
+    static char fname[] = "ckpt_open";
+    int fd;
+    if ((fd = open(filepath, O_RDONLY)) == -1) {
+        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
+        return NULL;
+    }
+    struct ckpt_reader *r = NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < CKPT_HEADER_SIZE) {
+        fprintf(stderr, "%s: %s is not a decoding context\n", fname, filepath);
+        goto error;
+    }
+    if ((r = calloc(1, sizeof(struct ckpt_reader))) == NULL) {
+        fprintf(stderr, "%s: calloc ckpt_reader\n", fname);
+        goto error;
+    }
+    r->size = st.st_size;
+    r->map  = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (r->map == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap %s\n", fname, filepath);
+        r->map = NULL;
+        goto error;
+    }
+    close(fd);
+    fd = -1;
+    decode_header(r->map, &r->hdr);
+    if (r->hdr.magic != CKPT_MAGIC || r->hdr.version != CKPT_VERSION) {
+        fprintf(stderr, "%s: %s is not a decoding context of version %d\n", fname, filepath, CKPT_VERSION);
+        goto error;
+    }
+    if (r->hdr.rowsize != r->hdr.params.size_p
+            || CKPT_HEADER_SIZE + r->hdr.state_size > r->hdr.payload_offset
+            || r->hdr.payload_offset + r->hdr.nrows * r->hdr.rowsize > r->size) {
+        fprintf(stderr, "%s: %s is truncated or corrupted\n", fname, filepath);
+        goto error;
+    }
+    madvise(r->map, r->size, MADV_SEQUENTIAL);
+    *sp = r->hdr.params;
+    *d_type = r->hdr.d_type;
+    return r;
+
+error:
+    if (fd != -1)
+        close(fd);
+    if (r != NULL)
+        ckpt_close(r);
+    return NULL;
+}
+
+// Read size bytes of the state section. Bytes past its end read as zero.
+void ckpt_get(struct ckpt_reader *r, void *data, size_t size)
+{
+    if (r->failed || r->pos + size > r->hdr.state_size) {
+        r->failed = 1;
+        memset(data, 0, size);
+        return;
+    }
+    memcpy(data, r->map + CKPT_HEADER_SIZE + r->pos, size);
+    r->pos += size;
+}
+
+int ckpt_get_int(struct ckpt_reader *r)
+{
+    int32_t v;
+    ckpt_get(r, &v, sizeof(int32_t));
+    return v;
+}
+
+// Length of the next coefficient row, without consuming it
+int ckpt_peek_row_len(struct ckpt_reader *r)
+{
+    size_t pos = r->pos;
+    int len = ckpt_get_int(r);
+    r->pos = pos;
+    return len;
+}
+
+/*
+ * Read a coefficient row into row, which has room for maxlen elements
+ * and is zeroed by the caller. Returns the length of the row.
+ */
+int ckpt_get_row(struct ckpt_reader *r, GF_ELEMENT *row, int maxlen)
+{
+    int len = ckpt_get_int(r);
+    int n   = ckpt_get_int(r);
+    if (r->failed || len < 0 || len > maxlen) {
+        r->failed = 1;
+        return 0;
+    }
+    if (n >= 0) {
+        if (n > len || r->pos + (size_t) n * (sizeof(int32_t) + 1) > r->hdr.state_size) {
+            r->failed = 1;
+            return 0;
+        }
+        const unsigned char *idx = r->map + CKPT_HEADER_SIZE + r->pos;
+        const unsigned char *val = idx + (size_t) n * sizeof(int32_t);
+        for (int k=0; k<n; k++) {
+            int32_t j;
+            memcpy(&j, idx + k * sizeof(int32_t), sizeof(int32_t));
+            if (j < 0 || j >= len) {
+                r->failed = 1;
+                return 0;
+            }
+            row[j] = val[k];
+        }
+        r->pos += (size_t) n * (sizeof(int32_t) + 1);
+    } else {
+        int first = -n-1;
+        int end   = ckpt_get_int(r);
+        if (first > end || end > len) {
+            r->failed = 1;
+            return 0;
+        }
+        ckpt_get(r, row+first, end-first);
+    }
+    return len;
+}
+
+// The next payload row, which stays valid until ckpt_close()
+GF_ELEMENT *ckpt_get_payload(struct ckpt_reader *r)
+{
+    if (r->next >= r->hdr.nrows) {
+        r->failed = 1;
+        return NULL;
+    }
+    return r->map + r->hdr.payload_offset + (size_t) (r->next++) * r->hdr.rowsize;
+}
+
+// Copy the next payload row to syms
+void ckpt_copy_payload(struct ckpt_reader *r, GF_ELEMENT *syms)
+{
+    GF_ELEMENT *row = ckpt_get_payload(r);
+    if (row != NULL)
+        memcpy(syms, row, r->hdr.rowsize);
+    else
+        memset(syms, 0, r->hdr.rowsize);
+}
+
+/*
+ * Unmap the checkpoint. Returns -1 if the checkpoint was found truncated
+ * or corrupted while reading it, 0 otherwise.
+ */
+int ckpt_close(struct ckpt_reader *r)
+{
+    int failed = r->failed;
+    if (r->map != NULL)
+        munmap(r->map, r->size);
+    free(r);
+    return failed ? -1 : 0;
+}
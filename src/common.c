@@ -29,6 +29,72 @@ int has_item(int array[], int item, int length)
     return index;
 }
 
+/*
+ * Subgeneration membership. Subgenerations of BAND and WINDWRAP codes
+ * are consecutive packets from a leading packet, so their members are
+ * computed instead of being listed in pktid (which is NULL for them).
+ */
+// The leading packet of subgeneration gid of BAND and WINDWRAP codes
+int band_lead(struct snc_context *sc, int gid)
+{
+    int lead = gid * sc->params.size_b;
+    int numpp = sc->snum + sc->cnum;
+    // The last band subgenerations are moved back to end at the last packet
+    if (sc->params.type == BAND_SNC && lead > numpp - sc->params.size_g)
+        lead = numpp - sc->params.size_g;
+    return lead;
+}
+
+// Index of the i-th packet of subgeneration gid
+int gene_pktid(struct snc_context *sc, int gid, int i)
+{
+    if (sc->params.type == RAND_SNC)
+        return sc->gene[gid]->pktid[i];
+    int numpp = sc->snum + sc->cnum;
+    int index = band_lead(sc, gid) + i;
+    return index < numpp ? index : index - numpp;   // WINDWRAP wraps around
+}
+
+// Position of packet pktid in subgeneration gid, or -1 if it's not a member
+int gene_position(struct snc_context *sc, int gid, int pktid)
+{
+    if (sc->params.type == RAND_SNC)
+        return has_item(sc->gene[gid]->pktid, pktid, sc->params.size_g);
+    int numpp = sc->snum + sc->cnum;
+    int pos = pktid - band_lead(sc, gid);
+    if (pos < 0)
+        pos += numpp;
+    return pos < sc->params.size_g ? pos : -1;
+}
+
+/*
+ * Place the coding coefficients of a packet of subgeneration gid at the
+ * indices of its packets in ces, a zeroed vector of length snum+cnum.
+ * Coefficients of band subgenerations are copied into place at once.
+ */
+void expand_coes(struct snc_context *sc, int gid, GF_ELEMENT *coes, GF_ELEMENT *ces)
+{
+    int gensize = sc->params.size_g;
+    int i;
+    if (sc->params.type == RAND_SNC) {
+        for (i=0; i<gensize; i++)
+            ces[sc->gene[gid]->pktid[i]] = sc->params.bnc ? get_bit_in_array(coes, i) : coes[i];
+        return;
+    }
+    int numpp = sc->snum + sc->cnum;
+    int lead  = band_lead(sc, gid);
+    int len   = numpp - lead < gensize ? numpp - lead : gensize;   // the rest wraps around
+    if (sc->params.bnc) {
+        for (i=0; i<len; i++)
+            ces[lead+i] = get_bit_in_array(coes, i);
+        for (i=len; i<gensize; i++)
+            ces[i-len] = get_bit_in_array(coes, i);
+    } else {
+        memcpy(ces+lead, coes, len*sizeof(GF_ELEMENT));
+        memcpy(ces, coes+len, (gensize-len)*sizeof(GF_ELEMENT));
+    }
+}
+
 void append_to_list(struct node_list *list, struct node *nd)
 {
     if (list->first == NULL)
@@ -127,6 +193,37 @@ inline void set_bit_in_array(unsigned char *coes, int i)
     return;
 }
 
+/*
+ * Finalizer of splitmix64, a bijective mixing of 64-bit words
+ */
+static inline uint64_t mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Generate the coefficient vector of a packet of code with seeded
+ * coefficients. The vector is a function of (seed, seq) only, drawn
+ * from a counter-based generator, so that encoder and decoders obtain
+ * the same vector independently. For binary code the coefficients
+ * are condensed to bits as set_bit_in_array() does.
+ */
+void generate_seeded_coes(int seed, int seq, int size_g, int bnc, GF_ELEMENT *coes)
+{
+    uint64_t key = ((uint64_t) (uint32_t) seed << 32) | (uint32_t) seq;
+    int len = bnc ? ALIGN(size_g, 8) : size_g;
+    uint64_t x = 0;
+    for (int i=0; i<len; i++) {
+        if (i % 8 == 0)
+            x = mix64(key + (uint64_t) (i / 8 + 1) * 0x9e3779b97f4a7c15ULL);
+        coes[i] = (GF_ELEMENT) (x >> (8 * (i % 8)));
+    }
+    if (bnc && size_g % 8 != 0)
+        coes[len-1] &= (1 << (size_g % 8)) - 1;
+}
+
 /*
  * Swap two continuous memory blocks
  */
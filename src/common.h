@@ -6,9 +6,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
 #include "sparsenc.h"
 
 /* log levels */
@@ -52,7 +54,25 @@ typedef struct bipartite_graph {
  **/
 struct subgeneration {
     int gid;
-    int *pktid;                 // SIZE_G source packet IDs
+    int *pktid;                 // SIZE_G source packet IDs (RAND code only, see gene_pktid())
+};
+
+/**
+ * Code template: the subgenerations and the precode graph, which are
+ * fully determined by the code parameters and the seed. A template is
+ * immutable once built and is shared by all contexts of the same code
+ * through a process-wide cache (see sncEncoder.c).
+ **/
+#define TEMPLATE_CACHE_SIZE 16
+struct code_template {
+    struct  snc_parameters    params;
+    int                       snum;
+    int                       cnum;
+    int                       gnum;
+    struct  subgeneration   **gene;
+    struct  bipartite_graph  *graph;    // NULL if there is no precode
+    int                       refcnt;   // Contexts and cache holding the template
+    struct  code_template    *next;     // Next (less recently used) cached template
 };
 
 /**
@@ -63,11 +83,14 @@ struct snc_context {
     int                       snum;     // Number of source packets splitted
     int                       cnum;     // Number of parity-checks(cnum ~= snum * pcrate)
     int                       gnum;     // Number of subgenerations
-    struct  subgeneration   **gene;     // array of pointers each points to a subgeneration.
-    struct  bipartite_graph  *graph;
+    struct  code_template    *tmpl;     // Shared template of gene and graph
+    struct  subgeneration   **gene;     // array of pointers each points to a subgeneration (tmpl->gene)
+    struct  bipartite_graph  *graph;    // tmpl->graph
     GF_ELEMENT              **pp;       // Pointers to precoded source packets
+    unsigned char            *out;      // Output region where decoded source packets are stored in place (NULL if none)
     int                      *nccount;  // Count of coded packets generated from each subgeneration
     int                       count;    // Count of total coded packets generated
+    struct  snc_packet_pool  *pool;     // Pool of generated packets (NULL if none)
 };
 
 
@@ -99,6 +122,7 @@ struct snc_context {
  */
 struct snc_buffer {
     struct snc_parameters  params;  // Meta info of the code
+    struct snc_context    *sc;      // Subgenerations of the code (systematic code only)
     int                    snum;    // Number of source packets
     int                    cnum;    // Number of parity-check packets
     int                    gnum;    // Number of subgenerations
@@ -108,12 +132,114 @@ struct snc_buffer {
     int                   *nc;      // Number of currently buffered packets of each generation
     int                   *pn;      // Positions to store next packet of each subgeneration
     int                   *nsched;  // Number of scheduled times of each subgeneration
+    // Scheduling state, updated when nc or nsched changes
+    int                   *heap;    // Max-heap of subgenerations keyed by nc-nsched (ties: lower gid first)
+    int                   *hpos;    // Position of each subgeneration in heap
+    int                   *nonemp;  // The nemp non-empty subgenerations, in order of becoming non-empty
     // This is used during systematic scheduling
     //int                   *prevuc;    // position of last scheduled uncoded packet
     //int                   *lastuc;  // position of last buffered uncoded packet
     struct snc_packet    **sysbuf;   // Buffered uncoded packet (needed for systematic code)
     int                    sysnum;  // number of buffered systematic packet
     int                    sysptr;  // pointer of already scheduled systematic packet
+    struct snc_packet_pool *pool;   // Pool of recoded packets (NULL if none)
+    // Basis buffer: each subgeneration buffer keeps a basis of the received
+    // packets in row echelon form instead of a FIFO. gbuf[gid][0..nc[gid]-1]
+    // are sorted by pivot, and each is normalized to 1 at its pivot.
+    int                    basis;   // whether the buffer keeps bases
+    int                  **pivot;   // pivot (coefficient index) of each basis row
+    GF_ELEMENT            *mult;    // multipliers of basis rows when reducing a packet
+};
+
+/*
+ * Sliding-window encoder (see sncWindow.c)
+ * Source packets with sequence numbers in [start, end) are kept in a
+ * ring of size_g packets until acknowledged.
+ */
+struct snc_window_encoder {
+    struct snc_parameters  params;
+    GF_ELEMENT           **pp;      // ring of source packets, seq % size_g
+    int                    start;   // first unacknowledged seq
+    int                    end;     // seq of the next enqueued packet
+    int                    sent;    // next seq to be sent uncoded (systematic code)
+    int                    count;   // number of generated packets
+};
+
+/*
+ * Sliding-window decoder (see sncWindow.c)
+ * A ring of 2*size_g slots holds the delivered history [base-size_g, base)
+ * and the undelivered part [base, base+size_g) of the stream. Rows of
+ * unknown packets are kept in banded form: the row of slot p has its
+ * pivot (normalized to 1) at p and nonzeros only in [p, p+size_g).
+ */
+struct snc_window_decoder {
+    struct snc_parameters  params;
+    int                    cap;     // number of slots, 2*size_g
+    GF_ELEMENT           **coes;    // [cap][size_g] band row of each slot
+    GF_ELEMENT           **syms;    // [cap][size_p] payload of each slot
+    unsigned char         *state;   // WIN_EMPTY, WIN_PIVOT or WIN_DECODED
+    int                    base;    // seq of the next packet to deliver
+    int                    solved;  // packets in [base, solved) are decoded
+    GF_ELEMENT            *ces;     // encoding vector being processed
+    GF_ELEMENT            *msg;     // payload being processed
+    int                    received;    // number of received packets
+    long long              operations;  // number of finite field operations
+};
+
+/*
+ * Recorded linear operation on payload rows (see opschedule.c)
+ *   rows[dst] += ce * rows[src], or rows[dst] *= ce if src == -1
+ */
+struct linear_op {
+    int         dst;
+    int         src;
+    GF_ELEMENT  ce;
+};
+
+struct op_schedule {
+    int                nthreads;    // Number of payload workers
+    int                nops;        // Number of recorded operations
+    int                size;        // Capacity of ops
+    struct linear_op  *ops;
+    struct stripe_pool *pool;       // Payload workers replaying ops
+};
+
+/*
+ * Nonzero pattern of a decoding matrix (see pivoting.c)
+ * Decoders record entries as they become nonzero so that pivoting
+ * does not need to rescan the dense matrix. A row may list stale
+ * (since eliminated) or repeated columns; they are filtered against
+ * the matrix when the pattern is consumed.
+ */
+struct nz_pattern {
+    int    nrow;
+    int  **cols;        // candidate nonzero columns of each row
+    int   *len;         // number of candidates of each row, -1 if the row is to be scanned
+    int   *size;        // capacity of cols[i]
+};
+
+/*
+ * Pool of snc packets of one parameter set (see sncPacket.c)
+ * Packets are carved from slabs of POOL_SLAB_PKTS fixed-size blocks
+ * and named by index (slab * POOL_SLAB_PKTS + block). Free blocks form
+ * a lock-free stack whose head packs a tag (upper 32 bits, against ABA)
+ * and index+1 of the top block (lower 32 bits, 0 if empty). Slabs are
+ * only released when the pool is freed.
+ */
+#define POOL_SLAB_PKTS  128
+#define POOL_MAX_SLABS  4096
+
+struct snc_packet_pool {
+    struct snc_parameters  params;
+    int                    clen;        // bytes of coes of a packet
+    size_t                 bsize;       // bytes of a block
+    unsigned long          epoch;       // unique id of the pool, checked by thread caches
+    unsigned char        **slabs;       // [POOL_MAX_SLABS] block-aligned slabs
+    void                 **raw;         // [POOL_MAX_SLABS] slabs as allocated
+    int                    nslabs;
+    pthread_mutex_t        grow;        // serializes adding slabs
+    uint64_t               head;        // free stack
+    struct snc_packet_pool *next_live;  // list of live pools
 };
 
 /* Row vector of a matrix */
@@ -123,11 +249,28 @@ struct row_vector
     GF_ELEMENT *elem;   // elements of the row
 };
 
+/*
+ * Progress of the completion work of a decoder, i.e., the burst of
+ * substitutions and copying done once its decoding matrix gets full
+ * rank. The work is split into stages of small units so that it can
+ * run in slices of a budget of operations (see snc_decoder_step()).
+ */
+struct finish_state {
+    int stage;          // FINISH_IDLE if no completion work is pending
+    int pos;            // unit of the stage to resume from
+    long long work;     // operations done in the current slice (a row copy counts as size_p)
+};
+#define FINISH_IDLE 0
+
 
 /* common.c */
 void set_loglevel(const char *level);
 int get_loglevel();
 int has_item(int array[], int item, int length);
+int band_lead(struct snc_context *sc, int gid);
+int gene_pktid(struct snc_context *sc, int gid, int i);
+int gene_position(struct snc_context *sc, int gid, int pktid);
+void expand_coes(struct snc_context *sc, int gid, GF_ELEMENT *coes, GF_ELEMENT *ces);
 void append_to_list(struct node_list *list, struct node *nd);
 int remove_from_list(struct node_list *list, int data);
 int exist_in_list(struct node_list *list, int data);
@@ -135,8 +278,67 @@ void clear_list(struct node_list *list);
 void free_list(struct node_list *list);
 unsigned char get_bit_in_array(unsigned char *coes, int i);
 void set_bit_in_array(unsigned char *coes, int i);
+void generate_seeded_coes(int seed, int seq, int size_g, int bnc, GF_ELEMENT *coes);
 //int snc_rand(void);
 //void snc_srand(unsigned int seed);
+/* sncEncoder.c */
+struct snc_context *create_grouping_context(struct snc_parameters *sp);
+GF_ELEMENT *alloc_decoded(struct snc_context *sc, int pkt_id);
+void free_decoded(struct snc_context *sc, GF_ELEMENT *syms);
+long write_decoded(int fd, long offset, struct snc_context *sc, long len);
+int reload_context(struct snc_context *sc, int fd, long offset, long len);
+/* sncPacket.c */
+int pool_fits_params(struct snc_packet_pool *pool, struct snc_parameters *sp);
+struct snc_packet *duplicate_packet(struct snc_parameters *sp, struct snc_packet_pool *pool, struct snc_packet *pkt);
+/* checkpoint.c */
+struct ckpt_writer;
+struct ckpt_reader;
+struct ckpt_writer *ckpt_create_writer(struct snc_parameters *sp, int d_type);
+void ckpt_put(struct ckpt_writer *w, const void *data, size_t size);
+void ckpt_put_int(struct ckpt_writer *w, int value);
+void ckpt_put_row(struct ckpt_writer *w, GF_ELEMENT *row, int len);
+void ckpt_put_payload(struct ckpt_writer *w, GF_ELEMENT *syms);
+long ckpt_write(struct ckpt_writer *w, const char *filepath);
+struct ckpt_reader *ckpt_open(const char *filepath, struct snc_parameters *sp, int *d_type);
+void ckpt_get(struct ckpt_reader *r, void *data, size_t size);
+int ckpt_get_int(struct ckpt_reader *r);
+int ckpt_peek_row_len(struct ckpt_reader *r);
+int ckpt_get_row(struct ckpt_reader *r, GF_ELEMENT *row, int maxlen);
+GF_ELEMENT *ckpt_get_payload(struct ckpt_reader *r);
+void ckpt_copy_payload(struct ckpt_reader *r, GF_ELEMENT *syms);
+int ckpt_close(struct ckpt_reader *r);
+/* journal.c */
+struct journal;
+struct journal *jnl_create(const char *filepath, long base);
+int jnl_reset(struct journal *j, long base);
+long jnl_size(struct journal *j);
+int jnl_append(struct journal *j, struct snc_parameters *sp, struct snc_packet *pkt);
+struct journal *jnl_recover(const char *filepath, struct snc_parameters *sp, long done,
+                            void (*process)(struct snc_decoder *, struct snc_packet *),
+                            struct snc_decoder *decoder);
+void jnl_close(struct journal *j);
+/* matrix.c */
+GF_ELEMENT **create_matrix(int nrow, int ncol);
+void clear_matrix(GF_ELEMENT **rows, int nrow, int ncol);
+void free_matrix(GF_ELEMENT **rows);
+/* ring.c */
+struct mpsc_ring;
+struct mpsc_ring *create_ring(size_t nslots);
+int ring_push(struct mpsc_ring *ring, void *item);
+void *ring_pop(struct mpsc_ring *ring);
+int ring_empty(struct mpsc_ring *ring);
+void free_ring(struct mpsc_ring *ring);
+/* opschedule.c */
+int get_payload_threads(void);
+struct op_schedule *create_op_schedule(int nthreads);
+int append_linear_op(struct op_schedule *sched, int dst, int src, GF_ELEMENT ce);
+void apply_op_schedule(struct op_schedule *sched, GF_ELEMENT **rows, int rowlen);
+void free_op_schedule(struct op_schedule *sched);
+/* pivoting.c */
+struct nz_pattern *create_nz_pattern(int nrow);
+int nz_pattern_add(struct nz_pattern *pat, int row, int col);
+int nz_pattern_add_row(struct nz_pattern *pat, int row, GF_ELEMENT *elem, int from, int to);
+void free_nz_pattern(struct nz_pattern *pat);
 /* bipartite.c */
 int number_of_checks(int snum, double r);
 int create_bipartite_graph(BP_graph *graph, int nleft, int nright);
@@ -5,20 +5,37 @@
 #include "common.h"
 #include "galois.h"
 #include "decoderBD.h"
-static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx);
-static int apply_parity_check_matrix(struct decoding_context_BD *dec_ctx);
-static void finish_recovering_BD(struct decoding_context_BD *dec_ctx);
+static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx, long long budget);
+static void apply_parity_check_matrix(struct decoding_context_BD *dec_ctx);
+static int pivot_decoding_matrix(struct decoding_context_BD *dec_ctx);
+static int finish_recovering_BD(struct decoding_context_BD *dec_ctx, long long budget);
+static void stop_striping_BD(struct decoding_context_BD *dec_ctx);
+
+/*
+ * Stages of the completion work. Partial diagonalization and back
+ * substitution proceed one column at a time, and normalizing and saving
+ * one row at a time; pivoting and replaying the payload schedule run as
+ * single units. Pivoting that fails for lack of memory is retried by the
+ * next call.
+ */
+#define BD_DIAG         1   // partially diagonalize the decoding matrix
+#define BD_PRECODE      2   // apply the parity-check matrix
+#define BD_PIVOT        3   // pivot and re-order the decoding matrix
+#define BD_BACKSUB      4   // back substitution
+#define BD_NORMALIZE    5   // convert diagonal elements to 1
+#define BD_SCHEDULE     6   // replay deferred message operations
+#define BD_SAVE         7   // copy decoded packets to sc->pp
 
 extern long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
 extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
-extern long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ctoo_r, int **ctoo_c, int *inactives);
-extern long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ctoo_r, int **ctoo_c, int *inactives);
+extern long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ctoo_r, int **ctoo_c, int *inactives);
+extern long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ctoo_r, int **ctoo_c, int *inactives);
 
 // create decoding context for band decoder
 struct decoding_context_BD *create_dec_context_BD(struct snc_parameters *sp)
 {
     static char fname[] = "snc_create_dec_context_BD";
-    int i, j, k;
+    int j, k;
 
     // GNC code context
     // Since this is decoding, we construct GNC context without data
@@ -45,25 +62,22 @@ struct decoding_context_BD *create_dec_context_BD(struct snc_parameters *sp)
     dec_ctx->DoF          = 0;
     dec_ctx->de_precode   = 0;
     dec_ctx->inactivated  = 0;
+    dec_ctx->sched        = NULL;
+    dec_ctx->pattern      = NULL;
+    dec_ctx->dsts         = NULL;
+    dec_ctx->qs           = NULL;
+    dec_ctx->fin.stage    = FINISH_IDLE;
 
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
-    dec_ctx->coefficient = calloc(numpp, sizeof(GF_ELEMENT*));
+    dec_ctx->coefficient = create_matrix(numpp, numpp);
     if (dec_ctx->coefficient == NULL)
         goto AllocError;
-    dec_ctx->message     = calloc(numpp, sizeof(GF_ELEMENT*));
+    dec_ctx->message     = create_matrix(numpp, pktsize);
     if (dec_ctx->message == NULL)
         goto AllocError;
-    for (i=0; i<numpp; i++) {
-        dec_ctx->coefficient[i] = calloc(numpp, sizeof(GF_ELEMENT));
-        if (dec_ctx->coefficient[i] == NULL)
-            goto AllocError;
-        dec_ctx->message[i]     = calloc(pktsize, sizeof(GF_ELEMENT));
-        if (dec_ctx->message[i] == NULL)
-            goto AllocError;
-    }
 
     dec_ctx->ctoo_r = malloc(sizeof(int) * numpp);
     if (dec_ctx->ctoo_r == NULL)
@@ -71,6 +85,21 @@ struct decoding_context_BD *create_dec_context_BD(struct snc_parameters *sp)
     dec_ctx->ctoo_c = malloc(sizeof(int) * numpp);
     if (dec_ctx->ctoo_c == NULL)
         goto AllocError;
+    // Nonzero pattern of the decoding matrix, consumed by pivoting
+    if ((dec_ctx->pattern = create_nz_pattern(numpp)) == NULL)
+        goto AllocError;
+    // Allocated once rather than per slice of stepped back substitution
+    dec_ctx->dsts = malloc(sizeof(GF_ELEMENT*) * numpp);
+    dec_ctx->qs   = malloc(sizeof(GF_ELEMENT) * numpp);
+    if (dec_ctx->dsts == NULL || dec_ctx->qs == NULL) {
+        fprintf(stderr, "%s: malloc back substitution scratch failed\n", fname);
+        goto AllocError;
+    }
+
+    // Defer back substitution on messages to striped payload workers if requested
+    int nthreads = get_payload_threads();
+    if (nthreads != 0 && (dec_ctx->sched = create_op_schedule(nthreads)) == NULL)
+        goto AllocError;
 
     dec_ctx->overhead     = 0;
     dec_ctx->overheads = calloc(dec_ctx->sc->gnum, sizeof(int));
@@ -107,21 +136,14 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
         /*
          * Before precode's check matrix was applied
          */
-        for (i=0; i<gensize; i++) {
-            int index = dec_ctx->sc->gene[pkt->gid]->pktid[i];
-            if (dec_ctx->sc->params.bnc) {
-                ces[index] = get_bit_in_array(pkt->coes, i);
-            } else {
-                ces[index] = pkt->coes[i];
-            }
-        }
+        expand_coes(dec_ctx->sc, pkt->gid, pkt->coes, ces);
         for (i=0; i<numpp; i++) {
             if (ces[i] != 0) {
                 if (dec_ctx->coefficient[i][i] != 0) {
                     quotient = galois_divide(ces[i], dec_ctx->coefficient[i][i]);
                     dec_ctx->operations += 1;
                     int band_width = numpp-i > gensize ? gensize : numpp-i;
-                    galois_multiply_add_region(ces+i, &(dec_ctx->coefficient[i][i]), quotient, band_width);
+                    galois_multiply_add_region_short(ces+i, &(dec_ctx->coefficient[i][i]), quotient, band_width);
                     dec_ctx->operations += band_width;
                     galois_multiply_add_region(pkt->syms, dec_ctx->message[i], quotient, pktsize);
                     dec_ctx->operations += pktsize;
@@ -136,14 +158,7 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
         /*
          *Parity-check matrix has been applied, and therefore the decoding matrix has been pivoted and re-ordered
          */
-        for (i=0; i<gensize; i++) {
-            int orig_index = dec_ctx->sc->gene[pkt->gid]->pktid[i];
-            if (dec_ctx->sc->params.bnc) {
-                ces[orig_index] = get_bit_in_array(pkt->coes, i);
-            } else {
-                ces[orig_index] = pkt->coes[i];
-            }
-        }
+        expand_coes(dec_ctx->sc, pkt->gid, pkt->coes, ces);
         for (i=0; i<numpp; i++) {
             if (ces[dec_ctx->ctoo_c[i]] != 0) {
                 if (dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]] != 0) {
@@ -168,6 +183,9 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
      if (pivotfound == 1 && !dec_ctx->de_precode) {
         memcpy(dec_ctx->coefficient[pivot], ces, numpp*sizeof(GF_ELEMENT));
         memcpy(dec_ctx->message[pivot], pkt->syms,  pktsize*sizeof(GF_ELEMENT));
+        // the row is in banded form starting from the pivot
+        int band_width = numpp-pivot > gensize ? gensize : numpp-pivot;
+        nz_pattern_add_row(dec_ctx->pattern, pivot, dec_ctx->coefficient[pivot], pivot, pivot+band_width);
         dec_ctx->DoF += 1;
      }
 
@@ -178,27 +196,58 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
     }
     // If the number of received DoF is equal to NUM_SRC, apply the parity-check matrix.
     // The messages corresponding to rows of parity-check matrix are all-zero.
+    // The work is left to resume_decoding_BD().
     if (dec_ctx->de_precode == 0 && dec_ctx->DoF == dec_ctx->sc->snum) {
         if (get_loglevel() == TRACE)
             printf("Start to apply the parity-check matrix...\n");
-        int allzeros = partially_diag_decoding_matrix(dec_ctx);
-        if (get_loglevel() == TRACE)
-            printf("%d all-zero rows when partially diagonalizing the decoding matrix.\n", allzeros);
-        int missing_DoF = apply_parity_check_matrix(dec_ctx);
-        if (get_loglevel() == TRACE)
-            printf("After applying the parity-check matrix, %d DoF are missing.\n", missing_DoF);
-        dec_ctx->DoF = numpp - missing_DoF;
-        dec_ctx->de_precode = 1;
-    }
-
-    if (dec_ctx->DoF == dec_ctx->sc->snum + dec_ctx->sc->cnum) {
-        finish_recovering_BD(dec_ctx);
+        dec_ctx->fin.stage = BD_DIAG;
+        dec_ctx->fin.pos   = numpp - 1;
+    } else if (dec_ctx->de_precode == 1 && dec_ctx->DoF == numpp) {
+        dec_ctx->fin.stage = BD_BACKSUB;
+        dec_ctx->fin.pos   = numpp - 1;
     }
 
     free(ces);
     ces = NULL;
 }
 
+int resume_decoding_BD(struct decoding_context_BD *dec_ctx, long long budget)
+{
+    int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    long long ops;
+    int missing;
+    dec_ctx->fin.work = 0;
+    while (dec_ctx->fin.stage != FINISH_IDLE && dec_ctx->fin.work < budget) {
+        switch (dec_ctx->fin.stage) {
+        case BD_DIAG:
+            if (partially_diag_decoding_matrix(dec_ctx, budget) == 0)
+                dec_ctx->fin.stage = BD_PRECODE;
+            break;
+        case BD_PRECODE:
+            apply_parity_check_matrix(dec_ctx);
+            dec_ctx->fin.stage = BD_PIVOT;
+            break;
+        case BD_PIVOT:
+            ops = dec_ctx->operations;
+            missing = pivot_decoding_matrix(dec_ctx);
+            if (missing < 0)
+                return 1;
+            dec_ctx->DoF = numpp - missing;
+            dec_ctx->fin.work += dec_ctx->operations - ops;
+            dec_ctx->de_precode = 1;
+            if (get_loglevel() == TRACE)
+                printf("After applying the parity-check matrix, %d DoF are missing.\n", numpp - dec_ctx->DoF);
+            dec_ctx->fin.stage = dec_ctx->DoF == numpp ? BD_BACKSUB : FINISH_IDLE;
+            dec_ctx->fin.pos   = numpp - 1;
+            break;
+        default:
+            finish_recovering_BD(dec_ctx, budget);
+            break;
+        }
+    }
+    return dec_ctx->fin.stage != FINISH_IDLE;
+}
+
 /*
  * Partially diagonalize the upper-trianguler decoding matrix,
  * i.e., remove nonzero elements above nonzero diagonal elements:
@@ -211,11 +260,12 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
  *   |          o o |      |           o o |
  *   |            x |      |             x |
  *
+ * Columns are processed from fin.pos to the left until about budget
+ * operations are done in the slice. Return the number of columns left.
  */
-static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx)
+static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx, long long budget)
 {
     int         i, j, l;
-    int         nonzero_rows = 0;
     GF_ELEMENT  quotient;
     long long   operations = 0;
 
@@ -227,7 +277,18 @@ static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx)
     int *zeropivots = (int *) malloc( sizeof(int) * zero_size );    // store indices of columns where the diagonal element is zero
     int zero_p      = 0;                                        // indicate how many zero pivots have been identified
 
-    for (j=numpp-1; j>=0; j--) {
+    // Columns on the right, processed by previous slices, whose diagonal
+    // elements are zero (in the order they were identified)
+    for (j=numpp-1; j>dec_ctx->fin.pos; j--) {
+        if (dec_ctx->coefficient[j][j] == 0) {
+            if (zero_p == zero_size) {
+                zeropivots = (int *) realloc(zeropivots, sizeof(int) * (zero_size + 5));
+                zero_size += 5;
+            }
+            zeropivots[zero_p++] = j;
+        }
+    }
+    for (j=dec_ctx->fin.pos; j>=0 && dec_ctx->fin.work+operations<budget; j--) {
         if (dec_ctx->coefficient[j][j] == 0) {
             if (zero_p == zero_size) {
                 zeropivots = (int *) realloc(zeropivots, sizeof(int) * (zero_size + 5));
@@ -236,7 +297,6 @@ static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx)
             zeropivots[zero_p++] = j;
             continue;
         } else {
-            nonzero_rows += 1;
             int start_row = j-gensize > 0 ? j-gensize : 0;      // the upper triangular form is also in banded form, so no need to go through all rows
             for (i=start_row; i<j; i++) {
                 if (dec_ctx->coefficient[i][j] == 0)
@@ -249,6 +309,8 @@ static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx)
                 for (int z=0; z<zero_p; z++) {
                     l = zeropivots[z];
                     if (dec_ctx->coefficient[j][l] != 0) {
+                        if (dec_ctx->coefficient[i][l] == 0)
+                            nz_pattern_add(dec_ctx->pattern, i, l);
                         dec_ctx->coefficient[i][l] = galois_add(dec_ctx->coefficient[i][l], galois_multiply(dec_ctx->coefficient[j][l], quotient));
                         operations += 1;
                     }
@@ -261,16 +323,17 @@ static int partially_diag_decoding_matrix(struct decoding_context_BD *dec_ctx)
     }
     free(zeropivots);
     dec_ctx->operations += operations;
-    return (numpp-nonzero_rows);
+    dec_ctx->fin.work += operations;
+    dec_ctx->fin.pos = j;
+    if (j < 0 && get_loglevel() == TRACE)
+        printf("%d all-zero rows when partially diagonalizing the decoding matrix.\n", zero_p);
+    return (j+1);
 }
 
-// Apply the parity-check matrix to the decoding matrix; pivot, re-order and try to jointly decode
-static int apply_parity_check_matrix(struct decoding_context_BD *dec_ctx)
+// Apply the parity-check matrix to the decoding matrix
+static void apply_parity_check_matrix(struct decoding_context_BD *dec_ctx)
 {
-    int i, j, k;
-    int num_of_new_DoF = 0;
-
-    int gensize = dec_ctx->sc->params.size_g;
+    int i;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
@@ -282,21 +345,45 @@ static int apply_parity_check_matrix(struct decoding_context_BD *dec_ctx)
             NBR_node *varnode = dec_ctx->sc->graph->l_nbrs_of_r[p]->first;
             while (varnode != NULL) {
                 dec_ctx->coefficient[i][varnode->data] = varnode->ce;
+                nz_pattern_add(dec_ctx->pattern, i, varnode->data);
                 varnode = varnode->next;
             }
             dec_ctx->coefficient[i][dec_ctx->sc->snum+p] = 1;
+            nz_pattern_add(dec_ctx->pattern, i, dec_ctx->sc->snum+p);
             p++;
             memset(dec_ctx->message[i], 0, sizeof(GF_ELEMENT)*pktsize);         // parity-check vector corresponds to all-zero message
         }
     }
+}
+
+/*
+ * Pivot and re-order the decoding matrix to jointly decode it with the
+ * parity-check rows.
+ * Return the number of missing DoF, or -1 if pivoting failed for lack of
+ * memory (the matrix is left as it was).
+ */
+static int pivot_decoding_matrix(struct decoding_context_BD *dec_ctx)
+{
+    static char fname[] = "pivot_decoding_matrix";
+    int i;
+    int pktsize = dec_ctx->sc->params.size_p;
+    int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    long ops;
 
-    // 2, Pivot and re-order matrices
     if (getenv("SNC_BD_ONEROUND") != NULL 
          && atoi(getenv("SNC_BD_ONEROUND")) == 1) {
-        dec_ctx->operations += pivot_matrix_oneround(numpp, numpp, pktsize, dec_ctx->coefficient, dec_ctx->message, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactivated));
+        ops = pivot_matrix_oneround(numpp, numpp, pktsize, dec_ctx->coefficient, dec_ctx->message, dec_ctx->pattern, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactivated));
     } else {
-        dec_ctx->operations += pivot_matrix_tworound(numpp, numpp, pktsize, dec_ctx->coefficient, dec_ctx->message, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactivated));
+        ops = pivot_matrix_tworound(numpp, numpp, pktsize, dec_ctx->coefficient, dec_ctx->message, dec_ctx->pattern, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactivated));
+    }
+    if (ops < 0) {
+        fprintf(stderr, "%s: pivoting failed, to be retried\n", fname);
+        return -1;
     }
+    dec_ctx->operations += ops;
+    // The pattern is not maintained after pivoting
+    free_nz_pattern(dec_ctx->pattern);
+    dec_ctx->pattern = NULL;
 
     /* Count available innovative rows */
     int missing_DoF = 0;
@@ -310,179 +397,219 @@ static int apply_parity_check_matrix(struct decoding_context_BD *dec_ctx)
 }
 
 
-// recover decoded packets after NUM_SRC DoF has been received
-static void finish_recovering_BD(struct decoding_context_BD *dec_ctx)
+/*
+ * Recover decoded packets once the decoding matrix is full rank, from
+ * stage fin.stage and unit fin.pos until about budget operations are done
+ * in the slice.
+ * Return 1 if work remains pending, 0 otherwise.
+ */
+static int finish_recovering_BD(struct decoding_context_BD *dec_ctx, long long budget)
 {
-    int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-    int i, j, k;
+    int i, j;
     GF_ELEMENT quotient;
-    long long bs_ops = 0;
-    // Backard substitution from right-most col to the left
-    for (j=numpp-1; j>=0; j--) {
-        for (i=0; i<j; i++) {
-            if (dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] != 0) {
-                quotient = galois_divide(dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]], dec_ctx->coefficient[dec_ctx->ctoo_r[j]][dec_ctx->ctoo_c[j]]);
-                galois_multiply_add_region(dec_ctx->message[dec_ctx->ctoo_r[i]], dec_ctx->message[dec_ctx->ctoo_r[j]], quotient, pktsize);
-                dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] = 0;
-                bs_ops += 1 + pktsize;
+    struct finish_state *fin = &dec_ctx->fin;
+    if (fin->stage == BD_BACKSUB) {
+        // rows to be substituted by the same pivot row, and their multipliers
+        GF_ELEMENT **dsts = dec_ctx->dsts;
+        GF_ELEMENT *qs = dec_ctx->qs;
+        int ndst;
+        // Backard substitution from right-most col to the left
+        for (j=fin->pos; j>=0 && fin->work<budget; j--) {
+            ndst = 0;
+            for (i=0; i<j; i++) {
+                if (dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] != 0) {
+                    quotient = galois_divide(dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]], dec_ctx->coefficient[dec_ctx->ctoo_r[j]][dec_ctx->ctoo_c[j]]);
+                    if (dec_ctx->sched != NULL
+                        && append_linear_op(dec_ctx->sched, dec_ctx->ctoo_r[i], dec_ctx->ctoo_r[j], quotient) < 0) {
+                        stop_striping_BD(dec_ctx);
+                        ndst = 0;   // rows gathered so far are substituted already
+                    }
+                    dsts[ndst] = dec_ctx->message[dec_ctx->ctoo_r[i]];
+                    qs[ndst++] = quotient;
+                    dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] = 0;
+                    dec_ctx->operations += 1 + pktsize;
+                    fin->work += 1 + pktsize;
+                }
             }
+            if (dec_ctx->sched == NULL && ndst != 0)
+                galois_multiply_add_region_multi(dsts, dec_ctx->message[dec_ctx->ctoo_r[j]], qs, ndst, pktsize);
         }
+        fin->pos = j;
+        if (j >= 0)
+            return 1;
+        fin->stage = BD_NORMALIZE;
+        fin->pos = 0;
     }
-    // Convert all diagonal element to 1
-    for (i=0; i<numpp; i++) {
-        if (dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]] != 1)
-            galois_multiply_region(dec_ctx->message[dec_ctx->ctoo_r[i]], galois_divide(1, dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]]), pktsize);
-        dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]] = 1;
+    if (fin->stage == BD_NORMALIZE) {
+        // Convert all diagonal element to 1
+        for (i=fin->pos; i<numpp && fin->work<budget; i++) {
+            if (dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]] != 1) {
+                GF_ELEMENT inv = galois_divide(1, dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]]);
+                if (dec_ctx->sched != NULL
+                    && append_linear_op(dec_ctx->sched, dec_ctx->ctoo_r[i], -1, inv) < 0)
+                    stop_striping_BD(dec_ctx);
+                if (dec_ctx->sched == NULL)
+                    galois_multiply_region(dec_ctx->message[dec_ctx->ctoo_r[i]], inv, pktsize);
+            }
+            dec_ctx->coefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]] = 1;
+            fin->work += pktsize;
+        }
+        fin->pos = i;
+        if (i < numpp)
+            return 1;
+        fin->stage = BD_SCHEDULE;
+    }
+    if (fin->stage == BD_SCHEDULE) {
+        /* carry out recorded message operations by striped payload workers */
+        if (dec_ctx->sched != NULL) {
+            fin->work += (long long) dec_ctx->sched->nops * pktsize;
+            apply_op_schedule(dec_ctx->sched, dec_ctx->message, pktsize);
+        }
+        fin->stage = BD_SAVE;
+        fin->pos = 0;
+        if (fin->work >= budget)
+            return 1;
+    }
+    for (i=fin->pos; i<numpp && fin->work<budget; i++) {
         int pktid = dec_ctx->ctoo_c[i];
-        dec_ctx->sc->pp[pktid] = calloc(pktsize, sizeof(GF_ELEMENT));
+        dec_ctx->sc->pp[pktid] = alloc_decoded(dec_ctx->sc, pktid);
         memcpy(dec_ctx->sc->pp[pktid], dec_ctx->message[dec_ctx->ctoo_r[i]], pktsize*sizeof(GF_ELEMENT));
+        fin->work += pktsize;
     }
-    dec_ctx->operations += bs_ops;
+    fin->pos = i;
+    if (i < numpp)
+        return 1;
+    fin->stage = FINISH_IDLE;
     dec_ctx->finished = 1;
+    return 0;
+}
+
+/*
+ * Stop payload striping after an operation cannot be recorded: carry out
+ * the operations recorded so far and let later operations be applied to
+ * messages directly, so that none is lost.
+ */
+static void stop_striping_BD(struct decoding_context_BD *dec_ctx)
+{
+    static char fname[] = "stop_striping_BD";
+    fprintf(stderr, "%s: cannot record message operations, decoding without payload striping\n", fname);
+    apply_op_schedule(dec_ctx->sched, dec_ctx->message, dec_ctx->sc->params.size_p);
+    free_op_schedule(dec_ctx->sched);
+    dec_ctx->sched = NULL;
 }
 
 void free_dec_context_BD(struct decoding_context_BD *dec_ctx)
 {
     if (dec_ctx == NULL)
         return;
-    if (dec_ctx->sc != NULL)
-        snc_free_enc_context(dec_ctx->sc);
-    if (dec_ctx->coefficient != NULL) {
-        for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
-            if (dec_ctx->coefficient[i] != NULL)
-                free(dec_ctx->coefficient[i]);
-        }
-        free(dec_ctx->coefficient);
-    }
-    if (dec_ctx->message != NULL) {
-        for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
-            if (dec_ctx->message[i] != NULL)
-                free(dec_ctx->message[i]);
-        }
-        free(dec_ctx->message);
-    }
+    free_matrix(dec_ctx->coefficient);
+    free_matrix(dec_ctx->message);
     if (dec_ctx->ctoo_r != NULL)
         free(dec_ctx->ctoo_r);
     if (dec_ctx->ctoo_c != NULL)
         free(dec_ctx->ctoo_c);
     if (dec_ctx->overheads != NULL)
         free(dec_ctx->overheads);
+    if (dec_ctx->sched != NULL)
+        free_op_schedule(dec_ctx->sched);
+    if (dec_ctx->pattern != NULL)
+        free_nz_pattern(dec_ctx->pattern);
+    free(dec_ctx->dsts);
+    free(dec_ctx->qs);
+    if (dec_ctx->sc != NULL)
+        snc_free_enc_context(dec_ctx->sc);
     free(dec_ctx);
     dec_ctx = NULL;
     return;
 }
 
-/**
- * Save a decoding context to a file
- * Return values:
- *   On success: bytes written
- *   On error: -1
+/*
+ * Save a decoding context to a checkpoint. Before the precode is applied,
+ * rows of received DoFs are saved from their diagonal elements (at most
+ * size_g elements each); afterwards the pivoted matrix is saved in sparse
+ * form along with the pivoting order.
  */
-long save_dec_context_BD(struct decoding_context_BD *dec_ctx, const char *filepath)
+void save_dec_context_BD(struct decoding_context_BD *dec_ctx, struct ckpt_writer *w)
 {
-    long filesize = 0;
-    int d_type = BD_DECODER;
-    FILE *fp;
-    if ((fp = fopen(filepath, "w")) == NULL) {
-        fprintf(stderr, "Cannot open %s to save decoding context\n", filepath);
-        return (-1);
-    }
-    int i, j;
+    int i;
     int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-    // Write snc params
-    filesize += fwrite(&dec_ctx->sc->params, sizeof(struct snc_parameters), 1, fp);
-    // Write decoder type
-    filesize += fwrite(&(d_type), sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->finished, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->DoF, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->de_precode, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->inactivated, sizeof(int), 1, fp);
+    ckpt_put_int(w, dec_ctx->finished);
+    ckpt_put_int(w, dec_ctx->DoF);
+    ckpt_put_int(w, dec_ctx->de_precode);
+    ckpt_put_int(w, dec_ctx->inactivated);
     // Save running matrices
     if (dec_ctx->de_precode == 0) {
         // Parity-check packets are not applied yet
         int count = 0;
-        int len;
-        i = 0;
-        while (count != dec_ctx->DoF) {
+        for (i=0; i<numpp && count<dec_ctx->DoF; i++) {
             if (dec_ctx->coefficient[i][i] != 0) {
-                filesize += fwrite(&i, sizeof(int), 1, fp);
-                len = numpp -i < gensize ? numpp - i : gensize;
-                filesize += fwrite(&len, sizeof(int), 1, fp);
-                filesize += fwrite(&(dec_ctx->coefficient[i][i]), sizeof(GF_ELEMENT), len, fp);
-                filesize += fwrite(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
+                int len = numpp - i < gensize ? numpp - i : gensize;
+                ckpt_put_int(w, i);
+                ckpt_put_row(w, &(dec_ctx->coefficient[i][i]), len);
+                ckpt_put_payload(w, dec_ctx->message[i]);
                 count++;
             }
-            i++;
         }
     } else {
         // Save the pivoted decoding matrix
-        // Fixme: save space by making use of the sparse structure
         for (i=0; i<numpp; i++) {
-            filesize += fwrite(dec_ctx->coefficient[i], sizeof(GF_ELEMENT), numpp, fp);
-            filesize += fwrite(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
+            ckpt_put_row(w, dec_ctx->coefficient[i], numpp);
+            ckpt_put_payload(w, dec_ctx->message[i]);
         }
-        filesize += fwrite(dec_ctx->ctoo_r, sizeof(int), numpp, fp);
-        filesize += fwrite(dec_ctx->ctoo_c, sizeof(int), numpp, fp);
+        ckpt_put(w, dec_ctx->ctoo_r, sizeof(int)*numpp);
+        ckpt_put(w, dec_ctx->ctoo_c, sizeof(int)*numpp);
     }
     // Save performance index
-    filesize += fwrite(&dec_ctx->overhead, sizeof(int), 1, fp);
-    filesize += fwrite(dec_ctx->overheads, sizeof(int), dec_ctx->sc->gnum, fp);
-    filesize += fwrite(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
-    return filesize;
+    ckpt_put_int(w, dec_ctx->overhead);
+    ckpt_put(w, dec_ctx->overheads, sizeof(int)*dec_ctx->sc->gnum);
+    ckpt_put(w, &dec_ctx->operations, sizeof(long long));
 }
 
-
-struct decoding_context_BD *restore_dec_context_BD(const char *filepath)
+struct decoding_context_BD *restore_dec_context_BD(struct ckpt_reader *r, struct snc_parameters *sp)
 {
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
-        return NULL;
-    }
-    struct snc_parameters sp;
-    fread(&sp, sizeof(struct snc_parameters), 1, fp);
-    fseek(fp, sizeof(int), SEEK_CUR);  // skip decoding_type field
     // Create a fresh decoding context
-    struct decoding_context_BD *dec_ctx = create_dec_context_BD(&sp);
+    struct decoding_context_BD *dec_ctx = create_dec_context_BD(sp);
     if (dec_ctx == NULL) {
-        fprintf(stderr, "malloc decoding_context_GG failed\n");
+        fprintf(stderr, "malloc decoding_context_BD failed\n");
         return NULL;
     }
-    // Restore decoding context from file
-    int i, j;
-    fread(&dec_ctx->finished, sizeof(int), 1, fp);
-    fread(&dec_ctx->DoF, sizeof(int), 1, fp);
-    fread(&dec_ctx->de_precode, sizeof(int), 1, fp);
-    fread(&dec_ctx->inactivated, sizeof(int), 1, fp);
+    // Restore decoding context from checkpoint
+    int i;
+    int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    dec_ctx->finished    = ckpt_get_int(r);
+    dec_ctx->DoF         = ckpt_get_int(r);
+    dec_ctx->de_precode  = ckpt_get_int(r);
+    dec_ctx->inactivated = ckpt_get_int(r);
     // Restore running matrices
     if (dec_ctx->de_precode == 0) {
-        int count = 0;
-        int pivot, len;
-        while (count != dec_ctx->DoF) {
-           fread(&pivot, sizeof(int), 1, fp);
-           fread(&len, sizeof(int), 1, fp);
-           fread(&(dec_ctx->coefficient[pivot][pivot]), sizeof(GF_ELEMENT), len, fp);
-           fread(dec_ctx->message[pivot], sizeof(GF_ELEMENT), sp.size_p, fp);
-           count++;
+        for (i=0; i<dec_ctx->DoF; i++) {
+            int pivot = ckpt_get_int(r);
+            if (pivot < 0 || pivot >= numpp)
+                goto Corrupted;
+            int len = ckpt_get_row(r, &(dec_ctx->coefficient[pivot][pivot]), numpp-pivot);
+            ckpt_copy_payload(r, dec_ctx->message[pivot]);
+            nz_pattern_add_row(dec_ctx->pattern, pivot, dec_ctx->coefficient[pivot], pivot, pivot+len);
         }
     } else {
-        int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
         for (i=0; i<numpp; i++) {
-            fread(dec_ctx->coefficient[i], sizeof(GF_ELEMENT), numpp, fp);
-            fread(dec_ctx->message[i], sizeof(GF_ELEMENT), numpp, fp);
+            ckpt_get_row(r, dec_ctx->coefficient[i], numpp);
+            ckpt_copy_payload(r, dec_ctx->message[i]);
         }
-        fread(dec_ctx->ctoo_r, sizeof(int), numpp, fp);
-        fread(dec_ctx->ctoo_c, sizeof(int), numpp, fp);
+        ckpt_get(r, dec_ctx->ctoo_r, sizeof(int)*numpp);
+        ckpt_get(r, dec_ctx->ctoo_c, sizeof(int)*numpp);
+        free_nz_pattern(dec_ctx->pattern);
+        dec_ctx->pattern = NULL;
     }
     // Restore performance index
-    fread(&dec_ctx->overhead, sizeof(int), 1, fp);
-    fread(dec_ctx->overheads, sizeof(int), dec_ctx->sc->gnum, fp);
-    fread(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
+    dec_ctx->overhead = ckpt_get_int(r);
+    ckpt_get(r, dec_ctx->overheads, sizeof(int)*dec_ctx->sc->gnum);
+    ckpt_get(r, &dec_ctx->operations, sizeof(long long));
     return dec_ctx;
+
+Corrupted:
+    free_dec_context_BD(dec_ctx);
+    return NULL;
 }
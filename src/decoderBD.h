@@ -15,11 +15,17 @@ struct decoding_context_BD
     // decoding matrix
     GF_ELEMENT **coefficient;   //[NUM_PP][NUM_PP];
     GF_ELEMENT **message;       //[NUM_PP][EXT_N];
+    struct op_schedule *sched;  // deferred message row operations (payload striping), or NULL
+    struct nz_pattern *pattern; // nonzero pattern of coefficient, NULL once pivoted
+    GF_ELEMENT **dsts;          // scratch of back substitution: rows substituted by
+    GF_ELEMENT *qs;             // the same pivot row, and their multipliers
 
     // the following two mappings are to record pivoting processings
     int *ctoo_r;                // record the mapping from current row index to the original row id
     int *ctoo_c;                // record the mapping from current col index to the original row id
 
+    struct finish_state fin;    // pending completion work (see resume_decoding_BD())
+
     /*performance index*/
     int overhead;               // record how many packets have been received
     int *overheads;             // record how many packets have been received
@@ -31,12 +37,17 @@ void process_packet_BD(struct decoding_context_BD *dec_ctx, struct snc_packet *p
 void free_dec_context_BD(struct decoding_context_BD *dec_ctx);
 
 /**
- * File format to store ongoing decoding context
- *
- * snc_parameter
- * decoder_type
- * decoding_context_BD (excluding snc_context)
- *
+ * Run pending completion work of the decoder (triggered by process_packet_BD)
+ * until about budget operations are used up.
+ * Return 1 if work remains pending, 0 otherwise.
+ */
+int resume_decoding_BD(struct decoding_context_BD *dec_ctx, long long budget);
+
+/**
+ * Save/restore ongoing decoding context to/from a checkpoint
+ * (see checkpoint.c for the file format)
  */
-long save_dec_context_BD(struct decoding_context_BD *dec_ctx, const char *filepath);
-struct decoding_context_BD *restore_dec_context_BD(const char *filepath);
+struct ckpt_writer;
+struct ckpt_reader;
+void save_dec_context_BD(struct decoding_context_BD *dec_ctx, struct ckpt_writer *w);
+struct decoding_context_BD *restore_dec_context_BD(struct ckpt_reader *r, struct snc_parameters *sp);
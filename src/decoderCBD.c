@@ -13,14 +13,25 @@
 #include "galois.h"
 #include "decoderCBD.h"
 static int process_vector_CBD(struct decoding_context_CBD *dec_ctx, GF_ELEMENT *vector, GF_ELEMENT *message);
-static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx);
-static void finish_recovering_CBD(struct decoding_context_CBD *dec_ctx);
+static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx, long long budget);
+static int finish_recovering_CBD(struct decoding_context_CBD *dec_ctx, long long budget);
+static void stop_striping_CBD(struct decoding_context_CBD *dec_ctx, GF_ELEMENT *message, int firstop);
+
+/*
+ * Stages of the completion work. Parity-check vectors are applied one
+ * at a time, back substitution proceeds one column at a time, and
+ * decoded packets are saved one at a time.
+ */
+#define CBD_PRECODE     1   // apply the parity-check matrix
+#define CBD_BACKSUB     2   // back substitution
+#define CBD_SCHEDULE    3   // replay deferred message operations
+#define CBD_SAVE        4   // copy decoded packets to sc->pp
 
 // create decoding context for band decoder
 struct decoding_context_CBD *create_dec_context_CBD(struct snc_parameters *sp)
 {
     static char fname[] = "snc_create_dec_context_CBD";
-    int i, j, k;
+    int j, k;
 
     // GNC code context
     // Since this is decoding, we construct GNC context without data
@@ -49,6 +60,12 @@ struct decoding_context_CBD *create_dec_context_CBD(struct snc_parameters *sp)
     dec_ctx->DoF          = 0;
     dec_ctx->de_precode   = 0;
     dec_ctx->naive        = niv;
+    dec_ctx->row          = NULL;
+    dec_ctx->message      = NULL;
+    dec_ctx->sched        = NULL;
+    dec_ctx->dsts         = NULL;
+    dec_ctx->qs           = NULL;
+    dec_ctx->fin.stage    = FINISH_IDLE;
 
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
@@ -59,17 +76,25 @@ struct decoding_context_CBD *create_dec_context_CBD(struct snc_parameters *sp)
         fprintf(stderr, "%s: calloc dec_ctx->row failed\n", fname);
         goto AllocError;
     }
-    dec_ctx->message = calloc(numpp, sizeof(GF_ELEMENT*));
+    dec_ctx->message = create_matrix(numpp, pktsize);
     if (dec_ctx->message == NULL) {
-        fprintf(stderr, "%s: calloc dec_ctx->message failed\n", fname);
+        fprintf(stderr, "%s: create_matrix dec_ctx->message failed\n", fname);
         goto AllocError;
     }
-    for (i=0; i<numpp; i++) {
-        dec_ctx->message[i] = calloc(pktsize, sizeof(GF_ELEMENT));
-        if (dec_ctx->message[i] == NULL) {
-            fprintf(stderr, "%s: calloc dec_ctx->message[%d] failed\n", fname, i);
-            goto AllocError;
-        }
+    // Allocated once rather than per slice of stepped back substitution
+    dec_ctx->dsts = malloc(sizeof(GF_ELEMENT*) * numpp);
+    dec_ctx->qs   = malloc(sizeof(GF_ELEMENT) * numpp);
+    if (dec_ctx->dsts == NULL || dec_ctx->qs == NULL) {
+        fprintf(stderr, "%s: malloc back substitution scratch failed\n", fname);
+        goto AllocError;
+    }
+
+    // Defer message operations to striped payload workers if requested
+    dec_ctx->sched = NULL;
+    int nthreads = get_payload_threads();
+    if (nthreads != 0 && (dec_ctx->sched = create_op_schedule(nthreads)) == NULL) {
+        fprintf(stderr, "%s: create_op_schedule failed\n", fname);
+        goto AllocError;
     }
 
     dec_ctx->overhead     = 0;
@@ -92,10 +117,9 @@ void process_packet_CBD(struct decoding_context_CBD *dec_ctx, struct snc_packet
 {
     static char fname[] = "snc_process_packet_CBD";
     dec_ctx->overhead += 1;
-    int i, j, k;
+    int j, k;
     GF_ELEMENT quotient;
 
-    int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
@@ -109,14 +133,7 @@ void process_packet_CBD(struct decoding_context_CBD *dec_ctx, struct snc_packet
         ces[pkt->ucid] = 1;
     } else {
         // This is normal GNC packet
-        for (i=0; i<gensize; i++) {
-            int index = dec_ctx->sc->gene[pkt->gid]->pktid[i];
-            if (dec_ctx->sc->params.bnc) {
-                ces[index] = get_bit_in_array(pkt->coes, i);
-            } else {
-                ces[index] = pkt->coes[i];
-            }
-        }
+        expand_coes(dec_ctx->sc, pkt->gid, pkt->coes, ces);
     }
 
     /* Process full-length encoding vector against decoding matrix */
@@ -128,17 +145,36 @@ void process_packet_CBD(struct decoding_context_CBD *dec_ctx, struct snc_packet
         printf("received %d DoF: %d\n", dec_ctx->overhead, dec_ctx->DoF-lastDoF);
     // If the number of received DoF is equal to NUM_SRC, apply the parity-check matrix.
     // The messages corresponding to rows of parity-check matrix are all-zero.
-    if (dec_ctx->DoF == dec_ctx->sc->snum) {
+    // The work is left to resume_decoding_CBD().
+    if (dec_ctx->de_precode == 0 && dec_ctx->DoF == dec_ctx->sc->snum) {
         dec_ctx->de_precode = 1;    /*Mark de_precode before applying precode matrix*/
-        int missing_DoF = apply_parity_check_matrix(dec_ctx);
-        if (get_loglevel() == TRACE)
-            printf("After applying the parity-check matrix, %d DoF are missing.\n", missing_DoF);
-        dec_ctx->DoF = numpp - missing_DoF;
+        dec_ctx->fin.stage = CBD_PRECODE;
+        dec_ctx->fin.pos   = 0;
+    } else if (dec_ctx->de_precode == 1 && dec_ctx->DoF == numpp) {
+        dec_ctx->fin.stage = CBD_BACKSUB;
+        dec_ctx->fin.pos   = numpp - 1;
     }
+}
 
-    if (dec_ctx->DoF == dec_ctx->sc->snum + dec_ctx->sc->cnum) {
-        finish_recovering_CBD(dec_ctx);
+int resume_decoding_CBD(struct decoding_context_CBD *dec_ctx, long long budget)
+{
+    int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    dec_ctx->fin.work = 0;
+    while (dec_ctx->fin.stage != FINISH_IDLE && dec_ctx->fin.work < budget) {
+        if (dec_ctx->fin.stage == CBD_PRECODE) {
+            int missing_DoF = apply_parity_check_matrix(dec_ctx, budget);
+            if (missing_DoF == -1)
+                continue;
+            if (get_loglevel() == TRACE)
+                printf("After applying the parity-check matrix, %d DoF are missing.\n", missing_DoF);
+            dec_ctx->DoF = numpp - missing_DoF;
+            dec_ctx->fin.stage = dec_ctx->DoF == numpp ? CBD_BACKSUB : FINISH_IDLE;
+            dec_ctx->fin.pos   = numpp - 1;
+        } else {
+            finish_recovering_CBD(dec_ctx, budget);
+        }
     }
+    return dec_ctx->fin.stage != FINISH_IDLE;
 }
 
 /* Process a full row vector against CBD decoding matrix */
@@ -155,14 +191,21 @@ static int process_vector_CBD(struct decoding_context_CBD *dec_ctx, GF_ELEMENT *
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
     int rowop = 0;
+    // In payload striping mode, message operations are recorded with a
+    // yet unknown destination, which becomes the pivot of the vector
+    int firstop = dec_ctx->sched != NULL ? dec_ctx->sched->nops : 0;
     for (i=0; i<numpp; i++) {
         if (vector[i] != 0) {
             if (dec_ctx->row[i] != NULL) {
                 /* There is a valid row saved for pivot-i, process against it */
                 assert(dec_ctx->row[i]->elem[0]);
                 quotient = galois_divide(vector[i], dec_ctx->row[i]->elem[0]);
-                galois_multiply_add_region(&(vector[i]), dec_ctx->row[i]->elem, quotient, dec_ctx->row[i]->len);
-                galois_multiply_add_region(message, dec_ctx->message[i], quotient, pktsize);
+                galois_multiply_add_region_short(&(vector[i]), dec_ctx->row[i]->elem, quotient, dec_ctx->row[i]->len);
+                if (dec_ctx->sched != NULL
+                    && append_linear_op(dec_ctx->sched, -1, i, quotient) < 0)
+                    stop_striping_CBD(dec_ctx, message, firstop);
+                if (dec_ctx->sched == NULL)
+                    galois_multiply_add_region(message, dec_ctx->message[i], quotient, pktsize);
                 dec_ctx->operations += 1 + dec_ctx->row[i]->len + pktsize;
                 if (!dec_ctx->de_precode) {
                     dec_ctx->ops1 += 1 + dec_ctx->row[i]->len + pktsize;
@@ -198,15 +241,26 @@ static int process_vector_CBD(struct decoding_context_CBD *dec_ctx, GF_ELEMENT *
         memcpy(dec_ctx->row[pivot]->elem, &(vector[pivot]), len*sizeof(GF_ELEMENT));
         assert(dec_ctx->row[pivot]->elem[0]);
         memcpy(dec_ctx->message[pivot], message,  pktsize*sizeof(GF_ELEMENT));
+        if (dec_ctx->sched != NULL) {
+            for (i=firstop; i<dec_ctx->sched->nops; i++)
+                dec_ctx->sched->ops[i].dst = pivot;
+        }
         if (get_loglevel() == TRACE) 
             printf("received-DoF %d new-DoF %d row_ops: %d\n", dec_ctx->DoF, pivot, rowop);
         dec_ctx->DoF += 1;
+    } else if (dec_ctx->sched != NULL) {
+        /* Non-innovative vector, its message operations are not needed */
+        dec_ctx->sched->nops = firstop;
     }
     return pivot;
 }
 
-// Apply the parity-check matrix to the decoding matrix
-static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx)
+/*
+ * Apply the parity-check matrix to the decoding matrix, from the fin.pos-th
+ * parity-check vector on until about budget operations are done in the slice.
+ * Return the number of missing DoF, or -1 if vectors are left to apply.
+ */
+static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx, long long budget)
 {
     static char fname[] = "apply_parity_check_matrix";
     int i, j, k;
@@ -219,8 +273,9 @@ static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx)
     // 1, Copy parity-check vectors to the nonzero rows of the decoding matrix
     GF_ELEMENT *ces = malloc(numpp*sizeof(GF_ELEMENT));
     GF_ELEMENT *msg = malloc(pktsize*sizeof(GF_ELEMENT));
-    int p = 0;          // index pointer to the parity-check vector that is to be copyed
-    for (int p=0; p<dec_ctx->sc->cnum; p++) {
+    int p;              // index pointer to the parity-check vector that is to be copyed
+    for (p=dec_ctx->fin.pos; p<dec_ctx->sc->cnum && dec_ctx->fin.work<budget; p++) {
+        long long ops = dec_ctx->operations;
         memset(ces, 0, numpp*sizeof(GF_ELEMENT));
         memset(msg, 0, pktsize*sizeof(GF_ELEMENT));
         /* Set the coding vector according to parity-check bits */
@@ -231,9 +286,13 @@ static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx)
         }
         ces[dec_ctx->sc->snum+p] = 1;
         int pivot = process_vector_CBD(dec_ctx, ces, msg);
+        dec_ctx->fin.work += dec_ctx->operations - ops + numpp;
     }
     free(ces);
     free(msg);
+    dec_ctx->fin.pos = p;
+    if (p < dec_ctx->sc->cnum)
+        return (-1);
 
     /* Count available innovative rows */
     int missing_DoF = 0;
@@ -250,40 +309,85 @@ static int apply_parity_check_matrix(struct decoding_context_CBD *dec_ctx)
 /**
  * Finish CBD decoding
  * This routine converts decoding matrix from upper triangular
- * form to diagonal.
+ * form to diagonal. It proceeds from stage fin.stage and unit fin.pos
+ * until about budget operations are done in the slice, and returns 1
+ * if work remains pending, 0 otherwise.
  */
-static void finish_recovering_CBD(struct decoding_context_CBD *dec_ctx)
+static int finish_recovering_CBD(struct decoding_context_CBD *dec_ctx, long long budget)
 {
-    int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
     int i, j;
     int len;
+    int ndst;
     GF_ELEMENT quotient;
-    for (i=numpp-1; i>=0; i--) {
-        /* eliminate all nonzeros above diagonal elements from right to left*/
-        for (j=0; j<i; j++) {
-            len = dec_ctx->row[j]->len;
-            if (j+len <= i || dec_ctx->row[j]->elem[i-j] == 0)
-                continue;
-            assert(dec_ctx->row[i]->elem[0]);
-            quotient = galois_divide(dec_ctx->row[j]->elem[i-j], dec_ctx->row[i]->elem[0]);
-            galois_multiply_add_region(dec_ctx->message[j], dec_ctx->message[i], quotient, pktsize);
-            dec_ctx->operations += (pktsize + 1);
-            dec_ctx->ops3 += (pktsize + 1);
-            dec_ctx->row[j]->elem[i-j] = 0;
+    struct finish_state *fin = &dec_ctx->fin;
+    if (fin->stage == CBD_BACKSUB) {
+        // rows to be substituted by the same pivot row, and their multipliers
+        GF_ELEMENT **dsts = dec_ctx->dsts;
+        GF_ELEMENT *qs = dec_ctx->qs;
+        for (i=fin->pos; i>=0 && fin->work<budget; i--) {
+            /* eliminate all nonzeros above diagonal elements from right to left*/
+            ndst = 0;
+            for (j=0; j<i; j++) {
+                len = dec_ctx->row[j]->len;
+                if (j+len <= i || dec_ctx->row[j]->elem[i-j] == 0)
+                    continue;
+                assert(dec_ctx->row[i]->elem[0]);
+                quotient = galois_divide(dec_ctx->row[j]->elem[i-j], dec_ctx->row[i]->elem[0]);
+                if (dec_ctx->sched != NULL
+                    && append_linear_op(dec_ctx->sched, j, i, quotient) < 0) {
+                    stop_striping_CBD(dec_ctx, NULL, dec_ctx->sched->nops);
+                    ndst = 0;   // rows gathered so far are substituted already
+                }
+                dsts[ndst] = dec_ctx->message[j];
+                qs[ndst++] = quotient;
+                dec_ctx->operations += (pktsize + 1);
+                dec_ctx->ops3 += (pktsize + 1);
+                dec_ctx->row[j]->elem[i-j] = 0;
+            }
+            if (dec_ctx->sched == NULL && ndst != 0)
+                galois_multiply_add_region_multi(dsts, dec_ctx->message[i], qs, ndst, pktsize);
+            fin->work += (long long) ndst * (pktsize + 1) + i;
+            /* convert diagonal to 1*/
+            if (dec_ctx->row[i]->elem[0] != 1) {
+                if (dec_ctx->sched != NULL
+                    && append_linear_op(dec_ctx->sched, i, -1, galois_divide(1, dec_ctx->row[i]->elem[0])) < 0)
+                    stop_striping_CBD(dec_ctx, NULL, dec_ctx->sched->nops);
+                if (dec_ctx->sched == NULL)
+                    galois_multiply_region(dec_ctx->message[i], galois_divide(1, dec_ctx->row[i]->elem[0]), pktsize);
+                dec_ctx->operations += (pktsize + 1);
+                dec_ctx->ops3 += (pktsize + 1);
+                fin->work += pktsize + 1;
+                dec_ctx->row[i]->elem[0] = 1;
+            }
         }
-        /* convert diagonal to 1*/
-        if (dec_ctx->row[i]->elem[0] != 1) {
-            galois_multiply_region(dec_ctx->message[i], galois_divide(1, dec_ctx->row[i]->elem[0]), pktsize);
-            dec_ctx->operations += (pktsize + 1);
-            dec_ctx->ops3 += (pktsize + 1);
-            dec_ctx->row[i]->elem[0] = 1;
+        fin->pos = i;
+        if (i >= 0)
+            return 1;
+        fin->stage = CBD_SCHEDULE;
+    }
+    if (fin->stage == CBD_SCHEDULE) {
+        /* carry out deferred message operations by striped payload workers */
+        if (dec_ctx->sched != NULL) {
+            fin->work += (long long) dec_ctx->sched->nops * pktsize;
+            apply_op_schedule(dec_ctx->sched, dec_ctx->message, pktsize);
         }
-        /* save decoded packet */
-        dec_ctx->sc->pp[i] = calloc(pktsize, sizeof(GF_ELEMENT));
+        fin->stage = CBD_SAVE;
+        fin->pos = 0;
+        if (fin->work >= budget)
+            return 1;
+    }
+    /* save decoded packets */
+    for (i=fin->pos; i<numpp && fin->work<budget; i++) {
+        dec_ctx->sc->pp[i] = alloc_decoded(dec_ctx->sc, i);
         memcpy(dec_ctx->sc->pp[i], dec_ctx->message[i], pktsize*sizeof(GF_ELEMENT));
+        fin->work += pktsize;
     }
+    fin->pos = i;
+    if (i < numpp)
+        return 1;
+    fin->stage = FINISH_IDLE;
     dec_ctx->finished = 1;
     if (get_loglevel() == TRACE) {
         int snum = dec_ctx->sc->snum;
@@ -291,14 +395,34 @@ static void finish_recovering_CBD(struct decoding_context_CBD *dec_ctx)
                                                   (double) dec_ctx->ops2/snum/pktsize,
                                                   (double) dec_ctx->ops3/snum/pktsize);
     }
+    return 0;
+}
+
+/*
+ * Stop payload striping after an operation cannot be recorded: carry out
+ * the operations recorded so far and let later operations be applied to
+ * messages directly, so that none is lost. Operations from the firstop-th
+ * on are those of the vector being processed, whose message is message.
+ */
+static void stop_striping_CBD(struct decoding_context_CBD *dec_ctx, GF_ELEMENT *message, int firstop)
+{
+    static char fname[] = "stop_striping_CBD";
+    struct op_schedule *sched = dec_ctx->sched;
+    int pktsize = dec_ctx->sc->params.size_p;
+    int nops = sched->nops;
+    fprintf(stderr, "%s: cannot record message operations, decoding without payload striping\n", fname);
+    sched->nops = firstop;
+    apply_op_schedule(sched, dec_ctx->message, pktsize);
+    for (int i=firstop; i<nops; i++)
+        galois_multiply_add_region(message, dec_ctx->message[sched->ops[i].src], sched->ops[i].ce, pktsize);
+    free_op_schedule(sched);
+    dec_ctx->sched = NULL;
 }
 
 void free_dec_context_CBD(struct decoding_context_CBD *dec_ctx)
 {
     if (dec_ctx == NULL)
         return;
-    if (dec_ctx->sc != NULL)
-        snc_free_enc_context(dec_ctx->sc);
     if (dec_ctx->row != NULL) {
         for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
             if (dec_ctx->row[i] != NULL) {
@@ -309,113 +433,94 @@ void free_dec_context_CBD(struct decoding_context_CBD *dec_ctx)
         }
         free(dec_ctx->row);
     }
-    if (dec_ctx->message != NULL) {
-        for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
-            if (dec_ctx->message[i] != NULL)
-                free(dec_ctx->message[i]);
-        }
-        free(dec_ctx->message);
-    }
+    free_matrix(dec_ctx->message);
+    free(dec_ctx->dsts);
+    free(dec_ctx->qs);
+    if (dec_ctx->sched != NULL)
+        free_op_schedule(dec_ctx->sched);
+    if (dec_ctx->sc != NULL)
+        snc_free_enc_context(dec_ctx->sc);
     free(dec_ctx);
     dec_ctx = NULL;
     return;
 }
 
-/**
- * Save a decoding context to a file
- * Return values:
- *   On success: bytes written
- *   On error: -1
+/*
+ * Save a decoding context to a checkpoint
  */
-long save_dec_context_CBD(struct decoding_context_CBD *dec_ctx, const char *filepath)
+void save_dec_context_CBD(struct decoding_context_CBD *dec_ctx, struct ckpt_writer *w)
 {
-    long filesize = 0;
-    int d_type = CBD_DECODER;
-    FILE *fp;
-    if ((fp = fopen(filepath, "w")) == NULL) {
-        fprintf(stderr, "Cannot open %s to save decoding context\n", filepath);
-        return (-1);
-    }
-    // Write snc params
-    filesize += fwrite(&dec_ctx->sc->params, sizeof(struct snc_parameters), 1, fp);
-    // Write decoder type
-    filesize += fwrite(&(d_type), sizeof(int), 1, fp);
-    // Write decoding context
-    filesize += fwrite(&dec_ctx->finished, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->DoF, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->de_precode, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->naive, sizeof(int), 1, fp);
+    ckpt_put_int(w, dec_ctx->finished);
+    ckpt_put_int(w, dec_ctx->DoF);
+    ckpt_put_int(w, dec_ctx->de_precode);
+    ckpt_put_int(w, dec_ctx->naive);
     // Decoder matrix rows
-    int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    // Message rows are saved with all deferred operations applied
+    if (dec_ctx->sched != NULL)
+        apply_op_schedule(dec_ctx->sched, dec_ctx->message, pktsize);
     for (int i=0; i<numpp; i++) {
-        int rowlen = dec_ctx->row[i] == NULL ? 0 : dec_ctx->row[i]->len;
-        filesize += fwrite(&rowlen, sizeof(int), 1, fp);
-        if (rowlen != 0) {
-            filesize += fwrite(dec_ctx->row[i]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-            filesize += fwrite(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
+        if (dec_ctx->row[i] == NULL) {
+            ckpt_put_int(w, -1);
+            continue;
         }
+        ckpt_put_int(w, i);
+        ckpt_put_row(w, dec_ctx->row[i]->elem, dec_ctx->row[i]->len);
+        ckpt_put_payload(w, dec_ctx->message[i]);
     }
     /*performance index*/
-    filesize += fwrite(&dec_ctx->overhead, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
-    return filesize;
+    ckpt_put_int(w, dec_ctx->overhead);
+    ckpt_put(w, &dec_ctx->operations, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops1, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops2, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops3, sizeof(long long));
 }
 
 /*
- * Restore a decoding context from a file
+ * Restore a decoding context from a checkpoint
  */
-struct decoding_context_CBD *restore_dec_context_CBD(const char *filepath)
+struct decoding_context_CBD *restore_dec_context_CBD(struct ckpt_reader *r, struct snc_parameters *sp)
 {
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
-        return NULL;
-    }
-    struct snc_parameters sp;
-    fread(&sp, sizeof(struct snc_parameters), 1, fp);
     // Create a fresh decoding context
-    struct decoding_context_CBD *dec_ctx = create_dec_context_CBD(&sp);
+    struct decoding_context_CBD *dec_ctx = create_dec_context_CBD(sp);
     if (dec_ctx == NULL) {
         fprintf(stderr, "malloc decoding_context_CBD failed\n");
         return NULL;
     }
-    // Restore decoding context from file
-    fseek(fp, sizeof(int), SEEK_CUR);  // skip decoding_type field
-
-    fread(&dec_ctx->finished, sizeof(int), 1, fp);
-    fread(&dec_ctx->DoF, sizeof(int), 1, fp);
-    fread(&dec_ctx->de_precode, sizeof(int), 1, fp);
-    fread(&dec_ctx->naive, sizeof(int), 1, fp);
+    // Restore decoding context from checkpoint
+    dec_ctx->finished   = ckpt_get_int(r);
+    dec_ctx->DoF        = ckpt_get_int(r);
+    dec_ctx->de_precode = ckpt_get_int(r);
+    dec_ctx->naive      = ckpt_get_int(r);
     // Decoder matrix rows
-    int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
     for (int i=0; i<numpp; i++) {
-        int rowlen = 0;
-        fread(&rowlen, sizeof(int), 1, fp);
-        if (rowlen != 0) {
-            // There is an non-NULL row
-            dec_ctx->row[i] = (struct row_vector*) malloc(sizeof(struct row_vector));
-            if (dec_ctx->row[i] == NULL) {
-                free_dec_context_CBD(dec_ctx);
-                return NULL;
-            }
-            dec_ctx->row[i]->len = rowlen;
-            dec_ctx->row[i]->elem = (GF_ELEMENT *) calloc(rowlen, sizeof(GF_ELEMENT));
-            if (dec_ctx->row[i]->elem == NULL) {
-                free_dec_context_CBD(dec_ctx);
-                return NULL;
-            }
-            fread(dec_ctx->row[i]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-            fread(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
-        }
+        int id = ckpt_get_int(r);
+        if (id == -1)
+            continue;       // There is no row
+        int rowlen = ckpt_peek_row_len(r);
+        if (id != i || rowlen <= 0 || rowlen > numpp)
+            goto Corrupted;
+        dec_ctx->row[i] = (struct row_vector*) malloc(sizeof(struct row_vector));
+        if (dec_ctx->row[i] == NULL)
+            goto Corrupted;
+        dec_ctx->row[i]->len = rowlen;
+        dec_ctx->row[i]->elem = (GF_ELEMENT *) calloc(rowlen, sizeof(GF_ELEMENT));
+        if (dec_ctx->row[i]->elem == NULL)
+            goto Corrupted;
+        ckpt_get_row(r, dec_ctx->row[i]->elem, rowlen);
+        ckpt_copy_payload(r, dec_ctx->message[i]);
     }
     /*performance index*/
-    fread(&dec_ctx->overhead, sizeof(int), 1, fp);
-    fread(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
+    dec_ctx->overhead = ckpt_get_int(r);
+    ckpt_get(r, &dec_ctx->operations, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops1, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops2, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops3, sizeof(long long));
     return dec_ctx;
+
+Corrupted:
+    free_dec_context_CBD(dec_ctx);
+    return NULL;
 }
@@ -19,6 +19,10 @@ struct decoding_context_CBD
     struct row_vector **row;    // NUM_PP rows for storing coefficient vectors
     // row[i] represents the i-th row starting from the diagonal element A[i][i]
     GF_ELEMENT **message;       // NUM_PP rows for storing message symbols
+    struct op_schedule *sched;  // deferred message row operations (payload striping), or NULL
+    GF_ELEMENT **dsts;          // scratch of back substitution: rows substituted by
+    GF_ELEMENT *qs;             // the same pivot row, and their multipliers
+    struct finish_state fin;    // pending completion work (see resume_decoding_CBD())
 
     /*performance index*/
     int overhead;               // record how many packets have been received
@@ -33,14 +37,18 @@ void process_packet_CBD(struct decoding_context_CBD *dec_ctx, struct snc_packet
 void free_dec_context_CBD(struct decoding_context_CBD *dec_ctx);
 
 /**
- * File format to store ongoing decoding context
- * abc.decoderCBD.part
- *
- * snc_parameter
- * decoder_type
- * decoding_context_CBD (excluding snc_context)
- *
+ * Run pending completion work of the decoder (triggered by process_packet_CBD)
+ * until about budget operations are used up.
+ * Return 1 if work remains pending, 0 otherwise.
  */
-long save_dec_context_CBD(struct decoding_context_CBD *dec_ctx, const char *filepath);
-struct decoding_context_CBD *restore_dec_context_CBD(const char *filepath);
+int resume_decoding_CBD(struct decoding_context_CBD *dec_ctx, long long budget);
+
+/**
+ * Save/restore ongoing decoding context to/from a checkpoint
+ * (see checkpoint.c for the file format)
+ */
+struct ckpt_writer;
+struct ckpt_reader;
+void save_dec_context_CBD(struct decoding_context_CBD *dec_ctx, struct ckpt_writer *w);
+struct decoding_context_CBD *restore_dec_context_CBD(struct ckpt_reader *r, struct snc_parameters *sp);
 #endif
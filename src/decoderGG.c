@@ -1,6 +1,23 @@
 /*------------------------- decoderGG.c -----------------------
  * Implementation of generation-by-generation decoding.
+ *
+ * Parallel GG decoding. Subgenerations are independent until
+ * packets decoded in one of them are masked into the others, so
+ * with SNC_GG_THREADS=n (n>=2) they are sharded in n consecutive
+ * gid ranges, each owned by a worker thread that alone processes
+ * packets of, updates and decodes its subgenerations. A packet
+ * decoded by a worker is notified through lock-free rings to the
+ * owners of the subgenerations containing it, and to a precode
+ * worker that alone runs the iterative precode decoding (i.e.,
+ * evolving check packets and their degrees). Each worker decodes
+ * with a private copy of the decoding context that shares the
+ * matrices and decoded packets, so that it has its own operation
+ * counters and recently decoded packets; decoded packets are
+ * installed with a CAS, so that a packet decoded in two places at
+ * once is notified only once.
  *-------------------------------------------------------------*/
+#include <pthread.h>
+#include <sched.h>
 #include "common.h"
 #include "galois.h"
 #include "decoderGG.h"
@@ -10,20 +27,44 @@ struct running_matrix {
     int remaining_rows;         // encoding vectors available for the matrix
     int remaining_cols;         // how many source packets remain unknown
     unsigned char *erased;      // bits indicating erased columns (known packets)
+    // Allocated with the first packet of the generation and released when
+    // it is decoded (see grab_matrix() and release_matrix()). Coefficients
+    // are in one slab (see matrix.c), while message rows are allocated one
+    // by one so that decoded rows can be moved to sc->pp.
     GF_ELEMENT **coefficient;
     GF_ELEMENT **message;
 };
 
 
 static void decode_generation(struct decoding_context_GG *dec_ctx, int gid);
-static void perform_iterative_decoding(struct decoding_context_GG *dec_ctx);
+static void perform_iterative_decoding(struct decoding_context_GG *dec_ctx, long long budget);
 static void new_decoded_source_packet(struct decoding_context_GG *dec_ctx, int pkt_id);
 static void new_decoded_check_packet(struct decoding_context_GG *dec_ctx, int pkt_id);
-static void update_generations(struct decoding_context_GG *dec_ctx);
+static void update_generations(struct decoding_context_GG *dec_ctx, long long budget);
 static long update_running_matrix(struct decoding_context_GG *dec_ctx, int gid, int sid, int index);
 static int check_for_new_recoverables(struct decoding_context_GG *dec_ctx);
+static NBR_node *undecoded_neighbor(struct decoding_context_GG *dec_ctx, int check_id);
 static int check_for_new_decodables(struct decoding_context_GG *dec_ctx);
 static void mask_packet(struct decoding_context_GG *dec_ctx, GF_ELEMENT ce, int index, struct snc_packet *enc_pkt);
+static int receive_packet(struct decoding_context_GG *dec_ctx, struct snc_packet *pkt);
+static int grab_matrix(struct decoding_context_GG *dec_ctx, struct running_matrix *matrix);
+static void release_matrix(struct decoding_context_GG *dec_ctx, struct running_matrix *matrix);
+static int generation_decodable(struct decoding_context_GG *dec_ctx, int gid);
+static int install_decoded(struct decoding_context_GG *dec_ctx, int pkt_id, GF_ELEMENT *syms);
+static int known_to_precode(struct decoding_context_GG *dec_ctx, int pkt_id);
+static int start_workers(struct decoding_context_GG *dec_ctx);
+static void submit_packet(struct gg_workers *all, struct snc_packet *pkt);
+static void quiesce_workers(struct decoding_context_GG *dec_ctx);
+static void stop_workers(struct decoding_context_GG *dec_ctx);
+static void free_workers(struct decoding_context_GG *dec_ctx);
+static void finish_workers(struct gg_workers *all);
+
+/*
+ * Stages of the iterative decoding that follows decoding a generation
+ */
+#define GG_PRECODE      1   // process recently decoded packets against the precode, one at a time
+#define GG_UPDATE       2   // mask recently decoded packets in undecoded generations, one at a time
+#define GG_DECODABLE    3   // decode a newly decodable generation, if any
 
 extern long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
 extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
@@ -39,6 +80,8 @@ struct decoding_context_GG *create_dec_context_GG(struct snc_parameters *sp)
         fprintf(stderr, "%s: malloc decoding context GG failed\n", fname);
         return NULL;
     }
+    dec_ctx->workers = NULL;
+    dec_ctx->spare   = NULL;
     // GNC code context
     // Since this is decoding, we construct GNC context without data
     // sc->pp will be filled by decoded packets
@@ -92,34 +135,7 @@ struct decoding_context_GG *create_dec_context_GG(struct snc_parameters *sp)
             fprintf(stderr, "%s: malloc dec_ctx->Matrices[%d]->erased\n", fname, i);
             goto AllocError;
         }
-
-        // Allocate coefficient and message matrices in running_matrix
-        // coefficeint: size_g x size_g
-        // message:     size_g x size_p
-        // Dim-1) Pointers to each row
-        dec_ctx->Matrices[i]->coefficient = calloc(dec_ctx->sc->params.size_g, sizeof(GF_ELEMENT*));
-        if (dec_ctx->Matrices[i]->coefficient == NULL) {
-            fprintf(stderr, "%s: calloc dec_ctx->Matrices[%d]->coefficient\n", fname, i);
-            goto AllocError;
-        }
-        dec_ctx->Matrices[i]->message = calloc(dec_ctx->sc->params.size_g, sizeof(GF_ELEMENT*));
-        if (dec_ctx->Matrices[i]->message == NULL) {
-            fprintf(stderr, "%s: calloc dec_ctx->Matrices[%d]->messsage\n", fname, i);
-            goto AllocError;
-        }
-        // Dim-2) Elements of each row
-        for (int j=0; j<dec_ctx->sc->params.size_g; j++) {
-            dec_ctx->Matrices[i]->coefficient[j] = calloc(dec_ctx->sc->params.size_g, sizeof(GF_ELEMENT));
-            if (dec_ctx->Matrices[i]->coefficient[j] == NULL) {
-                fprintf(stderr, "%s: calloc dec_ctx->Matrices[%d]->coefficient[%d]\n", fname, i, j);
-                goto AllocError;
-            }
-            dec_ctx->Matrices[i]->message[j] = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT));
-            if (dec_ctx->Matrices[i]->message[j] == NULL) {
-                fprintf(stderr, "%s: calloc dec_ctx->Matrices[%d]->messsage[%d]\n", fname, i, j);
-                goto AllocError;
-            }
-        }
+        // Coefficient and message matrices are allocated with the first packet
     }
     if ( (dec_ctx->recent = malloc(sizeof(ID_list))) == NULL ) {
         fprintf(stderr, "%s: malloc dec_ctx->recent", fname);
@@ -127,6 +143,15 @@ struct decoding_context_GG *create_dec_context_GG(struct snc_parameters *sp)
     }
 
     dec_ctx->recent->first = dec_ctx->recent->last = NULL;
+    dec_ctx->fin.stage  = FINISH_IDLE;
+    dec_ctx->cursor     = NULL;
+    dec_ctx->gfirst     = 0;
+    dec_ctx->gend       = dec_ctx->sc->gnum;
+    // Workers are started with the first packet (e.g., after the context is restored)
+    char *nt = getenv("SNC_GG_THREADS");
+    dec_ctx->nworkers   = (nt != NULL && atoi(nt) >= 2) ? atoi(nt) : 0;
+    if (dec_ctx->nworkers > dec_ctx->sc->gnum)
+        dec_ctx->nworkers = dec_ctx->sc->gnum;
     memset(dec_ctx->grecent, -1, sizeof(int)*FB_THOLD);             /* set recent decoded generation ids to -1 */
     dec_ctx->newgpos    = 0;
     dec_ctx->grcount    = 0;
@@ -145,10 +170,9 @@ void free_dec_context_GG(struct decoding_context_GG *dec_ctx)
 {
     if (dec_ctx == NULL)
         return;
-    if (dec_ctx->sc != NULL)
-        snc_free_enc_context(dec_ctx->sc);
 
-    int i, j, k;
+    int i, k;
+    free_workers(dec_ctx);
     if (dec_ctx->evolving_checks != NULL) {
         for (i=0; i<dec_ctx->sc->cnum; i++) {
             if (dec_ctx->evolving_checks[i] != NULL)
@@ -164,27 +188,17 @@ void free_dec_context_GG(struct decoding_context_GG *dec_ctx)
             if (dec_ctx->Matrices[i] != NULL) {
                 if (dec_ctx->Matrices[i]->erased != NULL)
                     free(dec_ctx->Matrices[i]->erased);
-                if (dec_ctx->Matrices[i]->coefficient != NULL) {
-                    for (j=0; j<dec_ctx->sc->params.size_g; j++) {
-                        if (dec_ctx->Matrices[i]->coefficient[j] != NULL)
-                            free(dec_ctx->Matrices[i]->coefficient[j]);
-                    }
-                    free(dec_ctx->Matrices[i]->coefficient);
-                }
-                if (dec_ctx->Matrices[i]->message != NULL) {
-                    for (j=0; j<dec_ctx->sc->params.size_g; j++) {
-                        if (dec_ctx->Matrices[i]->message[j] != NULL)
-                            free(dec_ctx->Matrices[i]->message[j]);
-                    }
-                    free(dec_ctx->Matrices[i]->message);
-                }
+                release_matrix(dec_ctx, dec_ctx->Matrices[i]);
                 free(dec_ctx->Matrices[i]);
             }
         }
         free(dec_ctx->Matrices);
     }
+    free_matrix(dec_ctx->spare);
     if (dec_ctx->recent != NULL)
         free_list(dec_ctx->recent);
+    if (dec_ctx->sc != NULL)
+        snc_free_enc_context(dec_ctx->sc);
     free(dec_ctx);
     dec_ctx = NULL;
     return;
@@ -193,6 +207,28 @@ void free_dec_context_GG(struct decoding_context_GG *dec_ctx)
 
 // cache a new received packet, extract its information and try decode the class it belongs to
 void process_packet_GG(struct decoding_context_GG *dec_ctx, struct snc_packet *pkt)
+{
+    if (dec_ctx->nworkers > 0) {
+        if (dec_ctx->workers != NULL || start_workers(dec_ctx) == 0) {
+            // Packets arriving once decoding is finished are dropped
+            if (!__atomic_load_n(&dec_ctx->finished, __ATOMIC_ACQUIRE))
+                submit_packet(dec_ctx->workers, pkt);
+            return;
+        }
+        dec_ctx->nworkers = 0;      // decode serially
+    }
+    if (receive_packet(dec_ctx, pkt) == 1) {
+        // Iterative decoding is left to resume_decoding_GG()
+        dec_ctx->fin.stage = GG_PRECODE;
+        dec_ctx->cursor    = dec_ctx->recent->first;
+    }
+}
+
+/*
+ * Process a packet against the matrix of its generation, and decode the
+ * generation if it gets full rank. Return 1 if the generation is decoded.
+ */
+static int receive_packet(struct decoding_context_GG *dec_ctx, struct snc_packet *pkt)
 {
     dec_ctx->overhead += 1;
 
@@ -203,7 +239,12 @@ void process_packet_GG(struct decoding_context_GG *dec_ctx, struct snc_packet *p
     int r_rows = matrix->remaining_rows;                                    // record rows of current matrix
     int r_cols = matrix->remaining_cols;                                    // record cols of current matrix
     if (r_cols == 0)
-        return;                                                             // this class has finished decoding
+        return 0;                                                           // this class has finished decoding
+    if (grab_matrix(dec_ctx, matrix) != 0 || (matrix->message[r_rows] == NULL
+            && (matrix->message[r_rows] = malloc(sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p)) == NULL)) {
+        fprintf(stderr, "receive_packet: cannot allocate matrix of generation %d\n", gid);
+        return 0;
+    }
 
 
     // 2, extract its information, mask it against decoded packets if it's necessary
@@ -217,7 +258,7 @@ void process_packet_GG(struct decoding_context_GG *dec_ctx, struct snc_packet *p
         }
         if (get_bit_in_array(matrix->erased, j) == 1) {
             //find the decoded packet, mask it with this source packet
-            int src_id = dec_ctx->sc->gene[gid]->pktid[j];      // index of the corresponding source packet
+            int src_id = gene_pktid(dec_ctx->sc, gid, j);       // index of the corresponding source packet
             mask_packet(dec_ctx, coe, src_id, pkt);
         } else {
             matrix->coefficient[r_rows][i] = coe;
@@ -246,16 +287,27 @@ void process_packet_GG(struct decoding_context_GG *dec_ctx, struct snc_packet *p
         else {
             matrix->remaining_rows = matrix->remaining_cols;
             decode_generation(dec_ctx, gid);
-            if (get_loglevel() == TRACE)
-                printf("Entering perform_iterative_decoding...\n");
-            perform_iterative_decoding(dec_ctx);
+            return 1;
         }
     }
+    return 0;
+}
+
+int resume_decoding_GG(struct decoding_context_GG *dec_ctx, long long budget)
+{
+    dec_ctx->fin.work = 0;
+    if (dec_ctx->fin.stage == FINISH_IDLE)
+        return 0;
+    if (dec_ctx->fin.stage == GG_PRECODE && dec_ctx->cursor == dec_ctx->recent->first
+            && get_loglevel() == TRACE)
+        printf("Entering perform_iterative_decoding...\n");
+    perform_iterative_decoding(dec_ctx, budget);
     if (dec_ctx->finished && get_loglevel() == TRACE) {
         printf("GG splitted operations: %.2f %.2f\n",
                 (double) dec_ctx->ops1/dec_ctx->sc->snum/dec_ctx->sc->params.size_p,
                 (double) dec_ctx->ops2/dec_ctx->sc->snum/dec_ctx->sc->params.size_p);
     }
+    return dec_ctx->fin.stage != FINISH_IDLE;
 }
 
 // decode packets of a generation via Gaussion elimination
@@ -282,15 +334,15 @@ static void decode_generation(struct decoding_context_GG *dec_ctx, int gid)
             // determine the index of each decoded packet
             if (get_bit_in_array(matrix->erased, j) == 0) {
                 set_bit_in_array(matrix->erased, j);
-                int src_id = dec_ctx->sc->gene[gid]->pktid[j];
-                if (dec_ctx->sc->pp[src_id] != NULL) {
+                int src_id = gene_pktid(dec_ctx->sc, gid, j);
+                // Move the decoded row to sc->pp
+                GF_ELEMENT *syms = matrix->message[i];
+                matrix->message[i] = NULL;
+                if (!install_decoded(dec_ctx, src_id, syms)) {
                     if (get_loglevel() == TRACE)
                         printf("%s: packet %d is already decoded.\n", fname, src_id);
-                    continue;
+                    break;
                 }
-                if ( (dec_ctx->sc->pp[src_id] = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT))) == NULL )
-                    fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, src_id);
-                memcpy(dec_ctx->sc->pp[src_id], matrix->message[i], sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p);
                 // Record the decoded packet as a recently decoded packet
                 ID *new_id;
                 if ( (new_id = malloc(sizeof(ID))) == NULL )
@@ -306,6 +358,7 @@ static void decode_generation(struct decoding_context_GG *dec_ctx, int gid)
     if (get_loglevel() == TRACE)
         printf("%s: %d packets decoded from generation %d\n", fname, c, gid);
     matrix->remaining_rows = matrix->remaining_cols = 0;
+    release_matrix(dec_ctx, matrix);
     /* Record recent decoded generations */
     dec_ctx->newgpos = dec_ctx->newgpos % FB_THOLD;
     dec_ctx->grecent[dec_ctx->newgpos] = gid;
@@ -314,31 +367,55 @@ static void decode_generation(struct decoding_context_GG *dec_ctx, int gid)
 }
 
 // This function performs iterative decoding on the precode and GNC code,
-// based on the most recently decoded packets from a generation by decode_generation()
-static void perform_iterative_decoding(struct decoding_context_GG *dec_ctx)
+// based on the most recently decoded packets from a generation by decode_generation().
+// Rounds of precode decoding, generation updating and decoding a newly decodable
+// generation repeat until no generation is decodable. The work resumes from stage
+// fin.stage at dec_ctx->cursor, and pauses after about budget operations.
+static void perform_iterative_decoding(struct decoding_context_GG *dec_ctx, long long budget)
 {
     static char fname[] = "perform_iterative_decoding";
-    // Perform iterative precode decoding
-    ID *new_decoded = dec_ctx->recent->first;
-    while (new_decoded != NULL) {
-        int new_id = new_decoded->data;
-        if (new_id >= dec_ctx->sc->snum) {
-            new_decoded_check_packet(dec_ctx, new_id);
+    struct finish_state *fin = &dec_ctx->fin;
+    while (fin->stage != FINISH_IDLE && fin->work < budget) {
+        if (fin->stage == GG_PRECODE) {
+            // Perform iterative precode decoding
+            ID *new_decoded = dec_ctx->cursor;
+            while (new_decoded != NULL && fin->work < budget) {
+                long long ops = dec_ctx->operations;
+                int new_id = new_decoded->data;
+                if (new_id >= dec_ctx->sc->snum) {
+                    new_decoded_check_packet(dec_ctx, new_id);
+                } else {
+                    new_decoded_source_packet(dec_ctx, new_id);
+                    if (dec_ctx->finished) {
+                        // Leave iterative decoding if all source packets are decoded
+                        fin->stage = FINISH_IDLE;
+                        return;
+                    }
+                }
+                check_for_new_recoverables(dec_ctx);
+                fin->work += dec_ctx->operations - ops + dec_ctx->sc->cnum;
+                new_decoded = new_decoded->next;
+            }
+            dec_ctx->cursor = new_decoded;
+            if (new_decoded != NULL)
+                return;
+            fin->stage = GG_UPDATE;
+            dec_ctx->cursor = dec_ctx->recent->first;
+        } else if (fin->stage == GG_UPDATE) {
+            // Perform iterative generation decoding
+            update_generations(dec_ctx, budget);
         } else {
-            new_decoded_source_packet(dec_ctx, new_id);
-            if (dec_ctx->finished)
-                return;     // Leave iterative decoding if all source packets are decoded
+            long long ops = dec_ctx->operations;
+            int new_decodable_gid = check_for_new_decodables(dec_ctx);
+            if (new_decodable_gid != -1) {
+                decode_generation(dec_ctx, new_decodable_gid);
+                fin->stage = GG_PRECODE;
+                dec_ctx->cursor = dec_ctx->recent->first;
+            } else {
+                fin->stage = FINISH_IDLE;
+            }
+            fin->work += dec_ctx->operations - ops + dec_ctx->sc->gnum;
         }
-        check_for_new_recoverables(dec_ctx);
-        new_decoded = new_decoded->next;
-    }
-
-    // Perform iterative generation decoding
-    update_generations(dec_ctx);
-    int new_decodable_gid = check_for_new_decodables(dec_ctx);
-    if (new_decodable_gid != -1) {
-        decode_generation(dec_ctx, new_decodable_gid);
-        perform_iterative_decoding(dec_ctx);
     }
 }
 
@@ -375,8 +452,6 @@ static void new_decoded_source_packet(struct decoding_context_GG *dec_ctx, int p
         dec_ctx->operations += dec_ctx->sc->params.size_p;
         dec_ctx->ops2 += dec_ctx->sc->params.size_p;
         dec_ctx->check_degrees[check_id] -= 1;
-        if (remove_from_list(dec_ctx->sc->graph->l_nbrs_of_r[check_id], pkt_id) == -1)
-            fprintf(stderr, "%s: remove %d from l_nbrs_of_r[%d]\n", fname, pkt_id, check_id);
 
         nb = nb->next;
     }
@@ -407,6 +482,20 @@ static void new_decoded_check_packet(struct decoding_context_GG *dec_ctx, int pk
         dec_ctx->ops2 += dec_ctx->sc->params.size_p;
     }
 }
+/*
+ * The first source neighbor of a check packet that is not decoded yet.
+ * The precode graph is shared by all contexts of the code and is not
+ * modified, so decoded neighbors are skipped here instead of being
+ * removed from the graph.
+ */
+static NBR_node *undecoded_neighbor(struct decoding_context_GG *dec_ctx, int check_id)
+{
+    NBR_node *nb = dec_ctx->sc->graph->l_nbrs_of_r[check_id]->first;
+    while (nb != NULL && known_to_precode(dec_ctx, nb->data))
+        nb = nb->next;
+    return nb;
+}
+
 // This function is part of iterative precode decoding, which
 // checks for new recoverable source/check packet after new packets
 // are decoded from generations and processed accordingly.
@@ -417,53 +506,53 @@ static int check_for_new_recoverables(struct decoding_context_GG *dec_ctx)
     int has_new_recoverable = -1;
     // check each check node
     for (int i=0; i<dec_ctx->sc->cnum; i++) {
-        if (dec_ctx->check_degrees[i] == 1
-                && dec_ctx->sc->pp[i+snum] != NULL
-                && !exist_in_list(dec_ctx->recent, i+snum)) {
+        if (dec_ctx->check_degrees[i] == 1 && known_to_precode(dec_ctx, i+snum)) {
             // The check packet is already decoded from some previous generations and its degree is
             // reduced to 1, meaning that it connects to a unrecovered source neighboer. Recover this
             // source neighbor.
-            int src_id = dec_ctx->sc->graph->l_nbrs_of_r[i]->first->data;
-            if (dec_ctx->sc->pp[src_id] != NULL ) {
-                if (get_loglevel() == TRACE) { 
-                    if (exist_in_list(dec_ctx->recent, src_id))
-                        printf("%s: source packet %d is recoverable but is already in the recent list\n", fname, src_id);
-                    else
-                        printf("%s: source packet %d is already decoded\n", fname, src_id);
-                }
+            NBR_node *remaining = undecoded_neighbor(dec_ctx, i);
+            if (remaining == NULL) {
+                if (get_loglevel() == TRACE)
+                    printf("%s: source neighbors of check %d are already decoded\n", fname, i+snum);
                 dec_ctx->check_degrees[i] = 0;
                 continue;
             }
+            int src_id = remaining->data;
             if (get_loglevel() == TRACE)
                 printf("%s: source packet %d is recoverable from check %d\n", fname, src_id, i+snum);
-            dec_ctx->sc->pp[src_id] = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT));
-            if (dec_ctx->sc->pp[src_id] == NULL)
+            GF_ELEMENT *syms = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT));
+            if (syms == NULL)
                 fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, src_id);
-            if (dec_ctx->sc->graph->l_nbrs_of_r[i]->first->ce == 1)
-                memcpy(dec_ctx->sc->pp[src_id], dec_ctx->evolving_checks[i], sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p);
+            if (remaining->ce == 1)
+                memcpy(syms, dec_ctx->evolving_checks[i], sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p);
             else {
-                GF_ELEMENT ce = galois_divide(1, dec_ctx->sc->graph->l_nbrs_of_r[i]->first->ce);
-                galois_multiply_add_region(dec_ctx->sc->pp[src_id], dec_ctx->evolving_checks[i], ce, dec_ctx->sc->params.size_p);
+                GF_ELEMENT ce = galois_divide(1, remaining->ce);
+                galois_multiply_add_region(syms, dec_ctx->evolving_checks[i], ce, dec_ctx->sc->params.size_p);
                 dec_ctx->operations += dec_ctx->sc->params.size_p + 1;
                 dec_ctx->ops2 += dec_ctx->sc->params.size_p + 1;
             }
-            // Record the decoded packet as a recently decoded packet
-            ID *new_id;
-            if ( (new_id = malloc(sizeof(ID))) == NULL )
-                fprintf(stderr, "%s: malloc new ID\n", fname);
-            new_id->data = src_id;
-            new_id->next = NULL;
-            append_to_list(dec_ctx->recent, new_id);
             dec_ctx->check_degrees[i] = 0;
+            // Record the decoded packet as a recently decoded packet
+            // (unless a worker of parallel GG has just decoded it)
+            if (install_decoded(dec_ctx, src_id, syms)) {
+                ID *new_id;
+                if ( (new_id = malloc(sizeof(ID))) == NULL )
+                    fprintf(stderr, "%s: malloc new ID\n", fname);
+                new_id->data = src_id;
+                new_id->next = NULL;
+                append_to_list(dec_ctx->recent, new_id);
+            }
         }
-        if (dec_ctx->sc->pp[i+snum] == NULL && dec_ctx->check_degrees[i] == 0) {
+        if (__atomic_load_n(&dec_ctx->sc->pp[i+snum], __ATOMIC_ACQUIRE) == NULL && dec_ctx->check_degrees[i] == 0) {
             // The check packet is recovered through its source neighbors
             if (get_loglevel() == TRACE)
                 printf("%s: check packet %d is recoverable\n", fname, i+snum);
-            dec_ctx->sc->pp[i+snum] = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT));
-            if (dec_ctx->sc->pp[i+snum] == NULL)
+            GF_ELEMENT *syms = calloc(dec_ctx->sc->params.size_p, sizeof(GF_ELEMENT));
+            if (syms == NULL)
                 fprintf(stderr, "%s: calloc sc->pp[%d]", fname, i+snum);
-            memcpy(dec_ctx->sc->pp[i+snum], dec_ctx->evolving_checks[i], sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p);
+            memcpy(syms, dec_ctx->evolving_checks[i], sizeof(GF_ELEMENT)*dec_ctx->sc->params.size_p);
+            if (!install_decoded(dec_ctx, i+snum, syms))
+                continue;
             // Record a recently decoded packet
             ID *new_id;
             if ( (new_id = malloc(sizeof(ID))) == NULL )
@@ -478,19 +567,21 @@ static int check_for_new_recoverables(struct decoding_context_GG *dec_ctx)
     return has_new_recoverable;
 }
 
-// Update non-decoded generations with recently decoded packets
-static void update_generations(struct decoding_context_GG *dec_ctx)
+// Update non-decoded generations with recently decoded packets, from
+// dec_ctx->cursor on until about budget operations are done in the slice
+static void update_generations(struct decoding_context_GG *dec_ctx, long long budget)
 {
     static char fname[] = "update_generations";
 
-    ID *precent = dec_ctx->recent->first;  // pointer to index of recently decoded packets
-    while (precent != NULL) {
+    ID *precent = dec_ctx->cursor;  // pointer to index of recently decoded packets
+    while (precent != NULL && dec_ctx->fin.work < budget) {
+        long long ops = dec_ctx->operations;
         int src_id = precent->data;
         // Check all generations that contain this source packet
         for (int i=0; i<dec_ctx->sc->gnum; i++) {
             if (dec_ctx->Matrices[i]->remaining_cols == 0)
                 continue;
-            int pos = has_item(dec_ctx->sc->gene[i]->pktid, src_id, dec_ctx->sc->params.size_g);
+            int pos = gene_position(dec_ctx->sc, i, src_id);
             if (pos != -1 
                 && get_bit_in_array(dec_ctx->Matrices[i]->erased, pos) == 0) {
                 // The recently decoded packet is not-yet decoded in the generation, mask it
@@ -499,10 +590,15 @@ static void update_generations(struct decoding_context_GG *dec_ctx)
                 dec_ctx->ops2 += ops;
             }
         }
+        dec_ctx->fin.work += dec_ctx->operations - ops + dec_ctx->sc->gnum;
         precent = precent->next;
     }
+    dec_ctx->cursor = precent;
+    if (precent != NULL)
+        return;
     // Clean up recently decoded packet ID list
     clear_list(dec_ctx->recent);
+    dec_ctx->fin.stage = GG_DECODABLE;
 }
 
 /********************************************************
@@ -561,6 +657,11 @@ static long update_running_matrix(struct decoding_context_GG *dec_ctx, int gid,
     }
     set_bit_in_array(matrix->erased, index);       // mark the column as erased
     matrix->remaining_cols -= 1;
+    if (matrix->remaining_cols == 0) {
+        // All packets of the generation are decoded elsewhere
+        matrix->remaining_rows = 0;
+        release_matrix(dec_ctx, matrix);
+    }
     return operations;
 }
 
@@ -568,44 +669,91 @@ static long update_running_matrix(struct decoding_context_GG *dec_ctx, int gid,
 // Return:
 //    Decodable generation id, or else -1.
 static int check_for_new_decodables(struct decoding_context_GG *dec_ctx)
+{
+    for (int i=dec_ctx->gfirst; i<dec_ctx->gend; i++) {
+        if (generation_decodable(dec_ctx, i))
+            return i;
+    }
+    return -1;
+}
+
+// Check if generation i has got full rank
+static int generation_decodable(struct decoding_context_GG *dec_ctx, int i)
 {
     static char fname[] = "check_for_new_decodables";
-    int i, j, k;
-    for (i=0; i<dec_ctx->sc->gnum; i++) {
-        struct running_matrix *matrix = dec_ctx->Matrices[i];
-        if ( matrix->remaining_cols != 0
-                && matrix->remaining_rows >= matrix->remaining_cols ) {
-            int r_rows = matrix->remaining_rows;
-            int r_cols = matrix->remaining_cols;
-            // perform forward substitution
-            int flushing_ops = forward_substitute(r_rows, r_cols, dec_ctx->sc->params.size_p, matrix->coefficient, matrix->message);
-            dec_ctx->operations += flushing_ops;
-            dec_ctx->ops1 += flushing_ops;
-
-            // check if the new packet is full rank, if yes, decode it, if not refresh the coefficient and message matrix anyway
-            int full_rank = 1;
-            int innovatives = 0;
-            for (j=0; j<r_cols; j++) {
-                if (matrix->coefficient[j][j] == 0)
-                    full_rank = 0;
-                else
-                    innovatives += 1;
-            }
+    int j;
+    struct running_matrix *matrix = dec_ctx->Matrices[i];
+    if (matrix->remaining_cols == 0 || matrix->remaining_rows < matrix->remaining_cols)
+        return 0;
+    int r_rows = matrix->remaining_rows;
+    int r_cols = matrix->remaining_cols;
+    // perform forward substitution
+    int flushing_ops = forward_substitute(r_rows, r_cols, dec_ctx->sc->params.size_p, matrix->coefficient, matrix->message);
+    dec_ctx->operations += flushing_ops;
+    dec_ctx->ops1 += flushing_ops;
 
-            if (full_rank == 0)
-                matrix->remaining_rows = innovatives;
-            else {
-                matrix->remaining_rows = matrix->remaining_cols;
-                if (get_loglevel() == TRACE)
-                    printf("%s: generation %d is decodable\n",fname, i);
-                return i;
-            }
-        }
+    // check if the new packet is full rank, if yes, decode it, if not refresh the coefficient and message matrix anyway
+    int full_rank = 1;
+    int innovatives = 0;
+    for (j=0; j<r_cols; j++) {
+        if (matrix->coefficient[j][j] == 0)
+            full_rank = 0;
+        else
+            innovatives += 1;
     }
-    return -1;
+
+    if (full_rank == 0) {
+        matrix->remaining_rows = innovatives;
+        return 0;
+    }
+    matrix->remaining_rows = matrix->remaining_cols;
+    if (get_loglevel() == TRACE)
+        printf("%s: generation %d is decodable\n",fname, i);
+    return 1;
 }
 
 
+/*
+ * Allocate the matrices of a generation, unless already allocated. The
+ * coefficient matrix of a released generation is reused if there is one.
+ */
+static int grab_matrix(struct decoding_context_GG *dec_ctx, struct running_matrix *matrix)
+{
+    static char fname[] = "grab_matrix";
+    if (matrix->coefficient != NULL)
+        return 0;
+    int gensize = dec_ctx->sc->params.size_g;
+    GF_ELEMENT **coefficient = dec_ctx->spare;
+    if (coefficient != NULL) {
+        dec_ctx->spare = NULL;
+        clear_matrix(coefficient, gensize, gensize);
+    } else if ((coefficient = create_matrix(gensize, gensize)) == NULL) {
+        return (-1);
+    }
+    if ((matrix->message = calloc(gensize, sizeof(GF_ELEMENT *))) == NULL) {
+        fprintf(stderr, "%s: calloc message rows\n", fname);
+        free_matrix(coefficient);
+        return (-1);
+    }
+    matrix->coefficient = coefficient;
+    return 0;
+}
+
+// Free message rows of a generation, and keep its coefficient matrix for reuse
+static void release_matrix(struct decoding_context_GG *dec_ctx, struct running_matrix *matrix)
+{
+    if (matrix->coefficient == NULL)
+        return;
+    for (int i=0; i<dec_ctx->sc->params.size_g; i++)
+        free(matrix->message[i]);
+    free(matrix->message);
+    if (dec_ctx->spare == NULL)
+        dec_ctx->spare = matrix->coefficient;
+    else
+        free_matrix(matrix->coefficient);
+    matrix->coefficient = matrix->message = NULL;
+}
+
 // mask the encoded packet with the decoded packet list
 // ce    - coefficient we use in masking
 // index - index of the decoded source packet we want to mask against ENC_pkt
@@ -618,156 +766,547 @@ static void mask_packet(struct decoding_context_GG *dec_ctx, GF_ELEMENT ce, int
     return;
 }
 
-/**
- * Save a decoding context to a file
- * Return values:
- *   On success: bytes written
- *   On error: -1
+/*********************************************************************
+ *                        Parallel GG decoding
+ *********************************************************************/
+#define GG_QUEUE    1024        // packets queued to a worker
+
+struct gg_worker {
+    struct decoding_context_GG ctx;     // private copy of the decoding context
+    struct gg_workers *all;
+    pthread_t          thread;
+    pthread_mutex_t    lock;
+    pthread_cond_t     wake;            // signaled when a message is queued to a sleeping worker
+    int                sleeping;
+    struct mpsc_ring  *packets;         // packets of the owned generations (NULL for the precode worker)
+    struct mpsc_ring  *notes;           // IDs of newly decoded packets
+    unsigned char     *mark;            // workers to be notified of a decoded packet
+};
+
+struct gg_workers {
+    struct decoding_context_GG *dec_ctx;    // context of the decoder
+    int                n;               // number of workers owning generations
+    int                precode;         // whether w[n] is a precode worker
+    struct gg_worker  *w;
+    int                started;         // number of worker threads started
+    int                stop;
+    unsigned char     *processed;       // packets processed by iterative precode decoding
+    int                originals;       // number of source packets decoded
+    int                outstanding;     // messages queued or being processed
+    pthread_mutex_t    lock;
+    pthread_cond_t     idle;            // broadcast when no message is outstanding or decoding is finished
+};
+
+/*
+ * Install a decoded packet in sc->pp, which takes over syms (or a copy of
+ * it in the output region bound to the decoder). Return 0 if the packet
+ * is already decoded (syms is then freed).
  */
-long save_dec_context_GG(struct decoding_context_GG *dec_ctx, const char *filepath)
+static int install_decoded(struct decoding_context_GG *dec_ctx, int pkt_id, GF_ELEMENT *syms)
+{
+    struct snc_context *sc = dec_ctx->sc;
+    struct gg_workers *all = dec_ctx->workers;
+    GF_ELEMENT *dst = (sc->out != NULL && pkt_id < sc->snum) ? alloc_decoded(sc, pkt_id) : syms;
+    GF_ELEMENT *none = NULL;
+    if (all == NULL) {
+        if (sc->pp[pkt_id] != NULL) {
+            free(syms);
+            return 0;
+        }
+    } else if (__atomic_load_n(&sc->pp[pkt_id], __ATOMIC_ACQUIRE) != NULL
+               || !__atomic_compare_exchange_n(&sc->pp[pkt_id], &none, dst, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Workers of parallel GG may decode the same packet at once
+        free(syms);
+        return 0;
+    }
+    // Other workers only read the packet once it is notified
+    if (dst != syms) {
+        memcpy(dst, syms, sizeof(GF_ELEMENT)*sc->params.size_p);
+        free(syms);
+    }
+    if (all == NULL) {
+        sc->pp[pkt_id] = dst;
+        return 1;
+    }
+    if (pkt_id < sc->snum
+        && __atomic_add_fetch(&all->originals, 1, __ATOMIC_ACQ_REL) == sc->snum)
+        finish_workers(all);
+    return 1;
+}
+
+// Whether a decoded packet has been processed by iterative precode decoding
+static int known_to_precode(struct decoding_context_GG *dec_ctx, int pkt_id)
 {
-    long filesize = 0;
-    int d_type = GG_DECODER;
-    FILE *fp;
-    if ((fp = fopen(filepath, "w")) == NULL) {
-        fprintf(stderr, "Cannot open %s to save decoding context\n", filepath);
+    if (dec_ctx->workers != NULL)
+        return dec_ctx->workers->processed[pkt_id];
+    return dec_ctx->sc->pp[pkt_id] != NULL
+           && (pkt_id < dec_ctx->sc->snum || !exist_in_list(dec_ctx->recent, pkt_id));
+}
+
+static void *work(void *arg);
+
+// Worker owning generation gid
+static inline int owner(struct gg_workers *all, int gid)
+{
+    return (long) gid * all->n / all->dec_ctx->sc->gnum;
+}
+
+static void wake_worker(struct gg_worker *wk)
+{
+    // Pairs with the fence of the worker going to sleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&wk->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&wk->lock);
+        pthread_cond_signal(&wk->wake);
+        pthread_mutex_unlock(&wk->lock);
+    }
+}
+
+static void finish_workers(struct gg_workers *all)
+{
+    __atomic_store_n(&all->dec_ctx->finished, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&all->lock);
+    pthread_cond_broadcast(&all->idle);
+    pthread_mutex_unlock(&all->lock);
+}
+
+// A queued message has been processed
+static void message_done(struct gg_workers *all)
+{
+    if (__atomic_sub_fetch(&all->outstanding, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&all->lock);
+        pthread_cond_broadcast(&all->idle);
+        pthread_mutex_unlock(&all->lock);
+    }
+}
+
+static void queue_note(struct gg_worker *wk, int pkt_id)
+{
+    static char fname[] = "queue_note";
+    ID *note;
+    if ((note = malloc(sizeof(ID))) == NULL) {
+        fprintf(stderr, "%s: malloc note\n", fname);
+        return;
+    }
+    note->data = pkt_id;
+    note->next = NULL;
+    __atomic_add_fetch(&wk->all->outstanding, 1, __ATOMIC_ACQ_REL);
+    // Each packet is notified once to a worker, so the ring has room
+    while (ring_push(wk->notes, note) != 0)
+        sched_yield();
+    wake_worker(wk);
+}
+
+/*
+ * Notify packets recently decoded by a worker to the owners of generations
+ * containing them and to the precode worker.
+ */
+static void notify_recent(struct gg_worker *wk)
+{
+    struct gg_workers *all = wk->all;
+    struct snc_context *sc = wk->ctx.sc;
+    ID *id;
+    for (id=wk->ctx.recent->first; id!=NULL; id=id->next) {
+        memset(wk->mark, 0, all->n);
+        for (int gid=0; gid<sc->gnum; gid++) {
+            if (gene_position(sc, gid, id->data) != -1)
+                wk->mark[owner(all, gid)] = 1;
+        }
+        for (int k=0; k<all->n; k++) {
+            if (wk->mark[k])
+                queue_note(&all->w[k], id->data);
+        }
+        if (all->precode)
+            queue_note(&all->w[all->n], id->data);
+    }
+    clear_list(wk->ctx.recent);
+}
+
+// Mask a decoded packet in the owned generations containing it
+static void update_owned(struct gg_worker *wk, int pkt_id)
+{
+    struct decoding_context_GG *ctx = &wk->ctx;
+    for (int gid=ctx->gfirst; gid<ctx->gend; gid++) {
+        struct running_matrix *matrix = ctx->Matrices[gid];
+        if (matrix->remaining_cols == 0)
+            continue;
+        int pos = gene_position(ctx->sc, gid, pkt_id);
+        if (pos == -1 || get_bit_in_array(matrix->erased, pos) == 1)
+            continue;
+        long ops = update_running_matrix(ctx, gid, pkt_id, pos);
+        ctx->operations += ops;
+        ctx->ops2 += ops;
+        if (generation_decodable(ctx, gid)) {
+            decode_generation(ctx, gid);
+            notify_recent(wk);
+        }
+    }
+}
+
+// Process a decoded packet by iterative precode decoding
+static void update_precode(struct gg_worker *wk, int pkt_id)
+{
+    struct decoding_context_GG *ctx = &wk->ctx;
+    if (pkt_id >= ctx->sc->snum)
+        new_decoded_check_packet(ctx, pkt_id);
+    else
+        new_decoded_source_packet(ctx, pkt_id);
+    wk->all->processed[pkt_id] = 1;
+    if (!ctx->finished)
+        check_for_new_recoverables(ctx);
+    notify_recent(wk);
+}
+
+static void *work(void *arg)
+{
+    struct gg_worker *wk = arg;
+    struct gg_workers *all = wk->all;
+    for (;;) {
+        if (__atomic_load_n(&all->stop, __ATOMIC_ACQUIRE))
+            break;
+        // Messages left once decoding is finished are dropped
+        int finished = __atomic_load_n(&all->dec_ctx->finished, __ATOMIC_ACQUIRE);
+        // Decoded packets are taken first to mask received packets against them
+        ID *note = ring_pop(wk->notes);
+        if (note != NULL) {
+            if (!finished && wk->packets != NULL)
+                update_owned(wk, note->data);
+            else if (!finished)
+                update_precode(wk, note->data);
+            free(note);
+            message_done(all);
+            continue;
+        }
+        struct snc_packet *pkt = wk->packets != NULL ? ring_pop(wk->packets) : NULL;
+        if (pkt != NULL) {
+            if (!finished && receive_packet(&wk->ctx, pkt) == 1)
+                notify_recent(wk);
+            snc_free_packet(pkt);
+            message_done(all);
+            continue;
+        }
+        pthread_mutex_lock(&wk->lock);
+        __atomic_store_n(&wk->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (ring_empty(wk->notes) && (wk->packets == NULL || ring_empty(wk->packets))
+               && !__atomic_load_n(&all->stop, __ATOMIC_RELAXED))
+            pthread_cond_wait(&wk->wake, &wk->lock);
+        __atomic_store_n(&wk->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&wk->lock);
+    }
+    return NULL;
+}
+
+// Queue a copy of a packet to the owner of its generation
+static void submit_packet(struct gg_workers *all, struct snc_packet *pkt)
+{
+    static char fname[] = "submit_packet";
+    struct snc_packet *dup = duplicate_packet(&all->dec_ctx->sc->params, NULL, pkt);
+    if (dup == NULL) {
+        fprintf(stderr, "%s: cannot copy packet\n", fname);
+        return;
+    }
+    struct gg_worker *wk = &all->w[owner(all, pkt->gid)];
+    __atomic_add_fetch(&all->outstanding, 1, __ATOMIC_ACQ_REL);
+    while (ring_push(wk->packets, dup) != 0) {
+        // Wait for the worker to catch up
+        if (__atomic_load_n(&all->dec_ctx->finished, __ATOMIC_ACQUIRE)) {
+            snc_free_packet(dup);
+            message_done(all);
+            return;
+        }
+        sched_yield();
+    }
+    wake_worker(wk);
+}
+
+/*
+ * Start the workers. Each gets a private copy of the decoding context
+ * with its own counters and recently decoded packets.
+ */
+static int start_workers(struct decoding_context_GG *dec_ctx)
+{
+    static char fname[] = "start_workers";
+    struct snc_context *sc = dec_ctx->sc;
+    int numpp = sc->snum + sc->cnum;
+    struct gg_workers *all;
+    if ((all = calloc(1, sizeof(struct gg_workers))) == NULL) {
+        fprintf(stderr, "%s: calloc gg_workers\n", fname);
         return (-1);
     }
-    int i, j, k;
-    int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
-    int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-    // Write snc params
-    filesize += fwrite(&dec_ctx->sc->params, sizeof(struct snc_parameters), 1, fp);
-    // Write decoder type
-    filesize += fwrite(&(d_type), sizeof(int), 1, fp);
-    // Save already decoded packets in dec_ctx->sc->pp
-    filesize += fwrite(&dec_ctx->decoded, sizeof(int), 1, fp);
-    for (i=0; i<numpp; i++) {
+    all->dec_ctx = dec_ctx;
+    all->n       = dec_ctx->nworkers;
+    all->precode = (sc->graph != NULL);
+    pthread_mutex_init(&all->lock, NULL);
+    pthread_cond_init(&all->idle, NULL);
+    dec_ctx->workers = all;
+    if ((all->w = calloc(all->n + all->precode, sizeof(struct gg_worker))) == NULL
+        || (all->processed = calloc(numpp, sizeof(unsigned char))) == NULL) {
+        fprintf(stderr, "%s: calloc workers\n", fname);
+        goto error;
+    }
+    for (int i=0; i<numpp; i++) {
+        if (sc->pp[i] != NULL) {
+            all->processed[i] = 1;
+            all->originals += (i < sc->snum);
+        }
+    }
+    for (int k=0; k<all->n+all->precode; k++) {
+        struct gg_worker *wk = &all->w[k];
+        wk->all = all;
+        wk->ctx = *dec_ctx;             // shares sc, matrices and precode decoding state
+        wk->ctx.nworkers   = 0;
+        wk->ctx.spare      = NULL;
+        wk->ctx.operations = wk->ctx.ops1 = wk->ctx.ops2 = 0;
+        wk->ctx.overhead   = 0;
+        // The precode worker owns no generation
+        wk->ctx.gfirst = k < all->n ? ((long) k * sc->gnum + all->n - 1) / all->n : 0;
+        wk->ctx.gend   = k < all->n ? ((long) (k+1) * sc->gnum + all->n - 1) / all->n : 0;
+        pthread_mutex_init(&wk->lock, NULL);
+        pthread_cond_init(&wk->wake, NULL);
+        if ((wk->ctx.recent = calloc(1, sizeof(ID_list))) == NULL
+            || (wk->mark = calloc(all->n, sizeof(unsigned char))) == NULL
+            || (wk->notes = create_ring(numpp)) == NULL
+            || (k < all->n && (wk->packets = create_ring(GG_QUEUE)) == NULL)) {
+            fprintf(stderr, "%s: cannot allocate worker %d\n", fname, k);
+            goto error;
+        }
+    }
+    for (int k=0; k<all->n+all->precode; k++) {
+        if (pthread_create(&all->w[k].thread, NULL, work, &all->w[k]) != 0) {
+            fprintf(stderr, "%s: cannot create worker thread %d\n", fname, k);
+            goto error;
+        }
+        all->started++;
+    }
+    return 0;
+
+error:
+    free_workers(dec_ctx);
+    return (-1);
+}
+
+// Move operation counters of the workers to the decoder (with workers idle)
+static void collect_counters(struct gg_workers *all)
+{
+    struct decoding_context_GG *dec_ctx = all->dec_ctx;
+    for (int k=0; k<all->n+all->precode; k++) {
+        struct decoding_context_GG *ctx = &all->w[k].ctx;
+        dec_ctx->operations += ctx->operations;
+        dec_ctx->ops1       += ctx->ops1;
+        dec_ctx->ops2       += ctx->ops2;
+        dec_ctx->overhead   += ctx->overhead;
+        ctx->operations = ctx->ops1 = ctx->ops2 = 0;
+        ctx->overhead   = 0;
+    }
+    dec_ctx->decoded = dec_ctx->originals = 0;
+    for (int i=0; i<dec_ctx->sc->snum+dec_ctx->sc->cnum; i++) {
         if (dec_ctx->sc->pp[i] != NULL) {
-            filesize += fwrite(&i, sizeof(int), 1, fp);  // pktid
-            filesize += fwrite(dec_ctx->sc->pp[i], sizeof(GF_ELEMENT), pktsize, fp);
+            dec_ctx->decoded   += 1;
+            dec_ctx->originals += (i < dec_ctx->sc->snum);
+        }
+    }
+}
+
+// Wait for the workers to process all queued messages (or to finish decoding)
+static void quiesce_workers(struct decoding_context_GG *dec_ctx)
+{
+    struct gg_workers *all = dec_ctx->workers;
+    if (all == NULL || all->stop)
+        return;
+    pthread_mutex_lock(&all->lock);
+    while (__atomic_load_n(&all->outstanding, __ATOMIC_ACQUIRE) != 0
+           && !__atomic_load_n(&dec_ctx->finished, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&all->idle, &all->lock);
+    pthread_mutex_unlock(&all->lock);
+    if (dec_ctx->finished)
+        stop_workers(dec_ctx);
+    else
+        collect_counters(all);
+}
+
+// Stop the worker threads, dropping the messages still queued
+static void stop_workers(struct decoding_context_GG *dec_ctx)
+{
+    struct gg_workers *all = dec_ctx->workers;
+    if (all == NULL || all->stop)
+        return;
+    __atomic_store_n(&all->stop, 1, __ATOMIC_RELEASE);
+    for (int k=0; k<all->started; k++) {
+        pthread_mutex_lock(&all->w[k].lock);
+        pthread_cond_signal(&all->w[k].wake);
+        pthread_mutex_unlock(&all->w[k].lock);
+        pthread_join(all->w[k].thread, NULL);
+    }
+    for (int k=0; k<all->n+all->precode && all->w!=NULL; k++) {
+        ID *note;
+        struct snc_packet *pkt;
+        while (all->w[k].notes != NULL && (note = ring_pop(all->w[k].notes)) != NULL)
+            free(note);
+        while (all->w[k].packets != NULL && (pkt = ring_pop(all->w[k].packets)) != NULL)
+            snc_free_packet(pkt);
+    }
+    if (all->w != NULL)
+        collect_counters(all);
+}
+
+static void free_workers(struct decoding_context_GG *dec_ctx)
+{
+    struct gg_workers *all = dec_ctx->workers;
+    if (all == NULL)
+        return;
+    stop_workers(dec_ctx);
+    for (int k=0; k<all->n+all->precode && all->w!=NULL; k++) {
+        struct gg_worker *wk = &all->w[k];
+        if (wk->ctx.recent != NULL)
+            free_list(wk->ctx.recent);
+        free_matrix(wk->ctx.spare);
+        free(wk->mark);
+        free_ring(wk->notes);
+        free_ring(wk->packets);
+        pthread_mutex_destroy(&wk->lock);
+        pthread_cond_destroy(&wk->wake);
+    }
+    pthread_mutex_destroy(&all->lock);
+    pthread_cond_destroy(&all->idle);
+    free(all->w);
+    free(all->processed);
+    free(all);
+    dec_ctx->workers = NULL;
+}
+
+int decoding_finished_GG(struct decoding_context_GG *dec_ctx)
+{
+    if (dec_ctx->workers == NULL)
+        return dec_ctx->finished;
+    if (!__atomic_load_n(&dec_ctx->finished, __ATOMIC_ACQUIRE))
+        return 0;
+    if (!dec_ctx->workers->stop) {
+        stop_workers(dec_ctx);
+        if (get_loglevel() == TRACE) {
+            printf("GG splitted operations: %.2f %.2f\n",
+                    (double) dec_ctx->ops1/dec_ctx->sc->snum/dec_ctx->sc->params.size_p,
+                    (double) dec_ctx->ops2/dec_ctx->sc->snum/dec_ctx->sc->params.size_p);
         }
     }
+    return 1;
+}
+
+/*
+ * Save a decoding context to a checkpoint. Decoded packets (sc->pp) are
+ * saved by snc_save_decoder_context().
+ */
+void save_dec_context_GG(struct decoding_context_GG *dec_ctx, struct ckpt_writer *w)
+{
+    int i, j;
+    int gensize = dec_ctx->sc->params.size_g;
+    quiesce_workers(dec_ctx);
+    ckpt_put_int(w, dec_ctx->decoded);
     // Save evolving check packets
     int count = 0;
     for (i=0; i<dec_ctx->sc->cnum; i++) {
         if (dec_ctx->evolving_checks[i] != NULL)
             count++;
     }
-    filesize += fwrite(&count, sizeof(int), 1, fp);  // evolving packets non-NULL count
+    ckpt_put_int(w, count);     // evolving packets non-NULL count
     for (i=0; i<dec_ctx->sc->cnum; i++) {
         if (dec_ctx->evolving_checks[i] != NULL) {
-            filesize += fwrite(&i, sizeof(int), 1, fp);  // check id
-            filesize += fwrite(dec_ctx->evolving_checks[i], sizeof(GF_ELEMENT), pktsize, fp);
+            ckpt_put_int(w, i);     // check id
+            ckpt_put_payload(w, dec_ctx->evolving_checks[i]);
         }
     }
     // Save check degrees
-    filesize += fwrite(dec_ctx->check_degrees, sizeof(int), dec_ctx->sc->cnum, fp);
-    filesize += fwrite(&dec_ctx->finished, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->decoded, sizeof(int), 1, fp);  // Yes, I know. I saved this value twice!
-    filesize += fwrite(&dec_ctx->originals, sizeof(int), 1, fp);
+    ckpt_put(w, dec_ctx->check_degrees, sizeof(int)*dec_ctx->sc->cnum);
+    ckpt_put_int(w, dec_ctx->finished);
+    ckpt_put_int(w, dec_ctx->originals);
     // Save running matrices
+    int nflags = ALIGN(gensize, 8);
     for (i=0; i<dec_ctx->sc->gnum; i++) {
-        filesize += fwrite(&dec_ctx->Matrices[i]->remaining_rows, sizeof(int), 1, fp);
-        filesize += fwrite(&dec_ctx->Matrices[i]->remaining_cols, sizeof(int), 1, fp);
-        int nflags = ALIGN(dec_ctx->sc->params.size_g, 8);
-        filesize += fwrite(dec_ctx->Matrices[i]->erased, 1, nflags, fp);
+        ckpt_put_int(w, dec_ctx->Matrices[i]->remaining_rows);
+        ckpt_put_int(w, dec_ctx->Matrices[i]->remaining_cols);
+        ckpt_put(w, dec_ctx->Matrices[i]->erased, nflags);
         for (j=0; j<dec_ctx->Matrices[i]->remaining_rows; j++) {
-            filesize += fwrite(dec_ctx->Matrices[i]->coefficient[j], sizeof(GF_ELEMENT), gensize, fp);
-            filesize += fwrite(dec_ctx->Matrices[i]->message[j], sizeof(GF_ELEMENT), pktsize, fp);
+            ckpt_put_row(w, dec_ctx->Matrices[i]->coefficient[j], gensize);
+            ckpt_put_payload(w, dec_ctx->Matrices[i]->message[j]);
         }
     }
     // Save recent ID_list
     count = 0;
-    ID *id = dec_ctx->recent->first;
-    while (id != NULL) {
+    ID *id;
+    for (id=dec_ctx->recent->first; id!=NULL; id=id->next)
         count++;
-        id = id->next;
-    }
-    filesize += fwrite(&count, sizeof(int), 1, fp);  // Number of recent IDs in the list
-    id = dec_ctx->recent->first;
-    while (count > 0) {
-        fwrite(&id->data, sizeof(int), 1, fp);
-        count--;
-        id = id->next;
-    }
+    ckpt_put_int(w, count);     // Number of recent IDs in the list
+    for (id=dec_ctx->recent->first; id!=NULL; id=id->next)
+        ckpt_put_int(w, id->data);
     // Save performance index
-    filesize += fwrite(&dec_ctx->overhead, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->operations, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops1, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops2, sizeof(long long), 1, fp);
-    fclose(fp);
-    return filesize;
+    ckpt_put_int(w, dec_ctx->overhead);
+    ckpt_put(w, &dec_ctx->operations, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops1, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops2, sizeof(long long));
 }
 
-struct decoding_context_GG *restore_dec_context_GG(const char *filepath)
+struct decoding_context_GG *restore_dec_context_GG(struct ckpt_reader *r, struct snc_parameters *sp)
 {
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
-        return NULL;
-    }
-    struct snc_parameters sp;
-    fread(&sp, sizeof(struct snc_parameters), 1, fp);
     // Create a fresh decoding context
-    struct decoding_context_GG *dec_ctx = create_dec_context_GG(&sp);
+    struct decoding_context_GG *dec_ctx = create_dec_context_GG(sp);
     if (dec_ctx == NULL) {
         fprintf(stderr, "malloc decoding_context_GG failed\n");
         return NULL;
     }
-    // Restore decoding context from file
-    fseek(fp, sizeof(int), SEEK_CUR);  // skip decoding_type field
-    // Restore already decoded packets
-    int i, j, k;
-    fread(&dec_ctx->decoded, sizeof(int), 1, fp);
-    for (i=0; i<dec_ctx->decoded; i++) {
-        int pktid;
-        fread(&pktid, sizeof(int), 1, fp);
-        dec_ctx->sc->pp[pktid] = calloc(sp.size_p, sizeof(GF_ELEMENT));
-        fread(dec_ctx->sc->pp[pktid], sizeof(GF_ELEMENT), sp.size_p, fp);
-    }
+    // Restore decoding context from checkpoint
+    int i, j;
+    int gensize = dec_ctx->sc->params.size_g;
+    dec_ctx->decoded = ckpt_get_int(r);
     // Restore evolving packets
-    int count;
-    fread(&count, sizeof(int), 1, fp);
+    int count = ckpt_get_int(r);
     for (i=0; i<count; i++) {
-        int evoid;
-        fread(&evoid, sizeof(int), 1, fp);
-        dec_ctx->evolving_checks[evoid] = calloc(sp.size_p, sizeof(GF_ELEMENT));
-        fread(dec_ctx->evolving_checks[evoid], sizeof(GF_ELEMENT), sp.size_p, fp);
+        int evoid = ckpt_get_int(r);
+        if (evoid < 0 || evoid >= dec_ctx->sc->cnum || dec_ctx->evolving_checks[evoid] != NULL)
+            goto Corrupted;
+        if ((dec_ctx->evolving_checks[evoid] = malloc(sp->size_p * sizeof(GF_ELEMENT))) == NULL)
+            goto Corrupted;
+        ckpt_copy_payload(r, dec_ctx->evolving_checks[evoid]);
     }
     // Restore check degrees
-    fread(dec_ctx->check_degrees, sizeof(int), dec_ctx->sc->cnum, fp);
-    fread(&dec_ctx->finished, sizeof(int), 1, fp);
-    fread(&dec_ctx->decoded, sizeof(int), 1, fp);
-    fread(&dec_ctx->originals, sizeof(int), 1, fp);
+    ckpt_get(r, dec_ctx->check_degrees, sizeof(int)*dec_ctx->sc->cnum);
+    dec_ctx->finished  = ckpt_get_int(r);
+    dec_ctx->originals = ckpt_get_int(r);
     // Restore running matrices
-    // Note that running matrices' memory were already allocated in creating_dec_context
+    // Note that matrices are only allocated for generations having rows
+    int nflags = ALIGN(gensize, 8);
     for (i=0; i<dec_ctx->sc->gnum; i++) {
-        fread(&dec_ctx->Matrices[i]->remaining_rows, sizeof(int), 1, fp);
-        fread(&dec_ctx->Matrices[i]->remaining_cols, sizeof(int), 1, fp);
-        int nflags = ALIGN(dec_ctx->sc->params.size_g, 8);
-        fread(dec_ctx->Matrices[i]->erased, 1, nflags, fp);
+        dec_ctx->Matrices[i]->remaining_rows = ckpt_get_int(r);
+        dec_ctx->Matrices[i]->remaining_cols = ckpt_get_int(r);
+        if (dec_ctx->Matrices[i]->remaining_rows < 0 || dec_ctx->Matrices[i]->remaining_rows > gensize)
+            goto Corrupted;
+        ckpt_get(r, dec_ctx->Matrices[i]->erased, nflags);
+        if (dec_ctx->Matrices[i]->remaining_rows > 0 && grab_matrix(dec_ctx, dec_ctx->Matrices[i]) != 0)
+            goto Corrupted;
         for (j=0; j<dec_ctx->Matrices[i]->remaining_rows; j++) {
-            fread(dec_ctx->Matrices[i]->coefficient[j], sizeof(GF_ELEMENT), sp.size_g, fp);
-            fread(dec_ctx->Matrices[i]->message[j], sizeof(GF_ELEMENT), sp.size_p, fp);
+            ckpt_get_row(r, dec_ctx->Matrices[i]->coefficient[j], gensize);
+            if ((dec_ctx->Matrices[i]->message[j] = malloc(sp->size_p * sizeof(GF_ELEMENT))) == NULL)
+                goto Corrupted;
+            ckpt_copy_payload(r, dec_ctx->Matrices[i]->message[j]);
         }
     }
     // Restore recent ID_list
-    fread(&count, sizeof(int), 1, fp);
+    count = ckpt_get_int(r);
     ID *new_id;
     for (i=0; i<count; i++) {
         if ( (new_id = malloc(sizeof(ID))) == NULL )
-            fprintf(stderr, "malloc new ID failed\n");
-        fread(&new_id->data, sizeof(int), 1, fp);
+            goto Corrupted;
+        new_id->data = ckpt_get_int(r);
         new_id->next = NULL;
         append_to_list(dec_ctx->recent, new_id);
     }
     // Restore performance index
-    fread(&dec_ctx->overhead, sizeof(int), 1, fp);
-    fread(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops1, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops2, sizeof(long long), 1, fp);
-    fclose(fp);
+    dec_ctx->overhead = ckpt_get_int(r);
+    ckpt_get(r, &dec_ctx->operations, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops1, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops2, sizeof(long long));
     return dec_ctx;
+
+Corrupted:
+    free_dec_context_GG(dec_ctx);
+    return NULL;
 }
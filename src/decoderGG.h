@@ -7,6 +7,7 @@ typedef struct node      ID;
 typedef struct node_list ID_list;
 
 struct running_matrix;
+struct gg_workers;
 
 struct decoding_context_GG {
     struct snc_context  *sc;            // The file information
@@ -25,6 +26,7 @@ struct decoding_context_GG {
     int decoded;                        // record how many packets have been decoded
     int originals;                      // record how many source packets are decoded
     struct running_matrix **Matrices;   // record running matrices of each class
+    GF_ELEMENT **spare;                 // coefficient matrix of a released generation kept for reuse
     ID_list *recent;                    // record most recently decoded packets IDs
     /*******************************************
      * Used if feedback to encoder is allowed
@@ -41,6 +43,16 @@ struct decoding_context_GG {
     long long ops1, ops2;               // splitted decoding operations
                                         // ops1 - operations invoked by Gaussian elimination
                                         // ops2 - operations invoked by substitutions
+
+    struct finish_state fin;            // pending iterative decoding (see resume_decoding_GG())
+    ID *cursor;                         // next recently decoded packet for the pending stage
+
+    /*******************************************
+     * Used in parallel GG decoding
+     ******************************************/
+    int gfirst, gend;                   // generations [gfirst, gend) decoded by the context
+    int nworkers;                       // worker threads requested (0 if decoding serially)
+    struct gg_workers *workers;         // shared state of the workers once started, or NULL
 };
 
 /**
@@ -54,13 +66,24 @@ void free_dec_context_GG(struct decoding_context_GG *dec_ctx);
 void process_packet_GG(struct decoding_context_GG *dec_ctx, struct snc_packet *pkt);
 
 /**
- * File format to store ongoing decoding context
- *
- * snc_parameter
- * decoder_type
- * decoding_context_GG (excluding snc_context)
- *
+ * Whether decoding is finished. The workers of a parallel GG decoder
+ * are stopped once it is.
+ */
+int decoding_finished_GG(struct decoding_context_GG *dec_ctx);
+
+/**
+ * Run pending iterative decoding (triggered by process_packet_GG when a
+ * generation is decoded) until about budget operations are used up.
+ * Return 1 if work remains pending, 0 otherwise.
+ */
+int resume_decoding_GG(struct decoding_context_GG *dec_ctx, long long budget);
+
+/**
+ * Save/restore ongoing decoding context to/from a checkpoint
+ * (see checkpoint.c for the file format)
  */
-long save_dec_context_GG(struct decoding_context_GG *dec_ctx, const char *filepath);
-struct decoding_context_GG *restore_dec_context_GG(const char *filepath);
+struct ckpt_writer;
+struct ckpt_reader;
+void save_dec_context_GG(struct decoding_context_GG *dec_ctx, struct ckpt_writer *w);
+struct decoding_context_GG *restore_dec_context_GG(struct ckpt_reader *r, struct snc_parameters *sp);
 #endif /* GG_DECODER */
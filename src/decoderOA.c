@@ -28,21 +28,30 @@ static long running_matrix_to_REF(struct decoding_context_OA *dec_ctx);
  * -                -
  */
 static void construct_GDM(struct decoding_context_OA *dec_ctx);
+static int pivot_GDM(struct decoding_context_OA *dec_ctx);
 
 /*
- * Fully transform GDM to identity matrix to finish decoding.
+ * Fully transform GDM to identity matrix to finish decoding. The work
+ * proceeds in stages, from unit fin.pos of stage fin.stage on, until
+ * about budget operations are done in the slice.
  */
-static void diagonalize_GDM(struct decoding_context_OA *dec_ctx);
+static void diagonalize_GDM(struct decoding_context_OA *dec_ctx, long long budget);
+
+#define OA_INACTIVE     1   // recover inactivated packets (one unit)
+#define OA_CLEAN        2   // clean up the inactive part of the upper half, per inactive column
+#define OA_ACTIVE       3   // recover active packets, per row
+#define OA_PIVOT        4   // retry pivoting GDM that failed for lack of memory
 
 /* Free running matrix */
 static void free_running_matrix(struct running_matrix *mat, int rows);
 
 extern long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
 extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
-extern long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ctoo_r, int **ctoo_c, int *inactives);
-extern long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ctoo_r, int **ctoo_c, int *inactives);
+extern long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ctoo_r, int **ctoo_c, int *inactives);
+extern long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ctoo_r, int **ctoo_c, int *inactives);
 
-static clock_t l_proc_start = 0;   // local processing start
+static __thread clock_t l_proc_start = 0;   // local processing start (per thread, decoders may run concurrently)
+static __thread clock_t d_proc_time  = 0;   // time taken by diagonalizing GDM
 
 /*
  * snc_create_dec_context_OA
@@ -74,6 +83,13 @@ struct decoding_context_OA *create_dec_context_OA(struct snc_parameters *sp, int
     dec_ctx->OA_ready   = 0;
     dec_ctx->local_DoF  = 0;
     dec_ctx->global_DoF = 0;
+    dec_ctx->JMBcoefficient = NULL;     // GDM is allocated when OA ready
+    dec_ctx->JMBmessage     = NULL;
+    dec_ctx->ctoo_r         = NULL;
+    dec_ctx->ctoo_c         = NULL;
+    dec_ctx->dsts           = NULL;
+    dec_ctx->qs             = NULL;
+    dec_ctx->fin.stage      = FINISH_IDLE;
 
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
@@ -110,7 +126,15 @@ struct decoding_context_OA *create_dec_context_OA(struct snc_parameters *sp, int
     /*
      * We don't allocate memory for global decoding (ie GDM) here. We only allocate
      * when OA ready. This avoids occupying a big amount of memory for a long time.
+     * Only the (small) scratch of cleaning up GDM is allocated once for all slices
+     * of stepped decoding.
      */
+    dec_ctx->dsts = malloc(sizeof(GF_ELEMENT*) * numpp);
+    dec_ctx->qs   = malloc(sizeof(GF_ELEMENT) * numpp);
+    if (dec_ctx->dsts == NULL || dec_ctx->qs == NULL) {
+        fprintf(stderr, "%s: malloc GDM clean-up scratch failed\n", fname);
+        goto AllocError;
+    }
 
     // performance indices
     dec_ctx->operations = 0;
@@ -143,6 +167,11 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
     int pivotfound = 0;
     int pivot;
 
+    // Systematic packets (gid=-1) are not used by the OA decoder, and
+    // may not carry coefficients
+    if (gid == -1)
+        return;
+
     /*
      * If decoder is not OA ready, process the packet within the generation.
      */
@@ -160,7 +189,7 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
             if (pkt_coes[i] != 0) {
                 if (matrix->row[i] != NULL) {
                     quotient = galois_divide(pkt_coes[i], matrix->row[i]->elem[0]);
-                    galois_multiply_add_region(&(pkt_coes[i]), matrix->row[i]->elem, quotient, matrix->row[i]->len);
+                    galois_multiply_add_region_short(&(pkt_coes[i]), matrix->row[i]->elem, quotient, matrix->row[i]->len);
                     galois_multiply_add_region(pkt->syms, matrix->message[i], quotient, pktsize);
                     dec_ctx->operations += 1 + matrix->row[i]->len + pktsize;
                     dec_ctx->ops1 += 1 + matrix->row[i]->len + pktsize;
@@ -197,6 +226,7 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
             clock_t start, stop;
             start = clock();
             construct_GDM(dec_ctx);
+            int pivoted = pivot_GDM(dec_ctx);
             stop = clock();
             if (get_loglevel() == TRACE) {
                 printf("Construct GDM took %.6f seconds\n", ((double) (stop-start))/CLOCKS_PER_SEC);
@@ -204,13 +234,12 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
 
             // If numpp innovative packets are received, recover all
             // source packets from JMBcoeffcient and JMBmessage
-            if (dec_ctx->global_DoF == numpp) {
-                start = clock();
-                diagonalize_GDM(dec_ctx);
-                stop = clock();
-                if (get_loglevel() == TRACE) {
-                    printf("Diagonalize GDM took %.6f seconds\n", ((double) (stop-start))/CLOCKS_PER_SEC);
-                }
+            // (left to resume_decoding_OA())
+            if (pivoted != 0) {
+                dec_ctx->fin.stage = OA_PIVOT;
+            } else if (dec_ctx->global_DoF == numpp) {
+                dec_ctx->fin.stage = OA_INACTIVE;
+                dec_ctx->fin.pos   = 0;
             }
         }
     } else {
@@ -221,15 +250,7 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
          * to transform the GEV according to the pivoting order.
          */
         GF_ELEMENT *re_ordered = calloc(numpp, sizeof(GF_ELEMENT));
-        for (i=0; i<gensize; i++) {
-            /* obtain index position of pktid in the full-length vector */
-            int curr_pos = dec_ctx->sc->gene[gid]->pktid[i];
-            if (dec_ctx->sc->params.bnc) {
-                re_ordered[curr_pos] = get_bit_in_array(pkt->coes, i);
-            } else {
-                re_ordered[curr_pos] = pkt->coes[i];
-            }
-        }
+        expand_coes(dec_ctx->sc, gid, pkt->coes, re_ordered);
 
         /*
          * Process the reordered GEV against GDM
@@ -263,33 +284,49 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
 
             if (dec_ctx->global_DoF == numpp) {
                 // recover all source from JMBcoeffcient & JMBmessage matrix
-                clock_t start, stop;
-                start = clock();
-                diagonalize_GDM(dec_ctx);
-                stop = clock();
-                if (get_loglevel() == TRACE) {
-                    printf("Diagonalize GDM took %.6f seconds\n", ((double) (stop-start))/CLOCKS_PER_SEC);
-                }
+                // (left to resume_decoding_OA())
+                dec_ctx->fin.stage = OA_INACTIVE;
+                dec_ctx->fin.pos   = 0;
             }
         }
         free(re_ordered);
     }
+}
+
+int resume_decoding_OA(struct decoding_context_OA *dec_ctx, long long budget)
+{
+    dec_ctx->fin.work = 0;
+    if (dec_ctx->fin.stage == OA_PIVOT) {
+        if (pivot_GDM(dec_ctx) != 0)
+            return 1;
+        int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+        dec_ctx->fin.stage = dec_ctx->global_DoF == numpp ? OA_INACTIVE : FINISH_IDLE;
+        dec_ctx->fin.pos   = 0;
+    }
+    if (dec_ctx->fin.stage == FINISH_IDLE)
+        return 0;
+    if (dec_ctx->fin.stage == OA_INACTIVE)
+        d_proc_time = 0;
+    clock_t start = clock();
+    diagonalize_GDM(dec_ctx, budget);
+    d_proc_time += clock() - start;
     if (dec_ctx->finished && get_loglevel() == TRACE) {
+        int pktsize = dec_ctx->sc->params.size_p;
+        printf("Diagonalize GDM took %.6f seconds\n", ((double) d_proc_time)/CLOCKS_PER_SEC);
         printf("OA splitted operations: %.2f %.2f %.2f %.2f\n",
                 (double) dec_ctx->ops1/dec_ctx->sc->snum/pktsize,
                 (double) dec_ctx->ops2/dec_ctx->sc->snum/pktsize,
                 (double) dec_ctx->ops3/dec_ctx->sc->snum/pktsize,
                 (double) dec_ctx->ops4/dec_ctx->sc->snum/pktsize);
     }
+    return dec_ctx->fin.stage != FINISH_IDLE;
 }
 
 void free_dec_context_OA(struct decoding_context_OA *dec_ctx)
 {
     if (dec_ctx == NULL)
         return;
-    if (dec_ctx->sc != NULL)
-        snc_free_enc_context(dec_ctx->sc);
-    int i, j, k;
+    int i, k;
     if (dec_ctx->Matrices != NULL) {
         for (i=0; i<dec_ctx->sc->gnum; i++){
             // Free each decoding matrix
@@ -300,24 +337,16 @@ void free_dec_context_OA(struct decoding_context_OA *dec_ctx)
         free(dec_ctx->Matrices);
         dec_ctx->Matrices = NULL;
     }
-    if (dec_ctx->JMBcoefficient != NULL) {
-        for (j=0; j<dec_ctx->sc->snum+dec_ctx->sc->cnum+dec_ctx->aoh; j++) {
-            if (dec_ctx->JMBcoefficient[j] != NULL)
-                free(dec_ctx->JMBcoefficient[j]);
-        }
-        free(dec_ctx->JMBcoefficient);
-    }
-    if (dec_ctx->JMBmessage != NULL) {
-        for (j=0; j<dec_ctx->sc->snum+dec_ctx->sc->cnum+dec_ctx->aoh; j++) {
-            if (dec_ctx->JMBmessage[j] != NULL)
-                free(dec_ctx->JMBmessage[j]);
-        }
-        free(dec_ctx->JMBmessage);
-    }
+    free_matrix(dec_ctx->JMBcoefficient);
+    free_matrix(dec_ctx->JMBmessage);
     if (dec_ctx->ctoo_r != NULL)
         free(dec_ctx->ctoo_r);
     if (dec_ctx->ctoo_c != NULL)
         free(dec_ctx->ctoo_c);
+    free(dec_ctx->dsts);
+    free(dec_ctx->qs);
+    if (dec_ctx->sc != NULL)
+        snc_free_enc_context(dec_ctx->sc);
     free(dec_ctx);
     dec_ctx = NULL;
     return;
@@ -347,7 +376,7 @@ static void free_running_matrix(struct running_matrix *mat, int rows)
     }
 }
 
-static void diagonalize_GDM(struct decoding_context_OA *dec_ctx)
+static void diagonalize_GDM(struct decoding_context_OA *dec_ctx, long long budget)
 {
     static char fname[] = "finish_recovering_inactivation";
     int i, j, k;
@@ -357,70 +386,86 @@ static void diagonalize_GDM(struct decoding_context_OA *dec_ctx)
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-
-    // Recover inactivated packets
-    if (get_loglevel() == TRACE) {
-        printf("Finishing decoding...\n");
-        printf("Recovering \"inactive\" packets...\n");
-    }
     int ias = dec_ctx->inactives;
-    GF_ELEMENT **ces_submatrix = calloc(ias, sizeof(GF_ELEMENT*));
-    GF_ELEMENT **msg_submatrix = calloc(ias, sizeof(GF_ELEMENT*));
-    for (i=0; i<ias; i++) {
-        ces_submatrix[i] = calloc(ias, sizeof(GF_ELEMENT));
-        msg_submatrix[i] = calloc(pktsize, sizeof(GF_ELEMENT));
-        for (j=0; j<ias; j++)
-            ces_submatrix[i][j] = dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[numpp-ias+i]][dec_ctx->ctoo_c[numpp-ias+j]];
-        memcpy(msg_submatrix[i], dec_ctx->JMBmessage[dec_ctx->ctoo_r[numpp-ias+i]], pktsize*sizeof(GF_ELEMENT));
-    }
+    struct finish_state *fin = &dec_ctx->fin;
 
-    /* Perform back substitution to reduce the "ias x ias" matrix to identity matrix */
-    long long ops = back_substitute(ias, ias, pktsize, ces_submatrix, msg_submatrix);
-    dec_ctx->operations += ops;
-    dec_ctx->ops4 += ops;
-
-    // Recover decoded overlapping packets
-    for (i=0; i<ias; i++) {
-        // get original pktid at column (numpp-ias+i0
-        pktid = dec_ctx->ctoo_c[numpp-ias+i];
-        // Construct decoded packets
-        if ( (dec_ctx->sc->pp[pktid] = calloc(pktsize, sizeof(GF_ELEMENT))) == NULL )
-            fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, pktid);
-        memcpy(dec_ctx->sc->pp[pktid], msg_submatrix[i], sizeof(GF_ELEMENT)*pktsize);
-    }
-    // Copy back msg_submatrix
-    for (i=0; i<ias; i++)
-        memcpy(dec_ctx->JMBmessage[dec_ctx->ctoo_r[numpp-ias+i]], msg_submatrix[i], pktsize*sizeof(GF_ELEMENT));
-    // free ces_submatrix, msg_submatrix
-    for (i=0; i<ias; i++) {
-        free(ces_submatrix[i]);
-        free(msg_submatrix[i]);
-    }
-    free(ces_submatrix);
-    free(msg_submatrix);
+    if (fin->stage == OA_INACTIVE) {
+        // Recover inactivated packets
+        if (get_loglevel() == TRACE) {
+            printf("Finishing decoding...\n");
+            printf("Recovering \"inactive\" packets...\n");
+        }
+        GF_ELEMENT **ces_submatrix = create_matrix(ias, ias);
+        GF_ELEMENT **msg_submatrix = create_matrix(ias, pktsize);
+        for (i=0; i<ias; i++) {
+            for (j=0; j<ias; j++)
+                ces_submatrix[i][j] = dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[numpp-ias+i]][dec_ctx->ctoo_c[numpp-ias+j]];
+            memcpy(msg_submatrix[i], dec_ctx->JMBmessage[dec_ctx->ctoo_r[numpp-ias+i]], pktsize*sizeof(GF_ELEMENT));
+        }
 
+        /* Perform back substitution to reduce the "ias x ias" matrix to identity matrix */
+        long long ops = back_substitute(ias, ias, pktsize, ces_submatrix, msg_submatrix);
+        dec_ctx->operations += ops;
+        dec_ctx->ops4 += ops;
+        fin->work += ops + (long long) ias * pktsize;
+
+        // Recover decoded overlapping packets
+        for (i=0; i<ias; i++) {
+            // get original pktid at column (numpp-ias+i0
+            pktid = dec_ctx->ctoo_c[numpp-ias+i];
+            // Construct decoded packets
+            if ( (dec_ctx->sc->pp[pktid] = alloc_decoded(dec_ctx->sc, pktid)) == NULL )
+                fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, pktid);
+            memcpy(dec_ctx->sc->pp[pktid], msg_submatrix[i], sizeof(GF_ELEMENT)*pktsize);
+        }
+        // Copy back msg_submatrix
+        for (i=0; i<ias; i++)
+            memcpy(dec_ctx->JMBmessage[dec_ctx->ctoo_r[numpp-ias+i]], msg_submatrix[i], pktsize*sizeof(GF_ELEMENT));
+        free_matrix(ces_submatrix);
+        free_matrix(msg_submatrix);
+        fin->stage = OA_CLEAN;
+        fin->pos   = numpp - ias;
+        if (fin->work >= budget)
+            return;
+    }
 
-    // Recover active packets
-    if (get_loglevel() == TRACE)
-        printf("Recovering \"active\" packets...\n");
     GF_ELEMENT quotient;
-    for (i=0; i<numpp-ias; i++) {
+    if (fin->stage == OA_CLEAN) {
+        // Recover active packets
+        if (fin->pos == numpp - ias && get_loglevel() == TRACE)
+            printf("Recovering \"active\" packets...\n");
         /*
          * Clean up the inactive part of the upper half of GDM by
-         * masking non-zero element aginst already decoded inactive packets
-         *
+         * masking non-zero element aginst already decoded inactive packets.
+         * Each decoded inactive packet is applied to all active rows at once.
          */
-        for (j=numpp-ias; j<numpp; j++) {
-            if (dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] != 0) {
-                quotient = dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]];
-                pktid = dec_ctx->ctoo_c[j];
-                galois_multiply_add_region(dec_ctx->JMBmessage[dec_ctx->ctoo_r[i]], dec_ctx->sc->pp[pktid], quotient, pktsize);
-                dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] = 0;
-                dec_ctx->operations += pktsize;
-                dec_ctx->ops4 += pktsize;
+        GF_ELEMENT **dsts = dec_ctx->dsts;
+        GF_ELEMENT *qs = dec_ctx->qs;
+        int ndst;
+        for (j=fin->pos; j<numpp && fin->work<budget; j++) {
+            ndst = 0;
+            pktid = dec_ctx->ctoo_c[j];
+            for (i=0; i<numpp-ias; i++) {
+                if (dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] != 0) {
+                    dsts[ndst] = dec_ctx->JMBmessage[dec_ctx->ctoo_r[i]];
+                    qs[ndst++] = dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]];
+                    dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[j]] = 0;
+                    dec_ctx->operations += pktsize;
+                    dec_ctx->ops4 += pktsize;
+                }
             }
+            if (ndst != 0)
+                galois_multiply_add_region_multi(dsts, dec_ctx->sc->pp[pktid], qs, ndst, pktsize);
+            fin->work += (long long) ndst * pktsize + numpp - ias;
         }
+        fin->pos = j;
+        if (j < numpp)
+            return;
+        fin->stage = OA_ACTIVE;
+        fin->pos   = 0;
+    }
 
+    for (i=fin->pos; i<numpp-ias && fin->work<budget; i++) {
         // Convert diagonal elements of top-left part of T to 1
         quotient = dec_ctx->JMBcoefficient[dec_ctx->ctoo_r[i]][dec_ctx->ctoo_c[i]];
         if (quotient != 1) {
@@ -434,11 +479,16 @@ static void diagonalize_GDM(struct decoding_context_OA *dec_ctx)
         pktid = dec_ctx->ctoo_c[i];
         if ( dec_ctx->sc->pp[pktid] != NULL )
             fprintf(stderr, "%s：warning: packet %d is already recovered.\n", fname, pktid);
-        if ( (dec_ctx->sc->pp[pktid] = calloc(pktsize, sizeof(GF_ELEMENT))) == NULL )
+        if ( (dec_ctx->sc->pp[pktid] = alloc_decoded(dec_ctx->sc, pktid)) == NULL )
             fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, pktid);
         memcpy(dec_ctx->sc->pp[pktid], dec_ctx->JMBmessage[dec_ctx->ctoo_r[i]], sizeof(GF_ELEMENT)*pktsize);
+        fin->work += 2 * pktsize;
     }
+    fin->pos = i;
+    if (i < numpp-ias)
+        return;
 
+    fin->stage = FINISH_IDLE;
     dec_ctx->finished = 1;
 }
 
@@ -504,17 +554,12 @@ static void construct_GDM(struct decoding_context_OA *dec_ctx)
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
     //Allocate GDM to snc_dec_context, apply precoding matrix
-    dec_ctx->JMBcoefficient = calloc(numpp+dec_ctx->aoh, sizeof(GF_ELEMENT*));
+    dec_ctx->JMBcoefficient = create_matrix(numpp+dec_ctx->aoh, numpp);
     if (dec_ctx->JMBcoefficient == NULL)
-        fprintf(stderr, "%s: calloc dec_ctx->JMBcoefficient\n", fname);
-    dec_ctx->JMBmessage     = calloc(numpp+dec_ctx->aoh, sizeof(GF_ELEMENT*));
+        fprintf(stderr, "%s: create_matrix dec_ctx->JMBcoefficient\n", fname);
+    dec_ctx->JMBmessage     = create_matrix(numpp+dec_ctx->aoh, pktsize);
     if (dec_ctx->JMBmessage == NULL)
-        fprintf(stderr, "%s: calloc dec_ctx->JMBmessage\n", fname);
-
-    for (i=0; i<numpp+dec_ctx->aoh; i++) {
-        dec_ctx->JMBcoefficient[i] = calloc(numpp, sizeof(GF_ELEMENT));
-        dec_ctx->JMBmessage[i]     = calloc(pktsize, sizeof(GF_ELEMENT));
-    }
+        fprintf(stderr, "%s: create_matrix dec_ctx->JMBmessage\n", fname);
     dec_ctx->inactives   = 0;
     dec_ctx->ctoo_r = malloc(sizeof(int) * numpp);
     dec_ctx->ctoo_c = malloc(sizeof(int) * numpp);
@@ -532,7 +577,7 @@ static void construct_GDM(struct decoding_context_OA *dec_ctx)
     }
 
     // Step 1, translate LEVs to GEV and move them to GDM
-    GF_ELEMENT *global_ces = calloc(numpp, sizeof(GF_ELEMENT));
+    // Rows of GDM are zero-initialized, so only the local entries are written
     int p_copy = 0;                             // 拷贝到JMBcofficient的行指针
     for (i=0; i<dec_ctx->sc->gnum; i++) {
         matrix = dec_ctx->Matrices[i];
@@ -540,16 +585,17 @@ static void construct_GDM(struct decoding_context_OA *dec_ctx)
             if (matrix->row[j] == NULL)
                 continue;                       // there is no local DoF here
             else {
-                memset(global_ces, 0, numpp*sizeof(GF_ELEMENT));    /* Reset before reuse */
-                for (k=j; k<gensize; k++)
-                    global_ces[dec_ctx->sc->gene[i]->pktid[k]] = matrix->row[j]->elem[k-j];
-                memcpy(dec_ctx->JMBcoefficient[p_copy], global_ces, numpp*sizeof(GF_ELEMENT));
+                for (k=j; k<gensize; k++) {
+                    if (matrix->row[j]->elem[k-j] == 0)
+                        continue;
+                    int col = gene_pktid(dec_ctx->sc, i, k);
+                    dec_ctx->JMBcoefficient[p_copy][col] = matrix->row[j]->elem[k-j];
+                }
                 memcpy(dec_ctx->JMBmessage[p_copy], matrix->message[j], pktsize*sizeof(GF_ELEMENT));
                 p_copy += 1;
             }
         }
     }
-    free(global_ces);
     if (get_loglevel() == TRACE)
         printf("%d local DoFs are available, copied %d to GDM.\n", dec_ctx->local_DoF, p_copy);
     // Free up local matrices
@@ -559,18 +605,36 @@ static void construct_GDM(struct decoding_context_OA *dec_ctx)
     }
     free(dec_ctx->Matrices);
     dec_ctx->Matrices = NULL;
+}
+
+/*
+ * Transform GDM to upper trianguler via pivoting. GDM is built in one
+ * pass above, so pivoting scans it for nonzeros rather than being given
+ * a pattern.
+ * Return 0 on success, -1 if pivoting failed for lack of memory (GDM is
+ * left as it was).
+ */
+static int pivot_GDM(struct decoding_context_OA *dec_ctx)
+{
+    static char fname[] = "pivot_GDM";
+    int i;
+    int pktsize = dec_ctx->sc->params.size_p;
+    int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
 
-    /* Transform GDM to upper trianguler via pivoting */
     clock_t start_pivoting, stop_pivoting;
     start_pivoting = clock();
     long long ops;
     if (getenv("SNC_OA_ONEROUND") != NULL
          && atoi(getenv("SNC_OA_ONEROUND")) == 1) {
-        ops = pivot_matrix_oneround(numpp+dec_ctx->aoh, numpp, pktsize, dec_ctx->JMBcoefficient, dec_ctx->JMBmessage, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactives));
+        ops = pivot_matrix_oneround(numpp+dec_ctx->aoh, numpp, pktsize, dec_ctx->JMBcoefficient, dec_ctx->JMBmessage, NULL, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactives));
     } else {
-        ops = pivot_matrix_tworound(numpp+dec_ctx->aoh, numpp, pktsize, dec_ctx->JMBcoefficient, dec_ctx->JMBmessage, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactives));
+        ops = pivot_matrix_tworound(numpp+dec_ctx->aoh, numpp, pktsize, dec_ctx->JMBcoefficient, dec_ctx->JMBmessage, NULL, &dec_ctx->ctoo_r, &dec_ctx->ctoo_c, &(dec_ctx->inactives));
     }
     stop_pivoting = clock();
+    if (ops < 0) {
+        fprintf(stderr, "%s: pivoting failed, to be retried\n", fname);
+        return -1;
+    }
     dec_ctx->operations += ops;
     dec_ctx->ops2 += ops;
     // Count available degree of freedom
@@ -583,136 +647,130 @@ static void construct_GDM(struct decoding_context_OA *dec_ctx)
         printf("Pivoting and forward substitution in total consumed %.6f seconds.\n", pivot_time);
         printf("A total of %d DoF have been received.\n", dec_ctx->global_DoF);
     }
+    return 0;
 }
 
-/**
- * Save a decoding context to a file
- * Return values:
- *   On success: bytes written
- *   On error: -1
+/*
+ * Save a decoding context to a checkpoint. Local matrices are saved before
+ * the decoder is OA ready, and the GDM (in sparse form) afterwards.
  */
-long save_dec_context_OA(struct decoding_context_OA *dec_ctx, const char *filepath)
+void save_dec_context_OA(struct decoding_context_OA *dec_ctx, struct ckpt_writer *w)
 {
-    long filesize = 0;
-    int d_type = OA_DECODER;
-    FILE *fp;
-    if ((fp = fopen(filepath, "w")) == NULL) {
-        fprintf(stderr, "Cannot open %s to save decoding context\n", filepath);
-        return (-1);
-    }
     int i, j;
     int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-    // Write snc params
-    filesize += fwrite(&dec_ctx->sc->params, sizeof(struct snc_parameters), 1, fp);
-    // Write decoder type
-    filesize += fwrite(&(d_type), sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->aoh, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->finished, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->OA_ready, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->local_DoF, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->global_DoF, sizeof(int), 1, fp);
-    // Save running matrices
-    // FIXME: if OA_ready=1, Matrices have been freed.
-    for (i=0; i<dec_ctx->sc->gnum; i++) {
-        for (j=0; j<gensize; j++) {
-            int rowlen = dec_ctx->Matrices[i]->row[j] == NULL ? 0 : dec_ctx->Matrices[i]->row[j]->len;
-            filesize += fwrite(&rowlen, sizeof(int), 1, fp);
-            if (rowlen != 0) {
-                filesize += fwrite(dec_ctx->Matrices[i]->row[j]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-                filesize += fwrite(dec_ctx->Matrices[i]->message[j], sizeof(GF_ELEMENT), pktsize, fp);
+    ckpt_put_int(w, dec_ctx->aoh);
+    ckpt_put_int(w, dec_ctx->finished);
+    ckpt_put_int(w, dec_ctx->OA_ready);
+    ckpt_put_int(w, dec_ctx->local_DoF);
+    ckpt_put_int(w, dec_ctx->global_DoF);
+    if (dec_ctx->OA_ready == 0) {
+        // Save running matrices (they are freed once OA ready)
+        for (i=0; i<dec_ctx->sc->gnum; i++) {
+            for (j=0; j<gensize; j++) {
+                if (dec_ctx->Matrices[i]->row[j] == NULL) {
+                    ckpt_put_int(w, -1);
+                    continue;
+                }
+                ckpt_put_int(w, j);
+                ckpt_put_row(w, dec_ctx->Matrices[i]->row[j]->elem, dec_ctx->Matrices[i]->row[j]->len);
+                ckpt_put_payload(w, dec_ctx->Matrices[i]->message[j]);
             }
         }
-    }
-
-    // Save GDM and its related bookkeeping information if OA ready.
-    // Fixme: GDM is sparse, so we can save space by using compact representation
-    // of the matrix. For example, save [row, col, value] for nonzero elements.
-    if (dec_ctx->OA_ready == 1) {
-        for (i=0; i<numpp + dec_ctx->aoh; i++) {
-            filesize += fwrite(dec_ctx->JMBcoefficient[i], sizeof(GF_ELEMENT), numpp, fp);
-            filesize += fwrite(dec_ctx->JMBmessage[i], sizeof(GF_ELEMENT), pktsize, fp);
+    } else {
+        // Save GDM and its related bookkeeping information
+        for (i=0; i<numpp+dec_ctx->aoh; i++) {
+            ckpt_put_row(w, dec_ctx->JMBcoefficient[i], numpp);
+            ckpt_put_payload(w, dec_ctx->JMBmessage[i]);
         }
-        filesize += fwrite(dec_ctx->ctoo_r, sizeof(int), numpp, fp);
-        filesize += fwrite(dec_ctx->ctoo_c, sizeof(int), numpp, fp);
-        filesize += fwrite(&dec_ctx->inactives, sizeof(int), 1, fp);
+        ckpt_put(w, dec_ctx->ctoo_r, sizeof(int)*numpp);
+        ckpt_put(w, dec_ctx->ctoo_c, sizeof(int)*numpp);
+        ckpt_put_int(w, dec_ctx->inactives);
     }
     // Save performance index
-    filesize += fwrite(&dec_ctx->overhead, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->operations, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops1, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops2, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops3, sizeof(long long), 1, fp);
-    filesize += fwrite(&dec_ctx->ops4, sizeof(long long), 1, fp);
-    fclose(fp);
-    return filesize;
+    ckpt_put_int(w, dec_ctx->overhead);
+    ckpt_put(w, &dec_ctx->operations, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops1, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops2, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops3, sizeof(long long));
+    ckpt_put(w, &dec_ctx->ops4, sizeof(long long));
 }
 
-struct decoding_context_OA *restore_dec_context_OA(const char *filepath)
+struct decoding_context_OA *restore_dec_context_OA(struct ckpt_reader *r, struct snc_parameters *sp)
 {
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
+    int aoh = ckpt_get_int(r);
+    if (aoh < 0)
         return NULL;
-    }
-    struct snc_parameters sp;
-    fread(&sp, sizeof(struct snc_parameters), 1, fp);
-    fseek(fp, sizeof(int), SEEK_CUR);  // skip decoding_type field
-    int aoh;
-    fread(&aoh, sizeof(int), 1, fp);
     // Create a fresh decoding context
-    struct decoding_context_OA *dec_ctx = create_dec_context_OA(&sp, aoh);
+    struct decoding_context_OA *dec_ctx = create_dec_context_OA(sp, aoh);
     if (dec_ctx == NULL) {
-        fprintf(stderr, "malloc decoding_context_GG failed\n");
+        fprintf(stderr, "malloc decoding_context_OA failed\n");
         return NULL;
     }
-    // Restore decoding context from file
+    // Restore decoding context from checkpoint
     int i, j;
-    fread(&dec_ctx->finished, sizeof(int), 1, fp);
-    fread(&dec_ctx->OA_ready, sizeof(int), 1, fp);
-    fread(&dec_ctx->local_DoF, sizeof(int), 1, fp);
-    fread(&dec_ctx->global_DoF, sizeof(int), 1, fp);
-    // Restore running matrices
-    // Note that running matrices' memory were already allocated in creating_dec_context
-    for (i=0; i<dec_ctx->sc->gnum; i++) {
-        for (j=0; j<sp.size_g; j++) {
-            int rowlen = 0;
-            fread(&rowlen, sizeof(int), 1, fp);
-            if (rowlen != 0) {
-                dec_ctx->Matrices[i]->row[j] = malloc(sizeof(struct row_vector));
-                dec_ctx->Matrices[i]->row[j]->len = rowlen;
-                dec_ctx->Matrices[i]->row[j]->elem = (GF_ELEMENT *) malloc(rowlen * sizeof(GF_ELEMENT));
-                fread(dec_ctx->Matrices[i]->row[j]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-                dec_ctx->Matrices[i]->message[j] = (GF_ELEMENT *) malloc(sp.size_p * sizeof(GF_ELEMENT));
-                fread(dec_ctx->Matrices[i]->message[j], sizeof(GF_ELEMENT), sp.size_p, fp);
+    int gensize = dec_ctx->sc->params.size_g;
+    int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
+    dec_ctx->finished   = ckpt_get_int(r);
+    dec_ctx->OA_ready   = ckpt_get_int(r);
+    dec_ctx->local_DoF  = ckpt_get_int(r);
+    dec_ctx->global_DoF = ckpt_get_int(r);
+    if (dec_ctx->OA_ready == 0) {
+        // Restore running matrices
+        // Note that running matrices' memory were already allocated in creating_dec_context
+        for (i=0; i<dec_ctx->sc->gnum; i++) {
+            for (j=0; j<gensize; j++) {
+                int id = ckpt_get_int(r);
+                if (id == -1)
+                    continue;
+                int rowlen = ckpt_peek_row_len(r);
+                if (id != j || rowlen <= 0 || rowlen > gensize)
+                    goto Corrupted;
+                struct row_vector *row;
+                if ((row = malloc(sizeof(struct row_vector))) == NULL)
+                    goto Corrupted;
+                dec_ctx->Matrices[i]->row[j] = row;
+                row->len = rowlen;
+                if ((row->elem = calloc(rowlen, sizeof(GF_ELEMENT))) == NULL)
+                    goto Corrupted;
+                ckpt_get_row(r, row->elem, rowlen);
+                if ((dec_ctx->Matrices[i]->message[j] = malloc(sp->size_p * sizeof(GF_ELEMENT))) == NULL)
+                    goto Corrupted;
+                ckpt_copy_payload(r, dec_ctx->Matrices[i]->message[j]);
             }
         }
-    }
-    // Restore GDM and its related information if OA_ready
-    int numpp = dec_ctx->sc->snum + dec_ctx->sc->cnum;
-    if (dec_ctx->OA_ready == 1) {
-        dec_ctx->JMBcoefficient = calloc(numpp+aoh, sizeof(GF_ELEMENT*));
-        dec_ctx->JMBmessage = calloc(numpp+aoh, sizeof(GF_ELEMENT*));
+    } else {
+        // Restore GDM and its related information; local matrices are no longer used
+        for (i=0; i<dec_ctx->sc->gnum; i++) {
+            free_running_matrix(dec_ctx->Matrices[i], gensize);
+            dec_ctx->Matrices[i] = NULL;
+        }
+        free(dec_ctx->Matrices);
+        dec_ctx->Matrices = NULL;
+        if ((dec_ctx->JMBcoefficient = create_matrix(numpp+aoh, numpp)) == NULL
+                || (dec_ctx->JMBmessage = create_matrix(numpp+aoh, sp->size_p)) == NULL)
+            goto Corrupted;
         for (i=0; i<numpp+aoh; i++) {
-            dec_ctx->JMBcoefficient[i] = calloc(numpp, sizeof(GF_ELEMENT));
-            fread(dec_ctx->JMBcoefficient[i], sizeof(GF_ELEMENT), numpp, fp);
-            dec_ctx->JMBmessage[i] = calloc(sp.size_p, sizeof(GF_ELEMENT));
-            fread(dec_ctx->JMBmessage[i], sizeof(GF_ELEMENT), sp.size_p, fp);
+            ckpt_get_row(r, dec_ctx->JMBcoefficient[i], numpp);
+            ckpt_copy_payload(r, dec_ctx->JMBmessage[i]);
         }
-        dec_ctx->ctoo_r = calloc(numpp, sizeof(int));
-        fread(dec_ctx->ctoo_r, sizeof(int), numpp, fp);
-        dec_ctx->ctoo_c = calloc(numpp, sizeof(int));
-        fread(dec_ctx->ctoo_c, sizeof(int), numpp, fp);
-        fread(&dec_ctx->inactives, sizeof(int), 1, fp);
+        if ((dec_ctx->ctoo_r = malloc(sizeof(int) * numpp)) == NULL
+                || (dec_ctx->ctoo_c = malloc(sizeof(int) * numpp)) == NULL)
+            goto Corrupted;
+        ckpt_get(r, dec_ctx->ctoo_r, sizeof(int)*numpp);
+        ckpt_get(r, dec_ctx->ctoo_c, sizeof(int)*numpp);
+        dec_ctx->inactives = ckpt_get_int(r);
     }
     // Restore performance index
-    fread(&dec_ctx->overhead, sizeof(int), 1, fp);
-    fread(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops1, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops2, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops3, sizeof(long long), 1, fp);
-    fread(&dec_ctx->ops4, sizeof(long long), 1, fp);
-    fclose(fp);
+    dec_ctx->overhead = ckpt_get_int(r);
+    ckpt_get(r, &dec_ctx->operations, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops1, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops2, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops3, sizeof(long long));
+    ckpt_get(r, &dec_ctx->ops4, sizeof(long long));
     return dec_ctx;
+
+Corrupted:
+    free_dec_context_OA(dec_ctx);
+    return NULL;
 }
@@ -34,6 +34,8 @@ struct decoding_context_OA
     // Arrays for record row/col id mappings after pivoting
     int *ctoo_r;                        // record the mapping from current row id to original row id
     int *ctoo_c;                        // record the mapping from current col id to original col id
+    GF_ELEMENT **dsts;                  // scratch of cleaning up GDM: rows substituted by
+    GF_ELEMENT *qs;                     // the same decoded packet, and their multipliers
     int inactives;                      // total number of inactivated packets among overlapping packets
 
     int overhead;                       // record how many packets have been received
@@ -43,6 +45,8 @@ struct decoding_context_OA
                                         // ops2 - pivoting/convert GDM to upper triangular
                                         // ops3 - fill in missed pivots
                                         // ops4 - back substitution solving all packets
+
+    struct finish_state fin;            // pending diagonalization of GDM (see resume_decoding_OA())
 };
 
 struct decoding_context_OA *create_dec_context_OA(struct snc_parameters *sp, int aoh);
@@ -50,13 +54,18 @@ void process_packet_OA(struct decoding_context_OA *dec_ctx, struct snc_packet *p
 void free_dec_context_OA(struct decoding_context_OA *dec_ctx);
 
 /**
- * File format to store ongoing decoding context
- *
- * snc_parameter
- * decoder_type
- * decoding_context_OA (excluding snc_context)
- *
+ * Run pending diagonalization of GDM (triggered by process_packet_OA)
+ * until about budget operations are used up.
+ * Return 1 if work remains pending, 0 otherwise.
+ */
+int resume_decoding_OA(struct decoding_context_OA *dec_ctx, long long budget);
+
+/**
+ * Save/restore ongoing decoding context to/from a checkpoint
+ * (see checkpoint.c for the file format)
  */
-long save_dec_context_OA(struct decoding_context_OA *dec_ctx, const char *filepath);
-struct decoding_context_OA *restore_dec_context_OA(const char *filepath);
+struct ckpt_writer;
+struct ckpt_reader;
+void save_dec_context_OA(struct decoding_context_OA *dec_ctx, struct ckpt_writer *w);
+struct decoding_context_OA *restore_dec_context_OA(struct ckpt_reader *r, struct snc_parameters *sp);
 #endif
@@ -8,13 +8,13 @@
 #include "galois.h"
 #include "decoderPP.h"
 static int process_vector_PP(struct decoding_context_PP *dec_ctx, GF_ELEMENT *vector, GF_ELEMENT *message);
-static void finish_recovering_PP(struct decoding_context_PP *dec_ctx);
+static int finish_recovering_PP(struct decoding_context_PP *dec_ctx, long long budget);
 
 // create decoding context for perpetual decoder
 struct decoding_context_PP *create_dec_context_PP(struct snc_parameters *sp)
 {
     static char fname[] = "snc_create_dec_context_CBD";
-    int i, j, k;
+    int j, k;
 
     if (sp->type != WINDWRAP_SNC || sp->size_c != 0) {
         fprintf(stdout, "WARNING: PP decoder only applies to perpetual codes.\n");
@@ -38,6 +38,7 @@ struct decoding_context_PP *create_dec_context_PP(struct snc_parameters *sp)
     dec_ctx->stage        = FORWARD;
     dec_ctx->pivots       = 0;
     dec_ctx->finished     = 0;
+    dec_ctx->fin.stage    = FINISH_IDLE;
 
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
@@ -48,18 +49,11 @@ struct decoding_context_PP *create_dec_context_PP(struct snc_parameters *sp)
         fprintf(stderr, "%s: calloc dec_ctx->row failed\n", fname);
         goto AllocError;
     }
-    dec_ctx->message = calloc(numpp, sizeof(GF_ELEMENT*));
+    dec_ctx->message = create_matrix(numpp, pktsize);
     if (dec_ctx->message == NULL) {
-        fprintf(stderr, "%s: calloc dec_ctx->message failed\n", fname);
+        fprintf(stderr, "%s: create_matrix dec_ctx->message failed\n", fname);
         goto AllocError;
     }
-    for (i=0; i<numpp; i++) {
-        dec_ctx->message[i] = calloc(pktsize, sizeof(GF_ELEMENT));
-        if (dec_ctx->message[i] == NULL) {
-            fprintf(stderr, "%s: calloc dec_ctx->message[%d] failed\n", fname, i);
-            goto AllocError;
-        }
-    }
 
     dec_ctx->overhead     = 0;
     dec_ctx->operations   = 0;
@@ -75,7 +69,11 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
     static char fname[] = "snc_process_packet_PP";
     dec_ctx->overhead += 1;
 
-    
+    // Systematic packets (gid=-1) have zero coefficients, which the PP
+    // decoder has always dropped as useless; don't look up generation -1
+    if (pkt->gid == -1)
+        return;
+
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum;
@@ -94,7 +92,7 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
         } else {
             memcpy(ces0, pkt->coes, gensize*sizeof(GF_ELEMENT));
         }
-        int pivot = dec_ctx->sc->gene[pkt->gid]->pktid[0];// By default, the coding coefficient of the pivot candidate is pkt->coes[0]
+        int pivot = band_lead(dec_ctx->sc, pkt->gid);// By default, the coding coefficient of the pivot candidate is pkt->coes[0]
         int shift = 0;
         while (ces0[shift] == 0) {
             shift += 1;
@@ -110,7 +108,7 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
         int rowlen = gensize - shift;
         while (dec_ctx->row[pivot] != NULL) {
             quotient = galois_divide(ces_tmp[0], dec_ctx->row[pivot]->elem[0]);
-            galois_multiply_add_region(ces_tmp, dec_ctx->row[pivot]->elem, quotient, dec_ctx->row[pivot]->len);
+            galois_multiply_add_region_short(ces_tmp, dec_ctx->row[pivot]->elem, quotient, dec_ctx->row[pivot]->len);
             galois_multiply_add_region(pkt->syms, dec_ctx->message[pivot], quotient, pktsize);
             int newlen = rowlen > dec_ctx->row[pivot]->len ? rowlen : dec_ctx->row[pivot]->len;  // new length of the vector after processed
             rowlen = newlen - 1;   // the first element has been reduced to 0, so omit it
@@ -154,21 +152,14 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
         GF_ELEMENT *ces1 = calloc(numpp, sizeof(GF_ELEMENT));
         if (ces1 == NULL)
             fprintf(stderr, "%s: calloc ces1 failed\n", fname);
-        for (i=0; i<gensize; i++) {
-            int index = dec_ctx->sc->gene[pkt->gid]->pktid[i];
-            if (dec_ctx->sc->params.bnc) {
-                ces1[index] = get_bit_in_array(pkt->coes, i);
-            } else {
-                ces1[index] = pkt->coes[i];
-            }
-        }
+        expand_coes(dec_ctx->sc, pkt->gid, pkt->coes, ces1);
         // Process the full length vector against existing rows
         for (k=0; k<numpp; k++) {
             if (ces1[k] != 0) {
                 if (dec_ctx->row[k] != NULL) {
                     assert(dec_ctx->row[k]->elem[0]);
                     quotient = galois_divide(ces1[k], dec_ctx->row[k]->elem[0]);
-                    galois_multiply_add_region(&(ces1[k]), dec_ctx->row[k]->elem, quotient, dec_ctx->row[k]->len);
+                    galois_multiply_add_region_short(&(ces1[k]), dec_ctx->row[k]->elem, quotient, dec_ctx->row[k]->len);
                     galois_multiply_add_region(pkt->syms, dec_ctx->message[k], quotient, pktsize);
                     dec_ctx->operations += 1 + dec_ctx->row[k]->len + pktsize;
                 } else {
@@ -192,7 +183,8 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
         free(ces1);
         if (dec_ctx->pivots == numpp) {
             dec_ctx->stage = FINALBACKWARD;
-            finish_recovering_PP(dec_ctx);
+            dec_ctx->fin.stage = FINALBACKWARD;
+            dec_ctx->fin.pos   = numpp - 1;
         }
         return;
     }
@@ -203,17 +195,15 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
         dec_ctx->pivots = numpp - gensize;  // reset number of pivots before we verify the bottom rows
         // Transform the bottom wrap-around vectors to full length (numpp) and then process against their above band vectors
         // Copy the corresponding part of the message matrix as well
-        GF_ELEMENT **ces = calloc(gensize, sizeof(GF_ELEMENT*));
-        GF_ELEMENT **message = calloc(gensize, sizeof(GF_ELEMENT*));
+        GF_ELEMENT **ces = create_matrix(gensize, numpp);
+        GF_ELEMENT **message = create_matrix(gensize, pktsize);
+        if (ces == NULL || message == NULL)
+            fprintf(stderr, "%s: create_matrix ces failed\n", fname);
         for (i=0; i<gensize; i++) {
-            ces[i] = calloc(numpp, sizeof(GF_ELEMENT));
-            if (ces[i] == NULL)
-                fprintf(stderr, "%s: calloc ces failed\n", fname);
             for (j=0; j<dec_ctx->row[numpp-gensize+i]->len; j++) {
                 int index = (numpp - gensize + i + j) % numpp;
                 ces[i][index] = dec_ctx->row[numpp-gensize+i]->elem[j];
             }
-            message[i] = calloc(pktsize, sizeof(GF_ELEMENT));
             memcpy(message[i], dec_ctx->message[numpp-gensize+i], pktsize*sizeof(GF_ELEMENT));
             // free the rows in dec_ctx->row, and message
             free(dec_ctx->row[numpp-gensize+i]->elem);
@@ -229,7 +219,7 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
                     if (dec_ctx->row[k] != NULL) {
                         assert(dec_ctx->row[k]->elem[0]);
                         quotient = galois_divide(ces[i][k], dec_ctx->row[k]->elem[0]);
-                        galois_multiply_add_region(&(ces[i][k]), dec_ctx->row[k]->elem, quotient, dec_ctx->row[k]->len);
+                        galois_multiply_add_region_short(&(ces[i][k]), dec_ctx->row[k]->elem, quotient, dec_ctx->row[k]->len);
                         galois_multiply_add_region(message[i], dec_ctx->message[k], quotient, pktsize);
                         dec_ctx->operations += 1 + dec_ctx->row[k]->len + pktsize;
                     } else {
@@ -250,35 +240,43 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
                     }
                 }
             }
-            free(ces[i]);  // free the processed full-length vector
-            free(message[i]);
         }
-        // free ces, and message
-        free(ces);
-        free(message);  // this is just an array of pointers
+        free_matrix(ces);
+        free_matrix(message);
     }
     if (dec_ctx->pivots == numpp) {
         dec_ctx->stage = FINALBACKWARD;
-        finish_recovering_PP(dec_ctx);
+        dec_ctx->fin.stage = FINALBACKWARD;
+        dec_ctx->fin.pos   = numpp - 1;
     }
     return;
 }
 
+int resume_decoding_PP(struct decoding_context_PP *dec_ctx, long long budget)
+{
+    dec_ctx->fin.work = 0;
+    if (dec_ctx->fin.stage == FINISH_IDLE)
+        return 0;
+    return finish_recovering_PP(dec_ctx, budget);
+}
+
 /**
  * Finish perpetual code decoding
  * This routine converts decoding matrix from upper triangular
- * form to diagonal.
+ * form to diagonal. It proceeds from column fin.pos until about
+ * budget operations are done in the slice, and returns 1 if
+ * columns are left, 0 otherwise.
  */
-static void finish_recovering_PP(struct decoding_context_PP *dec_ctx)
+static int finish_recovering_PP(struct decoding_context_PP *dec_ctx, long long budget)
 {
     int gensize = dec_ctx->sc->params.size_g;
     int pktsize = dec_ctx->sc->params.size_p;
-    int numpp = dec_ctx->sc->snum;
     int i, j;
     int len;
     GF_ELEMENT quotient;
     // eliminate all nonzeros of the upper-triangular, examining columns from right to left
-    for (i=numpp-1; i>=0; i--) {
+    for (i=dec_ctx->fin.pos; i>=0 && dec_ctx->fin.work<budget; i--) {
+        long long ops = dec_ctx->operations;
         // examine rows from top to bottom
         // FIXME: j=0 is overkill, maybe j=max(0, i-gensize)?
         for (j=0; j<i; j++) {
@@ -298,18 +296,22 @@ static void finish_recovering_PP(struct decoding_context_PP *dec_ctx)
             dec_ctx->row[i]->elem[0] = 1;
         }
         /* save decoded packet */
-        dec_ctx->sc->pp[i] = calloc(pktsize, sizeof(GF_ELEMENT));
+        dec_ctx->sc->pp[i] = alloc_decoded(dec_ctx->sc, i);
         memcpy(dec_ctx->sc->pp[i], dec_ctx->message[i], pktsize*sizeof(GF_ELEMENT));
+        dec_ctx->fin.work += dec_ctx->operations - ops + i + pktsize;
     }
+    dec_ctx->fin.pos = i;
+    if (i >= 0)
+        return 1;
+    dec_ctx->fin.stage = FINISH_IDLE;
     dec_ctx->finished = 1;
+    return 0;
 }
 
 void free_dec_context_PP(struct decoding_context_PP *dec_ctx)
 {
     if (dec_ctx == NULL)
         return;
-    if (dec_ctx->sc != NULL)
-        snc_free_enc_context(dec_ctx->sc);
     if (dec_ctx->row != NULL) {
         for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
             if (dec_ctx->row[i] != NULL) {
@@ -320,112 +322,78 @@ void free_dec_context_PP(struct decoding_context_PP *dec_ctx)
         }
         free(dec_ctx->row);
     }
-    if (dec_ctx->message != NULL) {
-        for (int i=dec_ctx->sc->snum+dec_ctx->sc->cnum-1; i>=0; i--) {
-            if (dec_ctx->message[i] != NULL)
-                free(dec_ctx->message[i]);
-        }
-        free(dec_ctx->message);
-    }
+    free_matrix(dec_ctx->message);
+    if (dec_ctx->sc != NULL)
+        snc_free_enc_context(dec_ctx->sc);
     free(dec_ctx);
     dec_ctx = NULL;
     return;
 }
 
-/**
- * Save a decoding context to a file
- * Return values:
- *   On success: bytes written
- *   On error: -1
+/*
+ * Save a decoding context to a checkpoint
  */
-long save_dec_context_PP(struct decoding_context_PP *dec_ctx, const char *filepath)
+void save_dec_context_PP(struct decoding_context_PP *dec_ctx, struct ckpt_writer *w)
 {
-    long filesize = 0;
-    int d_type = PP_DECODER;
-    FILE *fp;
-    if ((fp = fopen(filepath, "w")) == NULL) {
-        fprintf(stderr, "Cannot open %s to save decoding context\n", filepath);
-        return (-1);
-    }
-    // Write snc params
-    filesize += fwrite(&dec_ctx->sc->params, sizeof(struct snc_parameters), 1, fp);
-    // Write decoder type
-    filesize += fwrite(&(d_type), sizeof(int), 1, fp);
-    // Write decoding context
-    filesize += fwrite(&dec_ctx->finished, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->stage, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->pivots, sizeof(int), 1, fp);
-
+    ckpt_put_int(w, dec_ctx->finished);
+    ckpt_put_int(w, dec_ctx->stage);
+    ckpt_put_int(w, dec_ctx->pivots);
     // Decoder matrix rows
-    int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
     for (int i=0; i<numpp; i++) {
-        int rowlen = dec_ctx->row[i] == NULL ? 0 : dec_ctx->row[i]->len;
-        filesize += fwrite(&rowlen, sizeof(int), 1, fp);
-        if (rowlen != 0) {
-            filesize += fwrite(dec_ctx->row[i]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-            filesize += fwrite(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
+        if (dec_ctx->row[i] == NULL) {
+            ckpt_put_int(w, -1);
+            continue;
         }
+        ckpt_put_int(w, i);
+        ckpt_put_row(w, dec_ctx->row[i]->elem, dec_ctx->row[i]->len);
+        ckpt_put_payload(w, dec_ctx->message[i]);
     }
-    //performance index
-    filesize += fwrite(&dec_ctx->overhead, sizeof(int), 1, fp);
-    filesize += fwrite(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
-    return filesize;
+    /*performance index*/
+    ckpt_put_int(w, dec_ctx->overhead);
+    ckpt_put(w, &dec_ctx->operations, sizeof(long long));
 }
 
 /*
- * Restore a decoding context from a file
+ * Restore a decoding context from a checkpoint
  */
-struct decoding_context_PP *restore_dec_context_PP(const char *filepath)
+struct decoding_context_PP *restore_dec_context_PP(struct ckpt_reader *r, struct snc_parameters *sp)
 {
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
-        return NULL;
-    }
-    struct snc_parameters sp;
-    fread(&sp, sizeof(struct snc_parameters), 1, fp);
     // Create a fresh decoding context
-    struct decoding_context_PP *dec_ctx = create_dec_context_PP(&sp);
+    struct decoding_context_PP *dec_ctx = create_dec_context_PP(sp);
     if (dec_ctx == NULL) {
-        fprintf(stderr, "malloc decoding_context_CBD failed\n");
+        fprintf(stderr, "malloc decoding_context_PP failed\n");
         return NULL;
     }
-    // Restore decoding context from file
-    fseek(fp, sizeof(int), SEEK_CUR);  // skip decoding_type field
-
-    fread(&dec_ctx->finished, sizeof(int), 1, fp);
-    fread(&dec_ctx->stage, sizeof(int), 1, fp);
-    fread(&dec_ctx->pivots, sizeof(int), 1, fp);
+    // Restore decoding context from checkpoint
+    dec_ctx->finished = ckpt_get_int(r);
+    dec_ctx->stage    = ckpt_get_int(r);
+    dec_ctx->pivots   = ckpt_get_int(r);
     // Decoder matrix rows
-    int gensize = dec_ctx->sc->params.size_g;
-    int pktsize = dec_ctx->sc->params.size_p;
     int numpp   = dec_ctx->sc->snum + dec_ctx->sc->cnum;
     for (int i=0; i<numpp; i++) {
-        int rowlen = 0;
-        fread(&rowlen, sizeof(int), 1, fp);
-        if (rowlen != 0) {
-            // There is an non-NULL row
-            dec_ctx->row[i] = (struct row_vector*) malloc(sizeof(struct row_vector));
-            if (dec_ctx->row[i] == NULL) {
-                free_dec_context_PP(dec_ctx);
-                return NULL;
-            }
-            dec_ctx->row[i]->len = rowlen;
-            dec_ctx->row[i]->elem = (GF_ELEMENT *) calloc(rowlen, sizeof(GF_ELEMENT));
-            if (dec_ctx->row[i]->elem == NULL) {
-                free_dec_context_PP(dec_ctx);
-                return NULL;
-            }
-            fread(dec_ctx->row[i]->elem, sizeof(GF_ELEMENT), rowlen, fp);
-            fread(dec_ctx->message[i], sizeof(GF_ELEMENT), pktsize, fp);
-        }
+        int id = ckpt_get_int(r);
+        if (id == -1)
+            continue;       // There is no row
+        int rowlen = ckpt_peek_row_len(r);
+        if (id != i || rowlen <= 0 || rowlen > numpp)
+            goto Corrupted;
+        dec_ctx->row[i] = (struct row_vector*) malloc(sizeof(struct row_vector));
+        if (dec_ctx->row[i] == NULL)
+            goto Corrupted;
+        dec_ctx->row[i]->len = rowlen;
+        dec_ctx->row[i]->elem = (GF_ELEMENT *) calloc(rowlen, sizeof(GF_ELEMENT));
+        if (dec_ctx->row[i]->elem == NULL)
+            goto Corrupted;
+        ckpt_get_row(r, dec_ctx->row[i]->elem, rowlen);
+        ckpt_copy_payload(r, dec_ctx->message[i]);
     }
-    //performance index
-    fread(&dec_ctx->overhead, sizeof(int), 1, fp);
-    fread(&dec_ctx->operations, sizeof(long long), 1, fp);
-    fclose(fp);
+    /*performance index*/
+    dec_ctx->overhead = ckpt_get_int(r);
+    ckpt_get(r, &dec_ctx->operations, sizeof(long long));
     return dec_ctx;
+
+Corrupted:
+    free_dec_context_PP(dec_ctx);
+    return NULL;
 }
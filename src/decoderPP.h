@@ -25,6 +25,8 @@ struct decoding_context_PP
     /*performance index*/
     int overhead;               // record how many packets have been received
     long long operations;       // record the number of computations used
+
+    struct finish_state fin;    // pending back substitution (see resume_decoding_PP())
 };
 
 struct decoding_context_PP *create_dec_context_PP(struct snc_parameters *sp);
@@ -32,14 +34,18 @@ void process_packet_PP(struct decoding_context_PP *dec_ctx, struct snc_packet *p
 void free_dec_context_PP(struct decoding_context_PP *dec_ctx);
 
 /**
- * File format to store ongoing decoding context
- * abc.decoderCBD.part
- *
- * snc_parameter
- * decoder_type
- * decoding_context_CBD (excluding snc_context)
- *
+ * Run pending back substitution of the decoder (triggered by process_packet_PP)
+ * until about budget operations are used up.
+ * Return 1 if work remains pending, 0 otherwise.
+ */
+int resume_decoding_PP(struct decoding_context_PP *dec_ctx, long long budget);
+
+/**
+ * Save/restore ongoing decoding context to/from a checkpoint
+ * (see checkpoint.c for the file format)
  */
-long save_dec_context_PP(struct decoding_context_PP *dec_ctx, const char *filepath);
-struct decoding_context_PP *restore_dec_context_PP(const char *filepath);
+struct ckpt_writer;
+struct ckpt_reader;
+void save_dec_context_PP(struct decoding_context_PP *dec_ctx, struct ckpt_writer *w);
+struct decoding_context_PP *restore_dec_context_PP(struct ckpt_reader *r, struct snc_parameters *sp);
 #endif
@@ -12,186 +12,38 @@
 #endif
 #include "galois.h"
 #define GF_POWER    8
-static int constructed = 0;
-static uint8_t galois_log_table[1<<GF_POWER];
-static uint8_t galois_ilog_table[(1<<GF_POWER)];
-static uint8_t galois_mult_table[(1<<GF_POWER)*(1<<GF_POWER)];
-static uint8_t galois_divi_table[(1<<GF_POWER)*(1<<GF_POWER)];
 
-/* Two half tables are used for SSE multiply_add_region*/
-#if defined(INTEL_SSSE3)
-static uint8_t galois_half_mult_table_high[(1<<GF_POWER)][(1<<(GF_POWER/2))];
-static uint8_t galois_half_mult_table_low[(1<<GF_POWER)][(1<<(GF_POWER/2))];
-#endif
-
-static int primitive_poly_8  = 0435;    /* 100 011 101: x^8 + x^4 + x^3 + x^2 + 1 */
-static int galois_create_log_table();
-static int galois_create_mult_table();
-
-int GFConstructed() {
-    return constructed;
-}
-
-int constructField()
-{
-    if (constructed)
-        return 0;
-    else {
-        if (galois_create_mult_table() < 0) {
-            perror("constructField");
-            exit(1);
-        }
-#if defined(INTEL_SSSE3)
-    /*
-     * Create half tables for SSE multiply_add_region:
-     * low table contains the products of an element with all 4-bit words;
-     * high table contains the products of an element with all 8-bit words
-     * whose last 4 bits are all zero. So each half table contains 256 rows
-     * and 16 columns.
-     */
-    int a, b, c, d;
-    int pp = primitive_poly_8;
-    for (a = 1; a < (1<<(GF_POWER/2)) ; a++) {
-        b = 1;
-        c = a;
-        d = (a << (GF_POWER/2));
-        do {
-            galois_half_mult_table_low[b][a] = c;
-            galois_half_mult_table_high[b][a] = d;
-            b <<= 1;
-            if (b & (1<<GF_POWER)) b ^= pp;
-            c <<= 1;
-            if (c & (1<<GF_POWER)) c ^= pp;
-            d <<= 1;
-            if (d & (1<<GF_POWER)) d ^= pp;
-        } while (c != a);
-    }
-#endif
-        constructed = 1;
-    }
-    return 0;
-}
+/*
+ * Multi-destination multiply_add_region streams the source region in
+ * tiles of MULTI_TILE bytes through all destinations, and shares each
+ * loaded source vector among batches of MULTI_BATCH destinations.
+ */
+#define MULTI_TILE  4096
+#define MULTI_BATCH 8
 
-static int galois_create_log_table()
-{
-    int j, b;
-    int m = GF_POWER;
+/* Longest region handled by the short-vector kernels */
+#define SHORT_REGION 128
 
-    int gf_poly = primitive_poly_8;
-    int nw      =  1 << GF_POWER;
-    int nwml    = (1 << GF_POWER) - 1;
+/* Product of a region byte with multiplier m using the half tables */
+#define NIBBLE_MULTIPLY(m, s) \
+    (galois_half_mult_table_low[(m)][(s) & 0x0f] ^ galois_half_mult_table_high[(m)][(s) >> 4])
 
-    for (j=0; j<nw; j++) {
-        galois_log_table[j] = nwml;
-        galois_ilog_table[j] = 0;
-    }
+static void multiply_add_tile(uint8_t **dst, uint8_t *src, uint8_t *multipliers, int ndst, int start, int end);
+static inline void multiply_add_short(uint8_t *dst, uint8_t *src, uint8_t multiplier, int bytes);
 
-    b = 1;
-    for (j=0; j<nwml; j++) {
-        if (galois_log_table[b] != nwml) {
-            fprintf(stderr, "Galois_create_log_tables Error: j=%d, b=%d, B->J[b]=%d, J->B[j]=%d (0%o)\n", j, b, galois_log_table[b], galois_ilog_table[j], (b << 1) ^ gf_poly);
-            exit(1);
-        }
-        galois_log_table[b] = j;
-        galois_ilog_table[j] = b;
-        b = b << 1;
-        if (b & nw)
-            b = (b ^ gf_poly) & nwml;
-    }
-
-    return 0;
+/*
+ * Arithmetic tables are generated at build time (see gftables.c) and
+ * need no construction. The two functions are kept for compatibility.
+ */
+int GFConstructed() {
+    return 1;
 }
 
-static int galois_create_mult_table()
+int constructField()
 {
-    int j, x, y, logx;
-    int nw = (1<<GF_POWER);
-
-    // create tables
-    if (galois_create_log_table() < 0) {
-        fprintf(stderr, "create log/ilog tables failed\n");
-        return -1;
-    }
-
-    /* Set mult/div tables for x = 0 */
-    j = 0;
-    galois_mult_table[j] = 0;   /* y = 0 */
-    galois_divi_table[j] = -1;
-    j++;
-    for (y=1; y<nw; y++) {   /* y > 0 */
-        galois_mult_table[j] = 0;
-        galois_divi_table[j] = 0;
-        j++;
-    }
-
-    for (x=1; x<nw; x++) {  /* x > 0 */
-        galois_mult_table[j] = 0; /* y = 0 */
-        galois_divi_table[j] = -1;
-        j++;
-        logx = galois_log_table[x];
-
-        for (y=1; y<nw; y++) {  /* y > 0 */
-            int tmp;
-            tmp = logx + galois_log_table[y];
-            if (tmp >= ((1<<GF_POWER) - 1))
-                tmp -= ((1<<GF_POWER) - 1);             // avoid cross the boundary of log/ilog tables
-            galois_mult_table[j] = galois_ilog_table[tmp];
-
-            tmp = logx - galois_log_table[y];
-            while (tmp < 0)
-                tmp += ((1<<GF_POWER) - 1);
-            galois_divi_table[j] = galois_ilog_table[tmp];
-
-            j++;
-        }
-    }
-
     return 0;
 }
 
-// add operation over GF(2^m)
-inline uint8_t galois_add(uint8_t a, uint8_t b)
-{
-    return a ^ b;
-}
-
-inline uint8_t galois_sub(uint8_t a, uint8_t b)
-{
-    return a ^ b;
-}
-
-inline uint8_t galois_multiply(uint8_t a, uint8_t b)
-{
-    if (a ==0 || b== 0)
-        return 0;
-
-    if (a == 1)
-        return b;
-    else if (b == 1)
-        return a;
-
-    uint8_t result = galois_mult_table[(a<<GF_POWER) | b];
-    return result;
-}
-
-// return a/b
-inline uint8_t galois_divide(uint8_t a, uint8_t b)
-{
-    if (b == 0) {
-        fprintf(stderr, "ERROR! Divide by ZERO!\n");
-        return -1;
-    }
-
-    if (a == 0)
-        return 0;
-
-    if (b == 1)
-        return a;
-
-    uint8_t result =  galois_divi_table[(a<<GF_POWER) | b];
-    return result;
-}
-
 /*
  * When SSE is enabled, use SSE instructions to do multiply_add_region
  */
@@ -208,16 +60,16 @@ void galois_multiply_add_region(uint8_t *dst, uint8_t *src, uint8_t multiplier,
     dptr = dst;
     top  = src + bytes;
 
-    uint8_t *bh, *bl;
+    const uint8_t *bh, *bl;
     __m128i mth, mtl, loset;
 #if defined(INTEL_AVX2)
     __m256i mth2, mtl2, loset2;
 #endif
     if (multiplier != 1) {
         /* half tables only needed for multiplier != 1 */
-        bh = (uint8_t*) galois_half_mult_table_high;
+        bh = (const uint8_t*) galois_half_mult_table_high;
         bh += (multiplier << 4);
-        bl = (uint8_t*) galois_half_mult_table_low;
+        bl = (const uint8_t*) galois_half_mult_table_low;
         bl += (multiplier << 4);
         // read split tables as 128-bit values
         mth = _mm_loadu_si128((__m128i *)(bh));
@@ -241,7 +93,7 @@ void galois_multiply_add_region(uint8_t *dst, uint8_t *src, uint8_t multiplier,
                 if (multiplier == 1)
                     *(dptr+i) ^= *(sptr+i);
                 else
-                    *(dptr+i) ^= galois_mult_table[((*(sptr+i))<<GF_POWER) | multiplier];
+                    *(dptr+i) ^= NIBBLE_MULTIPLY(multiplier, *(sptr+i));
             }
             break;
         }
@@ -252,7 +104,7 @@ void galois_multiply_add_region(uint8_t *dst, uint8_t *src, uint8_t multiplier,
                 if (multiplier == 1)
                     *(dptr+i) ^= *(sptr+i);
                 else
-                    *(dptr+i) ^= galois_mult_table[((*(sptr+i))<<GF_POWER) | multiplier];
+                    *(dptr+i) ^= NIBBLE_MULTIPLY(multiplier, *(sptr+i));
             }
             break;
         }
@@ -311,11 +163,182 @@ void galois_multiply_add_region(uint8_t *dst, uint8_t *src, uint8_t multiplier,
     }
 
     for (i = 0; i < bytes; i++)
-        dst[i] ^= galois_mult_table[(src[i]<<GF_POWER) | multiplier];
+        dst[i] ^= NIBBLE_MULTIPLY(multiplier, src[i]);
     return;
 #endif
 }
 
+/*
+ * Short-vector multiply_add_region for coefficient vectors.
+ *
+ * Coefficient rows are typically size_g (16~64) bytes, where setup and
+ * the scalar tail of galois_multiply_add_region dominate. The short
+ * kernel covers a region with full-width vectors only: the last vector
+ * is loaded overlapping its predecessor, and is computed from the
+ * original dst before any store, so overlapped bytes are written twice
+ * with the same value. src and dst must not overlap.
+ *
+ * Regions longer than SHORT_REGION bytes fall back to
+ * galois_multiply_add_region.
+ */
+#define DEFINE_MULTIPLY_ADD_FIXED(n) \
+static void multiply_add_fixed_##n(uint8_t *dst, uint8_t *src, uint8_t multiplier) \
+{ \
+    multiply_add_short(dst, src, multiplier, n); \
+}
+DEFINE_MULTIPLY_ADD_FIXED(16)
+DEFINE_MULTIPLY_ADD_FIXED(32)
+DEFINE_MULTIPLY_ADD_FIXED(64)
+
+void galois_multiply_add_region_short(uint8_t *dst, uint8_t *src, uint8_t multiplier, int bytes)
+{
+    if (multiplier == 0 || bytes <= 0)
+        return;
+    switch (bytes) {
+        case 16:
+            multiply_add_fixed_16(dst, src, multiplier);
+            return;
+        case 32:
+            multiply_add_fixed_32(dst, src, multiplier);
+            return;
+        case 64:
+            multiply_add_fixed_64(dst, src, multiplier);
+            return;
+        default:
+            if (bytes > SHORT_REGION)
+                galois_multiply_add_region(dst, src, multiplier, bytes);
+            else
+                multiply_add_short(dst, src, multiplier, bytes);
+    }
+}
+
+static inline void multiply_add_short(uint8_t *dst, uint8_t *src, uint8_t multiplier, int bytes)
+{
+    int i;
+#if defined(INTEL_SSSE3)
+    __m128i mtl = _mm_loadu_si128((__m128i *) galois_half_mult_table_low[multiplier]);
+    __m128i mth = _mm_loadu_si128((__m128i *) galois_half_mult_table_high[multiplier]);
+    __m128i loset = _mm_set1_epi8(0x0f);
+    __m128i va, r, last;
+#if defined(INTEL_AVX2)
+    if (bytes >= 32) {
+        __m256i mtl2 = _mm256_broadcastsi128_si256(mtl);
+        __m256i mth2 = _mm256_broadcastsi128_si256(mth);
+        __m256i loset2 = _mm256_set1_epi8(0x0f);
+        __m256i vaa, rr, last2;
+        vaa = _mm256_loadu_si256((__m256i *)(src+bytes-32));
+        last2 = _mm256_xor_si256(_mm256_shuffle_epi8(mtl2, _mm256_and_si256(loset2, vaa)),
+                                 _mm256_shuffle_epi8(mth2, _mm256_and_si256(loset2, _mm256_srli_epi64(vaa, 4))));
+        last2 = _mm256_xor_si256(last2, _mm256_loadu_si256((__m256i *)(dst+bytes-32)));
+        for (i=0; i+32<bytes; i+=32) {
+            vaa = _mm256_loadu_si256((__m256i *)(src+i));
+            rr  = _mm256_xor_si256(_mm256_shuffle_epi8(mtl2, _mm256_and_si256(loset2, vaa)),
+                                   _mm256_shuffle_epi8(mth2, _mm256_and_si256(loset2, _mm256_srli_epi64(vaa, 4))));
+            rr  = _mm256_xor_si256(rr, _mm256_loadu_si256((__m256i *)(dst+i)));
+            _mm256_storeu_si256((__m256i *)(dst+i), rr);
+        }
+        _mm256_storeu_si256((__m256i *)(dst+bytes-32), last2);
+        return;
+    }
+#endif
+    if (bytes >= 16) {
+        va   = _mm_loadu_si128((__m128i *)(src+bytes-16));
+        last = _mm_xor_si128(_mm_shuffle_epi8(mtl, _mm_and_si128(loset, va)),
+                             _mm_shuffle_epi8(mth, _mm_and_si128(loset, _mm_srli_epi64(va, 4))));
+        last = _mm_xor_si128(last, _mm_loadu_si128((__m128i *)(dst+bytes-16)));
+        for (i=0; i+16<bytes; i+=16) {
+            va = _mm_loadu_si128((__m128i *)(src+i));
+            r  = _mm_xor_si128(_mm_shuffle_epi8(mtl, _mm_and_si128(loset, va)),
+                               _mm_shuffle_epi8(mth, _mm_and_si128(loset, _mm_srli_epi64(va, 4))));
+            r  = _mm_xor_si128(r, _mm_loadu_si128((__m128i *)(dst+i)));
+            _mm_storeu_si128((__m128i *)(dst+i), r);
+        }
+        _mm_storeu_si128((__m128i *)(dst+bytes-16), last);
+        return;
+    }
+    if (bytes >= 8) {
+        /* two (possibly overlapping) 8-byte halves */
+        __m128i first;
+        va    = _mm_loadl_epi64((__m128i *)(src));
+        first = _mm_xor_si128(_mm_shuffle_epi8(mtl, _mm_and_si128(loset, va)),
+                              _mm_shuffle_epi8(mth, _mm_and_si128(loset, _mm_srli_epi64(va, 4))));
+        first = _mm_xor_si128(first, _mm_loadl_epi64((__m128i *)(dst)));
+        va    = _mm_loadl_epi64((__m128i *)(src+bytes-8));
+        last  = _mm_xor_si128(_mm_shuffle_epi8(mtl, _mm_and_si128(loset, va)),
+                              _mm_shuffle_epi8(mth, _mm_and_si128(loset, _mm_srli_epi64(va, 4))));
+        last  = _mm_xor_si128(last, _mm_loadl_epi64((__m128i *)(dst+bytes-8)));
+        _mm_storel_epi64((__m128i *)(dst), first);
+        _mm_storel_epi64((__m128i *)(dst+bytes-8), last);
+        return;
+    }
+#endif
+    for (i=0; i<bytes; i++)
+        dst[i] ^= NIBBLE_MULTIPLY(multiplier, src[i]);
+}
+
+/*
+ * Multi-destination version of multiply_add_region:
+ *   dst[k] += multipliers[k] * src,  k = 0, 1, ..., ndst-1
+ * Destination regions must be distinct from each other and from src.
+ */
+void galois_multiply_add_region_multi(uint8_t **dst, uint8_t *src, uint8_t *multipliers, int ndst, int bytes)
+{
+    int off, end, b;
+    for (off=0; off<bytes; off+=MULTI_TILE) {
+        end = off + MULTI_TILE > bytes ? bytes : off + MULTI_TILE;
+        for (b=0; b<ndst; b+=MULTI_BATCH)
+            multiply_add_tile(dst+b, src, multipliers+b, ndst-b > MULTI_BATCH ? MULTI_BATCH : ndst-b, off, end);
+    }
+}
+
+/* Apply up to MULTI_BATCH destinations to bytes [start, end) of the regions */
+static void multiply_add_tile(uint8_t **dst, uint8_t *src, uint8_t *multipliers, int ndst, int start, int end)
+{
+    int i = start;
+    int k;
+#if defined(INTEL_AVX2)
+    __m256i mtl2[MULTI_BATCH], mth2[MULTI_BATCH];
+    __m256i loset2 = _mm256_set1_epi8(0x0f);
+    __m256i vaa, lo, hi, rr;
+    for (k=0; k<ndst; k++) {
+        mtl2[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) galois_half_mult_table_low[multipliers[k]]));
+        mth2[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) galois_half_mult_table_high[multipliers[k]]));
+    }
+    for (; i+32<=end; i+=32) {
+        vaa = _mm256_loadu_si256((__m256i *)(src+i));
+        lo  = _mm256_and_si256(loset2, vaa);
+        hi  = _mm256_and_si256(loset2, _mm256_srli_epi64(vaa, 4));
+        for (k=0; k<ndst; k++) {
+            rr = _mm256_xor_si256(_mm256_shuffle_epi8(mtl2[k], lo), _mm256_shuffle_epi8(mth2[k], hi));
+            rr = _mm256_xor_si256(rr, _mm256_loadu_si256((__m256i *)(dst[k]+i)));
+            _mm256_storeu_si256((__m256i *)(dst[k]+i), rr);
+        }
+    }
+#elif defined(INTEL_SSSE3)
+    __m128i mtl[MULTI_BATCH], mth[MULTI_BATCH];
+    __m128i loset = _mm_set1_epi8(0x0f);
+    __m128i va, lo, hi, r;
+    for (k=0; k<ndst; k++) {
+        mtl[k] = _mm_loadu_si128((__m128i *) galois_half_mult_table_low[multipliers[k]]);
+        mth[k] = _mm_loadu_si128((__m128i *) galois_half_mult_table_high[multipliers[k]]);
+    }
+    for (; i+16<=end; i+=16) {
+        va = _mm_loadu_si128((__m128i *)(src+i));
+        lo = _mm_and_si128(loset, va);
+        hi = _mm_and_si128(loset, _mm_srli_epi64(va, 4));
+        for (k=0; k<ndst; k++) {
+            r = _mm_xor_si128(_mm_shuffle_epi8(mtl[k], lo), _mm_shuffle_epi8(mth[k], hi));
+            r = _mm_xor_si128(r, _mm_loadu_si128((__m128i *)(dst[k]+i)));
+            _mm_storeu_si128((__m128i *)(dst[k]+i), r);
+        }
+    }
+#endif
+    for (; i<end; i++) {
+        for (k=0; k<ndst; k++)
+            dst[k][i] ^= NIBBLE_MULTIPLY(multipliers[k], src[i]);
+    }
+}
+
 /*
  * Muliply a region of elements with multiplier. When SSE is available, use it
  */
@@ -332,11 +355,11 @@ void galois_multiply_region(uint8_t *src, uint8_t multiplier, int bytes)
     sptr = src;
     top  = src + bytes;
 
-    uint8_t *bh, *bl;
+    const uint8_t *bh, *bl;
     /* half tables only needed for multiplier != 1 */
-    bh = (uint8_t*) galois_half_mult_table_high;
+    bh = (const uint8_t*) galois_half_mult_table_high;
     bh += (multiplier << 4);
-    bl = (uint8_t*) galois_half_mult_table_low;
+    bl = (const uint8_t*) galois_half_mult_table_low;
     bl += (multiplier << 4);
     // read split tables as 128-bit values
     __m128i mth = _mm_loadu_si128((__m128i *)(bh));
@@ -356,7 +379,7 @@ void galois_multiply_region(uint8_t *src, uint8_t multiplier, int bytes)
         if (sptr + 32 > top) {
             /* remaining data doesn't fit into __m128i, do not use SSE */
             for (int i=0; i<top-sptr; i++)
-                *(sptr+i) = galois_mult_table[((*(sptr+i))<<GF_POWER) | multiplier];
+                *(sptr+i) = NIBBLE_MULTIPLY(multiplier, *(sptr+i));
             break;
         }
         vaa = _mm256_loadu_si256 ((__m256i *)(sptr));
@@ -372,7 +395,7 @@ void galois_multiply_region(uint8_t *src, uint8_t multiplier, int bytes)
         if (sptr + 16 > top) {
             /* remaining data doesn't fit into __m128i, do not use SSE */
             for (int i=0; i<top-sptr; i++)
-                *(sptr+i) = galois_mult_table[((*(sptr+i))<<GF_POWER) | multiplier];
+                *(sptr+i) = NIBBLE_MULTIPLY(multiplier, *(sptr+i));
             break;
         }
         va = _mm_loadu_si128 ((__m128i *)(sptr));
@@ -388,7 +411,7 @@ void galois_multiply_region(uint8_t *src, uint8_t multiplier, int bytes)
     return;
 #else
     for (int i=0; i<bytes; i++)
-        src[i] = galois_mult_table[((src[i])<<GF_POWER) | multiplier];
+        src[i] = NIBBLE_MULTIPLY(multiplier, src[i]);
     return;
 #endif
 }
@@ -13,12 +13,51 @@
 #define GALOIS
 typedef unsigned char GF_ELEMENT;
 #endif
+/*
+ * Arithmetic tables, generated at build time by gftables.c
+ * (galois_exp_table is repeated twice so that the sum of two
+ * logarithms can index it directly).
+ */
+extern const uint8_t galois_log_table[256];
+extern const uint8_t galois_exp_table[512];
+extern const uint8_t galois_inv_table[256];
+extern const uint8_t galois_half_mult_table_low[256][16];
+extern const uint8_t galois_half_mult_table_high[256][16];
+
 // Galois field arithmetic routines
 int constructField();
-uint8_t galois_add(uint8_t a, uint8_t b);
-uint8_t galois_sub(uint8_t a, uint8_t b);
-uint8_t galois_multiply(uint8_t a, uint8_t b);
-uint8_t galois_divide(uint8_t a, uint8_t b);
+
+static inline uint8_t galois_add(uint8_t a, uint8_t b)
+{
+    return a ^ b;
+}
+
+static inline uint8_t galois_sub(uint8_t a, uint8_t b)
+{
+    return a ^ b;
+}
+
+static inline uint8_t galois_multiply(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return galois_exp_table[galois_log_table[a] + galois_log_table[b]];
+}
+
+// return a/b
+static inline uint8_t galois_divide(uint8_t a, uint8_t b)
+{
+    if (b == 0) {
+        fprintf(stderr, "ERROR! Divide by ZERO!\n");
+        return -1;
+    }
+    if (a == 0)
+        return 0;
+    return galois_exp_table[galois_log_table[a] + 255 - galois_log_table[b]];
+}
+
 void galois_multiply_region(uint8_t *src, uint8_t multiplier, int bytes);
 void galois_multiply_add_region(uint8_t *dst, uint8_t *src, uint8_t multiplier, int bytes);
+void galois_multiply_add_region_short(uint8_t *dst, uint8_t *src, uint8_t multiplier, int bytes);
+void galois_multiply_add_region_multi(uint8_t **dst, uint8_t *src, uint8_t *multipliers, int ndst, int bytes);
 #endif
@@ -16,7 +16,7 @@ long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_
 {
     //printf("entering foward_substitute()...\n");
     long operations = 0;
-    int i, j, k, m, n, p;
+    int i, j, k, n, p;
     int pivot;
     GF_ELEMENT quotient;
 
@@ -40,16 +40,11 @@ long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_
             if (!has_a_dimension)
                 continue;
             else {
-                // swap row
-                GF_ELEMENT tmp2;
-                for (m=0; m<ncolA; m++) {
-                    tmp2 = A[i][m];
-                    A[i][m] = A[pivot][m];
-                    A[pivot][m] = tmp2;
-                }
-                // swap B accordingly
-                // rows of B are in block memory, so only exchanging pointers
+                // swap rows of A and B by exchanging their pointers
                 GF_ELEMENT *temp_p;
+                temp_p = A[i];
+                A[i] = A[pivot];
+                A[pivot] = temp_p;
                 temp_p = B[i];
                 B[i] = B[pivot];
                 B[pivot] = temp_p;
@@ -62,7 +57,7 @@ long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_
             quotient = galois_divide(A[j][i], A[i][i]);
             operations += 1;
             // eliminate the items under row i at col i
-            galois_multiply_add_region(&(A[j][i]), &(A[i][i]), quotient, ncolA-i);
+            galois_multiply_add_region_short(&(A[j][i]), &(A[i][i]), quotient, ncolA-i);
             operations += (ncolA-i);
             // simultaneously do the same thing on right matrix B
             galois_multiply_add_region(B[j], B[i], quotient, ncolB);
@@ -75,23 +70,39 @@ long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_
 // perform back-substitution on full-rank upper trianguler matrix A
 long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT *A[], GF_ELEMENT *B[])
 {
+    static char fname[] = "back_substitute";
     //printf("entering back_substitute()...\n");
     long operations = 0;
 
     // Transform the upper triangular matrix A into diagonal.
     int i, j, k, l;
+    int ndst;
+    // rows of B to be substituted by the same row, and their multipliers
+    GF_ELEMENT **dsts = malloc(sizeof(GF_ELEMENT*) * ncolA);
+    GF_ELEMENT *qs = malloc(sizeof(GF_ELEMENT) * ncolA);
+    int multi = (dsts != NULL && qs != NULL);
+    if (!multi)
+        fprintf(stderr, "%s: malloc dsts/qs failed, substituting rows one at a time\n", fname);
     for (i=ncolA-1; i>=0; i--) {
         // eliminate all items above A[i][i]
+        ndst = 0;
         for (j=0; j<i; j++) {
             if (A[j][i] == 0)
                 continue;       // skip zeros
             GF_ELEMENT quotient = galois_divide(A[j][i], A[i][i]);
             operations += 1;
             A[j][i] = 0;
-            // doing accordingly to B
-            galois_multiply_add_region(B[j], B[i], quotient, ncolB);
+            if (multi) {
+                dsts[ndst] = B[j];
+                qs[ndst++] = quotient;
+            } else {
+                galois_multiply_add_region(B[j], B[i], quotient, ncolB);
+            }
             operations += ncolB;
         }
+        // doing accordingly to B
+        if (ndst != 0)
+            galois_multiply_add_region_multi(dsts, B[i], qs, ndst, ncolB);
         // diagonalize diagonal element
         if (A[i][i] != 1) {
             galois_multiply_region(B[i], galois_divide(1, A[i][i]), ncolB);
@@ -100,5 +111,7 @@ long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT *A[], GF_EL
         }
 
     }
+    free(dsts);
+    free(qs);
     return operations;
 }
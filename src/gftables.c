@@ -0,0 +1,107 @@
+/*-------------------------- gftables.c ---------------------------
+ * Build-time generator of GF(2^8) arithmetic tables.
+ *
+ * The program prints a C source file (galois_tables.c) defining the
+ * tables as const data, so that nothing needs to be constructed at
+ * run time:
+ *   galois_log_table   - discrete logarithms (log of 0 is unused)
+ *   galois_exp_table   - powers of the primitive element, repeated
+ *                        twice so log(a)+log(b) needs no reduction
+ *   galois_inv_table   - multiplicative inverses (inverse of 0 is 0)
+ *   galois_half_mult_table_low/high
+ *                      - products of each element with all 4-bit words
+ *                        (low) and with all 8-bit words whose lower 4
+ *                        bits are zero (high), for nibble-based region
+ *                        multiplication
+ *
+ * Usage: gftables > galois_tables.c
+ *----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+
+#define GF_POWER    8
+#define GF_SIZE     (1<<GF_POWER)
+
+static int primitive_poly_8  = 0435;    /* 100 011 101: x^8 + x^4 + x^3 + x^2 + 1 */
+
+static uint8_t log_table[GF_SIZE];
+static uint8_t exp_table[2*GF_SIZE];
+static uint8_t inv_table[GF_SIZE];
+static uint8_t half_mult_table_low[GF_SIZE][GF_SIZE>>4];
+static uint8_t half_mult_table_high[GF_SIZE][GF_SIZE>>4];
+
+static uint8_t multiply(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return exp_table[log_table[a] + log_table[b]];
+}
+
+/*
+ * Print table as an initialized array of len elements. Two-dimensional
+ * tables (rowlen < len) are printed with a brace-enclosed initializer
+ * per row of rowlen elements.
+ */
+static void print_table(const char *decl, uint8_t *table, int len, int rowlen)
+{
+    printf("%s = {", decl);
+    if (rowlen == len) {
+        for (int i=0; i<len; i++)
+            printf("%s%3d,", i % 16 == 0 ? "\n    " : " ", table[i]);
+    } else {
+        for (int i=0; i<len; i+=rowlen) {
+            printf("\n    {");
+            for (int j=0; j<rowlen; j++)
+                printf("%s%3d", j == 0 ? "" : ", ", table[i+j]);
+            printf("},");
+        }
+    }
+    printf("\n};\n\n");
+}
+
+int main(void)
+{
+    int i, j, b;
+    int nwml = GF_SIZE - 1;
+
+    /* log and exp tables */
+    b = 1;
+    for (i=0; i<nwml; i++) {
+        if (i != 0 && b == 1) {
+            fprintf(stderr, "gftables: 0%o is not a primitive polynomial\n", primitive_poly_8);
+            return 1;
+        }
+        log_table[b] = i;
+        exp_table[i] = b;
+        b <<= 1;
+        if (b & GF_SIZE)
+            b = (b ^ primitive_poly_8) & nwml;
+    }
+    for (i=nwml; i<2*GF_SIZE; i++)
+        exp_table[i] = exp_table[i-nwml];
+
+    /* inverse table */
+    inv_table[0] = 0;
+    for (i=1; i<GF_SIZE; i++)
+        inv_table[i] = exp_table[(nwml - log_table[i]) % nwml];
+
+    /* half tables */
+    for (i=0; i<GF_SIZE; i++) {
+        for (j=0; j<(GF_SIZE>>4); j++) {
+            half_mult_table_low[i][j]  = multiply(i, j);
+            half_mult_table_high[i][j] = multiply(i, j<<4);
+        }
+    }
+
+    printf("/* Generated by gftables.c at build time. Do not edit. */\n");
+    printf("#include <stdint.h>\n\n");
+    print_table("const uint8_t galois_log_table[256]", log_table, GF_SIZE, GF_SIZE);
+    print_table("const uint8_t galois_exp_table[512]", exp_table, 2*GF_SIZE, 2*GF_SIZE);
+    print_table("const uint8_t galois_inv_table[256]", inv_table, GF_SIZE, GF_SIZE);
+    /* 16-byte alignment allows aligned SIMD loads of table rows */
+    print_table("const uint8_t galois_half_mult_table_low[256][16] __attribute__((aligned(16)))",
+                (uint8_t *) half_mult_table_low, GF_SIZE*(GF_SIZE>>4), GF_SIZE>>4);
+    print_table("const uint8_t galois_half_mult_table_high[256][16] __attribute__((aligned(16)))",
+                (uint8_t *) half_mult_table_high, GF_SIZE*(GF_SIZE>>4), GF_SIZE>>4);
+    return 0;
+}
@@ -0,0 +1,214 @@
+/**************************************************************
+ * journal.c
+ *
+ * Append-only journal of the packets fed to a decoder.
+ *
+ * A journal complements a snapshot of the decoder (a checkpoint, see
+ * checkpoint.c): instead of saving the whole decoder state again, each
+ * packet is appended to the journal before the decoder processes it,
+ * so that the decoder is restored by loading the snapshot and feeding
+ * it the journaled packets once more.
+ *
+ * A journal file consists of a header
+ *   magic | version | base
+ * followed by records of
+ *   len | packet
+ * where packet is len bytes in the wire format of snc packets (see
+ * sncPacket.c). The k-th record holds the (base+k)-th packet processed
+ * by the decoder. Records are numbered by position rather than matched
+ * to a particular snapshot, so that records already contained in the
+ * snapshot (e.g., if the process stops after a new snapshot is saved
+ * but before the journal is cleared) are skipped on replay.
+ *
+ * Each record is appended with one writev(). A record torn by a crash
+ * is dropped on replay and truncated away before appending resumes.
+ * Like checkpoints, integers are in host byte order.
+ **************************************************************/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "common.h"
+#include "sparsenc.h"
+
+#define JNL_MAGIC       0x4a434e53      // "SNCJ"
+#define JNL_VERSION     1
+
+struct jnl_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base;                      // packets processed before the first record
+};
+
+struct journal {
+    int   fd;
+    long  base;
+    long  count;                        // number of records
+    off_t size;                         // bytes of the journal file
+};
+
+static int write_header(int fd, long base)
+{
+    struct jnl_header hdr;
+    hdr.magic   = JNL_MAGIC;
+    hdr.version = JNL_VERSION;
+    hdr.base    = base;
+    if (ftruncate(fd, 0) != 0)
+        return -1;
+    if (write(fd, &hdr, sizeof(struct jnl_header)) != sizeof(struct jnl_header))
+        return -1;
+    return 0;
+}
+
+/*
+ * Create (or clear) the journal in filepath, whose first record is going
+ * to be the base-th packet processed by the decoder.
+ */
+struct journal *jnl_create(const char *filepath, long base)
+{
+    static char fname[] = "jnl_create";
+    struct journal *j;
+    if ((j = calloc(1, sizeof(struct journal))) == NULL) {
+        fprintf(stderr, "%s: calloc journal\n", fname);
+        return NULL;
+    }
+    if ((j->fd = open(filepath, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1) {
+        fprintf(stderr, "%s: cannot open %s\n", fname, filepath);
+        free(j);
+        return NULL;
+    }
+    if (jnl_reset(j, base) != 0) {
+        fprintf(stderr, "%s: cannot write %s\n", fname, filepath);
+        jnl_close(j);
+        return NULL;
+    }
+    return j;
+}
+
+// Drop all records, the next record being the base-th packet
+int jnl_reset(struct journal *j, long base)
+{
+    if (write_header(j->fd, base) != 0)
+        return (-1);
+    j->base  = base;
+    j->count = 0;
+    j->size  = sizeof(struct jnl_header);
+    return 0;
+}
+
+// Bytes of the records in the journal
+long jnl_size(struct journal *j)
+{
+    return j->size - sizeof(struct jnl_header);
+}
+
+/*
+ * Append a packet to the journal with one writev(). Return -1 if the
+ * record cannot be written completely, in which case the caller has to
+ * save a new snapshot and reset the journal before appending again (a
+ * partial record left at the end is dropped on replay).
+ */
+int jnl_append(struct journal *j, struct snc_parameters *sp, struct snc_packet *pkt)
+{
+    unsigned char hdr[SNC_WIRE_HEADER];
+    struct iovec iov[4];
+    uint32_t len = snc_packet_wire_size(sp, pkt);
+    iov[0].iov_base = &len;
+    iov[0].iov_len  = sizeof(uint32_t);
+    int cnt = 1 + snc_serialize_packet(sp, pkt, hdr, &iov[1]);
+    ssize_t n = writev(j->fd, iov, cnt);
+    if (n != (ssize_t) (sizeof(uint32_t) + len))
+        return (-1);
+    j->size  += n;
+    j->count += 1;
+    return 0;
+}
+
+/*
+ * Replay the journal in filepath to a decoder that has processed done
+ * packets, by feeding it the journaled packets from the done-th on with
+ * process(). The journal is then reopened for appending (a torn record
+ * at its end is truncated away), or created if it does not exist.
+ *
+ * Return NULL if the journal is corrupted or does not follow the decoder,
+ * i.e., if it starts after the done-th packet.
+ */
+struct journal *jnl_recover(const char *filepath, struct snc_parameters *sp, long done,
+                            void (*process)(struct snc_decoder *, struct snc_packet *),
+                            struct snc_decoder *decoder)
+{
+    static char fname[] = "jnl_recover";
+    int fd;
+    if ((fd = open(filepath, O_RDWR)) == -1)
+        return jnl_create(filepath, done);
+    struct journal *j = NULL;
+    unsigned char *map = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        goto error;
+    if (st.st_size < sizeof(struct jnl_header)) {
+        // The process stopped while the journal was being cleared
+        close(fd);
+        return jnl_create(filepath, done);
+    }
+    // Decoders reduce syms of the packets in place, so map a private copy
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto error;
+    struct jnl_header hdr;
+    memcpy(&hdr, map, sizeof(struct jnl_header));
+    if (hdr.magic != JNL_MAGIC || hdr.version != JNL_VERSION) {
+        fprintf(stderr, "%s: %s is not a journal of version %d\n", fname, filepath, JNL_VERSION);
+        goto error;
+    }
+    if (hdr.base > done) {
+        fprintf(stderr, "%s: %s starts at packet %ld, after the snapshot\n", fname, filepath, (long) hdr.base);
+        goto error;
+    }
+    off_t pos = sizeof(struct jnl_header);
+    long k = 0;
+    while (pos + sizeof(uint32_t) <= st.st_size) {
+        uint32_t len;
+        memcpy(&len, map + pos, sizeof(uint32_t));
+        if (pos + sizeof(uint32_t) + len > st.st_size)
+            break;              // torn record
+        if ((long) hdr.base + k >= done) {
+            struct snc_packet pkt;
+            if (snc_deserialize_packet(sp, map + pos + sizeof(uint32_t), len, &pkt) != 0) {
+                fprintf(stderr, "%s: %s is corrupted at offset %ld\n", fname, filepath, (long) pos);
+                goto error;
+            }
+            // Views of systematic packets carry no coes; process() is
+            // snc_process_packet(), which gives them zero coefficients
+            process(decoder, &pkt);
+        }
+        pos += sizeof(uint32_t) + len;
+        k++;
+    }
+    munmap(map, st.st_size);
+    map = MAP_FAILED;
+    if (pos != st.st_size && ftruncate(fd, pos) != 0)
+        goto error;
+    if (fcntl(fd, F_SETFL, O_APPEND) != 0 || (j = malloc(sizeof(struct journal))) == NULL)
+        goto error;
+    j->fd    = fd;
+    j->base  = hdr.base;
+    j->count = k;
+    j->size  = pos;
+    return j;
+
+error:
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    close(fd);
+    return NULL;
+}
+
+void jnl_close(struct journal *j)
+{
+    if (j == NULL)
+        return;
+    close(j->fd);
+    free(j);
+}
@@ -0,0 +1,78 @@
+/**************************************************************
+ * matrix.c
+ *
+ * Dense matrices of decoders. The rows of a matrix are stored in
+ * one slab with a fixed stride that is a multiple of 64 bytes, so
+ * that each row starts on a cache line (and region operations can
+ * use aligned loads). Rows are reached through an array of row
+ * pointers placed at the start of the same allocation; rows are
+ * permuted by exchanging their pointers rather than their elements,
+ * and the matrix is freed through the array whatever the order of
+ * its pointers.
+ *
+ * Setting SNC_HUGE_PAGES=1 asks the kernel to back slabs of at
+ * least 2 MB with transparent huge pages.
+ **************************************************************/
+#define _DEFAULT_SOURCE     // posix_memalign(), madvise()
+#include <sys/mman.h>
+#include "common.h"
+
+#define MAT_ALIGN       64
+#define HUGE_PAGE       (2 * 1024 * 1024)
+
+static int huge_pages = -1;
+
+// Stride of rows of ncol elements
+static inline size_t row_stride(int ncol)
+{
+    return (size_t) ALIGN(ncol * sizeof(GF_ELEMENT), MAT_ALIGN) * MAT_ALIGN;
+}
+
+/*
+ * Create an nrow x ncol matrix of zeros. Return the array of row
+ * pointers, or NULL if memory cannot be allocated.
+ */
+GF_ELEMENT **create_matrix(int nrow, int ncol)
+{
+    static char fname[] = "create_matrix";
+    // Decoders may create matrices concurrently, e.g., in file sessions
+    if (__atomic_load_n(&huge_pages, __ATOMIC_RELAXED) == -1) {
+        char *hp = getenv("SNC_HUGE_PAGES");
+        __atomic_store_n(&huge_pages, hp != NULL && atoi(hp) == 1, __ATOMIC_RELAXED);
+    }
+    size_t stride = row_stride(ncol);
+    size_t ptrs   = (size_t) ALIGN(nrow * sizeof(GF_ELEMENT *), MAT_ALIGN) * MAT_ALIGN;
+    size_t size   = ptrs + stride * nrow;
+    size_t align  = MAT_ALIGN;
+    if (__atomic_load_n(&huge_pages, __ATOMIC_RELAXED) && size >= HUGE_PAGE) {
+        align = HUGE_PAGE;
+        size  = ALIGN(size, HUGE_PAGE) * HUGE_PAGE;
+    }
+    void *mem;
+    if (posix_memalign(&mem, align, size) != 0) {
+        fprintf(stderr, "%s: cannot allocate %d x %d matrix\n", fname, nrow, ncol);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (align == HUGE_PAGE)
+        madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    memset(mem, 0, size);
+    GF_ELEMENT **rows = mem;
+    unsigned char *slab = (unsigned char *) mem + ptrs;
+    for (int i=0; i<nrow; i++)
+        rows[i] = (GF_ELEMENT *) (slab + stride * i);
+    return rows;
+}
+
+// Zero all elements of a matrix of nrow x ncol
+void clear_matrix(GF_ELEMENT **rows, int nrow, int ncol)
+{
+    for (int i=0; i<nrow; i++)
+        memset(rows[i], 0, sizeof(GF_ELEMENT) * ncol);
+}
+
+void free_matrix(GF_ELEMENT **rows)
+{
+    free(rows);
+}
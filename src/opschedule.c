@@ -0,0 +1,283 @@
+/*---------------------- opschedule.c ----------------------------
+ * Linear operation schedule of payload (message) rows.
+ *
+ * Row operations of a decoder are determined by its coefficient
+ * matrix only. When payload striping is enabled, the decoder
+ * records row operations on message rows instead of carrying them
+ * out, and replays the recorded schedule later. The replay is
+ * split into disjoint byte stripes of the message rows, each
+ * stripe is processed by a worker thread from the first operation
+ * to the last. No locking is needed since stripes do not overlap.
+ *
+ * Workers are started with the schedule and kept until the
+ * schedule is freed, so that a replay only wakes them up.
+ *
+ * The number of payload workers is read from environment variable
+ * SNC_PAYLOAD_THREADS. Values smaller than 2 disable striping.
+ *----------------------------------------------------------------*/
+#include <pthread.h>
+#include "common.h"
+#include "galois.h"
+
+#define MIN_STRIPE  1024        // smallest stripe (bytes) worth a worker
+#define STRIPE_ALIGN 64         // stripe boundaries are cache-line aligned
+#define MULTI_DST   64          // max destinations applied together in a stripe
+
+struct stripe_job {
+    struct op_schedule  *sched;
+    GF_ELEMENT         **rows;
+    int                  start; // first byte of the stripe
+    int                  len;   // length of the stripe (0 if none in this replay)
+};
+
+/*
+ * Workers of a schedule. Worker k (k >= 1) processes jobs[k] of each
+ * replay; jobs[0] is processed by the replaying thread itself.
+ */
+struct stripe_pool {
+    pthread_mutex_t      lock;
+    pthread_cond_t       start;     // broadcast when a replay is posted
+    pthread_cond_t       done;      // signaled when the last worker is done
+    int                  round;     // number of replays posted
+    int                  pending;   // workers yet to finish the current replay
+    int                  stop;
+    int                  nworkers;  // number of started workers
+    pthread_t           *tids;
+    struct stripe_job   *jobs;
+    struct stripe_worker *args;
+};
+
+struct stripe_worker {
+    struct stripe_pool  *pool;
+    int                  id;
+};
+
+static void *apply_stripe(void *arg);
+static void *stripe_worker(void *arg);
+static struct stripe_pool *create_stripe_pool(struct op_schedule *sched, int nthreads);
+static void free_stripe_pool(struct stripe_pool *pool);
+
+/*
+ * Number of payload workers requested by SNC_PAYLOAD_THREADS
+ * Return 0 if payload striping is not requested.
+ */
+int get_payload_threads(void)
+{
+    char *nt = getenv("SNC_PAYLOAD_THREADS");
+    if (nt == NULL || atoi(nt) < 2)
+        return 0;
+    return atoi(nt);
+}
+
+struct op_schedule *create_op_schedule(int nthreads)
+{
+    static char fname[] = "create_op_schedule";
+    struct op_schedule *sched = malloc(sizeof(struct op_schedule));
+    if (sched == NULL) {
+        fprintf(stderr, "%s: malloc op_schedule failed\n", fname);
+        return NULL;
+    }
+    sched->nthreads = nthreads;
+    sched->nops     = 0;
+    sched->size     = 1024;
+    sched->pool     = NULL;
+    sched->ops = malloc(sizeof(struct linear_op) * sched->size);
+    if (sched->ops == NULL) {
+        fprintf(stderr, "%s: malloc sched->ops failed\n", fname);
+        free(sched);
+        return NULL;
+    }
+    if ((sched->pool = create_stripe_pool(sched, nthreads)) == NULL) {
+        free_op_schedule(sched);
+        return NULL;
+    }
+    return sched;
+}
+
+/*
+ * Start nthreads-1 workers waiting for replays. If fewer workers can be
+ * started, stripes are only as many as the started workers plus one.
+ */
+static struct stripe_pool *create_stripe_pool(struct op_schedule *sched, int nthreads)
+{
+    static char fname[] = "create_stripe_pool";
+    struct stripe_pool *pool = calloc(1, sizeof(struct stripe_pool));
+    if (pool == NULL) {
+        fprintf(stderr, "%s: calloc stripe_pool failed\n", fname);
+        return NULL;
+    }
+    pool->tids = malloc(sizeof(pthread_t) * nthreads);
+    pool->jobs = calloc(nthreads, sizeof(struct stripe_job));
+    pool->args = malloc(sizeof(struct stripe_worker) * nthreads);
+    if (pool->tids == NULL || pool->jobs == NULL || pool->args == NULL) {
+        fprintf(stderr, "%s: malloc stripe workers failed\n", fname);
+        free(pool->tids);
+        free(pool->jobs);
+        free(pool->args);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i=0; i<nthreads; i++)
+        pool->jobs[i].sched = sched;
+    for (int i=1; i<nthreads; i++) {
+        pool->args[i].pool = pool;
+        pool->args[i].id   = i;
+        if (pthread_create(&pool->tids[i], NULL, stripe_worker, &pool->args[i]) != 0) {
+            fprintf(stderr, "%s: pthread_create failed, %d payload workers are used\n", fname, i);
+            break;
+        }
+        pool->nworkers = i;
+    }
+    return pool;
+}
+
+/*
+ * Record operation rows[dst] += ce * rows[src] (or rows[dst] *= ce
+ * if src is -1).
+ * Return index of the recorded operation, or -1 on error.
+ */
+int append_linear_op(struct op_schedule *sched, int dst, int src, GF_ELEMENT ce)
+{
+    static char fname[] = "append_linear_op";
+    if (sched->nops == sched->size) {
+        struct linear_op *ops = realloc(sched->ops, sizeof(struct linear_op) * sched->size * 2);
+        if (ops == NULL) {
+            fprintf(stderr, "%s: realloc sched->ops failed\n", fname);
+            return -1;
+        }
+        sched->ops = ops;
+        sched->size *= 2;
+    }
+    sched->ops[sched->nops].dst = dst;
+    sched->ops[sched->nops].src = src;
+    sched->ops[sched->nops].ce  = ce;
+    return sched->nops++;
+}
+
+/*
+ * Apply all recorded operations to rows of rowlen bytes and clear
+ * the schedule. Rows are split into at most sched->nthreads stripes.
+ */
+void apply_op_schedule(struct op_schedule *sched, GF_ELEMENT **rows, int rowlen)
+{
+    if (sched->nops == 0)
+        return;
+    struct stripe_pool *pool = sched->pool;
+
+    int nstripes = rowlen / MIN_STRIPE;
+    if (nstripes > pool->nworkers + 1)
+        nstripes = pool->nworkers + 1;
+    if (nstripes < 1)
+        nstripes = 1;
+    int width = ALIGN(ALIGN(rowlen, nstripes), STRIPE_ALIGN) * STRIPE_ALIGN;
+
+    // Every worker takes part in the replay, possibly with an empty stripe
+    for (int i=0; i<=pool->nworkers; i++) {
+        pool->jobs[i].rows  = rows;
+        pool->jobs[i].start = i * width;
+        pool->jobs[i].len   = i >= nstripes || i * width >= rowlen ? 0 :
+                              ((i+1) * width > rowlen ? rowlen - i * width : width);
+    }
+    if (pool->nworkers != 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->pending = pool->nworkers;
+        pool->round  += 1;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    // The calling thread processes the first stripe itself
+    apply_stripe(&pool->jobs[0]);
+    if (pool->nworkers != 0) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending != 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    sched->nops = 0;
+}
+
+// Process the stripe of the worker in every replay until the pool is freed
+static void *stripe_worker(void *arg)
+{
+    struct stripe_worker *wk = (struct stripe_worker *) arg;
+    struct stripe_pool *pool = wk->pool;
+    int seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->round == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+        if (pool->jobs[wk->id].len > 0)
+            apply_stripe(&pool->jobs[wk->id]);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void *apply_stripe(void *arg)
+{
+    struct stripe_job *job = (struct stripe_job *) arg;
+    struct linear_op *op = job->sched->ops;
+    struct linear_op *end = op + job->sched->nops;
+    int start = job->start;
+    int len = job->len;
+    // consecutive operations sharing a source row are applied in one pass
+    GF_ELEMENT *dsts[MULTI_DST];
+    GF_ELEMENT qs[MULTI_DST];
+    int ndst;
+    while (op < end) {
+        if (op->src == -1) {
+            galois_multiply_region(job->rows[op->dst]+start, op->ce, len);
+            op++;
+            continue;
+        }
+        ndst = 0;
+        do {
+            dsts[ndst] = job->rows[op->dst] + start;
+            qs[ndst++] = op->ce;
+            op++;
+        } while (op < end && op->src == (op-1)->src && ndst < MULTI_DST);
+        if (ndst == 1)
+            galois_multiply_add_region(dsts[0], job->rows[(op-1)->src]+start, qs[0], len);
+        else
+            galois_multiply_add_region_multi(dsts, job->rows[(op-1)->src]+start, qs, ndst, len);
+    }
+    return NULL;
+}
+
+void free_op_schedule(struct op_schedule *sched)
+{
+    if (sched == NULL)
+        return;
+    if (sched->pool != NULL)
+        free_stripe_pool(sched->pool);
+    if (sched->ops != NULL)
+        free(sched->ops);
+    free(sched);
+}
+
+static void free_stripe_pool(struct stripe_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=1; i<=pool->nworkers; i++)
+        pthread_join(pool->tids[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->tids);
+    free(pool->jobs);
+    free(pool->args);
+    free(pool);
+}
@@ -19,51 +19,55 @@
 #define IA_INIT  0    // Initial number of inactivated columns
 #define IA_STEP  1    // Gradually inactivate more columns
 /*
- * Pivoting algorithms use double-linked lists to store numbers of
- * nonzeros of rows and columns of a matrix.
+ * Row/column index of the nonzeros of a matrix, built once from the
+ * nonzero pattern maintained by the caller (or from a scan of the
+ * matrix if no pattern is given) when pivoting starts.
+ *   nonzero columns of row i are row_idx[row_ptr[i]..row_ptr[i+1])
+ *   nonzero rows of column j are col_idx[col_ptr[j]..col_ptr[j+1]),
+ *   in ascending order
  */
-typedef struct subscript  Subscript;
-typedef struct subscripts ssList;
-struct subscript
-{
-    int index;
-    int nonzeros;
-    struct subscript *next;
-    struct subscript *prev;
-};
-
-struct subscripts
-{
-    struct subscript *ssFirst;
-    struct subscript *ssLast;
+struct sparse_index {
+    int *row_ptr;
+    int *row_idx;
+    int *col_ptr;
+    int *col_idx;
 };
 
-
-
 /*
- * Procedures to pivot matrix.
+ * Pivoting algorithms use bucket queues to store rows/cols according
+ * to their numbers of nonzeros. Items of the same bucket are chained
+ * in a double-linked list kept in index arrays, -1 ends a list.
  */
-static int inactivation_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivots, ssList *ColPivots);
-static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivots, ssList *ColPivots);
+struct bucket_queue {
+    int  nbucket;
+    int *head;      // first item of each bucket
+    int *next;
+    int *prev;
+    int *bucket;    // bucket of each item, -1 if not queued
+};
 
 /*
- * Reshape matrix A and B of Ax=B according to pivot sequence in (RowPivots, ColPivots)
+ * Procedures to pivot matrix.
  */
-static void reshape_matrix(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, ssList *RowPivots, ssList *ColPivots);
+static int inactivation_pivoting(int nrow, int ncolA, struct sparse_index *si, int *RowPivots, int *ColPivots);
+static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, int *RowPivots, int *ColPivots);
 
 /*
- * Reorder columns of matrix according to sequence in ColPivots
+ * Eliminate nonzeros below the diagonal of the active part after
+ * inactivation pivoting, and return a copy of the ias x ias bottom-right
+ * matrix T.
  */
-static void permute_matrix_columns(int nrow, int ncolA, GF_ELEMENT **A, ssList *ColPivots);
+static long long diagonalize_active_part(int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct sparse_index *si, int *ctoo_r, int *ctoo_c, int ias, GF_ELEMENT ***ptr_T);
 
 /*
  * Helper functions for pivoting
- * We use double-linked lists when pivoting a matrix.
  */
-static void insertSubAtBeginning(ssList *sub_list, Subscript *sub);
-static void insertSubAtEnd(ssList *sub_list, Subscript *sub);
-static void removeSubscript(ssList *sub_list, Subscript *sub);
-static void free_subscriptList(ssList *sub_list);
+static struct sparse_index *build_sparse_index(int nrow, int ncolA, GF_ELEMENT **A, struct nz_pattern *pat);
+static void free_sparse_index(struct sparse_index *si);
+static struct bucket_queue *create_bucket_queue(int nitem, int nbucket);
+static void bucket_push_front(struct bucket_queue *bq, int item, int b);
+static void bucket_remove(struct bucket_queue *bq, int item);
+static void free_bucket_queue(struct bucket_queue *bq);
 
 extern long long forward_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
 extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B);
@@ -83,9 +87,12 @@ extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A,
  *  nrow  - number of rows of A and B
  *  ncolA - number of columns of A
  *  ncolB - number of columns of B
+ *  pat   - nonzero pattern of A maintained by the caller, or NULL if
+ *          the nonzeros are to be found by scanning A
  *
  * Return:
- *  number of Galois field operations consumed
+ *  number of Galois field operations consumed, or -1 if the index of
+ *  nonzeros cannot be allocated (A and B are left untouched)
  *
  * Return as arguments:
  *  ctoo_r/ctoo_c  - Arrays containing mappings of row/col indices after pivoting
@@ -107,135 +114,47 @@ extern long long back_substitute(int nrow, int ncolA, int ncolB, GF_ELEMENT **A,
  *
  **********************************************************************************/
 
-long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ptr_ctoo_r, int **ptr_ctoo_c, int *inactives)
+
+long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ptr_ctoo_r, int **ptr_ctoo_c, int *inactives)
 {
     int i, j, k;
     long operations = 0;
-    ssList *row_pivots = malloc(sizeof(ssList));
-    ssList *col_pivots = malloc(sizeof(ssList));
-    row_pivots->ssFirst = row_pivots->ssLast = NULL;
-    col_pivots->ssFirst = col_pivots->ssLast = NULL;
 
     double pivoting_time=0.0;
     clock_t start_pivoting, stop_pivoting;
-    long long nonzeros, total;
     if (get_loglevel() == TRACE) {
         printf("Start one round of pivoting...\n");
         printf("Inactivation pivoting... IA_INIT: %d, IA_STEP: %d.\n", IA_INIT, IA_STEP);
         start_pivoting = clock();
     }
-    int ias = inactivation_pivoting(nrow, ncolA, A, row_pivots, col_pivots);
-    *inactives = ias;
-    if (get_loglevel() == TRACE) {
-        printf("A total of %d/%d columns are inactivated.\n", ias, ncolA);
-        stop_pivoting = clock();
-        pivoting_time = ((double) (stop_pivoting - start_pivoting)) / CLOCKS_PER_SEC;
-        printf("Inactivation pivoting consumed time: %.6f seconds.\n", pivoting_time);
-    }
-
     // Save orders of row/column indices after pivoting
     // Original-to-Current mapping: the i-th element of the array gives where is the original i-th row/col in the new (virtually) re-ordered matrix
     // Current-to-Original mapping: the i-th element of the array specifies what was the original row/col id of the current i-th row/col
     int *ctoo_r = *ptr_ctoo_r;
     int *ctoo_c = *ptr_ctoo_c;
-    Subscript *ss_pt_r = row_pivots->ssFirst;
-    Subscript *ss_pt_c = col_pivots->ssFirst;
-    for (i=0; i<ncolA; i++) {
-        ctoo_r[i] = ss_pt_r->index;
-        ss_pt_r = ss_pt_r->next;
-        ctoo_c[i] = ss_pt_c->index;
-        ss_pt_c = ss_pt_c->next;
-    }
-    free_subscriptList(row_pivots);
-    free_subscriptList(col_pivots);
-
-    // Diagonalize active part
-    // Don't physically swap row/col. Perform all operations on the original matrix with the help of the mappings 
-    // To save random access time, we still need to make a copy of the top-right (nColA-ias) x ias matrix U.
-    GF_ELEMENT **U = calloc(ncolA-ias, sizeof(GF_ELEMENT*));
-    for (i=0; i<ncolA-ias; i++) {
-        U[i] = calloc(ias, sizeof(GF_ELEMENT));
-        for (j=0; j<ias; j++)
-            U[i][j] = A[ctoo_r[i]][ctoo_c[ncolA-ias+j]];
-    }
-    // And also make a copy of the bottom-right (ias x ias) matrix T.
-    // This kind of copy is a tradeoff between memory usage and access time. 
-    GF_ELEMENT **T = calloc(ias, sizeof(GF_ELEMENT*));
-    for (i=0; i<ias; i++){
-        T[i] = calloc(ias, sizeof(GF_ELEMENT));
-        for (j=0; j<ias; j++)
-            T[i][j] = A[ctoo_r[ncolA-ias+i]][ctoo_c[ncolA-ias+j]];
-    }
-    // Start to diagonalize
-    clock_t start_p, stop_p;
-    start_p = clock();
-    long long ops1=0;
-    GF_ELEMENT quotient;
-    nonzeros = 0;
-    for (i=0; i<ncolA-ias; i++) {
-        for (j=i+1; j<ncolA; j++) {
-            if (A[ctoo_r[i]][ctoo_c[i]] == 0 && get_loglevel() == TRACE)
-                printf("The diagonal element after re-ordering is nonzero.\n");
-            // process the item on (j, i)
-            if (A[ctoo_r[j]][ctoo_c[i]] != 0) {
-                quotient = galois_divide(A[ctoo_r[j]][ctoo_c[i]], A[ctoo_r[i]][ctoo_c[i]]);
-                ops1 += 1;
-                // multiply-and-add the corresponding part in the inactive part
-                if (j < ncolA-ias) {
-                    // eliminating nonzeros in the first ncolA-ias rows (but below diagonal)
-                    galois_multiply_add_region(U[j], U[i], quotient, ias);
-                } else {
-                    // eliminating nonzeros in the last ias rows
-                    galois_multiply_add_region(T[j-(ncolA-ias)], U[i], quotient, ias);
-                }
-                ops1 += ias;    // This part of matrix in processing is lower triangular in part, so operations only needed in the back half (i.e., inactiavted part)
-                // simultaneously do the same thing on right matrix B
-                galois_multiply_add_region(B[ctoo_r[j]], B[ctoo_r[i]], quotient, ncolB);
-                ops1 += ncolB;
-                A[ctoo_r[j]][ctoo_c[i]] = 0;            // eliminate the item
-                nonzeros += 1;
-            }
-        }
-    }
-    stop_p = clock();
+    struct sparse_index *si = build_sparse_index(nrow, ncolA, A, pat);
+    if (si == NULL)
+        return -1;
+    int ias = inactivation_pivoting(nrow, ncolA, si, ctoo_r, ctoo_c);
+    *inactives = ias;
     if (get_loglevel() == TRACE) {
-        printf("Diagonalize active part (%lld nonzero elements) after inactivating %d took %.6f seconds, cost %lld operations.\n", nonzeros, ias, ((double) (stop_p-start_p))/CLOCKS_PER_SEC, ops1);
+        printf("A total of %d/%d columns are inactivated.\n", ias, ncolA);
+        stop_pivoting = clock();
+        pivoting_time = ((double) (stop_pivoting - start_pivoting)) / CLOCKS_PER_SEC;
+        printf("Inactivation pivoting consumed time: %.6f seconds.\n", pivoting_time);
     }
-    operations += ops1;
 
-    // Copy U and T back, free U but keep T for forward substitution
-    for (i=0; i<ncolA-ias; i++) {
-        for (j=0; j<ias; j++)
-            A[ctoo_r[i]][ctoo_c[ncolA-ias+j]] = U[i][j];
-        free(U[i]);
-    }
-    free(U);
-    for (i=0; i<ias; i++) {
-        for (j=0; j<ias; j++)
-            A[ctoo_r[ncolA-ias+i]][ctoo_c[ncolA-ias+j]] = T[i][j];
-    }
+    // Diagonalize active part, and keep T for forward substitution
+    GF_ELEMENT **T;
+    operations += diagonalize_active_part(ncolA, ncolB, A, B, si, ctoo_r, ctoo_c, ias, &T);
+    free_sparse_index(si);
 
     /* Perform forward substitution on the ias x ias dense inactivated matrix. */
+    clock_t start_p, stop_p;
     start_p = clock();
-    /*
-    if (get_loglevel() == TRACE) {
-        nonzeros = 0;
-        total = 0;
-        for (i=0; i<ias; i++) {
-            for (j=0; j<ias; j++) {
-                total++;
-                if (T[i][j] != 0)
-                    nonzeros++;
-            }
-        }
-        printf("Current percentage of nonzeros of the sub-matrix: %.2f%%\n", (double) nonzeros/total*100);
-        printf("Perform forward substitution on the square sub-matrix of size: %d x %d\n", ias, ias);
-    }
-    */
     // Make a copy of the corresponding msg matrices of T before performing forward substitution. 
-    GF_ELEMENT **msg_submatrix = calloc(ias, sizeof(GF_ELEMENT*));
+    GF_ELEMENT **msg_submatrix = create_matrix(ias, ncolB);
     for (i=0; i<ias; i++){
-        msg_submatrix[i] = calloc(ncolB, sizeof(GF_ELEMENT));
         memcpy(msg_submatrix[i], B[ctoo_r[ncolA-ias+i]], ncolB*sizeof(GF_ELEMENT));
     }
 
@@ -248,29 +167,13 @@ long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_EL
         memcpy(B[ctoo_r[ncolA-ias+i]], msg_submatrix[i], ncolB*sizeof(GF_ELEMENT));
     }
 
-    //free T, msg_submatrix
-    for (i=0; i<ias; i++) {
-        free(T[i]);
-        free(msg_submatrix[i]);
-    }
-    free(T);
-    free(msg_submatrix);
+    free_matrix(T);
+    free_matrix(msg_submatrix);
     stop_p = clock();
     if (get_loglevel() == TRACE) {
         printf("Forward substitution on the bottom-right part took %.6f seconds, cost %lld operations\n", ((double) (stop_p-start_p))/CLOCKS_PER_SEC, ops);
     }
 
-    /*
-    if (get_loglevel() == TRACE) {
-        int missing_pivots = 0;
-        for (i=0; i<ncolA; i++) {
-            if (A[ctoo_r[i]][ctoo_c[i]] == 0)
-                missing_pivots += 1;
-        }
-        printf("There are %d pivots missing after forward substitution\n", missing_pivots);
-    }
-    */
-
     return operations;
 }
 
@@ -283,121 +186,45 @@ long pivot_matrix_oneround(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_EL
  *
  ********************************************************************************/
 
-long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, int **ptr_ctoo_r, int **ptr_ctoo_c, int *inactives)
+long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct nz_pattern *pat, int **ptr_ctoo_r, int **ptr_ctoo_c, int *inactives)
 {
     int i, j, k;
     long operations = 0;
-    // First pivoting: inactivation
-    ssList *row_pivots = malloc(sizeof(ssList));
-    ssList *col_pivots = malloc(sizeof(ssList));
-    row_pivots->ssFirst = row_pivots->ssLast = NULL;
-    col_pivots->ssFirst = col_pivots->ssLast = NULL;
 
     double pivoting_time=0.0;
     clock_t start_pivoting, stop_pivoting;
-    long long nonzeros, total;
     if (get_loglevel() == TRACE) {
         printf("Start one round of pivoting...\n");
         printf("Inactivation pivoting... IA_INIT: %d, IA_STEP: %d.\n", IA_INIT, IA_STEP);
         start_pivoting = clock();
     }
-    int ias = inactivation_pivoting(nrow, ncolA, A, row_pivots, col_pivots);
-    *inactives = ias;
-    if (get_loglevel() == TRACE) {
-        printf("A total of %d/%d columns are inactivated.\n", ias, ncolA);
-        stop_pivoting = clock();
-        pivoting_time = ((double) (stop_pivoting - start_pivoting)) / CLOCKS_PER_SEC;
-        printf("Inactivation pivoting consumed time: %.6f seconds.\n", pivoting_time);
-    }
-
+    // First pivoting: inactivation
     // Save orders of row/column indices after pivoting
     // Original-to-Current mapping: the i-th element of the array gives where is the original i-th row/col in the new (virtually) re-ordered matrix
     // Current-to-Original mapping: the i-th element of the array specifies what was the original row/col id of the current i-th row/col
     int *ctoo_r = *ptr_ctoo_r;
     int *ctoo_c = *ptr_ctoo_c;
-    Subscript *ss_pt_r = row_pivots->ssFirst;
-    Subscript *ss_pt_c = col_pivots->ssFirst;
-    for (i=0; i<ncolA; i++) {
-        ctoo_r[i] = ss_pt_r->index;
-        ss_pt_r = ss_pt_r->next;
-        ctoo_c[i] = ss_pt_c->index;
-        ss_pt_c = ss_pt_c->next;
-    }
-    free_subscriptList(row_pivots);
-    free_subscriptList(col_pivots);
-
-    // Diagonalize active part
-    // Don't physically swap row/col. Perform all operations on the original matrix with the help of the mappings 
-    // To save random access time, we still need to make a copy of the top-right (nColA-ias) x ias matrix U.
-    GF_ELEMENT **U = calloc(ncolA-ias, sizeof(GF_ELEMENT*));
-    for (i=0; i<ncolA-ias; i++) {
-        U[i] = calloc(ias, sizeof(GF_ELEMENT));
-        for (j=0; j<ias; j++)
-            U[i][j] = A[ctoo_r[i]][ctoo_c[ncolA-ias+j]];
-    }
-    // And also make a copy of the bottom-right (ias x ias) matrix T.
-    // This kind of copy is a tradeoff between memory usage and access time. 
-    GF_ELEMENT **T = calloc(ias, sizeof(GF_ELEMENT*));
-    for (i=0; i<ias; i++){
-        T[i] = calloc(ias, sizeof(GF_ELEMENT));
-        for (j=0; j<ias; j++)
-            T[i][j] = A[ctoo_r[ncolA-ias+i]][ctoo_c[ncolA-ias+j]];
-    }
-    // Start to diagonalize
-    clock_t start_p, stop_p;
-    start_p = clock();
-    long long ops1=0;
-    GF_ELEMENT quotient;
-    nonzeros = 0;
-    for (i=0; i<ncolA-ias; i++) {
-        for (j=i+1; j<ncolA; j++) {
-            if (A[ctoo_r[i]][ctoo_c[i]] == 0 && get_loglevel() == TRACE)
-                printf("The diagonal element after re-ordering is nonzero.\n");
-            // process the item on (j, i)
-            if (A[ctoo_r[j]][ctoo_c[i]] != 0) {
-                quotient = galois_divide(A[ctoo_r[j]][ctoo_c[i]], A[ctoo_r[i]][ctoo_c[i]]);
-                ops1 += 1;
-                // multiply-and-add the corresponding part in the inactive part
-                if (j < ncolA-ias) {
-                    // eliminating nonzeros in the first ncolA-ias rows (but below diagonal)
-                    galois_multiply_add_region(U[j], U[i], quotient, ias);
-                } else {
-                    // eliminating nonzeros in the last ias rows
-                    galois_multiply_add_region(T[j-(ncolA-ias)], U[i], quotient, ias);
-                }
-                ops1 += ias;    // This part of matrix in processing is lower triangular in part, so operations only needed in the back half (i.e., inactiavted part)
-                // simultaneously do the same thing on right matrix B
-                galois_multiply_add_region(B[ctoo_r[j]], B[ctoo_r[i]], quotient, ncolB);
-                ops1 += ncolB;
-                A[ctoo_r[j]][ctoo_c[i]] = 0;            // eliminate the item
-                nonzeros += 1;
-            }
-        }
-    }
-    stop_p = clock();
+    struct sparse_index *si = build_sparse_index(nrow, ncolA, A, pat);
+    if (si == NULL)
+        return -1;
+    int ias = inactivation_pivoting(nrow, ncolA, si, ctoo_r, ctoo_c);
+    *inactives = ias;
     if (get_loglevel() == TRACE) {
-        printf("Diagonalize active part (%lld nonzero elements) after inactivating %d took %.6f seconds, cost %lld operations.\n", nonzeros, ias, ((double) (stop_p-start_p))/CLOCKS_PER_SEC, ops1);
+        printf("A total of %d/%d columns are inactivated.\n", ias, ncolA);
+        stop_pivoting = clock();
+        pivoting_time = ((double) (stop_pivoting - start_pivoting)) / CLOCKS_PER_SEC;
+        printf("Inactivation pivoting consumed time: %.6f seconds.\n", pivoting_time);
     }
-    operations += ops1;
 
-    // Copy U and T back, free U but keep T as it is still needed for further pivoting
-    for (i=0; i<ncolA-ias; i++) {
-        for (j=0; j<ias; j++)
-            A[ctoo_r[i]][ctoo_c[ncolA-ias+j]] = U[i][j];
-        free(U[i]);
-    }
-    free(U);
-    for (i=0; i<ias; i++) {
-        for (j=0; j<ias; j++)
-            A[ctoo_r[ncolA-ias+i]][ctoo_c[ncolA-ias+j]] = T[i][j];
-    }
+    // Diagonalize active part, and keep T as it is still needed for further pivoting
+    GF_ELEMENT **T;
+    operations += diagonalize_active_part(ncolA, ncolB, A, B, si, ctoo_r, ctoo_c, ias, &T);
+    free_sparse_index(si);
 
     // Second round of pivoting
     // Zlatev pivoting on (ias x ias) matrix
-    ssList *row_pivots_2nd = malloc(sizeof(ssList));
-    ssList *col_pivots_2nd = malloc(sizeof(ssList));
-    row_pivots_2nd->ssFirst = row_pivots_2nd->ssLast = NULL;
-    col_pivots_2nd->ssFirst = col_pivots_2nd->ssLast = NULL;
+    int *row_pivots_2nd = malloc(sizeof(int) * ias);
+    int *col_pivots_2nd = malloc(sizeof(int) * ias);
     if (get_loglevel() == TRACE) {
         printf("Zlatev pivoting...\n");
         start_pivoting = clock();
@@ -411,42 +238,23 @@ long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_EL
     // Update row/col mappings
     int *partial_r = (int *) calloc(ias, sizeof(int));  // partial arrays are allocated to avoid corrupting the original ctoo_ arrays
     int *partial_c = (int *) calloc(ias, sizeof(int));
-    Subscript *spt_2nd_r = row_pivots_2nd->ssFirst;
-    Subscript *spt_2nd_c = col_pivots_2nd->ssFirst;
     for (i=0; i<ias; i++) {
-        partial_r[i] = ctoo_r[ncolA-ias+spt_2nd_r->index];
-        partial_c[i] = ctoo_c[ncolA-ias+spt_2nd_c->index];
-        spt_2nd_r = spt_2nd_r->next;
-        spt_2nd_c = spt_2nd_c->next;
+        partial_r[i] = ctoo_r[ncolA-ias+row_pivots_2nd[i]];
+        partial_c[i] = ctoo_c[ncolA-ias+col_pivots_2nd[i]];
     }
     memcpy(&(ctoo_r[ncolA-ias]), partial_r, sizeof(int)*ias);
     memcpy(&(ctoo_c[ncolA-ias]), partial_c, sizeof(int)*ias);
-    free_subscriptList(row_pivots_2nd);
-    free_subscriptList(col_pivots_2nd);
+    free(row_pivots_2nd);
+    free(col_pivots_2nd);
     free(partial_r);
     free(partial_c);
 
     /* Perform forward substitution on the ias x ias dense inactivated matrix. */
+    clock_t start_p, stop_p;
     start_p = clock();
-    /*
-    if (get_loglevel() == TRACE) {
-        nonzeros = 0;
-        total = 0;
-        for (i=0; i<ias; i++) {
-            for (j=0; j<ias; j++) {
-                total++;
-                if (T[i][j] != 0)
-                    nonzeros++;
-            }
-        }
-        printf("Current percentage of nonzeros of the sub-matrix: %.2f%%\n", (double) nonzeros/total*100);
-        printf("Perform forward substitution on the square sub-matrix of size: %d x %d\n", ias, ias);
-    }
-    */
     // Make a copy of the corresponding msg matrices of T before performing forward substitution. 
-    GF_ELEMENT **msg_submatrix = calloc(ias, sizeof(GF_ELEMENT*));
+    GF_ELEMENT **msg_submatrix = create_matrix(ias, ncolB);
     for (i=0; i<ias; i++){
-        msg_submatrix[i] = calloc(ncolB, sizeof(GF_ELEMENT));
         for (j=0; j<ias; j++)
             T[i][j] = A[ctoo_r[ncolA-ias+i]][ctoo_c[ncolA-ias+j]];  // reuse allocated memory, but data needs refresh because ctoo_r/ctoo_c were updated
         memcpy(msg_submatrix[i], B[ctoo_r[ncolA-ias+i]], ncolB*sizeof(GF_ELEMENT));
@@ -461,29 +269,104 @@ long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_EL
         memcpy(B[ctoo_r[ncolA-ias+i]], msg_submatrix[i], ncolB*sizeof(GF_ELEMENT));
     }
 
-    //free T, msg_submatrix
-    for (i=0; i<ias; i++) {
-        free(T[i]);
-        free(msg_submatrix[i]);
-    }
-    free(T);
-    free(msg_submatrix);
+    free_matrix(T);
+    free_matrix(msg_submatrix);
     stop_p = clock();
     if (get_loglevel() == TRACE) {
         printf("Forward substitution on the bottom-right part took %.6f seconds, cost %lld operations\n", ((double) (stop_p-start_p))/CLOCKS_PER_SEC, ops);
     }
+    return operations;
+}
 
-    /*
-    if (get_loglevel() == TRACE) {
-        int missing_pivots = 0;
-        for (i=0; i<ncolA; i++) {
-            if (A[ctoo_r[i]][ctoo_c[i]] == 0)
-                missing_pivots += 1;
+/*
+ * Diagonalize active part
+ * Don't physically swap row/col. Perform all operations on the original matrix with the help of the mappings.
+ * Only nonzeros of the active columns are visited, so the cost is proportional to the nonzeros rather
+ * than to the size of the matrix.
+ */
+static long long diagonalize_active_part(int ncolA, int ncolB, GF_ELEMENT **A, GF_ELEMENT **B, struct sparse_index *si, int *ctoo_r, int *ctoo_c, int ias, GF_ELEMENT ***ptr_T)
+{
+    int i, j, k, r, c;
+    int nact = ncolA - ias;
+    // position of each original row/col after pivoting (-1 for rows not chosen as pivots)
+    int nrow = 0;
+    for (i=0; i<ncolA; i++)
+        if (ctoo_r[i] >= nrow)
+            nrow = ctoo_r[i] + 1;
+    int *otoc_r = malloc(sizeof(int) * nrow);
+    int *otoc_c = malloc(sizeof(int) * ncolA);
+    memset(otoc_r, -1, sizeof(int) * nrow);
+    for (i=0; i<ncolA; i++) {
+        otoc_r[ctoo_r[i]] = i;
+        otoc_c[ctoo_c[i]] = i;
+    }
+
+    // To save random access time, we still need to make a copy of the top-right (nColA-ias) x ias matrix U
+    // and the bottom-right (ias x ias) matrix T. Only nonzeros of the inactive columns are copied.
+    GF_ELEMENT **U = create_matrix(nact, ias);
+    GF_ELEMENT **T = create_matrix(ias, ias);
+    for (i=0; i<ncolA; i++) {
+        GF_ELEMENT *row = i < nact ? U[i] : T[i-nact];
+        r = ctoo_r[i];
+        for (k=si->row_ptr[r]; k<si->row_ptr[r+1]; k++) {
+            c = si->row_idx[k];
+            if (otoc_c[c] >= nact)
+                row[otoc_c[c]-nact] = A[r][c];
         }
-        printf("There are %d pivots missing after forward substitution\n", missing_pivots);
     }
-    */
-    return operations;
+    // Start to diagonalize
+    clock_t start_p, stop_p;
+    start_p = clock();
+    long long ops1=0;
+    long long nonzeros = 0;
+    GF_ELEMENT quotient;
+    for (i=0; i<nact; i++) {
+        if (A[ctoo_r[i]][ctoo_c[i]] == 0 && get_loglevel() == TRACE)
+            printf("The diagonal element after re-ordering is nonzero.\n");
+        // process the items on (j, i), j>i
+        c = ctoo_c[i];
+        for (k=si->col_ptr[c]; k<si->col_ptr[c+1]; k++) {
+            r = si->col_idx[k];
+            j = otoc_r[r];
+            if (j <= i || A[r][c] == 0)
+                continue;
+            quotient = galois_divide(A[r][c], A[ctoo_r[i]][c]);
+            ops1 += 1;
+            // multiply-and-add the corresponding part in the inactive part
+            if (j < nact) {
+                // eliminating nonzeros in the first ncolA-ias rows (but below diagonal)
+                galois_multiply_add_region_short(U[j], U[i], quotient, ias);
+            } else {
+                // eliminating nonzeros in the last ias rows
+                galois_multiply_add_region_short(T[j-nact], U[i], quotient, ias);
+            }
+            ops1 += ias;    // This part of matrix in processing is lower triangular in part, so operations only needed in the back half (i.e., inactiavted part)
+            // simultaneously do the same thing on right matrix B
+            galois_multiply_add_region(B[r], B[ctoo_r[i]], quotient, ncolB);
+            ops1 += ncolB;
+            A[r][c] = 0;            // eliminate the item
+            nonzeros += 1;
+        }
+    }
+    stop_p = clock();
+    if (get_loglevel() == TRACE) {
+        printf("Diagonalize active part (%lld nonzero elements) after inactivating %d took %.6f seconds, cost %lld operations.\n", nonzeros, ias, ((double) (stop_p-start_p))/CLOCKS_PER_SEC, ops1);
+    }
+
+    // Copy U and T back, free U
+    for (i=0; i<nact; i++) {
+        for (j=0; j<ias; j++)
+            A[ctoo_r[i]][ctoo_c[nact+j]] = U[i][j];
+    }
+    free_matrix(U);
+    for (i=0; i<ias; i++) {
+        for (j=0; j<ias; j++)
+            A[ctoo_r[nact+i]][ctoo_c[nact+j]] = T[i][j];
+    }
+    free(otoc_r);
+    free(otoc_c);
+    *ptr_T = T;
+    return ops1;
 }
 
 
@@ -493,7 +376,7 @@ long pivot_matrix_tworound(int nrow, int ncolA, int ncolB, GF_ELEMENT **A, GF_EL
  * A special kind of Markowitz pivoting in which pivots are selected from 3
  * candidates who have the smallest nonzeros.
  ******************************************************************************/
-static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivots, ssList *ColPivots)
+static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, int *RowPivots, int *ColPivots)
 {
     // Nonzeros of each rows and cols
     int *row_counts = (int *) calloc(nrow, sizeof(int));
@@ -516,41 +399,22 @@ static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivot
         }
     }
     /*************************************************************************
-     * A list of double lists. Elements of each double list contain rows/cols
-     * indices. Rows/cols of same double-linked list have the same number of
-     * nonzero elements.
+     * Bucket queues of rows/cols indices. Rows/cols of the same bucket have
+     * the same number of nonzero elements.
      **************************************************************************/
-    ssList **RowID_lists = (ssList **) malloc(sizeof(ssList*) * (max_row1s+1));
-    ssList **ColID_lists = (ssList **) malloc(sizeof(ssList*) * (max_col1s+1));
-    for (i=0; i<max_row1s+1; i++) {
-        RowID_lists[i] = (ssList *) malloc(sizeof(ssList));
-        RowID_lists[i]->ssFirst = RowID_lists[i]->ssLast = NULL;
-    }
-    for (i=0; i<max_col1s+1; i++) {
-        ColID_lists[i] = (ssList *) malloc(sizeof(ssList));
-        ColID_lists[i]->ssFirst = ColID_lists[i]->ssLast = NULL;
-    }
-    // Travel through the matrix and populate double-linked lists
+    struct bucket_queue *RowID_lists = create_bucket_queue(nrow, max_row1s+1);
+    struct bucket_queue *ColID_lists = create_bucket_queue(ncolA, max_col1s+1);
+    // Travel through the matrix and populate bucket queues
     int allzero_rows = 0;
     for (i=0; i<nrow; i++) {
-        int row_count = row_counts[i];
-        Subscript *rowID = malloc(sizeof(Subscript));
-        rowID->index = i;
-        rowID->nonzeros = row_count;
-        rowID->prev = rowID->next = NULL;
-        insertSubAtBeginning(RowID_lists[row_count], rowID);
-        if (row_count == 0)
+        bucket_push_front(RowID_lists, i, row_counts[i]);
+        if (row_counts[i] == 0)
             allzero_rows += 1;
     }
     int allzero_cols = 0;
     for (i=0; i<ncolA; i++) {
-        int col_count = col_counts[i];
-        Subscript *colID = malloc(sizeof(Subscript));
-        colID->index = i;
-        colID->nonzeros = col_count;
-        colID->prev = colID->next = NULL;
-        insertSubAtBeginning(ColID_lists[col_count], colID);
-        if (col_count == 0)
+        bucket_push_front(ColID_lists, i, col_counts[i]);
+        if (col_counts[i] == 0)
             allzero_cols += 1;
     }
 
@@ -566,18 +430,12 @@ static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivot
     int toallzero_rows = 0;
     int singletons = 0;
     while (pivots_found != ncolA) {
-        //printf("%d rows removed, %d reduced to all-zero.\n", removed_rows, toallzero_rows);
-        //printf("%d cols removed, %d reduced to all-zero.\n", removed_cols, toallzero_cols);
-
         // 计算Markowitz count
         int potential_r  = -1;
         int potential_c  = -1;
         int potential_mc = -1;              // potential Markowitz count
         int current_mc;
         int mc_minipos;             // the minimum possible Markowitz count in each row test
-        int direct_found = 0;
-        // search for one pivot
-        Subscript *rows_inchecking, *cols_inchecking;
         int row_id, col_id;
 
         // Search rows
@@ -585,28 +443,20 @@ static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivot
         for (i=1; i<=max_row1s; i++) {
             // 先按行的非零元素多少搜索
             mc_minipos = (i - 1) * (i - 1);
-            if (RowID_lists[i]->ssFirst == NULL)
-                continue;
-
-            rows_inchecking = RowID_lists[i]->ssFirst;
-            while (rows_inchecking != NULL && (searched_rows < ZLATEVS)) {
+            row_id = RowID_lists->head[i];
+            while (row_id != -1 && (searched_rows < ZLATEVS)) {
                 searched_rows += 1;
-                row_id = rows_inchecking->index;
                 // 再按列的非零元素多少做test
                 for (j=1; j<=max_col1s; j++) {
-                    cols_inchecking = ColID_lists[j]->ssFirst;
-                    while (cols_inchecking != NULL) {
-                        col_id = cols_inchecking->index;
+                    for (col_id=ColID_lists->head[j]; col_id!=-1; col_id=ColID_lists->next[col_id]) {
                         if (A[row_id][col_id] != 0) {
                             // we have found an entry in (row_id)-th row
                             current_mc = (i-1) * (j-1);
                             if (current_mc == 0) {
-
                                 potential_r = row_id;
                                 potential_c = col_id;
                                 if (i==1)
                                     singletons += 1;
-                                //  printf("a singleton row is found.\n");
                                 goto found;
                             } else if (potential_mc == -1 || current_mc < potential_mc) {
                                 potential_r = row_id;
@@ -614,10 +464,9 @@ static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivot
                                 potential_mc = current_mc;
                             }
                         }
-                        cols_inchecking = cols_inchecking->next;
                     }
                 }
-                rows_inchecking = rows_inchecking->next;
+                row_id = RowID_lists->next[row_id];
             }
         }
 
@@ -629,106 +478,66 @@ static int zlatev_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivot
             }
             // There are row/col being reduced to all-zero, take them
             // as pivot anyway because we have no other choices
-            Subscript *sub_ptt;
-            sub_ptt = ColID_lists[0]->ssFirst;
             int zerocols = 0;
-            while(sub_ptt != NULL) {
-                zerocols += 1;
-                Subscript *newCpivot0 = malloc(sizeof(Subscript));
-                newCpivot0->index = sub_ptt->index;
-                newCpivot0->nonzeros = sub_ptt->nonzeros;
-                newCpivot0->prev = newCpivot0->next = NULL;
-                insertSubAtEnd(ColPivots, newCpivot0);
-                sub_ptt = sub_ptt->next;
-            }
-
-            sub_ptt = RowID_lists[0]->ssFirst;
-            //for (i=0; i<(toallzero_rows+allzero_cols); i++)
+            for (k=ColID_lists->head[0]; k!=-1; k=ColID_lists->next[k])
+                ColPivots[pivots_found+zerocols++] = k;
+            k = RowID_lists->head[0];
             for (i=0; i<zerocols; i++) {
-                Subscript *newRpivot0 = malloc(sizeof(Subscript));
-                newRpivot0->index = sub_ptt->index;
-                newRpivot0->nonzeros = sub_ptt->nonzeros;
-                newRpivot0->prev = newRpivot0->next = NULL;
-                insertSubAtEnd(RowPivots, newRpivot0);
-                sub_ptt = sub_ptt->next;
+                RowPivots[pivots_found+i] = k;
+                k = RowID_lists->next[k];
             }
             if (get_loglevel() == TRACE)
                 printf("There are %d/%d singleton rows were found as pivots.\n", singletons, pivots_found);
+            free(row_counts);
+            free(col_counts);
+            free_bucket_queue(RowID_lists);
+            free_bucket_queue(ColID_lists);
             return ncolA;
         }
 
 found:
         // Found a pivot, save it
+        RowPivots[pivots_found] = potential_r;
+        ColPivots[pivots_found] = potential_c;
         pivots_found += 1;
         int p_r = potential_r;
         int p_c = potential_c;
-        // Save coordiate (p_r, p_c)
-        Subscript *newRpivot = malloc(sizeof(Subscript));
-        newRpivot->index = p_r;
-        newRpivot->nonzeros = row_counts[p_r];
-        newRpivot->prev = newRpivot->next = NULL;
-        insertSubAtEnd(RowPivots, newRpivot);
-        Subscript *newCpivot = malloc(sizeof(Subscript));
-        newCpivot->index = p_c;
-        newCpivot->nonzeros = col_counts[p_c];
-        newCpivot->prev = newCpivot->next = NULL;
-        insertSubAtEnd(ColPivots, newCpivot);
 
         // Update row_counts[], col_counts[], RowID_lists, ColID_lists
         // 1, check nonzero elements of the row: potential_r, update numbers of nonzero elements of the correspondings columns(col_counts[] and ColID_lists).
-        int nzs;
-        Subscript *ss_pt;
-        Subscript *ss_pt_next;
-        // Note: some row/col have been eliminated, so we need to traverse Subscript when updating
+        int item, item_next;
+        // Note: some row/col have been eliminated, so we need to traverse bucket queues when updating
         // 1, Update columns
         for (i=1; i<=max_col1s; i++) {
-            ss_pt = ColID_lists[i]->ssFirst;
-            while (ss_pt != NULL) {
-                if (A[p_r][ss_pt->index] != 0) {
-                    // 该subscript对象将要被更新处理，因此要记下当前遍历的位置
-                    ss_pt_next = ss_pt->next;
-                    if (ss_pt->index == p_c) {
-                        removeSubscript(ColID_lists[i], ss_pt);
-                        removed_cols += 1;
-                        col_counts[ss_pt->index] -= 1;
-                        free(ss_pt);
-                    } else {
-                        removeSubscript(ColID_lists[i], ss_pt);
-                        ss_pt->nonzeros -= 1;
-                        insertSubAtBeginning(ColID_lists[ss_pt->nonzeros], ss_pt);
-                        if (ss_pt->nonzeros == 0)
-                            toallzero_cols += 1;
-                        col_counts[ss_pt->index] -= 1;
-                    }
-                    ss_pt = ss_pt_next;
+            for (item=ColID_lists->head[i]; item!=-1; item=item_next) {
+                item_next = ColID_lists->next[item];
+                if (A[p_r][item] == 0)
+                    continue;
+                bucket_remove(ColID_lists, item);
+                col_counts[item] -= 1;
+                if (item == p_c) {
+                    removed_cols += 1;
                 } else {
-                    ss_pt = ss_pt->next;
+                    bucket_push_front(ColID_lists, item, i-1);
+                    if (i == 1)
+                        toallzero_cols += 1;
                 }
             }
         }
         // 2, Update rows
         for (j=1; j<=max_row1s; j++) {
-            ss_pt = RowID_lists[j]->ssFirst;
-            while (ss_pt != NULL) {
-                if (A[ss_pt->index][p_c] != 0) {
-                    // 该subscript对象将要被更新处理，因此要记下当前遍历的位置
-                    ss_pt_next = ss_pt->next;
-                    if (ss_pt->index == p_r) {
-                        removeSubscript(RowID_lists[j], ss_pt);
-                        removed_rows += 1;
-                        row_counts[ss_pt->index] -= 1;
-                        free(ss_pt);
-                    } else {
-                        removeSubscript(RowID_lists[j], ss_pt);
-                        ss_pt->nonzeros -= 1;
-                        if (ss_pt->nonzeros == 0)
-                            toallzero_rows += 1;
-                        insertSubAtBeginning(RowID_lists[ss_pt->nonzeros], ss_pt);
-                        row_counts[ss_pt->index] -= 1;
-                    }
-                    ss_pt = ss_pt_next;
+            for (item=RowID_lists->head[j]; item!=-1; item=item_next) {
+                item_next = RowID_lists->next[item];
+                if (A[item][p_c] == 0)
+                    continue;
+                bucket_remove(RowID_lists, item);
+                row_counts[item] -= 1;
+                if (item == p_r) {
+                    removed_rows += 1;
                 } else {
-                    ss_pt = ss_pt->next;
+                    if (j == 1)
+                        toallzero_rows += 1;
+                    bucket_push_front(RowID_lists, item, j-1);
                 }
             }
         }
@@ -737,10 +546,8 @@ found:
 
     free(row_counts);
     free(col_counts);
-    for (i=0; i<max_row1s+1; i++)
-        free_subscriptList(RowID_lists[i]);
-    for (i=0; i<max_col1s+1; i++)
-        free_subscriptList(ColID_lists[i]);
+    free_bucket_queue(RowID_lists);
+    free_bucket_queue(ColID_lists);
     if (get_loglevel() == TRACE) {
         printf("%d rows reduced to all-zero.\n", toallzero_rows);
         printf("%d cols reduced to all-zero.\n", toallzero_cols);
@@ -758,46 +565,41 @@ found:
  *  1) inactivate some columns and only perform pivoting on the rest of the "active" sub-matrix
  *  2) if singleton row cannot be found in the middle of pivoting, declare more inactive columns
  *  3) given the structure (heavier columns are in the back), declare inactive columns from the back
+ * Row counts are updated through the nonzeros of the removed columns, and rows whose count drops to one
+ * are kept on a stack, so no step scans the whole matrix.
  *********************************************************************************************************/
-static int inactivation_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *RowPivots, ssList *ColPivots)
+static int inactivation_pivoting(int nrow, int ncolA, struct sparse_index *si, int *RowPivots, int *ColPivots)
 {
     if (get_loglevel() == TRACE)
         printf("Pivoting matrix of size %d x %d via inactivation.\n", nrow, ncolA);
 
     int i, j, k;
     // 对矩阵中初始非零元素进行计数
-    int *row_counts = (int *) calloc(nrow, sizeof(int));
-    int *col_counts = (int *) calloc(ncolA, sizeof(int));
+    int *row_counts = (int *) malloc(sizeof(int) * nrow);
+    int *col_counts = (int *) malloc(sizeof(int) * ncolA);
 
-    int max_row1s = 0;                  // 记录初始矩阵里行中非零元素数目的最大值
     int max_col1s = 0;                  // 记录初始矩阵里列中非零元素数目的最大值
-    for (i=0; i<nrow; i++) {
-        for (j=0; j<ncolA; j++) {
-            if (A[i][j] != 0) {
-                row_counts[i] += 1;
-                if (row_counts[i] > max_row1s)
-                    max_row1s = row_counts[i];
-
-                col_counts[j] += 1;
-                if (col_counts[j] > max_col1s)
-                    max_col1s = col_counts[j];
-            }
-        }
-    }
-    // 创建指针数组，每个指针指向一个双向链表，同一个链表中的列具有相同数目的非零元素
-    // 该链表用来保存active的列的标号，按非零元素个数排列是为了方便inactivate含非零元素最多的列
-    ssList **ColID_lists = (ssList **) malloc(sizeof(ssList*) * (max_col1s+1));
-    for (i=0; i<max_col1s+1; i++) {
-        ColID_lists[i] = (ssList *) malloc(sizeof(ssList));
-        ColID_lists[i]->ssFirst = ColID_lists[i]->ssLast = NULL;
-    }
+    for (i=0; i<nrow; i++)
+        row_counts[i] = si->row_ptr[i+1] - si->row_ptr[i];
     for (i=0; i<ncolA; i++) {
-        int col_count = col_counts[i];
-        Subscript *colID = malloc(sizeof(Subscript));
-        colID->index = i;
-        colID->nonzeros = col_count;
-        colID->prev = colID->next = NULL;
-        insertSubAtBeginning(ColID_lists[col_count], colID);
+        col_counts[i] = si->col_ptr[i+1] - si->col_ptr[i];
+        if (col_counts[i] > max_col1s)
+            max_col1s = col_counts[i];
+    }
+    // 同一个bucket中的列具有相同数目的非零元素
+    // 该队列用来保存active的列的标号，按非零元素个数排列是为了方便inactivate含非零元素最多的列
+    struct bucket_queue *ColID_lists = create_bucket_queue(ncolA, max_col1s+1);
+    for (i=0; i<ncolA; i++)
+        bucket_push_front(ColID_lists, i, col_counts[i]);
+    int top = max_col1s;                // buckets above top are empty (columns never move between buckets)
+
+    // Rows that have become singletons. A row's count reaches one only once,
+    // so nrow entries suffice; rows are checked again when popped.
+    int *singleton_rows = (int *) malloc(sizeof(int) * nrow);
+    int nsingletons = 0;
+    for (i=nrow-1; i>=0; i--) {
+        if (row_counts[i] == 1)
+            singleton_rows[nsingletons++] = i;
     }
 
     // Declare an array to record three possible "states" of each column
@@ -813,27 +615,25 @@ static int inactivation_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *Ro
 
     int p_r;                    // used to store row index of the chosen pivot
     int p_c;                    // used to store col index of the chosen pivot
-    int singleton_r_found;
-    int ia;
+    int removed_c;
     int selected_pivots = 0;
+    int npivots = 0;            // pivots saved to RowPivots/ColPivots
     while (active != 0) {
         p_r = -1;
         p_c = -1;
-        singleton_r_found = 0;
-        for (i=0; i<nrow; i++) {
+        while (nsingletons > 0) {
+            i = singleton_rows[--nsingletons];
             if (row_counts[i] == 1) {
-                singleton_r_found = 1;
-                //printf("singleton row is found at row %d.\n", i);
                 p_r = i;
                 break;
             }
         }
 
-        if (singleton_r_found == 1) {
+        if (p_r != -1) {
             // a singleton row is found, store the pivot
-            for (j=0; j<ncolA; j++) {
-                if ((col_state[j]==0) && (A[p_r][j]!=0)) {
-                    p_c = j;
+            for (k=si->row_ptr[p_r]; k<si->row_ptr[p_r+1]; k++) {
+                if (col_state[si->row_idx[k]] == 0) {
+                    p_c = si->row_idx[k];
                     break;
                 }
             }
@@ -841,172 +641,271 @@ static int inactivation_pivoting(int nrow, int ncolA, GF_ELEMENT **A, ssList *Ro
                 printf("error: failed to find the nonzero element in the singlton row.\n");
                 exit(1);
             }
-            // save the pivot
             // 保存该pivot的坐标
-            Subscript *newRpivot = malloc(sizeof(Subscript));
-            newRpivot->index = p_r;
-            newRpivot->nonzeros = 1;
-            newRpivot->prev = newRpivot->next = NULL;
-            insertSubAtEnd(RowPivots, newRpivot);
-            Subscript *newCpivot = malloc(sizeof(Subscript));
-            newCpivot->index = p_c;
-            newCpivot->nonzeros = col_counts[p_c];
-            newCpivot->prev = newCpivot->next = NULL;
-            insertSubAtEnd(ColPivots, newCpivot);
-
-            // 更新row_counts
+            RowPivots[npivots] = p_r;
+            ColPivots[npivots] = p_c;
+            npivots += 1;
             row_counts[p_r] = -1;           // use -1 to indicate the row has an elelemnt was chosen as pivot
-            for (i=0; i<nrow; i++) {
-                if ( (row_counts[i] != -1) && (A[i][p_c] != 0) ) {
-                    row_counts[i] -= 1;
-                }
-            }
-            // 更新ColID_list
-            Subscript *ss_pt = ColID_lists[col_counts[p_c]]->ssFirst;
-            while (ss_pt != NULL) {
-                if (ss_pt->index == p_c)
-                    break;
-                ss_pt = ss_pt->next;
-            }
-            if (ss_pt->index == p_c) {
-                removeSubscript(ColID_lists[col_counts[p_c]], ss_pt);
-                free(ss_pt);
-                ss_pt = NULL;
-            }
-
             col_state[p_c] = 2;
-            active -= 1;
+            removed_c = p_c;
             selected_pivots += 1;
-            //printf("Inactivated: %d Pivots Found: %d\n", inactivated, selected_pivots);
         } else {
             // no singleton row can be found, declare one column with the most nonzeros as inactive
             // Note: other algorithms may be used to choose a column to inactivate
-            for (i=max_col1s; i>=0; i--) {
-                Subscript *ss_pt = ColID_lists[i]->ssFirst;
-                //if ((ss_pt != NULL) && (col_state[ss_pt->index] == 0))
-                if (ss_pt != NULL) {
-                    col_state[ss_pt->index] = 1;
-                    inactivated += 1;
-                    active -= 1;
-                    for (k=0; k<nrow; k++) {
-                        if ((A[k][ss_pt->index] != 0) && (row_counts[k] != -1))
-                            row_counts[k] -= 1;
-                    }
-
-                    removeSubscript(ColID_lists[i], ss_pt);
-                    free(ss_pt);
-                    ss_pt = NULL;
-                    break;
-                }
-            }
+            while (ColID_lists->head[top] == -1)
+                top--;
+            removed_c = ColID_lists->head[top];
+            col_state[removed_c] = 1;
+            inactivated += 1;
             selected_pivots += 1;
-            //printf("Inactivated: %d Pivots Found: %d\n", inactivated, selected_pivots);
         }
-
+        // 更新row_counts和ColID_lists
+        for (k=si->col_ptr[removed_c]; k<si->col_ptr[removed_c+1]; k++) {
+            i = si->col_idx[k];
+            if (row_counts[i] != -1 && --row_counts[i] == 1)
+                singleton_rows[nsingletons++] = i;
+        }
+        bucket_remove(ColID_lists, removed_c);
+        active -= 1;
     }
     // assign pivots for the dense part (any ordering is fine)
+    int free_r = 0;             // rows before free_r have all been selected
     for (i=0; i<ncolA; i++) {
         if (col_state[i] == 1) {
-            // find an arbitray row that has not been selected
-            int j_candidate;
-            for (j=0; j<nrow; j++) {
-                if (row_counts[j] != -1) {
-                    j_candidate = j;
-                    if (A[j][i] != 0)
-                        break;
+            // prefer a row that has not been selected and has a nonzero in the column
+            j = -1;
+            for (k=si->col_ptr[i]; k<si->col_ptr[i+1]; k++) {
+                if (row_counts[si->col_idx[k]] != -1) {
+                    j = si->col_idx[k];
+                    break;
                 }
             }
-            j = j_candidate;
-
+            if (j == -1) {
+                // otherwise take an arbitrary row that has not been selected
+                while (row_counts[free_r] == -1)
+                    free_r++;
+                j = free_r;
+            }
             // 保存该pivot的坐标
-            Subscript *newRpivot = malloc(sizeof(Subscript));
-            newRpivot->index = j;
-            newRpivot->nonzeros = 0;
-            newRpivot->prev = newRpivot->next = NULL;
-            insertSubAtEnd(RowPivots, newRpivot);
-            Subscript *newCpivot = malloc(sizeof(Subscript));
-            newCpivot->index = i;
-            newCpivot->nonzeros = 0;
-            newCpivot->prev = newCpivot->next = NULL;
-            insertSubAtEnd(ColPivots, newCpivot);
+            RowPivots[npivots] = j;
+            ColPivots[npivots] = i;
+            npivots += 1;
             row_counts[j] = -1;
             col_state[i] = 2;
-            //printf("pivot at (%d, %d) is chosen for the dense part.\n", j, i);
         }
     }
 
     // free up memories
     free(col_state);
-
-    for (i=0; i<max_col1s+1; i++)
-        free_subscriptList(ColID_lists[i]);
-    free(ColID_lists);
-
+    free(singleton_rows);
+    free_bucket_queue(ColID_lists);
     free(row_counts);
     free(col_counts);
     return inactivated;
 }
 
-// insert a subscript object at the beginning of the list
-static void insertSubAtBeginning(ssList *sub_list, Subscript *sub)
+static struct sparse_index *build_sparse_index(int nrow, int ncolA, GF_ELEMENT **A, struct nz_pattern *pat)
 {
-    if (sub_list->ssFirst == NULL) {
-        sub_list->ssFirst = sub_list->ssLast = sub;
-        sub->prev = NULL;
-        sub->next = NULL;
-    } else {
-        sub_list->ssFirst->prev = sub;
-        sub->next = sub_list->ssFirst;
-        sub_list->ssFirst = sub;
-        sub->prev = NULL;
+    static char fname[] = "build_sparse_index";
+    int i, j, k, c;
+    struct sparse_index *si = calloc(1, sizeof(struct sparse_index));
+    if (si == NULL)
+        goto AllocError;
+    if ((si->row_ptr = calloc(nrow+1, sizeof(int))) == NULL)
+        goto AllocError;
+    if ((si->col_ptr = calloc(ncolA+1, sizeof(int))) == NULL)
+        goto AllocError;
+    // mark[c] == i if column c has been taken for row i, so that
+    // repeated candidates of the pattern are counted once
+    int *mark = malloc(sizeof(int) * ncolA);
+    if (mark == NULL)
+        goto AllocError;
+    for (int pass=0; pass<2; pass++) {
+        memset(mark, -1, sizeof(int) * ncolA);
+        for (i=0; i<nrow; i++) {
+            int scan = pat == NULL || pat->len[i] < 0;
+            int n = scan ? ncolA : pat->len[i];
+            for (k=0; k<n; k++) {
+                c = scan ? k : pat->cols[i][k];
+                if (c >= ncolA || A[i][c] == 0 || mark[c] == i)
+                    continue;
+                mark[c] = i;
+                if (pass == 0) {
+                    si->row_ptr[i+1] += 1;
+                    si->col_ptr[c+1] += 1;
+                } else {
+                    si->row_idx[si->row_ptr[i+1]++] = c;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (i=0; i<nrow; i++)
+                si->row_ptr[i+1] += si->row_ptr[i];
+            for (j=0; j<ncolA; j++)
+                si->col_ptr[j+1] += si->col_ptr[j];
+            if ((si->row_idx = malloc(sizeof(int) * (si->row_ptr[nrow]+1))) == NULL
+                || (si->col_idx = malloc(sizeof(int) * (si->col_ptr[ncolA]+1))) == NULL) {
+                free(mark);
+                goto AllocError;
+            }
+            // row_ptr[i+1] is used as fill pointer of row i in the second pass
+            for (i=nrow; i>0; i--)
+                si->row_ptr[i] = si->row_ptr[i-1];
+        }
     }
+    free(mark);
+    // Rows are visited in ascending order, so are the rows of each column
+    int *fill = malloc(sizeof(int) * ncolA);
+    if (fill == NULL)
+        goto AllocError;
+    memcpy(fill, si->col_ptr, sizeof(int) * ncolA);
+    for (i=0; i<nrow; i++) {
+        for (k=si->row_ptr[i]; k<si->row_ptr[i+1]; k++)
+            si->col_idx[fill[si->row_idx[k]]++] = i;
+    }
+    free(fill);
+    return si;
+
+AllocError:
+    fprintf(stderr, "%s: malloc sparse index failed\n", fname);
+    free_sparse_index(si);
+    return NULL;
 }
 
-// insert a subscript object at the end of the list
-static void insertSubAtEnd(ssList *sub_list, Subscript *sub)
+static void free_sparse_index(struct sparse_index *si)
 {
-    if (sub_list->ssFirst == NULL && sub_list->ssLast == NULL) {
-        sub_list->ssFirst = sub_list->ssLast = sub;
-        sub->prev = NULL;
-        sub->next = NULL;
-    } else {
-        sub_list->ssLast->next = sub;
-        sub->prev = sub_list->ssLast;
-        sub->next = NULL;
-        sub_list->ssLast = sub;
+    if (si == NULL)
+        return;
+    free(si->row_ptr);
+    free(si->row_idx);
+    free(si->col_ptr);
+    free(si->col_idx);
+    free(si);
+}
+
+static struct bucket_queue *create_bucket_queue(int nitem, int nbucket)
+{
+    struct bucket_queue *bq = malloc(sizeof(struct bucket_queue));
+    bq->nbucket = nbucket;
+    bq->head   = malloc(sizeof(int) * nbucket);
+    bq->next   = malloc(sizeof(int) * nitem);
+    bq->prev   = malloc(sizeof(int) * nitem);
+    bq->bucket = malloc(sizeof(int) * nitem);
+    memset(bq->head, -1, sizeof(int) * nbucket);
+    memset(bq->bucket, -1, sizeof(int) * nitem);
+    return bq;
+}
+
+// insert an item at the beginning of a bucket
+static void bucket_push_front(struct bucket_queue *bq, int item, int b)
+{
+    bq->prev[item] = -1;
+    bq->next[item] = bq->head[b];
+    if (bq->head[b] != -1)
+        bq->prev[bq->head[b]] = item;
+    bq->head[b] = item;
+    bq->bucket[item] = b;
+}
+
+// remove an item from its bucket
+static void bucket_remove(struct bucket_queue *bq, int item)
+{
+    int b = bq->bucket[item];
+    if (bq->prev[item] != -1)
+        bq->next[bq->prev[item]] = bq->next[item];
+    else
+        bq->head[b] = bq->next[item];
+    if (bq->next[item] != -1)
+        bq->prev[bq->next[item]] = bq->prev[item];
+    bq->bucket[item] = -1;
+}
+
+static void free_bucket_queue(struct bucket_queue *bq)
+{
+    free(bq->head);
+    free(bq->next);
+    free(bq->prev);
+    free(bq->bucket);
+    free(bq);
+}
+
+/*
+ * Nonzero pattern maintained by decoders
+ */
+struct nz_pattern *create_nz_pattern(int nrow)
+{
+    static char fname[] = "create_nz_pattern";
+    struct nz_pattern *pat = malloc(sizeof(struct nz_pattern));
+    if (pat == NULL)
+        goto AllocError;
+    pat->nrow = nrow;
+    pat->cols = calloc(nrow, sizeof(int*));
+    pat->len  = calloc(nrow, sizeof(int));
+    pat->size = calloc(nrow, sizeof(int));
+    if (pat->cols == NULL || pat->len == NULL || pat->size == NULL)
+        goto AllocError;
+    return pat;
+
+AllocError:
+    fprintf(stderr, "%s: malloc nz_pattern failed\n", fname);
+    free_nz_pattern(pat);
+    return NULL;
+}
+
+/*
+ * Record that entry (row, col) may be nonzero
+ * Return 0 on success, -1 on error, after which the row is scanned
+ * in full by pivoting
+ */
+int nz_pattern_add(struct nz_pattern *pat, int row, int col)
+{
+    static char fname[] = "nz_pattern_add";
+    if (pat->len[row] < 0)
+        return 0;
+    if (pat->len[row] == pat->size[row]) {
+        int size = pat->size[row] == 0 ? 8 : pat->size[row] * 2;
+        int *cols = realloc(pat->cols[row], sizeof(int) * size);
+        if (cols == NULL) {
+            fprintf(stderr, "%s: realloc pattern row %d failed\n", fname, row);
+            free(pat->cols[row]);
+            pat->cols[row] = NULL;
+            pat->size[row] = 0;
+            pat->len[row]  = -1;
+            return -1;
+        }
+        pat->cols[row] = cols;
+        pat->size[row] = size;
     }
+    pat->cols[row][pat->len[row]++] = col;
+    return 0;
 }
 
-// remove a subscript object from the list (no free() operation yet)
-static void removeSubscript(ssList *sub_list, Subscript *sub)
+/*
+ * Record the nonzeros of elem[from..to) as entries of the row
+ */
+int nz_pattern_add_row(struct nz_pattern *pat, int row, GF_ELEMENT *elem, int from, int to)
 {
-    if (sub->prev == NULL && sub->next == NULL) {
-        // only one left in the list
-        sub_list->ssFirst = sub_list->ssLast = NULL;
-    } else if (sub->prev == NULL && sub->next != NULL) {
-        // the element is the head
-        sub_list->ssFirst = sub->next;
-        sub_list->ssFirst->prev = NULL;
-    } else if (sub->prev != NULL && sub->next == NULL) {
-        // the element is the tail
-        sub_list->ssLast = sub->prev;
-        sub->prev->next = NULL;
-    } else {
-        // the element is in the middle of the list
-        sub->next->prev = sub->prev;
-        sub->prev->next = sub->next;
+    for (int j=from; j<to; j++) {
+        if (elem[j] != 0 && nz_pattern_add(pat, row, j) != 0)
+            return -1;
     }
+    return 0;
 }
 
-// free the subscript list
-static void free_subscriptList(ssList *sub_list)
+void free_nz_pattern(struct nz_pattern *pat)
 {
-    Subscript *sub = sub_list->ssFirst;
-    while (sub != NULL) {
-        sub_list->ssFirst = sub->next;
-        free(sub);
-        sub = sub_list->ssFirst;
-    }
-    free(sub_list);
-    sub_list = NULL;
+    if (pat == NULL)
+        return;
+    if (pat->cols != NULL) {
+        for (int i=0; i<pat->nrow; i++) {
+            if (pat->cols[i] != NULL)
+                free(pat->cols[i]);
+        }
+        free(pat->cols);
+    }
+    if (pat->len != NULL)
+        free(pat->len);
+    if (pat->size != NULL)
+        free(pat->size);
+    free(pat);
 }
@@ -0,0 +1,106 @@
+/**************************************************************
+ * ring.c
+ *
+ * Bounded multi-producer single-consumer ring of pointers. Each
+ * slot carries a sequence number telling whether it is free for
+ * the producer of a position or filled for the consumer, and
+ * producers claim positions with a CAS on the head, so neither
+ * pushing nor popping takes a lock.
+ *
+ * Rings hand packets to the solver thread of asynchronous decoders
+ * (sncAsync.c) and messages between the workers of parallel GG
+ * decoders (decoderGG.c).
+ **************************************************************/
+#define _DEFAULT_SOURCE     // posix_memalign()
+#include "common.h"
+
+#define CACHE_LINE  64
+
+struct ring_slot {
+    size_t  seq;            // pos if free for position pos, pos+1 if filled
+    void   *item;
+};
+
+struct mpsc_ring {
+    struct ring_slot *slots;
+    size_t            mask; // number of slots - 1
+    // Producers and the consumer advance different ends of the ring
+    size_t head __attribute__((aligned(CACHE_LINE)));   // next position to fill
+    size_t tail __attribute__((aligned(CACHE_LINE)));   // next position to take
+};
+
+// Create a ring of at least nslots slots
+struct mpsc_ring *create_ring(size_t nslots)
+{
+    static char fname[] = "create_ring";
+    struct mpsc_ring *ring;
+    if (posix_memalign((void **) &ring, CACHE_LINE, sizeof(struct mpsc_ring)) != 0) {
+        fprintf(stderr, "%s: posix_memalign mpsc_ring failed\n", fname);
+        return NULL;
+    }
+    memset(ring, 0, sizeof(struct mpsc_ring));
+    size_t n = 1;
+    while (n < nslots)
+        n <<= 1;
+    ring->mask = n - 1;
+    if ((ring->slots = malloc(sizeof(struct ring_slot) * n)) == NULL) {
+        fprintf(stderr, "%s: malloc ring of %ld slots failed\n", fname, (long) n);
+        free(ring);
+        return NULL;
+    }
+    for (size_t i=0; i<n; i++)
+        ring->slots[i].seq = i;
+    return ring;
+}
+
+// Claim a position of the ring and fill it with item; return -1 if the ring is full
+int ring_push(struct mpsc_ring *ring, void *item)
+{
+    size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct ring_slot *slot;
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long dif = (long) (seq - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return (-1);    // the slot still holds the item of pos - nslots
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->item = item;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Take the next item of the ring (consumer only); return NULL if the ring is empty
+void *ring_pop(struct mpsc_ring *ring)
+{
+    size_t pos = ring->tail;
+    struct ring_slot *slot = &ring->slots[pos & ring->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return NULL;
+    void *item = slot->item;
+    __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->tail = pos + 1;
+    return item;
+}
+
+// Whether the next item is not filled yet (consumer only)
+int ring_empty(struct mpsc_ring *ring)
+{
+    size_t pos = ring->tail;
+    return __atomic_load_n(&ring->slots[pos & ring->mask].seq, __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+// Free the ring (items left in it are up to the caller)
+void free_ring(struct mpsc_ring *ring)
+{
+    if (ring == NULL)
+        return;
+    free(ring->slots);
+    free(ring);
+}
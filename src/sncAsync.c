@@ -0,0 +1,231 @@
+/**************************************************************
+ * sncAsync.c
+ *
+ * Asynchronous decoder. Packets are submitted to a bounded ring
+ * and decoded by a dedicated solver thread, so that the thread
+ * receiving packets never runs elimination itself, including the
+ * heavy work done when the decoder gets full rank.
+ *
+ * The ring is a bounded multi-producer single-consumer queue (see
+ * ring.c), so submitting a packet takes no lock. The solver sleeps
+ * on a condition variable when the ring is empty; producers only
+ * take the lock to wake it up.
+ *
+ * Completion is notified through a file descriptor that becomes
+ * readable (an eventfd, or a pipe where eventfd is not available)
+ * and an optional callback invoked on the solver thread.
+ **************************************************************/
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "common.h"
+#include "sparsenc.h"
+
+struct snc_async_decoder {
+    struct snc_decoder *decoder;
+    struct mpsc_ring   *ring;
+    void (*done)(struct snc_decoder *, void *);
+    void               *arg;
+    int                 notify_fd[2];   // read and write ends (the same eventfd on Linux)
+    pthread_t           solver;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;   // signaled when a packet is submitted to a sleeping solver
+    pthread_cond_t      idle;   // broadcast when the solver has emptied the ring
+    int                 sleeping;
+    int                 stop;
+    int                 finished;
+    long                submitted;
+    long                processed;
+};
+
+static void *solve(void *arg);
+
+static int open_notify_fd(int fd[2])
+{
+#ifdef __linux__
+    fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd[0] != -1)
+        return 0;
+#endif
+    if (pipe(fd) != 0)
+        return (-1);
+    fcntl(fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(fd[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static void close_notify_fd(int fd[2])
+{
+    if (fd[0] != -1)
+        close(fd[0]);
+    if (fd[1] != -1 && fd[1] != fd[0])
+        close(fd[1]);
+}
+
+/*
+ * Create an asynchronous decoder with a ring of at least qsize packets.
+ * done(decoder, arg) is called on the solver thread when the decoder
+ * is finished, if done is not NULL.
+ */
+struct snc_async_decoder *snc_create_async_decoder(struct snc_parameters *sp, int d_type, int qsize,
+                                                   void (*done)(struct snc_decoder *, void *), void *arg)
+{
+    static char fname[] = "snc_create_async_decoder";
+    struct snc_async_decoder *adec;
+    if ((adec = calloc(1, sizeof(struct snc_async_decoder))) == NULL) {
+        fprintf(stderr, "%s: calloc snc_async_decoder failed\n", fname);
+        return NULL;
+    }
+    adec->notify_fd[0] = adec->notify_fd[1] = -1;
+    adec->done = done;
+    adec->arg  = arg;
+    if ((adec->ring = create_ring(qsize)) == NULL)
+        goto error;
+    if ((adec->decoder = snc_create_decoder(sp, d_type)) == NULL)
+        goto error;
+    if (open_notify_fd(adec->notify_fd) != 0) {
+        fprintf(stderr, "%s: cannot create notification fd\n", fname);
+        goto error;
+    }
+    pthread_mutex_init(&adec->lock, NULL);
+    pthread_cond_init(&adec->wake, NULL);
+    pthread_cond_init(&adec->idle, NULL);
+    if (pthread_create(&adec->solver, NULL, solve, adec) != 0) {
+        fprintf(stderr, "%s: cannot create solver thread\n", fname);
+        pthread_mutex_destroy(&adec->lock);
+        pthread_cond_destroy(&adec->wake);
+        pthread_cond_destroy(&adec->idle);
+        goto error;
+    }
+    return adec;
+
+error:
+    close_notify_fd(adec->notify_fd);
+    snc_free_decoder(adec->decoder);
+    free_ring(adec->ring);
+    free(adec);
+    return NULL;
+}
+
+/*
+ * Submit a packet to the decoder without waiting for it to be decoded.
+ * The decoder takes over the caller's reference of pkt, which must be an
+ * allocated packet (not a view created by snc_deserialize_packet()).
+ * Return 0 on success, or -1 if the ring is full (pkt is left to the
+ * caller). Packets submitted after the decoder is finished are dropped.
+ */
+int snc_async_process_packet(struct snc_async_decoder *adec, struct snc_packet *pkt)
+{
+    static char fname[] = "snc_async_process_packet";
+    if (pkt->refcnt == 0) {
+        fprintf(stderr, "%s: packet views cannot be decoded asynchronously\n", fname);
+        return (-1);
+    }
+    if (ring_push(adec->ring, pkt) != 0)
+        return (-1);
+    __atomic_add_fetch(&adec->submitted, 1, __ATOMIC_RELEASE);
+    // Pairs with the fence of the solver going to sleep: either the solver
+    // sees the packet, or the packet's producer sees the solver sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&adec->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&adec->lock);
+        pthread_cond_signal(&adec->wake);
+        pthread_mutex_unlock(&adec->lock);
+    }
+    return 0;
+}
+
+static void notify_finished(struct snc_async_decoder *adec)
+{
+    __atomic_store_n(&adec->finished, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(adec->notify_fd[1], &one, adec->notify_fd[0] == adec->notify_fd[1] ? sizeof(uint64_t) : 1) == -1)
+        fprintf(stderr, "notify_finished: cannot write notification fd\n");
+    if (adec->done != NULL)
+        adec->done(adec->decoder, adec->arg);
+}
+
+static void *solve(void *arg)
+{
+    struct snc_async_decoder *adec = arg;
+    for (;;) {
+        struct snc_packet *pkt = ring_pop(adec->ring);
+        if (pkt == NULL) {
+            pthread_mutex_lock(&adec->lock);
+            __atomic_store_n(&adec->sleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            while ((pkt = ring_pop(adec->ring)) == NULL && !adec->stop) {
+                pthread_cond_broadcast(&adec->idle);
+                pthread_cond_wait(&adec->wake, &adec->lock);
+            }
+            __atomic_store_n(&adec->sleeping, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&adec->lock);
+            if (pkt == NULL)
+                break;
+        }
+        if (!adec->finished && !__atomic_load_n(&adec->stop, __ATOMIC_RELAXED)) {
+            snc_process_packet(adec->decoder, pkt);
+            if (snc_decoder_finished(adec->decoder))
+                notify_finished(adec);
+        }
+        snc_free_packet(pkt);
+        __atomic_add_fetch(&adec->processed, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Whether the decoder is finished
+int snc_async_decoder_finished(struct snc_async_decoder *adec)
+{
+    return __atomic_load_n(&adec->finished, __ATOMIC_ACQUIRE);
+}
+
+// File descriptor that becomes readable when the decoder is finished
+int snc_async_decoder_fd(struct snc_async_decoder *adec)
+{
+    return adec->notify_fd[0];
+}
+
+/*
+ * Wait until the packets submitted so far are processed (or dropped).
+ * To be called by the thread submitting packets.
+ */
+void snc_async_flush(struct snc_async_decoder *adec)
+{
+    long submitted = __atomic_load_n(&adec->submitted, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&adec->lock);
+    while (__atomic_load_n(&adec->processed, __ATOMIC_ACQUIRE) < submitted)
+        pthread_cond_wait(&adec->idle, &adec->lock);
+    pthread_mutex_unlock(&adec->lock);
+}
+
+/*
+ * The decoder working in the background. It may only be used while the
+ * solver is idle, i.e., once the decoder is finished, or after
+ * snc_async_flush() if no packets are submitted in the meantime.
+ */
+struct snc_decoder *snc_async_get_decoder(struct snc_async_decoder *adec)
+{
+    return adec->decoder;
+}
+
+// Stop the solver thread, and free the decoder and the packets still queued
+void snc_free_async_decoder(struct snc_async_decoder *adec)
+{
+    if (adec == NULL)
+        return;
+    pthread_mutex_lock(&adec->lock);
+    __atomic_store_n(&adec->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&adec->wake);
+    pthread_mutex_unlock(&adec->lock);
+    pthread_join(adec->solver, NULL);
+    pthread_mutex_destroy(&adec->lock);
+    pthread_cond_destroy(&adec->wake);
+    pthread_cond_destroy(&adec->idle);
+    close_notify_fd(adec->notify_fd);
+    snc_free_decoder(adec->decoder);
+    free_ring(adec->ring);
+    free(adec);
+}
@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "common.h"
 #include "decoderGG.h"
 #include "decoderOA.h"
@@ -18,8 +23,26 @@
 struct snc_decoder {
     void   *dec_ctx;        // decoder context
     int    d_type;          // decoder type
+    GF_ELEMENT *coes;       // coefficients regenerated for packets with seq
+    GF_ELEMENT *syms;       // copy of symbols of shared packets
+    struct journal *journal;    // journal of processed packets (see journal.c)
+    char   *snapshot;       // path of the snapshot the journal follows
+    long   snapsize;        // bytes of the snapshot
+    int    stepped;         // leave completion work to snc_decoder_step()
+    struct snc_packet **queue;  // packets received by a stepped GG decoder while
+    int    qhead, qlen, qcap;   // work was pending, processed by snc_decoder_step()
+    unsigned char *out_map; // mapped output file (see snc_bind_decoder_output_file())
+    int    out_fd;
 };
 
+static long processed_packets(struct snc_decoder *decoder);
+static int pending_work(struct snc_decoder *decoder);
+static int resume(struct snc_decoder *decoder, long long budget);
+static void decode_packet(struct snc_decoder *decoder, struct snc_packet *pkt);
+static int queue_packet(struct snc_decoder *decoder, struct snc_packet *pkt);
+static int process_queued(struct snc_decoder *decoder);
+static int save_snapshot(struct snc_decoder *decoder);
+
 struct snc_decoder *snc_create_decoder(struct snc_parameters *sp, int d_type)
 {
     struct snc_decoder *decoder = malloc(sizeof(struct snc_decoder));
@@ -27,6 +50,14 @@ struct snc_decoder *snc_create_decoder(struct snc_parameters *sp, int d_type)
         return NULL;
 
     decoder->d_type = d_type;
+    decoder->coes   = NULL;
+    decoder->syms   = NULL;
+    decoder->journal  = NULL;
+    decoder->snapshot = NULL;
+    decoder->stepped  = 0;
+    decoder->queue    = NULL;
+    decoder->qhead    = decoder->qlen = decoder->qcap = 0;
+    decoder->out_map  = NULL;
 
     int allowed_oh = 0;  // allowed overhead of OA decoder
     char *aoh;
@@ -70,6 +101,74 @@ failure:
 
 void snc_process_packet(struct snc_decoder *decoder, struct snc_packet *pkt)
 {
+    if (pending_work(decoder) || decoder->qlen != 0) {
+        if (decoder->stepped && decoder->d_type == GG_DECODER) {
+            // Generations other than those being decoded still need
+            // packets; keep the packet until the work is done
+            queue_packet(decoder, pkt);
+            return;
+        }
+        if (decoder->stepped) {
+            // Other decoders leave work pending once they (nearly) have
+            // full rank, where the packet is of little use; drop it
+            return;
+        }
+        // Work that could not complete (pivoting out of memory) is retried
+        // by the next packet, and the packet is dropped meanwhile
+        resume(decoder, LLONG_MAX);
+        if (snc_decoder_finished(decoder) || pending_work(decoder))
+            return;
+    }
+    decode_packet(decoder, pkt);
+}
+
+// Journal the packet and feed it to the decoder
+static void decode_packet(struct snc_decoder *decoder, struct snc_packet *pkt)
+{
+    struct snc_packet local;
+    struct snc_parameters *sp = &snc_get_enc_context(decoder)->params;
+    int compact = 0;
+    if (decoder->journal != NULL && !snc_decoder_finished(decoder)) {
+        // Journal the packet before the decoder reduces its syms. Once
+        // the journal outgrows the snapshot, replace both by a new snapshot
+        // so that saving stays O(packet) per packet in the amortized sense.
+        compact = jnl_append(decoder->journal, sp, pkt) != 0
+                  || jnl_size(decoder->journal) > decoder->snapsize;
+    }
+    int seeded = sp->sce && pkt->seq >= 0;
+    if (seeded || pkt->coes == NULL) {
+        // Regenerate coefficients of the packet from its seq, and let the
+        // decoder process a copy of the packet carrying the coefficients.
+        // Views of systematic packets carry no coefficients; they get the
+        // zero coefficients systematic packets are generated with, so that
+        // no decoder reads a NULL coes.
+        if (decoder->coes == NULL
+            && (decoder->coes = malloc(sizeof(GF_ELEMENT) * sp->size_g)) == NULL) {
+            fprintf(stderr, "snc_process_packet: malloc decoder->coes failed\n");
+            return;
+        }
+        if (seeded)
+            generate_seeded_coes(sp->seed, pkt->seq, sp->size_g, sp->bnc, decoder->coes);
+        else
+            memset(decoder->coes, 0, sizeof(GF_ELEMENT) * sp->size_g);
+        local = *pkt;
+        local.coes = decoder->coes;
+        pkt = &local;
+    }
+    if (__atomic_load_n(&pkt->refcnt, __ATOMIC_ACQUIRE) > 1) {
+        // Decoders reduce syms of the packet in place, which must not
+        // happen to a packet held by others
+        if (decoder->syms == NULL
+            && (decoder->syms = malloc(sizeof(GF_ELEMENT) * sp->size_p)) == NULL) {
+            fprintf(stderr, "snc_process_packet: malloc decoder->syms failed\n");
+            return;
+        }
+        memcpy(decoder->syms, pkt->syms, sizeof(GF_ELEMENT) * sp->size_p);
+        if (pkt != &local)
+            local = *pkt;
+        local.syms = decoder->syms;
+        pkt = &local;
+    }
     switch (decoder->d_type) {
     case GG_DECODER:
         process_packet_GG(((struct decoding_context_GG *) decoder->dec_ctx), pkt);
@@ -87,14 +186,121 @@ void snc_process_packet(struct snc_decoder *decoder, struct snc_packet *pkt)
         process_packet_PP(((struct decoding_context_PP *) decoder->dec_ctx), pkt);
         break;
     }
+    if (!decoder->stepped)
+        resume(decoder, LLONG_MAX);
+    if (compact)
+        snc_compact_decoder_journal(decoder);
     return;
 }
 
+// Whether completion work triggered by a packet is pending
+static int pending_work(struct snc_decoder *decoder)
+{
+    struct finish_state *fin = NULL;
+    switch (decoder->d_type) {
+    case GG_DECODER:
+        fin = &((struct decoding_context_GG *) decoder->dec_ctx)->fin;
+        break;
+    case OA_DECODER:
+        fin = &((struct decoding_context_OA *) decoder->dec_ctx)->fin;
+        break;
+    case BD_DECODER:
+        fin = &((struct decoding_context_BD *) decoder->dec_ctx)->fin;
+        break;
+    case CBD_DECODER:
+        fin = &((struct decoding_context_CBD *) decoder->dec_ctx)->fin;
+        break;
+    case PP_DECODER:
+        fin = &((struct decoding_context_PP *) decoder->dec_ctx)->fin;
+        break;
+    }
+    return fin != NULL && fin->stage != FINISH_IDLE;
+}
+
+// Carry out pending completion work for about budget operations
+static int resume(struct snc_decoder *decoder, long long budget)
+{
+    switch (decoder->d_type) {
+    case GG_DECODER:
+        return resume_decoding_GG((struct decoding_context_GG *) decoder->dec_ctx, budget);
+    case OA_DECODER:
+        return resume_decoding_OA((struct decoding_context_OA *) decoder->dec_ctx, budget);
+    case BD_DECODER:
+        return resume_decoding_BD((struct decoding_context_BD *) decoder->dec_ctx, budget);
+    case CBD_DECODER:
+        return resume_decoding_CBD((struct decoding_context_CBD *) decoder->dec_ctx, budget);
+    case PP_DECODER:
+        return resume_decoding_PP((struct decoding_context_PP *) decoder->dec_ctx, budget);
+    }
+    return 0;
+}
+
+void snc_set_decoder_stepped(struct snc_decoder *decoder, int stepped)
+{
+    decoder->stepped = stepped;
+}
+
+// Keep a copy of a packet received by a stepped GG decoder while work is pending
+static int queue_packet(struct snc_decoder *decoder, struct snc_packet *pkt)
+{
+    static char fname[] = "queue_packet";
+    if (decoder->qlen == decoder->qcap) {
+        int qcap = decoder->qcap == 0 ? 64 : decoder->qcap * 2;
+        struct snc_packet **queue = realloc(decoder->queue, sizeof(struct snc_packet*) * qcap);
+        if (queue == NULL) {
+            fprintf(stderr, "%s: realloc queue failed, packet dropped\n", fname);
+            return (-1);
+        }
+        decoder->queue = queue;
+        decoder->qcap  = qcap;
+    }
+    struct snc_packet *dup = duplicate_packet(&snc_get_enc_context(decoder)->params, NULL, pkt);
+    if (dup == NULL) {
+        fprintf(stderr, "%s: copy packet failed, packet dropped\n", fname);
+        return (-1);
+    }
+    decoder->queue[decoder->qlen++] = dup;
+    return 0;
+}
+
+/*
+ * Process queued packets in order until one of them leaves work pending.
+ * Return 1 if packets remain queued, 0 otherwise.
+ */
+static int process_queued(struct snc_decoder *decoder)
+{
+    while (decoder->qhead < decoder->qlen && !pending_work(decoder)) {
+        struct snc_packet *pkt = decoder->queue[decoder->qhead++];
+        decode_packet(decoder, pkt);
+        snc_free_packet(pkt);
+    }
+    if (decoder->qhead == decoder->qlen)
+        decoder->qhead = decoder->qlen = 0;
+    return decoder->qlen != 0;
+}
+
+/*
+ * Carry out pending completion work of a stepped decoder for about
+ * budget_ops finite field operations (a row operation on payloads counts
+ * as size_p), then process the packets queued meanwhile.
+ * Return 1 if work or queued packets remain, 0 otherwise.
+ */
+int snc_decoder_step(struct snc_decoder *decoder, long long budget_ops)
+{
+    if (pending_work(decoder)) {
+        if (budget_ops < 1)
+            budget_ops = 1;     // make progress in any case
+        if (resume(decoder, budget_ops))
+            return 1;
+    }
+    return process_queued(decoder) || pending_work(decoder);
+}
+
 int snc_decoder_finished(struct snc_decoder *decoder)
 {
     switch (decoder->d_type) {
     case GG_DECODER:
-        return ((struct decoding_context_GG *) decoder->dec_ctx)->finished;
+        return decoding_finished_GG((struct decoding_context_GG *) decoder->dec_ctx);
     case OA_DECODER:
         return ((struct decoding_context_OA *) decoder->dec_ctx)->finished;
     case BD_DECODER:
@@ -124,13 +330,76 @@ struct snc_context *snc_get_enc_context(struct snc_decoder *decoder)
     return 0;
 }
 
+/*
+ * Bind an output region to the decoder, where source packet i is decoded
+ * in place at buf + i*size_p. Packets already decoded (e.g., by a restored
+ * decoder) are moved to the region.
+ */
+int snc_bind_decoder_output(struct snc_decoder *decoder, unsigned char *buf)
+{
+    static char fname[] = "snc_bind_decoder_output";
+    struct snc_context *sc = snc_get_enc_context(decoder);
+    if (sc->out != NULL) {
+        fprintf(stderr, "%s: an output region is already bound to the decoder\n", fname);
+        return (-1);
+    }
+    sc->out = buf;
+    for (int i=0; i<sc->snum; i++) {
+        if (sc->pp[i] != NULL) {
+            GF_ELEMENT *syms = sc->pp[i];
+            sc->pp[i] = alloc_decoded(sc, i);
+            memcpy(sc->pp[i], syms, sizeof(GF_ELEMENT)*sc->params.size_p);
+            free(syms);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Bind the file filepath as the output region, which is created (or
+ * truncated) and mapped. The file is cut to datasize bytes when the
+ * decoder is freed.
+ */
+int snc_bind_decoder_output_file(struct snc_decoder *decoder, const char *filepath)
+{
+    static char fname[] = "snc_bind_decoder_output_file";
+    struct snc_context *sc = snc_get_enc_context(decoder);
+    size_t outsize = (size_t) sc->snum * sc->params.size_p;
+    int fd;
+    if ((fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+        fprintf(stderr, "%s: cannot open %s\n", fname, filepath);
+        return (-1);
+    }
+    unsigned char *map = MAP_FAILED;
+    if (ftruncate(fd, outsize) == 0)
+        map = mmap(NULL, outsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map %s\n", fname, filepath);
+        close(fd);
+        return (-1);
+    }
+    if (snc_bind_decoder_output(decoder, map) != 0) {
+        munmap(map, outsize);
+        close(fd);
+        return (-1);
+    }
+    decoder->out_map = map;
+    decoder->out_fd  = fd;
+    return 0;
+}
+
 // Return decode overhead, which is defined as oh = N / M, where
 //   N - Number of received packets to successfully decode
 //   M - Number of source packets
 double snc_decode_overhead(struct snc_decoder *decoder)
 {
     struct snc_context *sc = snc_get_enc_context(decoder);
-    int snum = sc->snum;
+    return ((double) processed_packets(decoder) / sc->snum);
+}
+
+// Number of packets the decoder has processed
+static long processed_packets(struct snc_decoder *decoder)
+{
     int ohs  = 0;
     switch (decoder->d_type) {
     case GG_DECODER:
@@ -149,7 +418,7 @@ double snc_decode_overhead(struct snc_decoder *decoder)
         ohs = ((struct decoding_context_PP *) decoder->dec_ctx)->overhead;
         break;
     }
-    return ((double) ohs / snum);
+    return ohs;
 }
 
 // Return decode cost, which is defined as N_ops/M/K, where
@@ -186,6 +455,13 @@ void snc_free_decoder(struct snc_decoder *decoder)
 {
     if (decoder == NULL)
         return;
+    long datasize  = 0;
+    size_t outsize = 0;
+    if (decoder->out_map != NULL) {
+        struct snc_context *sc = snc_get_enc_context(decoder);
+        datasize = sc->params.datasize;
+        outsize  = (size_t) sc->snum * sc->params.size_p;
+    }
     switch (decoder->d_type) {
     case GG_DECODER:
         free_dec_context_GG(((struct decoding_context_GG *) decoder->dec_ctx));
@@ -204,63 +480,250 @@ void snc_free_decoder(struct snc_decoder *decoder)
         break;
     }
     decoder->dec_ctx = NULL;
+    if (decoder->out_map != NULL) {
+        // Cut the padding of the last source packet
+        munmap(decoder->out_map, outsize);
+        if (ftruncate(decoder->out_fd, datasize) != 0)
+            fprintf(stderr, "snc_free_decoder: cannot truncate output file\n");
+        close(decoder->out_fd);
+    }
+    jnl_close(decoder->journal);
+    if (decoder->snapshot != NULL)
+        free(decoder->snapshot);
+    if (decoder->coes != NULL)
+        free(decoder->coes);
+    if (decoder->syms != NULL)
+        free(decoder->syms);
+    for (int i=decoder->qhead; i<decoder->qlen; i++)
+        snc_free_packet(decoder->queue[i]);
+    if (decoder->queue != NULL)
+        free(decoder->queue);
     free(decoder);
     decoder = NULL;
     return;
 }
 
 
+/*
+ * Save decoder context into a checkpoint file (see checkpoint.c). The
+ * decoder-specific state is followed by the decoded packets.
+ * Return values:
+ *   On success: bytes written
+ *   On error: -1
+ */
 long snc_save_decoder_context(struct snc_decoder *decoder, const char *filepath)
 {
+    // Checkpoints hold no pending work nor queued packets
+    do {
+        if (pending_work(decoder) && resume(decoder, LLONG_MAX))
+            return (-1);
+    } while (process_queued(decoder) || pending_work(decoder));
+    struct snc_context *sc = snc_get_enc_context(decoder);
+    struct ckpt_writer *w = ckpt_create_writer(&sc->params, decoder->d_type);
+    if (w == NULL)
+        return (-1);
     switch (decoder->d_type) {
     case GG_DECODER:
-        return save_dec_context_GG((struct decoding_context_GG *) decoder->dec_ctx, filepath);
+        save_dec_context_GG((struct decoding_context_GG *) decoder->dec_ctx, w);
+        break;
     case OA_DECODER:
-        return save_dec_context_OA((struct decoding_context_OA *) decoder->dec_ctx, filepath);
+        save_dec_context_OA((struct decoding_context_OA *) decoder->dec_ctx, w);
+        break;
     case BD_DECODER:
-        return save_dec_context_BD((struct decoding_context_BD *) decoder->dec_ctx, filepath);
+        save_dec_context_BD((struct decoding_context_BD *) decoder->dec_ctx, w);
+        break;
     case CBD_DECODER:
-        return save_dec_context_CBD((struct decoding_context_CBD *) decoder->dec_ctx, filepath);
+        save_dec_context_CBD((struct decoding_context_CBD *) decoder->dec_ctx, w);
+        break;
     case PP_DECODER:
-        return save_dec_context_PP((struct decoding_context_PP *) decoder->dec_ctx, filepath);
+        save_dec_context_PP((struct decoding_context_PP *) decoder->dec_ctx, w);
+        break;
+    }
+    // Save already decoded packets in sc->pp
+    int numpp = sc->snum + sc->cnum;
+    int count = 0;
+    for (int i=0; i<numpp; i++)
+        count += (sc->pp[i] != NULL);
+    ckpt_put_int(w, count);
+    for (int i=0; i<numpp; i++) {
+        if (sc->pp[i] != NULL) {
+            ckpt_put_int(w, i);     // pktid
+            ckpt_put_payload(w, sc->pp[i]);
+        }
     }
+    return ckpt_write(w, filepath);
 }
 
+// Restore decoder from the context stored in a checkpoint file
 struct snc_decoder *snc_restore_decoder(const char *filepath)
 {
+    static char fname[] = "snc_restore_decoder";
+    struct snc_parameters sp;
+    int d_type;
+    struct ckpt_reader *r;
+    if ((r = ckpt_open(filepath, &sp, &d_type)) == NULL)
+        return NULL;
     struct snc_decoder *decoder;
-    FILE *fp;
-    if ((fp = fopen(filepath, "r")) == NULL) {
-        fprintf(stderr, "Cannot open %s to load decoding context\n", filepath);
+    if ((decoder = calloc(1, sizeof(struct snc_decoder))) == NULL) {
+        ckpt_close(r);
         return NULL;
     }
-    // Check decoder context file type
-    fseek(fp, sizeof(struct snc_parameters), SEEK_SET);  // skip decoding_type field
-    int d_type;
-    fread(&d_type, sizeof(int), 1, fp);
-    fclose(fp);
-    if ((decoder = malloc(sizeof(struct snc_decoder))) == NULL)
-        return NULL;
+    decoder->d_type = d_type;
     switch (d_type) {
     case GG_DECODER:
-        decoder->dec_ctx = restore_dec_context_GG(filepath);
-        decoder->d_type = GG_DECODER;
-        return decoder;
+        decoder->dec_ctx = restore_dec_context_GG(r, &sp);
+        break;
     case OA_DECODER:
-        decoder->dec_ctx = restore_dec_context_OA(filepath);
-        decoder->d_type = OA_DECODER;
-        return decoder;
+        decoder->dec_ctx = restore_dec_context_OA(r, &sp);
+        break;
     case BD_DECODER:
-        decoder->dec_ctx = restore_dec_context_BD(filepath);
-        decoder->d_type = BD_DECODER;
-        return decoder;
+        decoder->dec_ctx = restore_dec_context_BD(r, &sp);
+        break;
     case CBD_DECODER:
-        decoder->dec_ctx = restore_dec_context_CBD(filepath);
-        decoder->d_type = CBD_DECODER;
-        return decoder;
+        decoder->dec_ctx = restore_dec_context_CBD(r, &sp);
+        break;
     case PP_DECODER:
-        decoder->dec_ctx = restore_dec_context_PP(filepath);
-        decoder->d_type = PP_DECODER;
-        return decoder;
+        decoder->dec_ctx = restore_dec_context_PP(r, &sp);
+        break;
     }
+    if (decoder->dec_ctx == NULL) {
+        fprintf(stderr, "%s: cannot restore decoding context from %s\n", fname, filepath);
+        ckpt_close(r);
+        free(decoder);
+        return NULL;
+    }
+    // Restore already decoded packets
+    struct snc_context *sc = snc_get_enc_context(decoder);
+    int numpp = sc->snum + sc->cnum;
+    int count = ckpt_get_int(r);
+    int i;
+    for (i=0; i<count; i++) {
+        int pktid = ckpt_get_int(r);
+        if (pktid < 0 || pktid >= numpp || sc->pp[pktid] != NULL)
+            break;
+        if ((sc->pp[pktid] = alloc_decoded(sc, pktid)) == NULL)
+            break;
+        ckpt_copy_payload(r, sc->pp[pktid]);
+    }
+    if (ckpt_close(r) != 0 || i != count) {
+        fprintf(stderr, "%s: %s is truncated or corrupted\n", fname, filepath);
+        snc_free_decoder(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+
+// Path of filepath with suffix appended
+static char *suffixed_path(const char *filepath, const char *suffix)
+{
+    char *path = malloc(strlen(filepath) + strlen(suffix) + 1);
+    if (path != NULL)
+        sprintf(path, "%s%s", filepath, suffix);
+    return path;
+}
+
+/*
+ * Save a snapshot of the decoder to decoder->snapshot. Checkpoints are
+ * written under a temporary name and renamed (see ckpt_write()), so a
+ * complete snapshot is in place at any time.
+ */
+static int save_snapshot(struct snc_decoder *decoder)
+{
+    static char fname[] = "save_snapshot";
+    long size = snc_save_decoder_context(decoder, decoder->snapshot);
+    if (size == -1) {
+        fprintf(stderr, "%s: cannot save snapshot to %s\n", fname, decoder->snapshot);
+        return (-1);
+    }
+    decoder->snapsize = size;
+    return 0;
+}
+
+/*
+ * Start journaling the decoder: a snapshot of the decoder is saved to
+ * filepath, and packets fed to the decoder afterwards are appended to
+ * the journal filepath.jnl.
+ */
+int snc_journal_decoder(struct snc_decoder *decoder, const char *filepath)
+{
+    static char fname[] = "snc_journal_decoder";
+    char *jpath;
+    if (decoder->journal != NULL) {
+        fprintf(stderr, "%s: decoder is already journaled to %s\n", fname, decoder->snapshot);
+        return (-1);
+    }
+    if ((decoder->snapshot = suffixed_path(filepath, "")) == NULL
+        || (jpath = suffixed_path(filepath, ".jnl")) == NULL) {
+        fprintf(stderr, "%s: malloc path\n", fname);
+        goto error;
+    }
+    if (save_snapshot(decoder) != 0) {
+        free(jpath);
+        goto error;
+    }
+    decoder->journal = jnl_create(jpath, processed_packets(decoder));
+    free(jpath);
+    if (decoder->journal == NULL)
+        goto error;
+    return 0;
+
+error:
+    free(decoder->snapshot);
+    decoder->snapshot = NULL;
+    return (-1);
+}
+
+/*
+ * Compact the journal: save a new snapshot and clear the journal. The
+ * snapshot is renamed into place before the journal is cleared; records
+ * left in the journal if the process stops in between are contained in
+ * the snapshot, and are skipped when the decoder is restored.
+ */
+long snc_compact_decoder_journal(struct snc_decoder *decoder)
+{
+    static char fname[] = "snc_compact_decoder_journal";
+    if (decoder->journal == NULL)
+        return (-1);
+    if (save_snapshot(decoder) != 0)
+        return (-1);
+    if (jnl_reset(decoder->journal, processed_packets(decoder)) != 0) {
+        fprintf(stderr, "%s: cannot clear journal of %s, stop journaling\n", fname, decoder->snapshot);
+        jnl_close(decoder->journal);
+        decoder->journal = NULL;
+        return (-1);
+    }
+    return decoder->snapsize;
+}
+
+/*
+ * Restore decoder from the snapshot in filepath and the journal in
+ * filepath.jnl, by replaying the journaled packets to the decoder
+ * restored from the snapshot. The restored decoder keeps journaling.
+ */
+struct snc_decoder *snc_restore_journaled_decoder(const char *filepath)
+{
+    static char fname[] = "snc_restore_journaled_decoder";
+    struct snc_decoder *decoder;
+    char *jpath;
+    if ((decoder = snc_restore_decoder(filepath)) == NULL)
+        return NULL;
+    if ((decoder->snapshot = suffixed_path(filepath, "")) == NULL
+        || (jpath = suffixed_path(filepath, ".jnl")) == NULL) {
+        fprintf(stderr, "%s: malloc path\n", fname);
+        snc_free_decoder(decoder);
+        return NULL;
+    }
+    struct stat st;
+    decoder->snapsize = stat(filepath, &st) == 0 ? st.st_size : 0;
+    decoder->journal = jnl_recover(jpath, &snc_get_enc_context(decoder)->params,
+                                   processed_packets(decoder), snc_process_packet, decoder);
+    if (decoder->journal == NULL) {
+        fprintf(stderr, "%s: cannot replay journal %s\n", fname, jpath);
+        free(jpath);
+        snc_free_decoder(decoder);
+        return NULL;
+    }
+    free(jpath);
+    return decoder;
 }
@@ -4,19 +4,27 @@
  * Functions for SNC encoding. Coded packets can be generated
  * from memory buffer or files.
  **************************************************************/
+#define _DEFAULT_SOURCE     // pwritev()
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include "common.h"
 #include "galois.h"
 #include "sparsenc.h"
 
+static struct snc_context *create_context(unsigned char *buf, struct snc_parameters *sp, int precode);
 static int create_context_from_params(struct snc_context *sc);
 static int verify_code_parameter(struct snc_parameters *sp);
+static struct code_template *get_code_template(struct snc_parameters *sp);
+static void put_code_template(struct code_template *tmpl);
+static struct code_template *build_code_template(struct snc_parameters *sp);
+static void free_code_template(struct code_template *tmpl);
 static void perform_precoding(struct snc_context *sc);
-static int group_packets_rand(struct snc_context *sc);
-static int group_packets_pseudorand(struct snc_context *sc);
-static int group_packets_band(struct snc_context *sc);
-static int group_packets_windwrap(struct snc_context *sc);
+static int group_packets_rand(struct code_template *sc);
+static int group_packets_pseudorand(struct code_template *sc);
 static void encode_packet(struct snc_context *sc, int gid, struct snc_packet *pkt);
 static int schedule_generation(struct snc_context *sc);
 static int banded_nonuniform_sched(struct snc_context *sc);
@@ -31,6 +39,21 @@ static int banded_nonuniform_sched(struct snc_context *sc);
  *   -1 - Create failed
  */
 struct snc_context *snc_create_enc_context(unsigned char *buf, struct snc_parameters *sp)
+{
+    return create_context(buf, sp, 1);
+}
+
+/*
+ * Create a context holding only the subgenerations of the code, without
+ * the precode and data, e.g., for recoders to relate systematic packets
+ * to subgenerations. sp->seed must be the seed of the encoder's context.
+ */
+struct snc_context *create_grouping_context(struct snc_parameters *sp)
+{
+    return create_context(NULL, sp, 0);
+}
+
+static struct snc_context *create_context(unsigned char *buf, struct snc_parameters *sp, int precode)
 {
     static char fname[] = "snc_create_enc_context";
     // Set log level
@@ -54,7 +77,8 @@ struct snc_context *snc_create_enc_context(unsigned char *buf, struct snc_parame
     sc->params.bnc      = sp->bnc;
     sc->params.sys      = sp->sys;
     sc->params.seed     = sp->seed;
-    /* Seed local random number generator for precoding and/or random grouping
+    sc->params.sce      = sp->sce;
+    /* Seed of the local random number generator for precoding and/or random grouping
      *
      *   If creating a completely new snc context, seed is -1 by default. We
      *   will seed using current time stamp.
@@ -68,18 +92,7 @@ struct snc_context *snc_create_enc_context(unsigned char *buf, struct snc_parame
         gettimeofday(&tv, NULL);
         sc->params.seed = tv.tv_sec * 1000 + tv.tv_usec / 1000; // seed use microsec
     }
-    init_genrand(sc->params.seed);
     sp->seed = sc->params.seed;  // set seed in the passed-in argument as well
-    // Determine packet and generation numbers
-    int num_src = ALIGN(sc->params.datasize, sc->params.size_p);
-    int num_chk = sp->size_c;
-    sc->snum  = num_src;  // Number of source packets
-    sc->cnum  = num_chk;  // Number of check packets
-    if (sc->params.type == BAND_SNC) {
-        sc->gnum  = ALIGN((num_src+num_chk-sc->params.size_g), sc->params.size_b) + 1;
-    } else {
-        sc->gnum  = ALIGN( (num_src+num_chk), sc->params.size_b);
-    }
     /*
      * Verify code parameter
      */
@@ -89,13 +102,15 @@ struct snc_context *snc_create_enc_context(unsigned char *buf, struct snc_parame
         return NULL;
     }
     /*
-     * Create generations, bipartite graph
+     * Get generations, bipartite graph
      */
     if (create_context_from_params(sc) != 0) {
         fprintf(stderr, "%s: create_context_from_params\n", fname);
         snc_free_enc_context(sc);
         return NULL;
     }
+    if (!precode)
+        return sc;
 
     // Allocating pointers to data
     if ((sc->pp = calloc(sc->snum+sc->cnum, sizeof(GF_ELEMENT*))) == NULL) {
@@ -189,53 +204,203 @@ static int verify_code_parameter(struct snc_parameters *sp)
 static int create_context_from_params(struct snc_context *sc)
 {
     static char fname[] = "snc_create_enc_context_params";
-    // Inintialize generation structures
-    sc->gene  = calloc(sc->gnum, sizeof(struct subgeneration*));
-    if ( sc->gene == NULL ) {
-        fprintf(stderr, "%s: malloc sc->gene\n", fname);
-        return(-1);
-    }
-    for (int j=0; j<sc->gnum; j++) {
-        sc->gene[j] = malloc(sizeof(struct subgeneration));
-        if ( sc->gene[j] == NULL ) {
-            fprintf(stderr, "%s: malloc sc->gene[%d]\n", fname, j);
-            return(-1);
-        }
-        sc->gene[j]->gid = -1;
-        sc->gene[j]->pktid = malloc(sizeof(int)*sc->params.size_g);       // Use malloc because pktid needs to be initialized as -1's later
-        if ( sc->gene[j]->pktid == NULL ) {
-            fprintf(stderr, "%s: malloc sc->gene[%d]->pktid\n", fname, j);
-            return(-1);
-        }
-        memset(sc->gene[j]->pktid, -1, sizeof(int)*sc->params.size_g);
+    if ((sc->tmpl = get_code_template(&sc->params)) == NULL) {
+        fprintf(stderr, "%s: get_code_template\n", fname);
+        return (-1);
     }
+    sc->snum  = sc->tmpl->snum;   // Number of source packets
+    sc->cnum  = sc->tmpl->cnum;   // Number of check packets
+    sc->gnum  = sc->tmpl->gnum;
+    sc->gene  = sc->tmpl->gene;
+    sc->graph = sc->tmpl->graph;
     sc->nccount = calloc(sc->gnum, sizeof(int));
     if (sc->nccount == NULL) {
         fprintf(stderr, "%s: calloc sc->nccount\n", fname);
         return (-1);
     }
     sc->count = 0;
+    return(0);
+}
+
+/*
+ * Cache of code templates, most recently used first. The cache holds one
+ * reference of each cached template; contexts hold one each as well, so an
+ * evicted template lives on until its last context is freed.
+ */
+static pthread_mutex_t tmpl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct code_template *tmpl_cache = NULL;
+
+// Whether sp gives the code of the template (other parameters don't change it)
+static int template_matches(struct code_template *tmpl, struct snc_parameters *sp)
+{
+    return tmpl->params.datasize == sp->datasize
+        && tmpl->params.size_p   == sp->size_p
+        && tmpl->params.size_c   == sp->size_c
+        && tmpl->params.size_b   == sp->size_b
+        && tmpl->params.size_g   == sp->size_g
+        && tmpl->params.type     == sp->type
+        && tmpl->params.bpc      == sp->bpc
+        && tmpl->params.seed     == sp->seed;
+}
+
+// Find a cached template and move it to the front; tmpl_lock must be held
+static struct code_template *lookup_template(struct snc_parameters *sp)
+{
+    struct code_template **link = &tmpl_cache;
+    while (*link != NULL && !template_matches(*link, sp))
+        link = &(*link)->next;
+    struct code_template *tmpl = *link;
+    if (tmpl != NULL) {
+        *link = tmpl->next;
+        tmpl->next = tmpl_cache;
+        tmpl_cache = tmpl;
+        tmpl->refcnt += 1;
+    }
+    return tmpl;
+}
+
+/*
+ * Get a reference of the template of the code given by sp, building it if
+ * it is not cached. The reference is released by put_code_template().
+ */
+static struct code_template *get_code_template(struct snc_parameters *sp)
+{
+    struct code_template *tmpl;
+    pthread_mutex_lock(&tmpl_lock);
+    tmpl = lookup_template(sp);
+    pthread_mutex_unlock(&tmpl_lock);
+    if (tmpl != NULL)
+        return tmpl;
+
+    // Build without holding the lock. Templates built concurrently for the
+    // same code are identical, so the one cached first is used.
+    struct code_template *built;
+    if ((built = build_code_template(sp)) == NULL)
+        return NULL;
+    pthread_mutex_lock(&tmpl_lock);
+    if ((tmpl = lookup_template(sp)) != NULL) {
+        pthread_mutex_unlock(&tmpl_lock);
+        free_code_template(built);
+        return tmpl;
+    }
+    built->refcnt = 2;
+    built->next = tmpl_cache;
+    tmpl_cache = built;
+    // Evict the least recently used template if the cache is over size
+    int n = 1;
+    struct code_template *last = built;
+    while (last->next != NULL && n < TEMPLATE_CACHE_SIZE) {
+        last = last->next;
+        n++;
+    }
+    struct code_template *evicted = last->next;
+    last->next = NULL;
+    if (evicted != NULL && --evicted->refcnt > 0)
+        evicted = NULL;
+    pthread_mutex_unlock(&tmpl_lock);
+    free_code_template(evicted);
+    return built;
+}
+
+static void put_code_template(struct code_template *tmpl)
+{
+    pthread_mutex_lock(&tmpl_lock);
+    int unused = (--tmpl->refcnt == 0);
+    pthread_mutex_unlock(&tmpl_lock);
+    if (unused)
+        free_code_template(tmpl);
+}
+
+/*
+ * Build the subgenerations and the precode graph of the code. Both are
+ * drawn from the local random number generator seeded by sp->seed.
+ */
+static struct code_template *build_code_template(struct snc_parameters *sp)
+{
+    static char fname[] = "build_code_template";
+    struct code_template *tmpl;
+    if ((tmpl = calloc(1, sizeof(struct code_template))) == NULL) {
+        fprintf(stderr, "%s: calloc code_template\n", fname);
+        return NULL;
+    }
+    tmpl->params = *sp;
+    init_genrand(tmpl->params.seed);
+    // Determine packet and generation numbers
+    int num_src = ALIGN(tmpl->params.datasize, tmpl->params.size_p);
+    int num_chk = tmpl->params.size_c;
+    tmpl->snum  = num_src;  // Number of source packets
+    tmpl->cnum  = num_chk;  // Number of check packets
+    if (tmpl->params.type == BAND_SNC) {
+        tmpl->gnum  = ALIGN((num_src+num_chk-tmpl->params.size_g), tmpl->params.size_b) + 1;
+    } else {
+        tmpl->gnum  = ALIGN( (num_src+num_chk), tmpl->params.size_b);
+    }
+    // Inintialize generation structures
+    tmpl->gene  = calloc(tmpl->gnum, sizeof(struct subgeneration*));
+    if ( tmpl->gene == NULL ) {
+        fprintf(stderr, "%s: malloc tmpl->gene\n", fname);
+        goto error;
+    }
+    for (int j=0; j<tmpl->gnum; j++) {
+        tmpl->gene[j] = malloc(sizeof(struct subgeneration));
+        if ( tmpl->gene[j] == NULL ) {
+            fprintf(stderr, "%s: malloc tmpl->gene[%d]\n", fname, j);
+            goto error;
+        }
+        tmpl->gene[j]->gid = j;
+        tmpl->gene[j]->pktid = NULL;
+        // Subgenerations of BAND and WINDWRAP codes are consecutive packets
+        // whose indices are computed (see gene_pktid() in common.c).
+        if (tmpl->params.type != RAND_SNC)
+            continue;
+        tmpl->gene[j]->pktid = malloc(sizeof(int)*tmpl->params.size_g);       // Use malloc because pktid needs to be initialized as -1's later
+        if ( tmpl->gene[j]->pktid == NULL ) {
+            fprintf(stderr, "%s: malloc tmpl->gene[%d]->pktid\n", fname, j);
+            goto error;
+        }
+        memset(tmpl->gene[j]->pktid, -1, sizeof(int)*tmpl->params.size_g);
+    }
 
     int coverage;
-    if (sc->params.type == RAND_SNC) {
-        coverage = group_packets_rand(sc);
-        //coverage = group_packets_pseudorand(sc);
-    } else if (sc->params.type == BAND_SNC) {
-        coverage = group_packets_band(sc);
-    } else if (sc->params.type == WINDWRAP_SNC) {
-        coverage = group_packets_windwrap(sc);
+    if (tmpl->params.type == RAND_SNC) {
+        coverage = group_packets_rand(tmpl);
+        //coverage = group_packets_pseudorand(tmpl);
     }
     // Creating bipartite graph of the precode
-    if (sc->cnum != 0) {
-        if ( (sc->graph = malloc(sizeof(BP_graph))) == NULL ) {
+    if (tmpl->cnum != 0) {
+        if ( (tmpl->graph = malloc(sizeof(BP_graph))) == NULL ) {
             fprintf(stderr, "%s: malloc BP_graph\n", fname);
-            return (-1);
+            goto error;
+        }
+        tmpl->graph->binaryce = tmpl->params.bpc;     // If precode in GF(2), edges use 1 as coefficient
+        if (create_bipartite_graph(tmpl->graph, tmpl->snum, tmpl->cnum) < 0) {
+            tmpl->graph = NULL;     // freed by create_bipartite_graph
+            goto error;
         }
-        sc->graph->binaryce = sc->params.bpc;     // If precode in GF(2), edges use 1 as coefficient
-        if (create_bipartite_graph(sc->graph, sc->snum, sc->cnum) < 0)
-            return (-1);
     }
-    return(0);
+    return tmpl;
+
+error:
+    free_code_template(tmpl);
+    return NULL;
+}
+
+static void free_code_template(struct code_template *tmpl)
+{
+    if (tmpl == NULL)
+        return;
+    if (tmpl->gene != NULL) {
+        for (int i=tmpl->gnum-1; i>=0; i--) {
+            if (tmpl->gene[i] != NULL) {
+                free(tmpl->gene[i]->pktid);  // free packet IDs
+                free(tmpl->gene[i]);         // free generation itself
+            }
+        }
+        free(tmpl->gene);
+    }
+    if (tmpl->graph != NULL)
+        free_bipartite_graph(tmpl->graph);
+    free(tmpl);
 }
 
 void snc_free_enc_context(struct snc_context *sc)
@@ -246,22 +411,14 @@ void snc_free_enc_context(struct snc_context *sc)
     if (sc->pp != NULL) {
         for (i=sc->snum+sc->cnum-1; i>=0; i--) {
             if (sc->pp[i] != NULL) {
-                free(sc->pp[i]);
+                free_decoded(sc, sc->pp[i]);
                 sc->pp[i] = NULL;
             }
         }
         free(sc->pp);
     }
-    if (sc->gene != NULL) {
-        for (i=sc->gnum-1; i>=0; i--) {
-            free(sc->gene[i]->pktid);  // free packet IDs
-            free(sc->gene[i]);         // free generation itself
-            sc->gene[i] = NULL;
-        }
-        free(sc->gene);
-    }
-    if (sc->graph != NULL)
-        free_bipartite_graph(sc->graph);
+    if (sc->tmpl != NULL)
+        put_code_template(sc->tmpl);    // gene and graph belong to the template
     if (sc->nccount != NULL)
         free(sc->nccount);
     free(sc);
@@ -269,6 +426,25 @@ void snc_free_enc_context(struct snc_context *sc)
     return;
 }
 
+/*
+ * Storage of decoded packet pkt_id. Source packets of a decoder bound to
+ * an output region are decoded in place (see snc_bind_decoder_output()).
+ */
+GF_ELEMENT *alloc_decoded(struct snc_context *sc, int pkt_id)
+{
+    if (sc->out != NULL && pkt_id < sc->snum)
+        return sc->out + (size_t) pkt_id * sc->params.size_p;
+    return calloc(sc->params.size_p, sizeof(GF_ELEMENT));
+}
+
+// Free storage of a decoded packet, unless it is in the output region
+void free_decoded(struct snc_context *sc, GF_ELEMENT *syms)
+{
+    if (sc->out != NULL && syms >= sc->out && syms < sc->out + (size_t) sc->snum * sc->params.size_p)
+        return;
+    free(syms);
+}
+
 unsigned char *snc_recover_data(struct snc_context *sc)
 {
     static char fname[] = "snc_recover_data";
@@ -306,26 +482,119 @@ void snc_free_recovered(unsigned char *data)
 long snc_recover_to_file(const char *filepath, struct snc_context *sc)
 {
     static char fname[] = "snc_recover_to_file";
-    long datasize = sc->params.datasize;
-    long alwrote = 0;
-    long towrite = datasize;
-
     if (get_loglevel() == TRACE)
         printf("Writing to decoded file.\n");
-    FILE *fp;
-    if ((fp = fopen(filepath, "a")) == NULL)
+    // Not O_APPEND: Linux ignores the offset of pwritev() on such files
+    int fd;
+    if ((fd = open(filepath, O_WRONLY | O_CREAT, 0644)) == -1) {
+        fprintf(stderr, "%s: cannot open %s\n", fname, filepath);
         return (-1);
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    long alwrote = end == -1 ? -1 : snc_recover_to_fd(fd, end, sc);
+    close(fd);
+    return alwrote;
+}
+
+#define RECOVER_IOVS    1024    // iovecs per pwritev() or preadv() (UIO_MAXIOV of Linux)
 
+/*
+ * Write len bytes from (or read them into, if rd) consecutive packets of
+ * size bytes at offset of the file open as fd, with pwritev() (preadv())
+ * of up to RECOVER_IOVS packets at a time. Return len, or -1.
+ */
+static long transfer_packets(int fd, long offset, GF_ELEMENT **pkts, long size, long len, int rd)
+{
+    static char fname[] = "transfer_packets";
+    struct iovec iov[RECOVER_IOVS];
+    long done = 0;
     int pc = 0;
-    while (alwrote < datasize) {
-        towrite = ((alwrote + sc->params.size_p) <= datasize) ? sc->params.size_p : datasize - alwrote;
-        if (fwrite(sc->pp[pc], sizeof(GF_ELEMENT), towrite, fp) != towrite)
-            fprintf(stderr, "%s: fwrite sc->pp[%d]\n", fname, pc);
-        pc++;
-        alwrote += towrite;
+    while (done < len) {
+        int cnt = 0;
+        long batch = 0;
+        while (cnt < RECOVER_IOVS && done + batch < len) {
+            long count = (done + batch + size <= len) ? size : len - done - batch;
+            iov[cnt].iov_base = pkts[pc++];
+            iov[cnt++].iov_len = count;
+            batch += count;
+        }
+        struct iovec *v = iov;
+        while (batch > 0) {
+            ssize_t n = rd ? preadv(fd, v, cnt, offset + done) : pwritev(fd, v, cnt, offset + done);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                fprintf(stderr, "%s: %s at offset %ld failed\n", fname, rd ? "preadv" : "pwritev", offset + done);
+                return (-1);
+            }
+            done  += n;
+            batch -= n;
+            // Skip what is transferred of a short read or write
+            while (cnt > 0 && n >= (ssize_t) v->iov_len) {
+                n -= v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (n > 0) {
+                v->iov_base = (unsigned char *) v->iov_base + n;
+                v->iov_len -= n;
+            }
+        }
     }
-    fclose(fp);
-    return alwrote;
+    return done;
+}
+
+/*
+ * Write the recovered data to the file open as fd, starting at offset,
+ * with pwritev() of up to RECOVER_IOVS packets at a time. The file offset
+ * of fd is neither used nor changed, so that blocks of a file can be
+ * written in any order, or concurrently by different threads, each to
+ * its own offset. Return the number of bytes written, or -1.
+ */
+long snc_recover_to_fd(int fd, long offset, struct snc_context *sc)
+{
+    return write_decoded(fd, offset, sc, sc->params.datasize);
+}
+
+// Write the first len bytes of the recovered data at offset of fd
+long write_decoded(int fd, long offset, struct snc_context *sc, long len)
+{
+    // Source packets are already contiguous in the output region
+    if (sc->out != NULL)
+        return transfer_packets(fd, offset, &sc->out, len, len, 0);
+    return transfer_packets(fd, offset, sc->pp, sc->params.size_p, len, 0);
+}
+
+/*
+ * Load len bytes at offset of the file open as fd into an encode context
+ * created without data, or reuse the packets of its previous data. The
+ * data is padded with zeros up to datasize, the precode is recomputed and
+ * the counts of generated packets are reset, as in a new context.
+ */
+int reload_context(struct snc_context *sc, int fd, long offset, long len)
+{
+    static char fname[] = "reload_context";
+    int size_p = sc->params.size_p;
+    for (int i=0; i<sc->snum+sc->cnum; i++) {
+        if (sc->pp[i] == NULL && (sc->pp[i] = calloc(size_p, sizeof(GF_ELEMENT))) == NULL) {
+            fprintf(stderr, "%s: calloc sc->pp[%d]\n", fname, i);
+            return (-1);
+        }
+    }
+    if (transfer_packets(fd, offset, sc->pp, size_p, len, 1) != len)
+        return (-1);
+    int last = len / size_p;    // first source packet not filled up
+    if (last < sc->snum)
+        memset(sc->pp[last] + len % size_p, 0, size_p - len % size_p);
+    for (int i=last+1; i<sc->snum; i++)
+        memset(sc->pp[i], 0, size_p);
+    // Check packets are accumulated by precoding
+    for (int i=sc->snum; i<sc->snum+sc->cnum; i++)
+        memset(sc->pp[i], 0, size_p);
+    perform_precoding(sc);
+    memset(sc->nccount, 0, sizeof(int) * sc->gnum);
+    sc->count = 0;
+    return 0;
 }
 
 // perform systematic LDPC precoding against SRC pkt list and results in a LDPC pkt list
@@ -352,7 +621,7 @@ static void perform_precoding(struct snc_context *sc)
  * grouping information to clients is removed. The only information clients
  * need to know is the number of packets, base size, and generation size.
  */
-static int group_packets_pseudorand(struct snc_context *sc)
+static int group_packets_pseudorand(struct code_template *sc)
 {
     int num_p = sc->snum + sc->cnum;
     int num_g = sc->gnum;
@@ -404,7 +673,7 @@ static int group_packets_pseudorand(struct snc_context *sc)
 /*
  * Use local RNG to group packets
  */
-static int group_packets_rand(struct snc_context *sc)
+static int group_packets_rand(struct code_template *sc)
 {
     int num_p = sc->snum + sc->cnum;
     int num_g = sc->gnum;
@@ -444,107 +713,30 @@ static int group_packets_rand(struct snc_context *sc)
     return coverage;
 }
 
-/*
- * Group packets to generations that overlap head-to-toe. Each generation's
- * encoding coefficients form a band in GDM.
- */
-static int group_packets_band(struct snc_context *sc)
-{
-    int num_p = sc->snum + sc->cnum;
-    int num_g = sc->gnum;
-
-    int *selected = calloc(num_p, sizeof(int));
-
-    int i, j;
-    int index;
-    int leading_pivot = 0;
-    for (i=0; i<num_g; i++) {
-        sc->gene[i]->gid = i;
-        leading_pivot = i * sc->params.size_b;
-        if (leading_pivot > num_p - sc->params.size_g) {
-            if (get_loglevel() == TRACE)
-                printf("Band lead of gid: %d is modified\n", i);
-            leading_pivot = num_p - sc->params.size_g;
-        }
-        for (j=0; j<sc->params.size_g; j++) {
-            index = leading_pivot + j;
-            selected[index] += 1;
-            sc->gene[i]->pktid[j] = index;
-        }
-    }
-    int coverage = 0;
-    for (i=0; i<num_p; i++)
-        coverage += selected[i];
-
-    free(selected);
-    return coverage;
-}
-
-/*
- * Group packets to generations that overlap consecutively. Wrap around if needed.
- */
-static int group_packets_windwrap(struct snc_context *sc)
+int snc_set_enc_packet_pool(struct snc_context *sc, struct snc_packet_pool *pool)
 {
-    int num_p = sc->snum + sc->cnum;
-    int num_g = sc->gnum;
-
-    int *selected = calloc(num_p, sizeof(int));
-
-    int i, j;
-    int index;
-    int leading_pivot = 0;
-    for (i=0; i<num_g; i++) {
-        sc->gene[i]->gid = i;
-        leading_pivot = i * sc->params.size_b;
-        for (j=0; j<sc->params.size_g; j++) {
-            index = (leading_pivot + j) % num_p;
-            selected[index] += 1;
-            sc->gene[i]->pktid[j] = index;
-        }
+    static char fname[] = "snc_set_enc_packet_pool";
+    if (pool != NULL && !pool_fits_params(pool, &sc->params)) {
+        fprintf(stderr, "%s: packets of the pool do not match the code parameters\n", fname);
+        return -1;
     }
-    int coverage = 0;
-    for (i=0; i<num_p; i++)
-        coverage += selected[i];
-
-    free(selected);
-    return coverage;
+    sc->pool = pool;
+    return 0;
 }
 
 /*
- * Allocate an empty GNC coded packet
- *  gid = -1
- *  coes: zeros
- *  syms: zeros
+ * Generate a GNC coded packet. Memory is allocated in the function,
+ * or taken from the packet pool of the context if there is one.
  */
-struct snc_packet *snc_alloc_empty_packet(struct snc_parameters *sp)
+struct snc_packet *snc_generate_packet(struct snc_context *sc)
 {
-    struct snc_packet *pkt = calloc(1, sizeof(struct snc_packet));
+    struct snc_packet *pkt;
+    if (sc->pool != NULL)
+        pkt = snc_pool_alloc_packet(sc->pool);
+    else
+        pkt = snc_alloc_empty_packet(&sc->params);
     if (pkt == NULL)
         return NULL;
-    pkt->ucid = -1;
-    if (sp->bnc) {
-        // For binary code, coding coefficients (bits) are condensed
-        pkt->coes = calloc(ALIGN(sp->size_g, 8), sizeof(GF_ELEMENT));
-    } else {
-        pkt->coes = calloc(sp->size_g, sizeof(GF_ELEMENT));
-    }
-    if (pkt->coes == NULL)
-        goto AllocErr;
-    pkt->syms = calloc(sp->size_p, sizeof(GF_ELEMENT));
-    if (pkt->syms == NULL)
-        goto AllocErr;
-
-    return pkt;
-
-AllocErr:
-    snc_free_packet(pkt);
-    return NULL;
-}
-
-/* Generate a GNC coded packet. Memory is allocated in the function. */
-struct snc_packet *snc_generate_packet(struct snc_context *sc)
-{
-    struct snc_packet *pkt = snc_alloc_empty_packet(&sc->params);
     int gid = schedule_generation(sc);
     encode_packet(sc, gid, pkt);
     return pkt;
@@ -569,18 +761,6 @@ int snc_generate_packet_im(struct snc_context *sc, struct snc_packet *pkt)
     return (0);
 }
 
-void snc_free_packet(struct snc_packet *pkt)
-{
-    if (pkt == NULL)
-        return;
-    if (pkt->coes != NULL)
-        free(pkt->coes);
-    if (pkt->syms != NULL)
-        free(pkt->syms);
-    free(pkt);
-}
-
-
 static void encode_packet(struct snc_context *sc, int gid, struct snc_packet *pkt)
 {
     pkt->gid = gid;
@@ -591,6 +771,7 @@ static void encode_packet(struct snc_context *sc, int gid, struct snc_packet *pk
         memcpy(pkt->syms, sc->pp[pktid], sc->params.size_p*sizeof(GF_ELEMENT));
         pkt->gid = -1;    // gid=-1 && ucid != -1 indicates it's a systematic packet
         pkt->ucid = pktid;
+        pkt->seq = -1;
         sc->nccount[gid] += 1;
         sc->count += 1;
         return;
@@ -603,7 +784,7 @@ static void encode_packet(struct snc_context *sc, int gid, struct snc_packet *pk
         } else {
             pkt->coes[sc->nccount[gid]] = 1;
         }
-        pktid = sc->gene[gid]->pktid[sc->nccount[gid]];
+        pktid = gene_pktid(sc, gid, sc->nccount[gid]);
         memcpy(pkt->syms, sc->pp[pktid], sc->params.size_p*sizeof(GF_ELEMENT));
         pkt->ucid = sc->nccount[gid];      // Mark the uncoded pkt, and store its index amongst the generation
         sc->nccount[gid] += 1;
@@ -612,8 +793,24 @@ static void encode_packet(struct snc_context *sc, int gid, struct snc_packet *pk
     */
     int i;
     GF_ELEMENT co;
+    if (sc->params.sce == 1) {
+        // Coefficients are derived from the packet's seq, and are not carried by the packet
+        GF_ELEMENT seeded[ALIGN(sc->params.size_g, 8) * 8];
+        pkt->seq = sc->count;
+        generate_seeded_coes(sc->params.seed, pkt->seq, sc->params.size_g, sc->params.bnc, seeded);
+        for (i=0; i<sc->params.size_g; i++) {
+            pktid = gene_pktid(sc, gid, i);
+            co = sc->params.bnc ? get_bit_in_array(seeded, i) : seeded[i];
+            galois_multiply_add_region(pkt->syms, sc->pp[pktid], co, sc->params.size_p);
+        }
+        pkt->ucid = -1;
+        sc->nccount[gid] += 1;
+        sc->count += 1;
+        return;
+    }
+    pkt->seq = -1;
     for (i=0; i<sc->params.size_g; i++) {
-        pktid = sc->gene[gid]->pktid[i];  // The i-th packet of the gid-th generation
+        pktid = gene_pktid(sc, gid, i);   // The i-th packet of the gid-th generation
         if (sc->params.bnc) {
             co = (GF_ELEMENT) rand() % 2;                   // Binary network code
             if (co == 1)
@@ -0,0 +1,573 @@
+/**************************************************************
+ * sncFile.c
+ *
+ * File sessions. A file is coded as a sequence of blocks of
+ * datasize bytes (the last one padded with zeros), a bounded
+ * window of which is in flight at a time.
+ *
+ * The file encoder keeps an encode context per block of the window.
+ * A loader thread reads the blocks ahead of the application with
+ * positional reads, and a context released by the application is
+ * refilled with the block a window later, reusing its packets, code
+ * template and seed.
+ *
+ * The file decoder keeps a slot per block of the window, made of a
+ * ring of packets (see ring.c) and an output region the decoder of
+ * the block decodes into (see snc_bind_decoder_output()). Slots are
+ * served by a pool of worker threads, slot s by worker s % nthreads,
+ * so that blocks are decoded in parallel. A finished block is written
+ * at its own offset of the output file by its worker, concurrently
+ * with the other blocks, and its slot moves on to the block a window
+ * later.
+ **************************************************************/
+#define _DEFAULT_SOURCE     // ftruncate()
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "sparsenc.h"
+
+#define SLOT_RELEASED   0
+#define SLOT_LOADING    1
+#define SLOT_READY      2
+
+#define SLOT_BATCH      16      // packets a worker takes from a slot in turn
+
+struct enc_slot {
+    struct snc_context *sc;
+    int                 blk;        // block held by the slot (-1 if none yet)
+    int                 state;
+};
+
+struct snc_file_encoder {
+    struct snc_parameters sp;
+    int                   fd;
+    long                  filesize;
+    int                   nblocks;
+    int                   window;
+    struct enc_slot      *slots;
+    pthread_t             loader;
+    pthread_mutex_t       lock;
+    pthread_cond_t        changed;  // broadcast when a block is loaded or released
+    int                   stop;
+    int                   error;
+};
+
+/*
+ * State of a decoder slot is published in serving: blk while packets of
+ * block blk are accepted, or -(blk+2) once blk is finished and until the
+ * slot moves on (for good after the last block).
+ */
+struct dec_slot {
+    struct snc_decoder *decoder;    // decoder of blk (created on its first packet)
+    struct mpsc_ring   *ring;
+    unsigned char      *buf;        // output region of the decoders of the slot
+    int                 blk;        // block of the slot (worker only)
+    int                 serving;
+    int                 pending;    // producers between reading serving and pushing
+};
+
+struct dec_worker {
+    struct snc_file_decoder *fdec;
+    int                      id;
+    pthread_t                thread;
+    pthread_mutex_t          lock;
+    pthread_cond_t           wake;
+    int                      sleeping;
+};
+
+struct snc_file_decoder {
+    struct snc_parameters sp;
+    int                   d_type;
+    int                   fd;
+    long                  filesize;
+    int                   nblocks;
+    int                   window;
+    int                   nthreads;
+    struct dec_slot      *slots;
+    struct dec_worker    *workers;
+    pthread_mutex_t       lock;
+    pthread_cond_t        done;     // broadcast when a block is written
+    int                   written;  // number of blocks written
+    double                overhead; // sums over the written blocks
+    double                cost;
+    int                   error;
+    int                   stop;
+};
+
+static void *load_blocks(void *arg);
+static void *decode_blocks(void *arg);
+
+static int count_blocks(long filesize, long datasize)
+{
+    return filesize / datasize + (filesize % datasize != 0);
+}
+
+// Bytes of block blk of the file
+static long block_size(long filesize, long datasize, int blk)
+{
+    long rest = filesize - (long) blk * datasize;
+    return rest < datasize ? rest : datasize;
+}
+
+/*
+ * Create an encoder of the file in filepath, split to blocks of
+ * sp->datasize bytes, keeping up to window blocks loaded. The seed of
+ * the blocks is set in sp as well.
+ */
+struct snc_file_encoder *snc_create_file_encoder(const char *filepath, struct snc_parameters *sp, int window)
+{
+    static char fname[] = "snc_create_file_encoder";
+    struct snc_file_encoder *fenc;
+    if ((fenc = calloc(1, sizeof(struct snc_file_encoder))) == NULL) {
+        fprintf(stderr, "%s: calloc snc_file_encoder failed\n", fname);
+        return NULL;
+    }
+    struct stat st;
+    if ((fenc->fd = open(filepath, O_RDONLY)) == -1 || fstat(fenc->fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: cannot read %s\n", fname, filepath);
+        goto error;
+    }
+    fenc->filesize = st.st_size;
+    fenc->nblocks  = count_blocks(fenc->filesize, sp->datasize);
+    fenc->window   = window < 1 ? 1 : (window > fenc->nblocks ? fenc->nblocks : window);
+    if ((fenc->slots = calloc(fenc->window, sizeof(struct enc_slot))) == NULL) {
+        fprintf(stderr, "%s: calloc slots failed\n", fname);
+        goto error;
+    }
+    // Blocks share the seed (set by the first context), hence the code template
+    for (int i=0; i<fenc->window; i++) {
+        if ((fenc->slots[i].sc = snc_create_enc_context(NULL, sp)) == NULL)
+            goto error;
+        fenc->slots[i].blk = -1;
+    }
+    fenc->sp = *sp;
+    pthread_mutex_init(&fenc->lock, NULL);
+    pthread_cond_init(&fenc->changed, NULL);
+    if (pthread_create(&fenc->loader, NULL, load_blocks, fenc) != 0) {
+        fprintf(stderr, "%s: cannot create loader thread\n", fname);
+        pthread_mutex_destroy(&fenc->lock);
+        pthread_cond_destroy(&fenc->changed);
+        goto error;
+    }
+    return fenc;
+
+error:
+    if (fenc->slots != NULL) {
+        for (int i=0; i<fenc->window; i++)
+            snc_free_enc_context(fenc->slots[i].sc);
+        free(fenc->slots);
+    }
+    if (fenc->fd != -1)
+        close(fenc->fd);
+    free(fenc);
+    return NULL;
+}
+
+// Load the blocks in order, each once the previous block of its slot is released
+static void *load_blocks(void *arg)
+{
+    struct snc_file_encoder *fenc = arg;
+    long datasize = fenc->sp.datasize;
+    for (int blk=0; blk<fenc->nblocks; blk++) {
+        struct enc_slot *slot = &fenc->slots[blk % fenc->window];
+        pthread_mutex_lock(&fenc->lock);
+        while (slot->state != SLOT_RELEASED && !fenc->stop)
+            pthread_cond_wait(&fenc->changed, &fenc->lock);
+        if (fenc->stop) {
+            pthread_mutex_unlock(&fenc->lock);
+            break;
+        }
+        slot->blk   = blk;
+        slot->state = SLOT_LOADING;
+        pthread_mutex_unlock(&fenc->lock);
+        int rc = reload_context(slot->sc, fenc->fd, (long) blk * datasize, block_size(fenc->filesize, datasize, blk));
+        pthread_mutex_lock(&fenc->lock);
+        if (rc == 0)
+            slot->state = SLOT_READY;
+        else
+            fenc->error = 1;
+        pthread_cond_broadcast(&fenc->changed);
+        pthread_mutex_unlock(&fenc->lock);
+        if (rc != 0)
+            break;
+    }
+    return NULL;
+}
+
+int snc_file_encoder_blocks(struct snc_file_encoder *fenc)
+{
+    return fenc->nblocks;
+}
+
+long snc_file_encoder_size(struct snc_file_encoder *fenc)
+{
+    return fenc->filesize;
+}
+
+/*
+ * Encode context of block blk, waiting for the block to be loaded. Return
+ * NULL if blk is already released, or cannot be loaded.
+ */
+struct snc_context *snc_file_encoder_get_block(struct snc_file_encoder *fenc, int blk)
+{
+    if (blk < 0 || blk >= fenc->nblocks)
+        return NULL;
+    struct enc_slot *slot = &fenc->slots[blk % fenc->window];
+    struct snc_context *sc = NULL;
+    pthread_mutex_lock(&fenc->lock);
+    while ((slot->blk < blk || (slot->blk == blk && slot->state == SLOT_LOADING)) && !fenc->error)
+        pthread_cond_wait(&fenc->changed, &fenc->lock);
+    if (slot->blk == blk && slot->state == SLOT_READY)
+        sc = slot->sc;
+    pthread_mutex_unlock(&fenc->lock);
+    return sc;
+}
+
+/*
+ * Release block blk, e.g., once the receiver has decoded it, so that its
+ * context is reused for the block a window later. Packets generated from
+ * the block remain valid.
+ */
+void snc_file_encoder_release_block(struct snc_file_encoder *fenc, int blk)
+{
+    if (blk < 0 || blk >= fenc->nblocks)
+        return;
+    struct enc_slot *slot = &fenc->slots[blk % fenc->window];
+    pthread_mutex_lock(&fenc->lock);
+    if (slot->blk == blk && slot->state == SLOT_READY) {
+        slot->state = SLOT_RELEASED;
+        pthread_cond_broadcast(&fenc->changed);
+    }
+    pthread_mutex_unlock(&fenc->lock);
+}
+
+void snc_free_file_encoder(struct snc_file_encoder *fenc)
+{
+    if (fenc == NULL)
+        return;
+    pthread_mutex_lock(&fenc->lock);
+    fenc->stop = 1;
+    pthread_cond_broadcast(&fenc->changed);
+    pthread_mutex_unlock(&fenc->lock);
+    pthread_join(fenc->loader, NULL);
+    pthread_mutex_destroy(&fenc->lock);
+    pthread_cond_destroy(&fenc->changed);
+    for (int i=0; i<fenc->window; i++)
+        snc_free_enc_context(fenc->slots[i].sc);
+    free(fenc->slots);
+    close(fenc->fd);
+    free(fenc);
+}
+
+/*
+ * Create a decoder of a file of filesize bytes coded with parameters sp
+ * (as set by the file encoder) to the file in filepath, decoding up to
+ * window blocks at a time with nthreads worker threads (one per CPU if
+ * nthreads <= 0).
+ */
+struct snc_file_decoder *snc_create_file_decoder(const char *filepath, struct snc_parameters *sp, int d_type,
+                                                 long filesize, int window, int nthreads)
+{
+    static char fname[] = "snc_create_file_decoder";
+    struct snc_file_decoder *fdec;
+    if ((fdec = calloc(1, sizeof(struct snc_file_decoder))) == NULL) {
+        fprintf(stderr, "%s: calloc snc_file_decoder failed\n", fname);
+        return NULL;
+    }
+    fdec->sp       = *sp;
+    fdec->d_type   = d_type;
+    fdec->filesize = filesize;
+    fdec->nblocks  = count_blocks(filesize, sp->datasize);
+    fdec->window   = window < 1 ? 1 : (window > fdec->nblocks ? fdec->nblocks : window);
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    fdec->nthreads = nthreads < 1 ? 1 : (nthreads > fdec->window ? fdec->window : nthreads);
+    // The file has its final size from the start, blocks being written in any order
+    if ((fdec->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 || ftruncate(fdec->fd, filesize) != 0) {
+        fprintf(stderr, "%s: cannot create %s\n", fname, filepath);
+        goto error;
+    }
+    if ((fdec->slots = calloc(fdec->window, sizeof(struct dec_slot))) == NULL) {
+        fprintf(stderr, "%s: calloc slots failed\n", fname);
+        goto error;
+    }
+    int snum  = ALIGN(sp->datasize, sp->size_p);
+    int qsize = 2 * sp->size_g;     // short queues, not to generate many packets beyond rank
+    for (int i=0; i<fdec->window; i++) {
+        struct dec_slot *slot = &fdec->slots[i];
+        slot->blk = slot->serving = i;
+        if ((slot->ring = create_ring(qsize)) == NULL)
+            goto error;
+        if ((slot->buf = malloc((size_t) snum * sp->size_p)) == NULL) {
+            fprintf(stderr, "%s: malloc output region of slot %d failed\n", fname, i);
+            goto error;
+        }
+    }
+    if ((fdec->workers = calloc(fdec->nthreads, sizeof(struct dec_worker))) == NULL) {
+        fprintf(stderr, "%s: calloc workers failed\n", fname);
+        goto error;
+    }
+    pthread_mutex_init(&fdec->lock, NULL);
+    pthread_cond_init(&fdec->done, NULL);
+    int started;
+    for (started=0; started<fdec->nthreads; started++) {
+        struct dec_worker *w = &fdec->workers[started];
+        w->fdec = fdec;
+        w->id   = started;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        if (pthread_create(&w->thread, NULL, decode_blocks, w) != 0) {
+            fprintf(stderr, "%s: cannot create worker thread %d\n", fname, started);
+            pthread_mutex_destroy(&w->lock);
+            pthread_cond_destroy(&w->wake);
+            break;
+        }
+    }
+    if (started < fdec->nthreads) {
+        fdec->nthreads = started;
+        snc_free_file_decoder(fdec);
+        return NULL;
+    }
+    return fdec;
+
+error:
+    if (fdec->slots != NULL) {
+        for (int i=0; i<fdec->window; i++) {
+            free_ring(fdec->slots[i].ring);
+            free(fdec->slots[i].buf);
+        }
+        free(fdec->slots);
+    }
+    if (fdec->fd != -1)
+        close(fdec->fd);
+    free(fdec);
+    return NULL;
+}
+
+static void wake_worker(struct dec_worker *w)
+{
+    // Pairs with the fence of the worker going to sleep (as in sncAsync.c)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * Submit a packet of block blk. The decoder takes over the caller's
+ * reference of pkt, which must be an allocated packet. Return 0 if the
+ * packet is queued, or dropped because blk is already decoded; return -1
+ * (pkt is left to the caller) if blk is beyond the window or its ring is
+ * full.
+ */
+int snc_file_process_packet(struct snc_file_decoder *fdec, int blk, struct snc_packet *pkt)
+{
+    static char fname[] = "snc_file_process_packet";
+    if (pkt->refcnt == 0) {
+        fprintf(stderr, "%s: packet views cannot be decoded asynchronously\n", fname);
+        return (-1);
+    }
+    if (blk < 0 || blk >= fdec->nblocks) {
+        snc_free_packet(pkt);
+        return 0;
+    }
+    int s = blk % fdec->window;
+    struct dec_slot *slot = &fdec->slots[s];
+    int ret = 0;
+    int queued = 0;
+    // Pairs with the worker closing the block in finish_block(): either the
+    // worker waits for the packet to be pushed, or the packet sees it closed
+    __atomic_add_fetch(&slot->pending, 1, __ATOMIC_SEQ_CST);
+    int serving = __atomic_load_n(&slot->serving, __ATOMIC_SEQ_CST);
+    if (serving == blk) {
+        if (ring_push(slot->ring, pkt) == 0)
+            queued = 1;
+        else
+            ret = -1;
+    } else if ((serving >= 0 ? serving : -(serving + 2)) < blk) {
+        ret = -1;           // the slot is still busy with an earlier block
+    }
+    __atomic_sub_fetch(&slot->pending, 1, __ATOMIC_RELEASE);
+    if (queued)
+        wake_worker(&fdec->workers[s % fdec->nthreads]);
+    else if (ret == 0)
+        snc_free_packet(pkt);
+    return ret;
+}
+
+// Write the finished block of a slot and move the slot on to its next block
+static void finish_block(struct snc_file_decoder *fdec, struct dec_slot *slot)
+{
+    __atomic_store_n(&slot->serving, -(slot->blk + 2), __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&slot->pending, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+    struct snc_packet *pkt;
+    while ((pkt = ring_pop(slot->ring)) != NULL)
+        snc_free_packet(pkt);
+
+    long datasize = fdec->sp.datasize;
+    long len = block_size(fdec->filesize, datasize, slot->blk);
+    long n = write_decoded(fdec->fd, (long) slot->blk * datasize, snc_get_enc_context(slot->decoder), len);
+    pthread_mutex_lock(&fdec->lock);
+    fdec->overhead += snc_decode_overhead(slot->decoder);
+    fdec->cost     += snc_decode_cost(slot->decoder);
+    fdec->written  += 1;
+    if (n != len)
+        fdec->error = 1;
+    pthread_cond_broadcast(&fdec->done);
+    pthread_mutex_unlock(&fdec->lock);
+    snc_free_decoder(slot->decoder);
+    slot->decoder = NULL;
+
+    slot->blk += fdec->window;
+    __atomic_store_n(&slot->serving, slot->blk < fdec->nblocks ? slot->blk : -(slot->blk + 2), __ATOMIC_RELEASE);
+}
+
+static void decode_packet(struct snc_file_decoder *fdec, struct dec_slot *slot, struct snc_packet *pkt)
+{
+    static char fname[] = "decode_packet";
+    if (slot->decoder == NULL) {
+        struct snc_parameters sp = fdec->sp;
+        if ((slot->decoder = snc_create_decoder(&sp, fdec->d_type)) == NULL
+            || snc_bind_decoder_output(slot->decoder, slot->buf) != 0) {
+            fprintf(stderr, "%s: cannot create decoder of block %d\n", fname, slot->blk);
+            snc_free_decoder(slot->decoder);
+            slot->decoder = NULL;
+            snc_free_packet(pkt);
+            pthread_mutex_lock(&fdec->lock);
+            fdec->error = 1;
+            pthread_cond_broadcast(&fdec->done);
+            pthread_mutex_unlock(&fdec->lock);
+            return;
+        }
+    }
+    snc_process_packet(slot->decoder, pkt);
+    snc_free_packet(pkt);
+    if (snc_decoder_finished(slot->decoder))
+        finish_block(fdec, slot);
+}
+
+static int has_packets(struct dec_worker *w)
+{
+    struct snc_file_decoder *fdec = w->fdec;
+    for (int s=w->id; s<fdec->window; s+=fdec->nthreads) {
+        if (!ring_empty(fdec->slots[s].ring))
+            return 1;
+    }
+    return 0;
+}
+
+static void *decode_blocks(void *arg)
+{
+    struct dec_worker *w = arg;
+    struct snc_file_decoder *fdec = w->fdec;
+    while (!__atomic_load_n(&fdec->stop, __ATOMIC_RELAXED)) {
+        int idle = 1;
+        for (int s=w->id; s<fdec->window; s+=fdec->nthreads) {
+            struct dec_slot *slot = &fdec->slots[s];
+            struct snc_packet *pkt;
+            for (int k=0; k<SLOT_BATCH && (pkt = ring_pop(slot->ring)) != NULL; k++) {
+                decode_packet(fdec, slot, pkt);
+                idle = 0;
+            }
+        }
+        if (idle) {
+            pthread_mutex_lock(&w->lock);
+            __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            while (!has_packets(w) && !__atomic_load_n(&fdec->stop, __ATOMIC_RELAXED))
+                pthread_cond_wait(&w->wake, &w->lock);
+            __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+    return NULL;
+}
+
+// Whether block blk is decoded and written
+int snc_file_block_finished(struct snc_file_decoder *fdec, int blk)
+{
+    if (blk < 0 || blk >= fdec->nblocks)
+        return 0;
+    int serving = __atomic_load_n(&fdec->slots[blk % fdec->window].serving, __ATOMIC_ACQUIRE);
+    if (serving >= 0)
+        return serving > blk;
+    return -(serving + 2) > blk;    // a closed block is being written
+}
+
+// Whether all blocks are decoded and written, or decoding failed
+int snc_file_decoder_finished(struct snc_file_decoder *fdec)
+{
+    pthread_mutex_lock(&fdec->lock);
+    int finished = fdec->written == fdec->nblocks || fdec->error;
+    pthread_mutex_unlock(&fdec->lock);
+    return finished;
+}
+
+/*
+ * Wait until all blocks are decoded and written. Return 0, or -1 as soon
+ * as a block could not be decoded or written.
+ */
+int snc_file_decoder_wait(struct snc_file_decoder *fdec)
+{
+    pthread_mutex_lock(&fdec->lock);
+    while (fdec->written < fdec->nblocks && !fdec->error)
+        pthread_cond_wait(&fdec->done, &fdec->lock);
+    int ret = fdec->error ? -1 : 0;
+    pthread_mutex_unlock(&fdec->lock);
+    return ret;
+}
+
+// Average decoding overhead of the blocks written so far
+double snc_file_decode_overhead(struct snc_file_decoder *fdec)
+{
+    pthread_mutex_lock(&fdec->lock);
+    double overhead = fdec->written > 0 ? fdec->overhead / fdec->written : 0;
+    pthread_mutex_unlock(&fdec->lock);
+    return overhead;
+}
+
+// Average decoding cost of the blocks written so far
+double snc_file_decode_cost(struct snc_file_decoder *fdec)
+{
+    pthread_mutex_lock(&fdec->lock);
+    double cost = fdec->written > 0 ? fdec->cost / fdec->written : 0;
+    pthread_mutex_unlock(&fdec->lock);
+    return cost;
+}
+
+// Stop the workers, and free the decoders and the packets still queued
+void snc_free_file_decoder(struct snc_file_decoder *fdec)
+{
+    if (fdec == NULL)
+        return;
+    __atomic_store_n(&fdec->stop, 1, __ATOMIC_RELAXED);
+    for (int i=0; i<fdec->nthreads; i++) {
+        struct dec_worker *w = &fdec->workers[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->wake);
+    }
+    pthread_mutex_destroy(&fdec->lock);
+    pthread_cond_destroy(&fdec->done);
+    for (int i=0; i<fdec->window; i++) {
+        struct dec_slot *slot = &fdec->slots[i];
+        struct snc_packet *pkt;
+        while ((pkt = ring_pop(slot->ring)) != NULL)
+            snc_free_packet(pkt);
+        free_ring(slot->ring);
+        snc_free_decoder(slot->decoder);
+        free(slot->buf);
+    }
+    free(fdec->slots);
+    free(fdec->workers);
+    close(fdec->fd);
+    free(fdec);
+}
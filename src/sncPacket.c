@@ -0,0 +1,435 @@
+/**************************************************************
+ * sncPacket.c
+ *
+ * Allocation and wire format of snc packets.
+ *
+ * A packet is a single allocation: the struct is followed by the
+ * coding coefficients and then the symbols, so that coes and syms
+ * of a packet are adjacent in memory.
+ *
+ * On the wire a packet is laid out as
+ *   gid | ucid | seq | coes | syms
+ * where gid, ucid and seq are 32-bit integers in network byte order
+ * (SNC_WIRE_HEADER bytes in total). coes are omitted if they are not
+ * needed by the receiver, i.e., for systematic packets (gid=-1 and
+ * ucid!=-1) and for packets with seeded coefficients (seq>=0 of a code
+ * with sce set). For binary codes, coes take ALIGN(size_g, 8) bytes.
+ *
+ * Packets can also be taken from a pool (struct snc_packet_pool),
+ * which recycles fixed-size blocks instead of calling the allocator
+ * for every packet. Each thread keeps a small cache of free blocks of
+ * the pool it last allocated from; the cache is refilled from and
+ * flushed to the shared lock-free stack of the pool in batches.
+ *
+ * Packets are reference counted, and are freed (or returned to their
+ * pool) when the last reference is dropped. Views created by
+ * snc_deserialize_packet() have refcnt 0 and are never freed.
+ **************************************************************/
+#include <stdint.h>
+#include <sys/uio.h>
+#include "common.h"
+#include "sparsenc.h"
+
+static inline int coes_size(struct snc_parameters *sp)
+{
+    return sp->bnc ? ALIGN(sp->size_g, 8) : sp->size_g;
+}
+
+// Whether coes of the packet are carried on the wire
+static inline int wire_has_coes(struct snc_parameters *sp, int gid, int ucid, int seq)
+{
+    return !(gid == -1 && ucid != -1) && !(sp->sce && seq >= 0);
+}
+
+// Whether gid/ucid name a packet of the code described by sp
+static int valid_packet_ids(struct snc_parameters *sp, int gid, int ucid)
+{
+    int snum = ALIGN(sp->datasize, sp->size_p);
+    int gnum;
+    if (sp->type == BAND_SNC)
+        gnum = ALIGN((snum+sp->size_c-sp->size_g), sp->size_b) + 1;
+    else
+        gnum = ALIGN((snum+sp->size_c), sp->size_b);
+    if (gid == -1)
+        return ucid >= 0 && ucid < snum;                // systematic packet of source packet ucid
+    return gid >= 0 && gid < gnum && ucid >= -1 && ucid < sp->size_g;
+}
+
+static inline void put_int32(unsigned char *p, int v)
+{
+    uint32_t u = (uint32_t) v;
+    p[0] = u >> 24;
+    p[1] = u >> 16;
+    p[2] = u >> 8;
+    p[3] = u;
+}
+
+static inline int get_int32(const unsigned char *p)
+{
+    return (int) ((uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3]);
+}
+
+#define POOL_CACHE_PKTS 32
+
+// Pool block: the packet struct, followed by coes and syms
+struct pool_block {
+    int                next;    // index+1 of the next free block (0 if none)
+    int                index;   // index of the block in the pool
+    struct snc_packet  pkt;
+};
+
+// Per-thread cache of free blocks of one pool. The epoch tells apart a
+// pool freed and another one created at the same address.
+static __thread struct {
+    struct snc_packet_pool *pool;
+    unsigned long           epoch;
+    int                     n;
+    int                     idx[POOL_CACHE_PKTS];
+} tcache;
+
+static unsigned long pool_epoch = 0;
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct snc_packet_pool *live_pools = NULL;
+
+static inline struct pool_block *pool_block(struct snc_packet_pool *pool, int i)
+{
+    return (struct pool_block *) (pool->slabs[i / POOL_SLAB_PKTS] + (size_t) (i % POOL_SLAB_PKTS) * pool->bsize);
+}
+
+// Push blocks linked from first to last onto the free stack
+static void push_chain(struct snc_packet_pool *pool, int first, int last)
+{
+    struct pool_block *tail = pool_block(pool, last);
+    uint64_t old = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    uint64_t new;
+    do {
+        __atomic_store_n(&tail->next, (int) (old & 0xffffffff), __ATOMIC_RELAXED);
+        new = ((old >> 32) + 1) << 32 | (uint64_t) (first + 1);
+    } while (!__atomic_compare_exchange_n(&pool->head, &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+// Link n cached blocks and push them onto the free stack
+static void push_cached(struct snc_packet_pool *pool, int *idx, int n)
+{
+    for (int i=0; i<n-1; i++)
+        __atomic_store_n(&pool_block(pool, idx[i])->next, idx[i+1] + 1, __ATOMIC_RELAXED);
+    push_chain(pool, idx[0], idx[n-1]);
+}
+
+/*
+ * Pop at most max blocks from the free stack in one step. Blocks on the
+ * chain may be popped by other threads meanwhile, in which case the tag
+ * of the head has changed and the step is retried.
+ */
+static int pop_chain(struct snc_packet_pool *pool, int *idx, int max)
+{
+    uint64_t old = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    uint64_t new;
+    int n;
+    do {
+        int cur = (int) (old & 0xffffffff);
+        if (cur == 0)
+            return 0;
+        n = 0;
+        while (cur != 0 && n < max) {
+            idx[n++] = cur - 1;
+            cur = __atomic_load_n(&pool_block(pool, cur - 1)->next, __ATOMIC_RELAXED);
+        }
+        new = ((old >> 32) + 1) << 32 | (uint64_t) cur;
+    } while (!__atomic_compare_exchange_n(&pool->head, &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return n;
+}
+
+// Add a slab of free blocks to the pool, unless another thread just did
+static int grow_pool(struct snc_packet_pool *pool)
+{
+    static char fname[] = "grow_pool";
+    pthread_mutex_lock(&pool->grow);
+    if ((__atomic_load_n(&pool->head, __ATOMIC_ACQUIRE) & 0xffffffff) != 0) {
+        pthread_mutex_unlock(&pool->grow);
+        return 0;
+    }
+    int k = pool->nslabs;
+    if (k == POOL_MAX_SLABS) {
+        fprintf(stderr, "%s: pool is exhausted (%d packets)\n", fname, POOL_MAX_SLABS * POOL_SLAB_PKTS);
+        pthread_mutex_unlock(&pool->grow);
+        return -1;
+    }
+    // Blocks are aligned to cache lines so that threads holding
+    // neighbouring packets do not share lines
+    if ((pool->raw[k] = malloc(POOL_SLAB_PKTS * pool->bsize + 63)) == NULL) {
+        fprintf(stderr, "%s: malloc slab failed\n", fname);
+        pthread_mutex_unlock(&pool->grow);
+        return -1;
+    }
+    pool->slabs[k] = (unsigned char *) (((uintptr_t) pool->raw[k] + 63) & ~(uintptr_t) 63);
+    for (int i=0; i<POOL_SLAB_PKTS; i++) {
+        struct pool_block *blk = pool_block(pool, k * POOL_SLAB_PKTS + i);
+        blk->index = k * POOL_SLAB_PKTS + i;
+        blk->next  = (i == POOL_SLAB_PKTS - 1) ? 0 : blk->index + 2;
+    }
+    pool->nslabs = k + 1;
+    push_chain(pool, k * POOL_SLAB_PKTS, (k + 1) * POOL_SLAB_PKTS - 1);
+    pthread_mutex_unlock(&pool->grow);
+    return 0;
+}
+
+/*
+ * Bind the thread cache to the pool. Blocks cached for the previously
+ * bound pool are returned to it if it is still alive.
+ */
+static void bind_cache(struct snc_packet_pool *pool)
+{
+    if (tcache.pool == pool && tcache.epoch == pool->epoch)
+        return;
+    if (tcache.n > 0) {
+        pthread_mutex_lock(&live_lock);
+        for (struct snc_packet_pool *p = live_pools; p != NULL; p = p->next_live) {
+            if (p == tcache.pool && p->epoch == tcache.epoch) {
+                push_cached(p, tcache.idx, tcache.n);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&live_lock);
+    }
+    tcache.pool  = pool;
+    tcache.epoch = pool->epoch;
+    tcache.n     = 0;
+}
+
+struct snc_packet_pool *snc_create_packet_pool(struct snc_parameters *sp)
+{
+    static char fname[] = "snc_create_packet_pool";
+    struct snc_packet_pool *pool = calloc(1, sizeof(struct snc_packet_pool));
+    if (pool == NULL) {
+        fprintf(stderr, "%s: calloc pool failed\n", fname);
+        return NULL;
+    }
+    pool->params = *sp;
+    pool->clen   = coes_size(sp);
+    pool->bsize  = ALIGN(sizeof(struct pool_block) + pool->clen + sp->size_p, 64) * 64;
+    pool->epoch  = __atomic_add_fetch(&pool_epoch, 1, __ATOMIC_RELAXED);
+    pool->head   = 0;
+    if ((pool->slabs = calloc(POOL_MAX_SLABS, sizeof(unsigned char *))) == NULL
+        || (pool->raw = calloc(POOL_MAX_SLABS, sizeof(void *))) == NULL) {
+        fprintf(stderr, "%s: calloc slab table failed\n", fname);
+        free(pool->slabs);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->grow, NULL);
+    pthread_mutex_lock(&live_lock);
+    pool->next_live = live_pools;
+    live_pools = pool;
+    pthread_mutex_unlock(&live_lock);
+    return pool;
+}
+
+// Whether packets of the pool can hold packets of the code parameters
+int pool_fits_params(struct snc_packet_pool *pool, struct snc_parameters *sp)
+{
+    return pool->params.size_p == sp->size_p && pool->clen == coes_size(sp);
+}
+
+struct snc_packet *snc_pool_alloc_packet(struct snc_packet_pool *pool)
+{
+    bind_cache(pool);
+    while (tcache.n == 0) {
+        tcache.n = pop_chain(pool, tcache.idx, POOL_CACHE_PKTS / 2);
+        if (tcache.n == 0 && grow_pool(pool) != 0)
+            return NULL;
+    }
+    struct pool_block *blk = pool_block(pool, tcache.idx[--tcache.n]);
+    struct snc_packet *pkt = &blk->pkt;
+    pkt->gid  = -1;
+    pkt->ucid = -1;
+    pkt->seq  = -1;
+    pkt->coes = (GF_ELEMENT *) (blk + 1);
+    pkt->syms = pkt->coes + pool->clen;
+    pkt->pool = pool;
+    pkt->refcnt = 1;
+    memset(pkt->coes, 0, pool->clen + pool->params.size_p);
+    return pkt;
+}
+
+// Return a packet to its pool
+static void pool_free_packet(struct snc_packet *pkt)
+{
+    struct snc_packet_pool *pool = pkt->pool;
+    struct pool_block *blk = (struct pool_block *) ((unsigned char *) pkt - offsetof(struct pool_block, pkt));
+    if (tcache.pool != pool || tcache.epoch != pool->epoch) {
+        // Not cached by this thread, return it to the pool directly
+        push_chain(pool, blk->index, blk->index);
+        return;
+    }
+    if (tcache.n == POOL_CACHE_PKTS) {
+        push_cached(pool, &tcache.idx[POOL_CACHE_PKTS / 2], POOL_CACHE_PKTS / 2);
+        tcache.n = POOL_CACHE_PKTS / 2;
+    }
+    tcache.idx[tcache.n++] = blk->index;
+}
+
+void snc_free_packet_pool(struct snc_packet_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&live_lock);
+    struct snc_packet_pool **pp = &live_pools;
+    while (*pp != NULL && *pp != pool)
+        pp = &(*pp)->next_live;
+    if (*pp != NULL)
+        *pp = pool->next_live;
+    pthread_mutex_unlock(&live_lock);
+    if (tcache.pool == pool) {
+        tcache.pool = NULL;
+        tcache.n    = 0;
+    }
+    for (int i=0; i<pool->nslabs; i++)
+        free(pool->raw[i]);
+    free(pool->raw);
+    free(pool->slabs);
+    pthread_mutex_destroy(&pool->grow);
+    free(pool);
+}
+
+/*
+ * Allocate an empty GNC coded packet
+ *  gid = -1
+ *  coes: zeros
+ *  syms: zeros
+ */
+struct snc_packet *snc_alloc_empty_packet(struct snc_parameters *sp)
+{
+    // For binary code, coding coefficients (bits) are condensed
+    int clen = coes_size(sp);
+    struct snc_packet *pkt = calloc(1, sizeof(struct snc_packet) + clen + sp->size_p);
+    if (pkt == NULL)
+        return NULL;
+    pkt->gid  = -1;
+    pkt->ucid = -1;
+    pkt->seq  = -1;
+    pkt->coes = (GF_ELEMENT *) (pkt + 1);
+    pkt->syms = pkt->coes + clen;
+    pkt->pool = NULL;
+    pkt->refcnt = 1;
+    return pkt;
+}
+
+/*
+ * Make a private copy of a packet, taken from the pool if one is given.
+ * coes are not copied if pkt does not carry them.
+ */
+struct snc_packet *duplicate_packet(struct snc_parameters *sp, struct snc_packet_pool *pool, struct snc_packet *pkt)
+{
+    struct snc_packet *dup = pool != NULL ? snc_pool_alloc_packet(pool) : snc_alloc_empty_packet(sp);
+    if (dup == NULL)
+        return NULL;
+    dup->gid  = pkt->gid;
+    dup->ucid = pkt->ucid;
+    dup->seq  = pkt->seq;
+    if (pkt->coes != NULL)
+        memcpy(dup->coes, pkt->coes, coes_size(sp));
+    memcpy(dup->syms, pkt->syms, sp->size_p);
+    return dup;
+}
+
+struct snc_packet *snc_ref_packet(struct snc_packet *pkt)
+{
+    static char fname[] = "snc_ref_packet";
+    if (pkt->refcnt == 0) {
+        fprintf(stderr, "%s: packet views cannot be referenced\n", fname);
+        return NULL;
+    }
+    __atomic_add_fetch(&pkt->refcnt, 1, __ATOMIC_RELAXED);
+    return pkt;
+}
+
+void snc_free_packet(struct snc_packet *pkt)
+{
+    if (pkt == NULL || pkt->refcnt == 0)
+        return;
+    if (__atomic_sub_fetch(&pkt->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    if (pkt->pool != NULL)
+        pool_free_packet(pkt);
+    else
+        free(pkt);
+}
+
+int snc_packet_wire_size(struct snc_parameters *sp, struct snc_packet *pkt)
+{
+    int size = SNC_WIRE_HEADER + sp->size_p;
+    if (wire_has_coes(sp, pkt->gid, pkt->ucid, pkt->seq))
+        size += coes_size(sp);
+    return size;
+}
+
+/*
+ * Describe the wire representation of a packet with iovecs, without
+ * copying coes and syms. The header is written to hdr, which must hold
+ * SNC_WIRE_HEADER bytes and stay valid as long as the iovecs are used.
+ * iov must have room for 3 entries.
+ *
+ * Return the number of iovecs filled.
+ */
+int snc_serialize_packet(struct snc_parameters *sp, struct snc_packet *pkt, unsigned char *hdr, struct iovec *iov)
+{
+    put_int32(hdr, pkt->gid);
+    put_int32(hdr + 4, pkt->ucid);
+    put_int32(hdr + 8, pkt->seq);
+    int n = 0;
+    iov[n].iov_base = hdr;
+    iov[n++].iov_len = SNC_WIRE_HEADER;
+    if (wire_has_coes(sp, pkt->gid, pkt->ucid, pkt->seq)) {
+        int clen = coes_size(sp);
+        if (pkt->coes + clen == pkt->syms) {
+            // coes and syms are adjacent, as in packets allocated by snc_alloc_empty_packet()
+            iov[n].iov_base = pkt->coes;
+            iov[n++].iov_len = clen + sp->size_p;
+            return n;
+        }
+        iov[n].iov_base = pkt->coes;
+        iov[n++].iov_len = clen;
+    }
+    iov[n].iov_base = pkt->syms;
+    iov[n++].iov_len = sp->size_p;
+    return n;
+}
+
+/*
+ * Wrap len bytes of a received packet in buf as a packet view. coes and
+ * syms of the view point into buf (coes is NULL if they are not carried),
+ * so buf must outlive the view. A view is owned by the caller;
+ * snc_free_packet() ignores it and snc_buffer_packet() buffers a copy.
+ * gid and ucid are checked against the code described by sp.
+ *
+ * Return 0 on success, or -1 if buf is not a valid packet.
+ */
+int snc_deserialize_packet(struct snc_parameters *sp, unsigned char *buf, int len, struct snc_packet *pkt)
+{
+    static char fname[] = "snc_deserialize_packet";
+    if (len < SNC_WIRE_HEADER) {
+        fprintf(stderr, "%s: packet of %d bytes is shorter than the header\n", fname, len);
+        return -1;
+    }
+    int gid  = get_int32(buf);
+    int ucid = get_int32(buf + 4);
+    int seq  = get_int32(buf + 8);
+    if (seq < -1 || !valid_packet_ids(sp, gid, ucid)) {
+        fprintf(stderr, "%s: invalid header gid: %d ucid: %d seq: %d\n", fname, gid, ucid, seq);
+        return -1;
+    }
+    int clen = wire_has_coes(sp, gid, ucid, seq) ? coes_size(sp) : 0;
+    if (len != SNC_WIRE_HEADER + clen + sp->size_p) {
+        fprintf(stderr, "%s: packet of %d bytes, expected %d\n", fname, len, SNC_WIRE_HEADER + clen + sp->size_p);
+        return -1;
+    }
+    pkt->gid  = gid;
+    pkt->ucid = ucid;
+    pkt->seq  = seq;
+    pkt->coes = clen ? buf + SNC_WIRE_HEADER : NULL;
+    pkt->syms = buf + SNC_WIRE_HEADER + clen;
+    pkt->pool = NULL;
+    pkt->refcnt = 0;
+    return 0;
+}
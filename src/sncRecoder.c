@@ -3,7 +3,13 @@
 #include "galois.h"
 #include "sparsenc.h"
 
-static struct snc_context *sc;  // encoding context duplicated at the recoder if needed
+static struct snc_buffer *create_buffer(struct snc_parameters *sp, int bufsize, int basis);
+static int insert_to_basis(struct snc_buffer *buf, int gid, struct snc_packet *pkt);
+static void heap_sift_up(struct snc_buffer *buf, int i);
+static void heap_sift_down(struct snc_buffer *buf, int i);
+static void buffer_grown(struct snc_buffer *buf, int gid);
+static int schedule_recode(struct snc_buffer *buf, int in_sched_t);
+static void recode_generation(struct snc_buffer *buf, int gid, struct snc_packet *pkt);
 /* Schedule a subgeneration to recode a packet according
  * to the specified scheduling type. */
 static int schedule_recode_generation(struct snc_buffer *buf, int sched_t);
@@ -11,7 +17,17 @@ static int banded_nonuniform_sched(struct snc_buffer *buf);
 
 struct snc_buffer *snc_create_buffer(struct snc_parameters *sp, int bufsize)
 {
-    static char fname[] = "snc_create_decoder";
+    return create_buffer(sp, bufsize, 0);
+}
+
+struct snc_buffer *snc_create_basis_buffer(struct snc_parameters *sp)
+{
+    return create_buffer(sp, sp->size_g, 1);
+}
+
+static struct snc_buffer *create_buffer(struct snc_parameters *sp, int bufsize, int basis)
+{
+    static char fname[] = "snc_create_buffer";
     int i;
     struct snc_buffer *buf;
     if ((buf = calloc(1, sizeof(struct snc_buffer))) == NULL) {
@@ -55,6 +71,34 @@ struct snc_buffer *snc_create_buffer(struct snc_parameters *sp, int bufsize)
         fprintf(stderr, "%s: calloc buf->nsched\n", fname);
         goto Error;
     }
+    if ((buf->heap = malloc(sizeof(int) * buf->gnum)) == NULL
+        || (buf->hpos = malloc(sizeof(int) * buf->gnum)) == NULL
+        || (buf->nonemp = malloc(sizeof(int) * buf->gnum)) == NULL) {
+        fprintf(stderr, "%s: malloc scheduling heap\n", fname);
+        goto Error;
+    }
+    for (i=0; i<buf->gnum; i++) {
+        // All keys are 0, so ordering by gid is a valid heap
+        buf->heap[i] = i;
+        buf->hpos[i] = i;
+    }
+    buf->basis = basis;
+    if (basis) {
+        if ((buf->pivot = calloc(buf->gnum, sizeof(int *))) == NULL) {
+            fprintf(stderr, "%s: calloc buf->pivot\n", fname);
+            goto Error;
+        }
+        for (i=0; i<buf->gnum; i++) {
+            if ((buf->pivot[i] = malloc(sizeof(int) * bufsize)) == NULL) {
+                fprintf(stderr, "%s: malloc buf->pivot[%d]\n", fname, i);
+                goto Error;
+            }
+        }
+        if ((buf->mult = malloc(sizeof(GF_ELEMENT) * bufsize)) == NULL) {
+            fprintf(stderr, "%s: malloc buf->mult\n", fname);
+            goto Error;
+        }
+    }
     if (sp->sys == 1) {
         /*
         if ((buf->prevuc = malloc(buf->gnum*sizeof(int))) == NULL) {
@@ -75,7 +119,11 @@ struct snc_buffer *snc_create_buffer(struct snc_parameters *sp, int bufsize)
         }
         buf->sysnum = 0;
         buf->sysptr = 0;
-        sc = snc_create_enc_context(NULL, sp);  //encoding context is needed for systematic forwarding/recoding
+        // Subgenerations are needed to recode from systematic packets
+        if ((buf->sc = create_grouping_context(&buf->params)) == NULL) {
+            fprintf(stderr, "%s: create_grouping_context\n", fname);
+            goto Error;
+        }
     }
     return buf;
 
@@ -98,18 +146,44 @@ Error:
  */
 void snc_buffer_packet(struct snc_buffer *buf, struct snc_packet *pkt)
 {
+    static char fname[] = "snc_buffer_packet";
     int gid = pkt->gid;
-    if (gid == -1 && pkt->ucid != -1) {
+    int coded = !(gid == -1 && pkt->ucid != -1);
+    int seeded = buf->params.sce && pkt->seq >= 0;
+    int refcnt = __atomic_load_n(&pkt->refcnt, __ATOMIC_ACQUIRE);
+    if (refcnt == 0 || (refcnt > 1 && coded && (seeded || buf->basis))) {
+        // A view is not owned by the buffer, and a shared packet cannot be
+        // modified in place (to regenerate its coefficients or to reduce it
+        // against the basis), so buffer a copy instead
+        struct snc_packet *dup = duplicate_packet(&buf->params, buf->pool, pkt);
+        if (dup == NULL) {
+            fprintf(stderr, "%s: copy packet failed\n", fname);
+            return;
+        }
+        snc_free_packet(pkt);
+        pkt = dup;
+    }
+    if (!coded) {
         // This is a systematic packet
         buf->sysbuf[buf->sysnum] = pkt;
         buf->sysnum += 1;
         return;
     }
+    if (seeded) {
+        // Recoding works on explicit coefficients, regenerate them from seq
+        generate_seeded_coes(buf->params.seed, pkt->seq, buf->params.size_g, buf->params.bnc, pkt->coes);
+        pkt->seq = -1;
+    }
+    if (buf->basis) {
+        if (insert_to_basis(buf, gid, pkt))
+            buffer_grown(buf, gid);
+        return;
+    }
     if (buf->nc[gid] == 0) {
         // Buffer of the generation is empty
         buf->gbuf[gid][0] = pkt;
         buf->nc[gid]++;
-        buf->nemp++;
+        buffer_grown(buf, gid);
     } else if (buf->nc[gid] == buf->size) {
         // Buffer of the generation is full, remove in a FIFO manner
         snc_free_packet(buf->gbuf[gid][buf->pn[gid]]);  //discard packet previously stored in the position
@@ -118,6 +192,7 @@ void snc_buffer_packet(struct snc_buffer *buf, struct snc_packet *pkt)
         // Buffer is neither empty nor full
         buf->gbuf[gid][buf->pn[gid]] = pkt;
         buf->nc[gid]++;
+        buffer_grown(buf, gid);
     }
     /*
     if (pkt->ucid != -1)
@@ -128,18 +203,145 @@ void snc_buffer_packet(struct snc_buffer *buf, struct snc_packet *pkt)
     return;
 }
 
+// Update scheduling state after nc[gid] has increased
+static void buffer_grown(struct snc_buffer *buf, int gid)
+{
+    if (buf->nc[gid] == 1)
+        buf->nonemp[buf->nemp++] = gid;
+    heap_sift_up(buf, buf->hpos[gid]);
+}
+
+// Whether subgeneration a precedes b in the MLPI heap
+static inline int heap_before(struct snc_buffer *buf, int a, int b)
+{
+    int ka = buf->nc[a] - buf->nsched[a];
+    int kb = buf->nc[b] - buf->nsched[b];
+    return ka > kb || (ka == kb && a < b);
+}
+
+static inline void heap_swap(struct snc_buffer *buf, int i, int j)
+{
+    int t = buf->heap[i];
+    buf->heap[i] = buf->heap[j];
+    buf->heap[j] = t;
+    buf->hpos[buf->heap[i]] = i;
+    buf->hpos[buf->heap[j]] = j;
+}
+
+static void heap_sift_up(struct snc_buffer *buf, int i)
+{
+    while (i > 0 && heap_before(buf, buf->heap[i], buf->heap[(i-1)/2])) {
+        heap_swap(buf, i, (i-1)/2);
+        i = (i-1) / 2;
+    }
+}
+
+static void heap_sift_down(struct snc_buffer *buf, int i)
+{
+    for (;;) {
+        int best = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < buf->gnum && heap_before(buf, buf->heap[l], buf->heap[best]))
+            best = l;
+        if (r < buf->gnum && heap_before(buf, buf->heap[r], buf->heap[best]))
+            best = r;
+        if (best == i)
+            return;
+        heap_swap(buf, i, best);
+        i = best;
+    }
+}
+
+/*
+ * Reduce pkt against the basis of generation gid and add it to the basis
+ * if it is innovative. The coefficients are reduced first, so that the
+ * symbols of a non-innovative packet are never touched; the packet is
+ * freed in that case.
+ *
+ * Return 1 if pkt is added to the basis, 0 otherwise.
+ */
+static int insert_to_basis(struct snc_buffer *buf, int gid, struct snc_packet *pkt)
+{
+    int gensize = buf->params.size_g;
+    int clen = buf->params.bnc ? ALIGN(gensize, 8) : gensize;
+    struct snc_packet **rows = buf->gbuf[gid];
+    int *pivot = buf->pivot[gid];
+    int rank = buf->nc[gid];
+    GF_ELEMENT co;
+    int i, k;
+    // Rows are sorted by pivot and are zero before their pivots, so
+    // eliminating in order does not refill eliminated positions
+    for (k=0; k<rank; k++) {
+        co = buf->params.bnc ? get_bit_in_array(pkt->coes, pivot[k]) : pkt->coes[pivot[k]];
+        buf->mult[k] = co;
+        if (co != 0)
+            galois_multiply_add_region_short(pkt->coes, rows[k]->coes, co, clen);
+    }
+    int p = -1;
+    for (i=0; i<gensize && p == -1; i++) {
+        co = buf->params.bnc ? get_bit_in_array(pkt->coes, i) : pkt->coes[i];
+        if (co != 0)
+            p = i;
+    }
+    if (p == -1) {
+        // Non-innovative
+        snc_free_packet(pkt);
+        return 0;
+    }
+    for (k=0; k<rank; k++) {
+        if (buf->mult[k] != 0)
+            galois_multiply_add_region(pkt->syms, rows[k]->syms, buf->mult[k], buf->params.size_p);
+    }
+    if (!buf->params.bnc && pkt->coes[p] != 1) {
+        co = galois_divide(1, pkt->coes[p]);
+        galois_multiply_region(&pkt->coes[p], co, gensize - p);
+        galois_multiply_region(pkt->syms, co, buf->params.size_p);
+    }
+    // Insert the row in pivot order
+    for (k=rank; k>0 && pivot[k-1] > p; k--) {
+        rows[k]  = rows[k-1];
+        pivot[k] = pivot[k-1];
+    }
+    rows[k]  = pkt;
+    pivot[k] = p;
+    buf->nc[gid] = rank + 1;
+    return 1;
+}
+
+int snc_set_buffer_packet_pool(struct snc_buffer *buf, struct snc_packet_pool *pool)
+{
+    static char fname[] = "snc_set_buffer_packet_pool";
+    if (pool != NULL && !pool_fits_params(pool, &buf->params)) {
+        fprintf(stderr, "%s: packets of the pool do not match the code parameters\n", fname);
+        return -1;
+    }
+    buf->pool = pool;
+    return 0;
+}
+
 // FIXME: This function has not been revised accordingly after I introduced RAND_SYS and MLPI_SYS
 //        scheduling algorithms into sparsenc.
 struct snc_packet *snc_recode_packet(struct snc_buffer *buf, int sched_t)
 {
-    struct snc_packet *pkt = snc_alloc_empty_packet(&buf->params);
-    if (pkt == NULL)
+    int gid = schedule_recode(buf, sched_t);
+    if (gid == -1)
         return NULL;
+    if (gid == buf->gnum) {
+        // Forward the latest received systematic packet as is
+        buf->sysptr = buf->sysnum;
+        return snc_ref_packet(buf->sysbuf[buf->sysnum-1]);
+    }
 
-    if (snc_recode_packet_im(buf, pkt, sched_t) == 0)
-        return pkt;
+    struct snc_packet *pkt;
+    if (buf->pool != NULL)
+        pkt = snc_pool_alloc_packet(buf->pool);
     else
+        pkt = snc_alloc_empty_packet(&buf->params);
+    if (pkt == NULL)
         return NULL;
+    recode_generation(buf, gid, pkt);
+    return pkt;
     /*
     pkt->gid = gid;
     GF_ELEMENT co = 0;
@@ -148,10 +350,10 @@ struct snc_packet *snc_recode_packet(struct snc_buffer *buf, int sched_t)
         if (buf->params.bnc == 1) {
             co = rand() % 2;
             if (co == 1)
-                galois_multiply_add_region(pkt->coes, buf->gbuf[gid][i]->coes, co, ALIGN(buf->params.size_g, 8));
+                galois_multiply_add_region_short(pkt->coes, buf->gbuf[gid][i]->coes, co, ALIGN(buf->params.size_g, 8));
         } else {
             co = rand() % (1 << 8);
-            galois_multiply_add_region(pkt->coes, buf->gbuf[gid][i]->coes, co, buf->params.size_g);
+            galois_multiply_add_region_short(pkt->coes, buf->gbuf[gid][i]->coes, co, buf->params.size_g);
         }
         galois_multiply_add_region(pkt->syms, buf->gbuf[gid][i]->syms, co, buf->params.size_p);
     }
@@ -159,34 +361,47 @@ struct snc_packet *snc_recode_packet(struct snc_buffer *buf, int sched_t)
     return pkt;
 }
 
-int snc_recode_packet_im(struct snc_buffer *buf, struct snc_packet *pkt, int in_sched_t)
+int snc_recode_packet_im(struct snc_buffer *buf, struct snc_packet *pkt, int sched_t)
 {
-    int sched_t = in_sched_t;
-    if (buf->params.sys != 1) {
-        if (in_sched_t == RAND_SCHED_SYS)
-            sched_t = RAND_SCHED;
-        if (in_sched_t == MLPI_SCHED_SYS)
-            sched_t = MLPI_SCHED;
-    }
-
-    int gid = schedule_recode_generation(buf, sched_t);
+    int gid = schedule_recode(buf, sched_t);
     if (gid == -1)
         return -1;
 
     if (gid == buf->gnum) {
         // There is systematic packet need to be forwarded
-        // printf("Forwarding the latest received systematic packet %d\n", buf->sysbuf[buf->sysptr]->ucid);
         pkt->gid = -1;
-        pkt->ucid = buf->sysbuf[buf->sysptr]->ucid;
-        memset(pkt->syms, 0, sizeof(GF_ELEMENT)*buf->params.size_p);
+        pkt->ucid = buf->sysbuf[buf->sysnum-1]->ucid;
+        pkt->seq = -1;
         memcpy(pkt->syms, buf->sysbuf[buf->sysnum-1]->syms, sizeof(GF_ELEMENT)*buf->params.size_p);
         buf->sysptr = buf->sysnum;
         return 0;
     }
+    recode_generation(buf, gid, pkt);
+    return 0;
+}
+
+/*
+ * Schedule a generation to recode from. Return gnum if the latest
+ * systematic packet is to be forwarded, or -1 if nothing can be sent.
+ */
+static int schedule_recode(struct snc_buffer *buf, int in_sched_t)
+{
+    int sched_t = in_sched_t;
+    if (buf->params.sys != 1) {
+        if (in_sched_t == RAND_SCHED_SYS)
+            sched_t = RAND_SCHED;
+        if (in_sched_t == MLPI_SCHED_SYS)
+            sched_t = MLPI_SCHED;
+    }
+    return schedule_recode_generation(buf, sched_t);
+}
 
-    // Generate a normal recoded GNC packet
+// Generate a normal recoded GNC packet from the buffered packets of generation gid
+static void recode_generation(struct snc_buffer *buf, int gid, struct snc_packet *pkt)
+{
     pkt->gid = gid;
     pkt->ucid = -1;
+    pkt->seq = -1;
     // Clean up pkt
     if (buf->params.bnc) {
         memset(pkt->coes, 0, ALIGN(buf->params.size_g, 8)*sizeof(GF_ELEMENT));
@@ -200,10 +415,10 @@ int snc_recode_packet_im(struct snc_buffer *buf, struct snc_packet *pkt, int in_
     for (i=0; i<buf->sysnum; i++) {
         // Find the sys packet's corresponding index in the generation.
         // If buf->sysbuf[i]->ucid doesn't belong to the generation, skip.
-        int relative_idx = has_item(sc->gene[gid]->pktid, buf->sysbuf[i]->ucid, sc->params.size_g); 
+        int relative_idx = gene_position(buf->sc, gid, buf->sysbuf[i]->ucid);
         if (relative_idx == -1)
             continue;
-        if (sc->params.bnc) {
+        if (buf->params.bnc) {
             co = (GF_ELEMENT) rand() % 2;                   // Binary network code
             if (co == 1)
                 set_bit_in_array(pkt->coes, relative_idx);  // Set the corresponding coefficient as 1
@@ -211,7 +426,7 @@ int snc_recode_packet_im(struct snc_buffer *buf, struct snc_packet *pkt, int in_
             co = (GF_ELEMENT) rand() % (1 << 8);     // Randomly generated coding coefficient
             pkt->coes[relative_idx] = co;
         }
-        galois_multiply_add_region(pkt->syms, buf->sysbuf[i]->syms, co, sc->params.size_p);
+        galois_multiply_add_region(pkt->syms, buf->sysbuf[i]->syms, co, buf->params.size_p);
     }
 
     // Second, go through the buffered coded packets of the generation
@@ -219,14 +434,13 @@ int snc_recode_packet_im(struct snc_buffer *buf, struct snc_packet *pkt, int in_
         if (buf->params.bnc == 1) {
             co = rand() % 2;
             if (co == 1)
-                galois_multiply_add_region(pkt->coes, buf->gbuf[gid][i]->coes, co, ALIGN(buf->params.size_g, 8));
+                galois_multiply_add_region_short(pkt->coes, buf->gbuf[gid][i]->coes, co, ALIGN(buf->params.size_g, 8));
         } else {
             co = rand() % (1 << 8);
-            galois_multiply_add_region(pkt->coes, buf->gbuf[gid][i]->coes, co, buf->params.size_g);
+            galois_multiply_add_region_short(pkt->coes, buf->gbuf[gid][i]->coes, co, buf->params.size_g);
         }
         galois_multiply_add_region(pkt->syms, buf->gbuf[gid][i]->syms, co, buf->params.size_p);
     }
-    return 0;
 }
 
 void snc_free_buffer(struct snc_buffer *buf)
@@ -251,6 +465,19 @@ void snc_free_buffer(struct snc_buffer *buf)
         free(buf->pn);
     if (buf->nsched != NULL)
         free(buf->nsched);
+    if (buf->heap != NULL)
+        free(buf->heap);
+    if (buf->hpos != NULL)
+        free(buf->hpos);
+    if (buf->nonemp != NULL)
+        free(buf->nonemp);
+    if (buf->pivot != NULL) {
+        for (i=0; i<buf->gnum; i++)
+            free(buf->pivot[i]);
+        free(buf->pivot);
+    }
+    if (buf->mult != NULL)
+        free(buf->mult);
     /*
     if (buf->prevuc != NULL)
         free(buf->prevuc);
@@ -272,6 +499,7 @@ void snc_free_buffer(struct snc_buffer *buf)
         }
         free(buf->sysbuf);
     }
+    snc_free_enc_context(buf->sc);
     free(buf);
     buf = NULL;
     return;
@@ -300,33 +528,25 @@ static int schedule_recode_generation(struct snc_buffer *buf, int sched_t)
     if (sched_t == TRIV_SCHED) {
         gid = rand() % buf->gnum;
         buf->nsched[gid]++;
+        heap_sift_down(buf, buf->hpos[gid]);
         return gid;
     }
 
     if (sched_t == RAND_SCHED || sched_t == RAND_SCHED_SYS) {
         if (buf->nemp == 0)
             return -1;
-        int index = rand() % buf->nemp;
-        int i = -1;
-        gid = 0;
-        while ( i != index) {
-            if (buf->nc[gid++] != 0)
-                i++;
-        }
-        buf->nsched[gid-1]++;
-        return gid-1;
+        gid = buf->nonemp[rand() % buf->nemp];
+        buf->nsched[gid]++;
+        heap_sift_down(buf, buf->hpos[gid]);
+        return gid;
     }
 
     if (sched_t == MLPI_SCHED || sched_t == MLPI_SCHED_SYS) {
-        gid = 0;
-        int max = buf->nc[gid] - buf->nsched[gid];
-        for (int j=0; j<buf->gnum; j++) {
-            if (buf->nc[j] - buf->nsched[j] > max) {
-                max = buf->nc[j] - buf->nsched[j];
-                gid = j;
-            }
-        }
+        // The subgeneration of maximum nc-nsched (the exact rank for basis
+        // buffers) is on top of the heap
+        gid = buf->heap[0];
         buf->nsched[gid]++;
+        heap_sift_down(buf, 0);
         return gid;
     }
 
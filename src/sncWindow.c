@@ -0,0 +1,336 @@
+/**************************************************************
+ * sncWindow.c
+ *
+ * Sliding-window (streaming) mode of band codes. Source packets
+ * are appended to the encoder as they are produced, and each
+ * coded packet combines the packets of the current window, i.e.,
+ * those not yet acknowledged by the receiver (at most size_g of
+ * them). The window slides when the receiver acknowledges the
+ * packets it has delivered.
+ *
+ * Window packets use struct snc_packet:
+ *   gid  - seq of the first packet of the window
+ *   ucid - offset of an uncoded packet in the window (-1 if coded)
+ *   coes - size_g coefficients, the i-th applies to packet gid+i
+ *
+ * The decoder keeps received packets in banded form as the CBD
+ * decoder does, and delivers packets in order as soon as a prefix
+ * of the undelivered packets becomes decodable.
+ **************************************************************/
+#include "common.h"
+#include "galois.h"
+#include "sparsenc.h"
+
+#define WIN_EMPTY   0   // no packet is pivoted at the slot
+#define WIN_PIVOT   1   // a band row is pivoted at the slot
+#define WIN_DECODED 2   // the packet of the slot is decoded
+
+static void solve_prefix(struct snc_window_decoder *dec);
+
+/*------------------------------- Encoder -------------------------------*/
+struct snc_window_encoder *snc_create_window_encoder(struct snc_parameters *sp)
+{
+    static char fname[] = "snc_create_window_encoder";
+    if (sp->size_g <= 0 || sp->size_p <= 0) {
+        fprintf(stderr, "%s: size_g and size_p must be positive\n", fname);
+        return NULL;
+    }
+    struct snc_window_encoder *enc = calloc(1, sizeof(struct snc_window_encoder));
+    if (enc == NULL) {
+        fprintf(stderr, "%s: calloc snc_window_encoder failed\n", fname);
+        return NULL;
+    }
+    memcpy(&enc->params, sp, sizeof(struct snc_parameters));
+    if ((enc->pp = calloc(sp->size_g, sizeof(GF_ELEMENT*))) == NULL)
+        goto AllocError;
+    for (int i=0; i<sp->size_g; i++) {
+        if ((enc->pp[i] = calloc(sp->size_p, sizeof(GF_ELEMENT))) == NULL)
+            goto AllocError;
+    }
+    return enc;
+
+AllocError:
+    fprintf(stderr, "%s: calloc source packet ring failed\n", fname);
+    snc_free_window_encoder(enc);
+    return NULL;
+}
+
+/*
+ * Append a source packet of size_p bytes to the stream
+ * Return its seq, or -1 if the window is full (acknowledgement needed)
+ */
+int snc_window_enqueue(struct snc_window_encoder *enc, unsigned char *buf)
+{
+    if (enc->end - enc->start == enc->params.size_g)
+        return -1;
+    memcpy(enc->pp[enc->end % enc->params.size_g], buf, enc->params.size_p*sizeof(GF_ELEMENT));
+    return enc->end++;
+}
+
+/*
+ * Slide the window: packets before seq have been delivered by the receiver
+ */
+void snc_window_acknowledge(struct snc_window_encoder *enc, int seq)
+{
+    if (seq > enc->end)
+        seq = enc->end;
+    if (seq > enc->start)
+        enc->start = seq;
+    if (enc->sent < enc->start)
+        enc->sent = enc->start;
+}
+
+struct snc_packet *snc_window_generate_packet(struct snc_window_encoder *enc)
+{
+    struct snc_packet *pkt = snc_alloc_empty_packet(&enc->params);
+    if (pkt == NULL)
+        return NULL;
+    if (snc_window_generate_packet_im(enc, pkt) != 0) {
+        snc_free_packet(pkt);
+        return NULL;
+    }
+    return pkt;
+}
+
+/*
+ * Generate a window packet in a given memory area.
+ * Return 0 on success, -1 if the window is empty.
+ */
+int snc_window_generate_packet_im(struct snc_window_encoder *enc, struct snc_packet *pkt)
+{
+    if (pkt == NULL || pkt->coes == NULL || pkt->syms == NULL)
+        return -1;
+    if (enc->start == enc->end)
+        return -1;
+    int gensize = enc->params.size_g;
+    int pktsize = enc->params.size_p;
+    if (enc->params.bnc) {
+        memset(pkt->coes, 0, ALIGN(gensize, 8)*sizeof(GF_ELEMENT));
+    } else {
+        memset(pkt->coes, 0, gensize*sizeof(GF_ELEMENT));
+    }
+    pkt->gid = enc->start;
+    pkt->seq = -1;
+    enc->count += 1;
+    if (enc->params.sys == 1 && enc->sent < enc->end) {
+        // send each source packet uncoded once
+        int offset = enc->sent - enc->start;
+        if (enc->params.bnc) {
+            set_bit_in_array(pkt->coes, offset);
+        } else {
+            pkt->coes[offset] = 1;
+        }
+        memcpy(pkt->syms, enc->pp[enc->sent % gensize], pktsize*sizeof(GF_ELEMENT));
+        pkt->ucid = offset;
+        enc->sent += 1;
+        return 0;
+    }
+    memset(pkt->syms, 0, pktsize*sizeof(GF_ELEMENT));
+    GF_ELEMENT co;
+    for (int i=0; i<enc->end-enc->start; i++) {
+        if (enc->params.bnc) {
+            co = (GF_ELEMENT) rand() % 2;                   // Binary network code
+            if (co == 1)
+                set_bit_in_array(pkt->coes, i);
+        } else {
+            co = (GF_ELEMENT) rand() % (1 << 8);            // Randomly generated coding coefficient
+            pkt->coes[i] = co;
+        }
+        galois_multiply_add_region(pkt->syms, enc->pp[(enc->start+i) % gensize], co, pktsize);
+    }
+    pkt->ucid = -1;
+    return 0;
+}
+
+void snc_free_window_encoder(struct snc_window_encoder *enc)
+{
+    if (enc == NULL)
+        return;
+    if (enc->pp != NULL) {
+        for (int i=0; i<enc->params.size_g; i++) {
+            if (enc->pp[i] != NULL)
+                free(enc->pp[i]);
+        }
+        free(enc->pp);
+    }
+    free(enc);
+}
+
+/*------------------------------- Decoder -------------------------------*/
+struct snc_window_decoder *snc_create_window_decoder(struct snc_parameters *sp)
+{
+    static char fname[] = "snc_create_window_decoder";
+    if (sp->size_g <= 0 || sp->size_p <= 0) {
+        fprintf(stderr, "%s: size_g and size_p must be positive\n", fname);
+        return NULL;
+    }
+    struct snc_window_decoder *dec = calloc(1, sizeof(struct snc_window_decoder));
+    if (dec == NULL) {
+        fprintf(stderr, "%s: calloc snc_window_decoder failed\n", fname);
+        return NULL;
+    }
+    memcpy(&dec->params, sp, sizeof(struct snc_parameters));
+    dec->cap = 2 * sp->size_g;
+    if ((dec->coes = calloc(dec->cap, sizeof(GF_ELEMENT*))) == NULL)
+        goto AllocError;
+    if ((dec->syms = calloc(dec->cap, sizeof(GF_ELEMENT*))) == NULL)
+        goto AllocError;
+    for (int i=0; i<dec->cap; i++) {
+        if ((dec->coes[i] = calloc(sp->size_g, sizeof(GF_ELEMENT))) == NULL)
+            goto AllocError;
+        if ((dec->syms[i] = calloc(sp->size_p, sizeof(GF_ELEMENT))) == NULL)
+            goto AllocError;
+    }
+    if ((dec->state = calloc(dec->cap, sizeof(unsigned char))) == NULL)
+        goto AllocError;
+    if ((dec->ces = calloc(dec->cap, sizeof(GF_ELEMENT))) == NULL)
+        goto AllocError;
+    if ((dec->msg = calloc(sp->size_p, sizeof(GF_ELEMENT))) == NULL)
+        goto AllocError;
+    return dec;
+
+AllocError:
+    fprintf(stderr, "%s: calloc decoding ring failed\n", fname);
+    snc_free_window_decoder(dec);
+    return NULL;
+}
+
+/*
+ * Feed the decoder with a window packet. Packets referring to source
+ * packets that are no longer kept (older than size_g packets before
+ * the next one to deliver) are dropped.
+ */
+void snc_window_process_packet(struct snc_window_decoder *dec, struct snc_packet *pkt)
+{
+    int gensize = dec->params.size_g;
+    int pktsize = dec->params.size_p;
+    int lo = dec->solved;               // first unknown packet
+    int hi = dec->base + gensize;       // packets from hi on are not kept yet
+    int i, s, slot;
+    GF_ELEMENT co;
+
+    dec->received += 1;
+    memset(dec->ces, 0, dec->cap*sizeof(GF_ELEMENT));
+    memcpy(dec->msg, pkt->syms, pktsize*sizeof(GF_ELEMENT));
+    // Translate window coefficients, removing decoded packets from the payload
+    for (i=0; i<gensize; i++) {
+        co = dec->params.bnc ? get_bit_in_array(pkt->coes, i) : pkt->coes[i];
+        if (co == 0)
+            continue;
+        s = pkt->gid + i;
+        if (s >= hi || s < dec->base - gensize)
+            return;
+        if (s < lo) {
+            galois_multiply_add_region(dec->msg, dec->syms[s % dec->cap], co, pktsize);
+            dec->operations += pktsize;
+        } else {
+            dec->ces[s-lo] = co;
+        }
+    }
+    // Forward eliminate against band rows. A row pivoted at s has nonzeros in
+    // [s, s+size_g) only, so the vector stays within [lo, hi).
+    for (s=lo; s<hi; s++) {
+        co = dec->ces[s-lo];
+        if (co == 0)
+            continue;
+        slot = s % dec->cap;
+        if (dec->state[slot] == WIN_PIVOT) {
+            galois_multiply_add_region_short(dec->ces+(s-lo), dec->coes[slot], co, gensize);
+            galois_multiply_add_region(dec->msg, dec->syms[slot], co, pktsize);
+            dec->operations += gensize + pktsize;
+            continue;
+        }
+        // Innovative packet, normalize and save it as the band row of slot s
+        GF_ELEMENT inv = galois_divide(1, co);
+        galois_multiply_region(dec->ces+(s-lo), inv, gensize);
+        galois_multiply_region(dec->msg, inv, pktsize);
+        dec->operations += gensize + pktsize;
+        memcpy(dec->coes[slot], dec->ces+(s-lo), gensize*sizeof(GF_ELEMENT));
+        memcpy(dec->syms[slot], dec->msg, pktsize*sizeof(GF_ELEMENT));
+        dec->state[slot] = WIN_PIVOT;
+        solve_prefix(dec);
+        return;
+    }
+}
+
+/*
+ * Decode the longest prefix of the undelivered packets whose band rows
+ * only refer to packets within the prefix.
+ */
+static void solve_prefix(struct snc_window_decoder *dec)
+{
+    int gensize = dec->params.size_g;
+    int pktsize = dec->params.size_p;
+    int hi = dec->base + gensize;
+    int p, k, slot;
+    int reach = dec->solved;        // right end of the nonzeros of rows seen
+    int end = dec->solved;          // end of the longest closed prefix
+    for (p=dec->solved; p<hi && dec->state[p % dec->cap] == WIN_PIVOT; ) {
+        slot = p % dec->cap;
+        for (k=gensize-1; k>0 && dec->coes[slot][k] == 0; k--)
+            ;
+        if (p + k + 1 > reach)
+            reach = p + k + 1;
+        p++;
+        if (reach <= p)
+            end = p;
+    }
+    // Back substitution within the prefix
+    for (p=end-1; p>=dec->solved; p--) {
+        slot = p % dec->cap;
+        for (k=1; k<gensize && p+k<end; k++) {
+            if (dec->coes[slot][k] != 0) {
+                galois_multiply_add_region(dec->syms[slot], dec->syms[(p+k) % dec->cap], dec->coes[slot][k], pktsize);
+                dec->operations += pktsize;
+            }
+        }
+        memset(dec->coes[slot], 0, gensize*sizeof(GF_ELEMENT));
+        dec->state[slot] = WIN_DECODED;
+    }
+    dec->solved = end;
+}
+
+/*
+ * Copy the next in-order decoded packet to buf (size_p bytes)
+ * Return its seq, or -1 if it is not decoded yet
+ */
+int snc_window_deliver(struct snc_window_decoder *dec, unsigned char *buf)
+{
+    if (dec->base == dec->solved)
+        return -1;
+    int seq = dec->base;
+    memcpy(buf, dec->syms[seq % dec->cap], dec->params.size_p*sizeof(GF_ELEMENT));
+    dec->base += 1;
+    // The oldest history slot is reused by packet base+size_g-1
+    dec->state[(seq + dec->params.size_g) % dec->cap] = WIN_EMPTY;
+    return seq;
+}
+
+// Number of delivered packets, i.e., the seq to acknowledge to the encoder
+int snc_window_delivered(struct snc_window_decoder *dec)
+{
+    return dec->base;
+}
+
+void snc_free_window_decoder(struct snc_window_decoder *dec)
+{
+    if (dec == NULL)
+        return;
+    for (int i=0; i<dec->cap; i++) {
+        if (dec->coes != NULL && dec->coes[i] != NULL)
+            free(dec->coes[i]);
+        if (dec->syms != NULL && dec->syms[i] != NULL)
+            free(dec->syms[i]);
+    }
+    if (dec->coes != NULL)
+        free(dec->coes);
+    if (dec->syms != NULL)
+        free(dec->syms);
+    if (dec->state != NULL)
+        free(dec->state);
+    if (dec->ces != NULL)
+        free(dec->ces);
+    if (dec->msg != NULL)
+        free(dec->msg);
+    free(dec);
+}